@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -43,7 +44,8 @@ ADD_TEST_CASE( Jzjson_tests )
 ********************************************************/
 
 /// @brief DynNode which can be of string type, map type, vector type.
-template<class StrT = std::string>
+/// @tparam KeyT key type of maps, eg. ftl::Symbol to intern keys and look them up by pointer.
+template<class StrT = std::string, class KeyT = StrT>
 class DynNode
 {
 public:
@@ -55,11 +57,26 @@ public:
         NIL_NODE_TYPE, // not used as valid node type
     };
 
-    using this_type = DynNode<StrT>;
+    using this_type = DynNode<StrT, KeyT>;
     using StrType = StrT;
-    using DynNodePtr = std::unique_ptr<this_type>;
-    using MapType = std::unordered_map<StrType, DynNodePtr>;
-    using VecType = std::vector<DynNodePtr>;
+    using KeyType = KeyT;
+    // maps, vectors and child nodes are allocated by the default constructed allocator of StrT, eg. ftl::SizeClassString.
+    using allocator_type = typename StrT::allocator_type;
+    template<class T>
+    using rebind_alloc = typename std::allocator_traits<allocator_type>::template rebind_alloc<T>;
+
+    struct NodeDeleter
+    {
+        void operator()( this_type *p ) const
+        {
+            rebind_alloc<this_type> alloc;
+            p->~this_type();
+            alloc.deallocate( p, 1 );
+        }
+    };
+    using DynNodePtr = std::unique_ptr<this_type, NodeDeleter>;
+    using MapType = std::unordered_map<KeyType, DynNodePtr, std::hash<KeyType>, std::equal_to<KeyType>, rebind_alloc<std::pair<const KeyType, DynNodePtr>>>;
+    using VecType = std::vector<DynNodePtr, rebind_alloc<DynNodePtr>>;
 
     static const size_t STR_SIZE = sizeof( StrType );
     static const size_t MAP_SIZE = sizeof( MapType );
@@ -186,7 +203,7 @@ public:
         return true;
     }
     // as a MapType, append an element.
-    bool mapInsert( const StrType &key, this_type &&node, bool bForceUpdate = false )
+    bool mapInsert( const KeyType &key, this_type &&node, bool bForceUpdate = false )
     {
         return mapInsert( key, makeNodePtr( std::move( node ) ), bForceUpdate );
     }
@@ -236,7 +253,7 @@ public:
     }
     // throws runtime_error if it's not a map
     // throw our_of_range
-    this_type &operator[]( const StrType &key )
+    this_type &operator[]( const KeyType &key )
     {
         if ( nodeType != MAP_NODE_TYPE )
             throw std::runtime_error( "Expected MAP_NODE_TYPE" );
@@ -250,7 +267,7 @@ public:
         return *asVec().at( idx );
     }
     // throw our_of_range
-    const this_type &operator[]( const StrType &key ) const
+    const this_type &operator[]( const KeyType &key ) const
     {
         if ( nodeType != MAP_NODE_TYPE )
             throw std::runtime_error( "Expected MAP_NODE_TYPE" );
@@ -295,7 +312,7 @@ public:
             func( *v );
     }
 
-    bool mapContains( const StrType &key ) const
+    bool mapContains( const KeyType &key ) const
     {
         if ( nodeType != MAP_NODE_TYPE )
             throw std::runtime_error( "Expected MAP_NODE_TYPE" );
@@ -306,7 +323,7 @@ public:
     // if no such nod found, throws out_of_range.
     // if current is a vector, search the child elements and return mapped node.
     // if current is a map, search the keys and return the mapped node.
-    const this_type &childWithKey( const StrType &key ) const
+    const this_type &childWithKey( const KeyType &key ) const
     {
         if ( nodeType == VEC_NODE_TYPE )
         {
@@ -324,7 +341,7 @@ public:
         {
             throw std::runtime_error( "Expected VEC_NODE_TYPE, MAP_NODE_TYPE" );
         }
-        throw std::out_of_range( key );
+        throw std::out_of_range( std::string( key.begin(), key.end() ) );
     }
 
     // similar to above. But return the map that contains the key value pair.
@@ -332,7 +349,7 @@ public:
     // if no such nod found, throws out_of_range.
     // if current is a vector, search the child elements and return the child node.
     // if current is a map, search the mapped values of children and return mapped value.
-    const this_type &childWithKeyValue( const StrType &key, const StrType &val ) const
+    const this_type &childWithKeyValue( const KeyType &key, const StrType &val ) const
     {
         if ( nodeType == VEC_NODE_TYPE )
         {
@@ -364,7 +381,7 @@ public:
         {
             throw std::runtime_error( "Expected VEC_NODE_TYPE, MAP_NODE_TYPE" );
         }
-        throw std::out_of_range( key );
+        throw std::out_of_range( std::string( key.begin(), key.end() ) );
     }
 
     // return 1 if it's a string type.
@@ -377,7 +394,7 @@ public:
         return 1;
     }
 
-    static bool iequals( const std::string &a, const std::string &b )
+    static bool iequals( std::string_view a, std::string_view b )
     {
         unsigned int sz = a.size();
         if ( b.size() != sz )
@@ -391,7 +408,10 @@ public:
 protected:
     DynNodePtr makeNodePtr( this_type &&node )
     {
-        return DynNodePtr( new this_type( std::move( node ) ) );
+        rebind_alloc<this_type> alloc;
+        auto p = alloc.allocate( 1 );
+        new ( p ) this_type( std::move( node ) );
+        return DynNodePtr( p );
     }
     StrType &asStr()
     {
@@ -424,7 +444,7 @@ protected:
         return *reinterpret_cast<const MapType *>( p );
     }
 
-    bool mapInsert( const StrType &key, DynNodePtr &&pNode, bool bForceUpdate = false )
+    bool mapInsert( const KeyType &key, DynNodePtr &&pNode, bool bForceUpdate = false )
     {
         assert( nodeType == MAP_NODE_TYPE );
         auto &m = asMap();
@@ -444,7 +464,7 @@ protected:
     static const size_t DATASIZE = STR_SIZE > MAP_SIZE ? ( STR_SIZE > VEC_SIZE ? STR_SIZE : VEC_SIZE )
                                                        : ( MAP_SIZE > VEC_SIZE ? MAP_SIZE : VEC_SIZE );
     NodeType nodeType;
-    char m_data[DATASIZE]; // may use std::variant when updated to c++17.
+    alignas( StrType ) alignas( MapType ) alignas( VecType ) char m_data[DATASIZE]; // may use std::variant when updated to c++17.
 };
 using JsonNode = DynNode<>;
 
@@ -711,10 +731,10 @@ struct JzonSerializer
     }
 
     /// \param indentLevel -1 for no indent.
-    template<class StrT = std::string>
-    std::ostream &write( std::ostream &os, const DynNode<StrT> &dyn, int indentLevel = 0, bool newLine = true ) const
+    template<class StrT = std::string, class KeyT = StrT>
+    std::ostream &write( std::ostream &os, const DynNode<StrT, KeyT> &dyn, int indentLevel = 0, bool newLine = true ) const
     {
-        using Node = DynNode<StrT>;
+        using Node = DynNode<StrT, KeyT>;
         int n = 0, LEN;
         bool bSingleLine = true;
 
@@ -760,7 +780,7 @@ struct JzonSerializer
                 os << GrammarChars::MAPLB; // or no newline.
             indentLevel = indentLevel < 0 ? indentLevel : indentLevel + 1;
             LEN = dyn.size();
-            dyn.mapForeach( [&]( const StrT &key, const Node &node ) {
+            dyn.mapForeach( [&]( const KeyT &key, const Node &node ) {
                 os << Indent4( indentLevel );
                 printStr( os, key );
                 //-- print ':' or ' '
@@ -792,8 +812,8 @@ struct JzonSerializer
         }
         return os;
     }
-    template<class StrT = std::string>
-    std::ostream &printJsonCompact( std::ostream &os, const DynNode<StrT> &dyn ) const
+    template<class StrT = std::string, class KeyT = StrT>
+    std::ostream &printJsonCompact( std::ostream &os, const DynNode<StrT, KeyT> &dyn ) const
     {
         return write( os, dyn, -1 );
     }
@@ -802,8 +822,8 @@ struct JzonSerializer
     ///            read
     ///////////////////////////////////////////////////////////////////////////////////
 
-    template<class StrT = std::string>
-    bool read( DynNode<StrT> &dyn, std::istream &ss, std::ostream &err ) const
+    template<class StrT = std::string, class KeyT = StrT>
+    bool read( DynNode<StrT, KeyT> &dyn, std::istream &ss, std::ostream &err ) const
     {
         typename JsonGrammar::Pos pos{1, 0};
         //        int lineCount = 1, charCount = 0;
@@ -897,11 +917,11 @@ protected:
         return {TokenType::INVALID, c.ch};
     }
     /// \param dyn is already constructed as map, read all map elements.
-    template<class StrT = std::string>
-    bool read_json_map( DynNode<StrT> &dyn, std::istream &ss, std::ostream &err, typename JzonGrammar::Pos &pos ) const
+    template<class StrT = std::string, class KeyT = StrT>
+    bool read_json_map( DynNode<StrT, KeyT> &dyn, std::istream &ss, std::ostream &err, typename JzonGrammar::Pos &pos ) const
     {
         std::string s;
-        using Node = DynNode<StrT>;
+        using Node = DynNode<StrT, KeyT>;
         using DynStr = typename Node::StrType;
         using TokenType = typename JzonGrammar::TokenType;
 
@@ -940,7 +960,7 @@ protected:
             //-- now have value already in s .
             if ( res.toktype == TokenType::ID )
             {
-                child.resetToStr( s );
+                child.resetToStr( DynStr( s.begin(), s.end() ) );
             }
             else if ( res.toktype == TokenType::VEC_START )
             {
@@ -969,11 +989,12 @@ protected:
             }
 
             //-- insert kv pair.
-            if ( dyn.mapContains( key ) )
+            auto dynKey = typename Node::KeyType( std::string_view( key ) ); // eg. interned as a Symbol.
+            if ( dyn.mapContains( dynKey ) )
             {
                 if ( bCombineDupKeys )
                 {
-                    auto &childdyn = dyn[key];
+                    auto &childdyn = dyn[dynKey];
                     if ( !bCombinedKeys.count( key ) ) // it's alreay combined into vec.
                     {
                         bCombinedKeys.insert( key );
@@ -990,15 +1011,15 @@ protected:
                 }
             }
             else
-                dyn.mapInsert( DynStr( key ), std::move( child ) );
+                dyn.mapInsert( dynKey, std::move( child ) );
         }
     }
 
-    template<class StrT = std::string>
-    bool read_json_vec( DynNode<StrT> &dyn, std::istream &ss, std::ostream &err, typename JzonGrammar::Pos &pos ) const
+    template<class StrT = std::string, class KeyT = StrT>
+    bool read_json_vec( DynNode<StrT, KeyT> &dyn, std::istream &ss, std::ostream &err, typename JzonGrammar::Pos &pos ) const
     {
         std::string s;
-        using Node = DynNode<StrT>;
+        using Node = DynNode<StrT, KeyT>;
         using DynStr = typename Node::StrType;
         using TokenType = typename JzonGrammar::TokenType;
         // bOmitVecComma bydefault.
@@ -1011,7 +1032,7 @@ protected:
                 return true;
             if ( res.toktype == TokenType::ID )
             {
-                child.resetToStr( s );
+                child.resetToStr( DynStr( s.begin(), s.end() ) );
                 dyn.vecAppend( std::move( child ) );
                 continue;
             }
@@ -1039,10 +1060,10 @@ protected:
         }
     }
 
-    template<class StrT = std::string>
-    bool read_json( DynNode<StrT> &dyn, std::istream &ss, std::ostream &err, typename JzonGrammar::Pos &pos ) const
+    template<class StrT = std::string, class KeyT = StrT>
+    bool read_json( DynNode<StrT, KeyT> &dyn, std::istream &ss, std::ostream &err, typename JzonGrammar::Pos &pos ) const
     {
-        using Node = DynNode<StrT>;
+        using Node = DynNode<StrT, KeyT>;
         using DynStr = typename Node::StrType;
         using TokenType = typename JzonGrammar::TokenType;
 
@@ -1060,7 +1081,7 @@ protected:
         }
         else if ( res.toktype == TokenType::ID ) // read string
         {
-            dyn.resetToStr( s );
+            dyn.resetToStr( DynStr( s.begin(), s.end() ) );
             return true;
         }
         //        else
@@ -1068,11 +1089,11 @@ protected:
         return false;
     }
 };
-JzonSerializer<> jzonSerializer{};
-JzonSerializer<> jsonSerializer{false, false, false, false, false};
+inline JzonSerializer<> jzonSerializer{};
+inline JzonSerializer<> jsonSerializer{false, false, false, false, false};
 
-template<class StrT>
-inline std::ostream &operator<<( std::ostream &os, const jz::DynNode<StrT> &node )
+template<class StrT, class KeyT>
+inline std::ostream &operator<<( std::ostream &os, const jz::DynNode<StrT, KeyT> &node )
 {
     return jz::jzonSerializer.write( os, node );
 }
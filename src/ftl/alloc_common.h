@@ -2,6 +2,7 @@
 #include <cassert>
 #include <atomic>
 #include <algorithm>
+#include <cstdint>
 
 namespace ftl
 {
@@ -21,8 +22,71 @@ inline constexpr Int align_up( Int n, Int uiAlignment )
     return ( n + ( uiAlignment - 1 ) ) & ~( uiAlignment - 1 );
 }
 
+////////////////////////////////////////////////////////////////////
+/// \brief AtomicTaggedPtr is an ABA-safe head of lock-free singly list.
+/// A 16-bit version tag is packed into the unused upper bits of a 48-bit user space pointer, and is bumped on every update.
+/// A pop which loaded head and head->next before other threads popped and pushed the same head back fails its CAS, because the tag
+/// has changed even though the pointer is the same.
+/// \note Nodes must stay readable after being popped (eg. pool slots), since a stale pop may read head->next.
+////////////////////////////////////////////////////////////////////
+template<typename T>
+class AtomicTaggedPtr
+{
+public:
+    static constexpr unsigned PTR_BITS = 48;
+    static constexpr std::uint64_t PTR_MASK = ( std::uint64_t( 1 ) << PTR_BITS ) - 1;
+
+    struct Value
+    {
+        std::uint64_t bits = 0;
+
+        T *ptr() const
+        {
+            return reinterpret_cast<T *>( bits & PTR_MASK );
+        }
+        std::uint64_t tag() const
+        {
+            return bits >> PTR_BITS;
+        }
+        /// \brief next version pointing to p.
+        Value next( T *p ) const
+        {
+            assert( ( reinterpret_cast<std::uint64_t>( p ) & ~PTR_MASK ) == 0 );
+            return Value{( ( tag() + 1 ) << PTR_BITS ) | reinterpret_cast<std::uint64_t>( p )};
+        }
+    };
+
+    AtomicTaggedPtr( T *p = nullptr ) : m_bits( reinterpret_cast<std::uint64_t>( p ) )
+    {
+    }
+    AtomicTaggedPtr( const AtomicTaggedPtr & ) = delete;
+    AtomicTaggedPtr &operator=( const AtomicTaggedPtr & ) = delete;
+
+    Value load( std::memory_order mo = std::memory_order_seq_cst ) const
+    {
+        return Value{m_bits.load( mo )};
+    }
+
+    /// \brief set pointer and bump the tag.
+    void store( T *p, std::memory_order mo = std::memory_order_seq_cst )
+    {
+        m_bits.store( load( std::memory_order_relaxed ).next( p ).bits, mo );
+    }
+
+    /// \brief on failure, expected is updated to the current value.
+    bool compare_exchange_weak( Value &expected, T *desired )
+    {
+        return m_bits.compare_exchange_weak( expected.bits, expected.next( desired ).bits );
+    }
+
+protected:
+    std::atomic<std::uint64_t> m_bits;
+};
+
 ////////////////////////////////////////////////////////////////////
 /// \brief Instrusive Singly List - Atomic Operations
+/// \note Pop on std::atomic<T*> head is subject to ABA if nodes may be pushed back while another thread is popping.
+///       Use AtomicTaggedPtr head instead.
 ////////////////////////////////////////////////////////////////////
 
 template<typename T>
@@ -50,6 +114,31 @@ T *PopSinglyListNode( std::atomic<T *> *head, std::atomic<T *> T::*pMemberNext )
     return pHead;
 }
 
+// ABA-safe atomic push/pop
+template<typename T>
+void PushSinglyListNode( AtomicTaggedPtr<T> *head, T *node, std::atomic<T *> T::*pMemberNext )
+{
+    auto vHead = head->load( std::memory_order_relaxed );
+    do
+    {
+        ( node->*pMemberNext ).store( vHead.ptr(), std::memory_order_relaxed );
+    } while ( !head->compare_exchange_weak( vHead, node ) );
+}
+
+template<typename T>
+T *PopSinglyListNode( AtomicTaggedPtr<T> *head, std::atomic<T *> T::*pMemberNext )
+{
+    auto vHead = head->load();
+    T *pHead = nullptr;
+    do
+    {
+        pHead = vHead.ptr();
+        if ( !pHead )
+            break;
+    } while ( !head->compare_exchange_weak( vHead, ( pHead->*pMemberNext ).load( std::memory_order_relaxed ) ) );
+    return pHead;
+}
+
 // non-atomic push singly list node
 template<typename T>
 void PushSinglyListNode( T **head, T *node, T *T::*pMemberNext )
@@ -95,6 +184,30 @@ T *PopSinglyListNode( std::atomic<T *> *head )
     return pHead;
 }
 
+template<typename T, std::atomic<T *> T::*pMemberNext>
+void PushSinglyListNode( AtomicTaggedPtr<T> *head, T *node )
+{
+    auto vHead = head->load( std::memory_order_relaxed );
+    do
+    {
+        ( node->*pMemberNext ).store( vHead.ptr(), std::memory_order_relaxed );
+    } while ( !head->compare_exchange_weak( vHead, node ) );
+}
+
+template<typename T, std::atomic<T *> T::*pMemberNext>
+T *PopSinglyListNode( AtomicTaggedPtr<T> *head )
+{
+    auto vHead = head->load();
+    T *pHead = nullptr;
+    do
+    {
+        pHead = vHead.ptr();
+        if ( !pHead )
+            break;
+    } while ( !head->compare_exchange_weak( vHead, ( pHead->*pMemberNext ).load( std::memory_order_relaxed ) ) );
+    return pHead;
+}
+
 // non-atomic push singly list node
 template<typename T, T *T::*pMemberNext>
 void PushSinglyListNode( T **head, T *node )
@@ -0,0 +1,327 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <ftl/alloc_common.h>
+#include <ftl/sys_alloc.h>
+
+#include <cassert>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <string>
+
+namespace ftl
+{
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief BasicArena is a type-erased bump allocator for request-scoped data, eg. a DynNode tree parsed from a message.
+/// - malloc() bumps a pointer in the current chunk. free() is a no-op, except that the last allocation is rolled back.
+/// - checkpoint() / rollback() free everything allocated after the checkpoint at once. reset() rolls back to empty.
+/// - Chunks are kept across rollbacks and reused, so a steady stream of similar requests doesn't allocate from AlignedAlloc.
+/// - A new chunk is twice as large as the previous one, up to maxChunkSize, or as large as a big allocation.
+///
+/// Usage:
+///     Arena arena;
+///     for ( ;; ) // per message
+///     {
+///         Arena::Scope scope( arena ); // rollback at exit.
+///         jz::DynNode<ArenaString<>> node; // allocated by ArenaAllocatorRef from the current arena of this thread.
+///         jz::jzonSerializer.read( node, ss, err );
+///         std::pmr::vector<int> vec( &arena );
+///     }
+///
+/// \note Not thread-safe. Objects must be destroyed before memory is rolled back.
+template<class AlignedAlloc = StdAlignedAlloc>
+class BasicArena : public std::pmr::memory_resource
+{
+protected:
+    struct Chunk
+    {
+        Chunk *pNext;
+        std::size_t bytes; // including Chunk header.
+
+        Byte *begin()
+        {
+            return reinterpret_cast<Byte *>( this ) + HEADER_SIZE;
+        }
+        Byte *end()
+        {
+            return reinterpret_cast<Byte *>( this ) + bytes;
+        }
+    };
+    static constexpr std::size_t HEADER_SIZE = ftl::align_up( sizeof( Chunk ), alignof( std::max_align_t ) );
+    static constexpr std::size_t CHUNK_ALIGNMENT = 64;
+
+    Chunk *m_pHead = nullptr; // chunks in order of use.
+    Chunk *m_pCurr = nullptr;
+    Byte *m_pPos = nullptr, *m_pEnd = nullptr; // free space of current chunk.
+    std::size_t m_nAllocated = 0;
+    std::size_t m_nextChunkSize, m_maxChunkSize;
+
+public:
+    /// \brief position to rollback to.
+    struct Checkpoint
+    {
+        Chunk *pChunk;
+        Byte *pPos;
+        std::size_t nAllocated;
+    };
+
+    /// \brief Scope takes a checkpoint and makes the arena current for this thread. At exit, it rolls back the arena and restores the
+    /// previous current arena.
+    class Scope
+    {
+        BasicArena &m_arena;
+        Checkpoint m_checkpoint;
+        BasicArena *m_pPrev;
+
+    public:
+        Scope( BasicArena &arena ) : m_arena( arena ), m_checkpoint( arena.checkpoint() ), m_pPrev( current() )
+        {
+            current() = &arena;
+        }
+        Scope( const Scope & ) = delete;
+        Scope &operator=( const Scope & ) = delete;
+
+        ~Scope()
+        {
+            current() = m_pPrev;
+            m_arena.rollback( m_checkpoint );
+        }
+    };
+
+    /// \param initChunkSize size of the first chunk.
+    /// \param maxChunkSize chunks grow up to maxChunkSize, unless an allocation is larger.
+    BasicArena( std::size_t initChunkSize = 4096, std::size_t maxChunkSize = 1 << 20 )
+        : m_nextChunkSize( std::max( initChunkSize, 2 * HEADER_SIZE ) ), m_maxChunkSize( std::max( maxChunkSize, m_nextChunkSize ) )
+    {
+    }
+    BasicArena( const BasicArena & ) = delete;
+    BasicArena &operator=( const BasicArena & ) = delete;
+
+    ~BasicArena()
+    {
+        release();
+    }
+
+    /// \brief arena of the innermost Scope in this thread, used by default constructed ArenaAllocatorRef.
+    static BasicArena *&current()
+    {
+        static thread_local BasicArena *tlpArena = nullptr;
+        return tlpArena;
+    }
+
+    /// \pre alignment is power of 2.
+    /// \return nullptr if failed.
+    void *malloc( std::size_t size, std::size_t alignment = alignof( std::max_align_t ) )
+    {
+        if ( m_pPos )
+        {
+            const auto pos = ftl::align_up( std::uintptr_t( m_pPos ), std::uintptr_t( alignment ) );
+            if ( pos + size <= std::uintptr_t( m_pEnd ) )
+            {
+                m_pPos = reinterpret_cast<Byte *>( pos + size );
+                m_nAllocated += size;
+                return reinterpret_cast<Byte *>( pos );
+            }
+        }
+        return malloc_slow( size, alignment );
+    }
+
+    /// \brief no-op, except that the last allocation is rolled back, eg. a vector growing at top of arena.
+    void free( void *p, std::size_t size )
+    {
+        if ( static_cast<Byte *>( p ) + size == m_pPos )
+        {
+            m_pPos = static_cast<Byte *>( p );
+            m_nAllocated -= size;
+        }
+    }
+
+    Checkpoint checkpoint() const
+    {
+        return Checkpoint{m_pCurr, m_pPos, m_nAllocated};
+    }
+
+    /// \brief free all memory allocated after checkpoint. Chunks are kept for reuse.
+    /// \pre checkpoint is taken after the last rollback to an earlier checkpoint.
+    void rollback( const Checkpoint &checkpoint )
+    {
+        m_pCurr = checkpoint.pChunk;
+        m_pPos = checkpoint.pPos;
+        m_pEnd = m_pCurr ? m_pCurr->end() : nullptr;
+        m_nAllocated = checkpoint.nAllocated;
+    }
+
+    /// \brief free all memory. Chunks are kept for reuse.
+    void reset()
+    {
+        rollback( Checkpoint{nullptr, nullptr, 0} );
+    }
+
+    /// \brief free all memory and chunks.
+    void release()
+    {
+        while ( auto pChunk = m_pHead )
+        {
+            m_pHead = pChunk->pNext;
+            AlignedAlloc::free( pChunk, pChunk->bytes );
+        }
+        reset();
+    }
+
+    /// \brief bytes requested by malloc() and not rolled back, excluding alignment padding.
+    std::size_t allocated_bytes() const
+    {
+        return m_nAllocated;
+    }
+
+    /// \brief total bytes of chunks.
+    std::size_t capacity() const
+    {
+        std::size_t n = 0;
+        for ( auto pChunk = m_pHead; pChunk; pChunk = pChunk->pNext )
+            n += pChunk->bytes;
+        return n;
+    }
+
+protected:
+    void *do_allocate( std::size_t bytes, std::size_t alignment ) override
+    {
+        if ( auto p = malloc( bytes, alignment ) )
+            return p;
+        throw std::bad_alloc();
+    }
+
+    void do_deallocate( void *p, std::size_t bytes, std::size_t ) override
+    {
+        free( p, bytes );
+    }
+
+    bool do_is_equal( const std::pmr::memory_resource &other ) const noexcept override
+    {
+        return this == &other;
+    }
+
+    /// \brief move to the next kept chunk if it fits, otherwise insert a new chunk after the current one.
+    void *malloc_slow( std::size_t size, std::size_t alignment )
+    {
+        const auto needed = HEADER_SIZE + size + ( alignment > alignof( std::max_align_t ) ? alignment : 0 );
+        auto pNext = m_pCurr ? m_pCurr->pNext : m_pHead;
+        if ( !pNext || pNext->bytes < needed )
+        {
+            const auto bytes = ftl::align_up( std::max( m_nextChunkSize, needed ), CHUNK_ALIGNMENT );
+            auto pChunk = static_cast<Chunk *>( AlignedAlloc::aligned_alloc( CHUNK_ALIGNMENT, bytes ) );
+            if ( !pChunk )
+                return nullptr;
+            pChunk->bytes = bytes;
+            pChunk->pNext = pNext;
+            ( m_pCurr ? m_pCurr->pNext : m_pHead ) = pChunk;
+            pNext = pChunk;
+            m_nextChunkSize = std::min( m_nextChunkSize * 2, m_maxChunkSize );
+        }
+        m_pCurr = pNext;
+        m_pPos = m_pCurr->begin();
+        m_pEnd = m_pCurr->end();
+        return malloc( size, alignment );
+    }
+};
+
+using Arena = BasicArena<>;
+
+/// \brief Standard allocator referencing an arena. Default constructed one references the current arena of this thread, see
+/// BasicArena::Scope, so it can be used by containers which default-construct allocators, eg. DynNode.
+template<class T, class ArenaT = Arena>
+class ArenaAllocatorRef
+{
+    template<class U, class A>
+    friend class ArenaAllocatorRef;
+
+    ArenaT *m_pArena;
+
+public:
+    using value_type = T;
+
+    template<class U>
+    struct rebind
+    {
+        using other = ArenaAllocatorRef<U, ArenaT>;
+    };
+
+    /// \pre in a BasicArena::Scope.
+    ArenaAllocatorRef() : m_pArena( ArenaT::current() )
+    {
+        assert( m_pArena );
+    }
+
+    ArenaAllocatorRef( ArenaT &arena ) : m_pArena( &arena )
+    {
+    }
+
+    template<class U>
+    ArenaAllocatorRef( const ArenaAllocatorRef<U, ArenaT> &a ) : m_pArena( a.m_pArena )
+    {
+    }
+
+    T *allocate( std::size_t n )
+    {
+        if ( auto p = m_pArena->malloc( n * sizeof( T ), alignof( T ) ) )
+            return static_cast<T *>( p );
+        throw std::bad_alloc();
+    }
+
+    void deallocate( T *p, std::size_t n )
+    {
+        m_pArena->free( p, n * sizeof( T ) );
+    }
+
+    ArenaT &resource() const
+    {
+        return *m_pArena;
+    }
+
+    template<class U>
+    bool operator==( const ArenaAllocatorRef<U, ArenaT> &a ) const
+    {
+        return m_pArena == a.m_pArena;
+    }
+
+    template<class U>
+    bool operator!=( const ArenaAllocatorRef<U, ArenaT> &a ) const
+    {
+        return m_pArena != a.m_pArena;
+    }
+};
+
+template<class CharT = char>
+using ArenaString = std::basic_string<CharT, std::char_traits<CharT>, ArenaAllocatorRef<CharT>>;
+
+} // namespace ftl
+
+namespace std
+{
+/// \brief hash strings allocated by ArenaAllocatorRef like std::string, eg. for DynNode<ArenaString<>> map keys.
+template<class CharT, class ArenaT>
+struct hash<basic_string<CharT, char_traits<CharT>, ftl::ArenaAllocatorRef<CharT, ArenaT>>>
+{
+    size_t operator()( const basic_string<CharT, char_traits<CharT>, ftl::ArenaAllocatorRef<CharT, ArenaT>> &s ) const noexcept
+    {
+        return hash<basic_string_view<CharT>>()( basic_string_view<CharT>( s.data(), s.size() ) );
+    }
+};
+} // namespace std
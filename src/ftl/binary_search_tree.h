@@ -15,159 +15,833 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#ifndef BINARY_SEARCH_TREE_H
-#define BINARY_SEARCH_TREE_H
+#pragma once
+#include <ftl/mem_pool.h>
 
-#include <binary_tree.h>
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace ftl
 {
 
-template<typename KeyType, typename ValueType, typename KeyCompare = std::less<KeyType>>
-class binary_search_tree : public binary_tree<KeyType, ValueType>
+/// \brief hook of a node in an AVL tree. Nodes of intrusive_bst derive from it.
+struct avl_hook
 {
-    // private types
-public:
-    // public types
-    typedef binary_tree<KeyType, ValueType> SuperType;
-    typedef typename SuperType::Node Node;
-    typedef typename SuperType::iterator iterator;
-    typedef typename SuperType::value_type value_type;
+    avl_hook *children[2] = {nullptr, nullptr};
+    avl_hook *parent = nullptr;
+    int height = 1;
+};
 
-    //	using BinaryTreeType<KeyType, ValueType>::Node;
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief AVL algorithms on avl_hook, shared by intrusive_bst, binary_search_tree and interval_tree.
+/// augment( avl_hook * ) is called bottom-up whenever the children of a node change, after its height is updated, to maintain a summary
+/// of the subtree, eg. the max end of interval_tree.
+struct avl_algo
+{
     enum
     {
         ILEFT = 0,
-        IRIGHT = 1,
-        NUM_CHILDREN = 2
+        IRIGHT = 1
     };
 
-protected:
-    // private members
-    Node *_root;
-    size_t _size;
-    KeyCompare _keyLess;
+    struct no_augment
+    {
+        void operator()( avl_hook * ) const
+        {
+        }
+    };
 
-public:
-    // public functions
-    binary_search_tree( const KeyCompare &kc = std::less<KeyType>() ) : _root( nullptr ), _size( 0 ), _keyLess( kc )
+    static int height( const avl_hook *p )
     {
+        return p ? p->height : 0;
     }
 
-    iterator root()
+    /// \brief leftmost node if i is ILEFT, or rightmost if i is IRIGHT.
+    template<class H>
+    static H *extreme( H *p, int i )
     {
-        return iterator( _root );
+        if ( p )
+            while ( p->children[i] )
+                p = p->children[i];
+        return p;
     }
-    iterator begin()
+
+    /// \brief in-order successor if i is IRIGHT, or predecessor if i is ILEFT.
+    template<class H>
+    static H *next_node( H *p, int i )
     {
-        Node *p = _root;
-        if ( p )
-            while ( p->children[ILEFT] )
-                p = p->children[ILEFT];
-        return iterator( p );
+        if ( p->children[i] )
+            return extreme<H>( p->children[i], 1 - i );
+        for ( ; p->parent; p = p->parent )
+            if ( p == p->parent->children[1 - i] )
+                return p->parent;
+        return nullptr;
     }
-    iterator last()
+
+    /// \return the first node in order for which pred( node ) is false, given pred is true for a prefix, eg. key < k for lower_bound.
+    template<class H, class Pred>
+    static H *partition_point( H *p, const Pred &pred )
     {
-        Node *p = _root;
-        if ( p )
-            while ( p->children[IRIGHT] )
+        H *pBound = nullptr;
+        while ( p )
+        {
+            if ( pred( p ) )
                 p = p->children[IRIGHT];
-        return iterator( p );
+            else
+            {
+                pBound = p;
+                p = p->children[ILEFT];
+            }
+        }
+        return pBound;
     }
-    iterator end()
+
+    /// \brief link p as the child i of parent, or as the root if parent is null, then rebalance.
+    template<class Augment>
+    static void link( avl_hook *&root, avl_hook *parent, int i, avl_hook *p, const Augment &augment )
     {
-        return iterator();
+        p->children[ILEFT] = p->children[IRIGHT] = nullptr;
+        p->parent = parent;
+        p->height = 1;
+        augment( p );
+        if ( parent )
+            parent->children[i] = p;
+        else
+            root = p;
+        rebalance( root, parent, augment );
     }
-    iterator lower_bound( const KeyType &v )
+
+    /// \brief unlink p, then rebalance.
+    template<class Augment>
+    static void unlink( avl_hook *&root, avl_hook *p, const Augment &augment )
     {
-        // return the first element that >= v
-        Node *p = _root;
-        if ( p && !_keyLess( p->kv.first, v ) )
+        avl_hook *pStart; // the lowest node whose subtree changed.
+        if ( p->children[ILEFT] && p->children[IRIGHT] ) // replace p by its successor.
         {
-            while ( true )
+            avl_hook *s = extreme( p->children[IRIGHT], ILEFT );
+            if ( s->parent != p )
             {
-                Node *prev = nextNode( p, 0 );
-                if ( prev && !_keyLess( prev->kv.first, v ) )
-                {
-                    p = prev;
-                }
-                else
-                {
-                    return iterator( p );
-                }
+                pStart = s->parent;
+                pStart->children[ILEFT] = s->children[IRIGHT];
+                if ( s->children[IRIGHT] )
+                    s->children[IRIGHT]->parent = pStart;
+                s->children[IRIGHT] = p->children[IRIGHT];
+                s->children[IRIGHT]->parent = s;
             }
+            else
+                pStart = s;
+            s->children[ILEFT] = p->children[ILEFT];
+            s->children[ILEFT]->parent = s;
+            s->height = p->height;
+            replace_child( root, p, s );
+        }
+        else
+        {
+            pStart = p->parent;
+            replace_child( root, p, p->children[ILEFT] ? p->children[ILEFT] : p->children[IRIGHT] );
+        }
+        rebalance( root, pStart, augment );
+        p->children[ILEFT] = p->children[IRIGHT] = p->parent = nullptr;
+    }
+
+    /// \brief link nodes, which are in order, as a perfectly balanced tree in O(n).
+    /// \return the root.
+    template<class H, class Augment>
+    static avl_hook *build( H *const *nodes, std::size_t n, avl_hook *parent, const Augment &augment )
+    {
+        if ( !n )
+            return nullptr;
+        const std::size_t mid = n / 2;
+        avl_hook *p = nodes[mid];
+        p->parent = parent;
+        p->children[ILEFT] = build( nodes, mid, p, augment );
+        p->children[IRIGHT] = build( nodes + mid + 1, n - mid - 1, p, augment );
+        update( p, augment );
+        return p;
+    }
+
+    /// \brief call dispose( p ) for each node in post-order, without a stack. Nodes are unlinked before disposed.
+    template<class Dispose>
+    static void dispose( avl_hook *p, const Dispose &dispose )
+    {
+        while ( p )
+        {
+            if ( p->children[ILEFT] )
+                p = std::exchange( p->children[ILEFT], nullptr );
+            else if ( p->children[IRIGHT] )
+                p = std::exchange( p->children[IRIGHT], nullptr );
+            else
+                dispose( std::exchange( p, p->parent ) );
         }
-        for ( ; p && _keyLess( p->kv.first, v ); p = nextNode( p ) )
-            ;
-        return iterator( p );
     }
-    iterator upper_bound( const KeyType &v )
+
+    /// \brief check parent links, heights and balance, and check( p ) for each node, eg. order and augmented values.
+    /// \return height of the subtree, or -1 if invalid. n is incremented by the number of nodes.
+    template<class Check>
+    static int verify( const avl_hook *p, const avl_hook *parent, std::size_t &n, const Check &check )
+    {
+        if ( !p )
+            return 0;
+        ++n;
+        if ( p->parent != parent || !check( p ) )
+            return -1;
+        const int hl = verify( p->children[ILEFT], p, n, check ), hr = verify( p->children[IRIGHT], p, n, check );
+        if ( hl < 0 || hr < 0 || hl - hr > 1 || hr - hl > 1 || p->height != 1 + std::max( hl, hr ) )
+            return -1;
+        return p->height;
+    }
+
+protected:
+    template<class Augment>
+    static void update( avl_hook *p, const Augment &augment )
+    {
+        p->height = 1 + std::max( height( p->children[ILEFT] ), height( p->children[IRIGHT] ) );
+        augment( p );
+    }
+
+    /// \brief put q at the place of p in p's parent.
+    static void replace_child( avl_hook *&root, avl_hook *p, avl_hook *q )
     {
-        // return the first element that > v
-        Node *p = _root;
-        if ( p && _keyLess( v, p->kv.first ) )
+        if ( !p->parent )
+            root = q;
+        else
+            p->parent->children[p->parent->children[IRIGHT] == p] = q;
+        if ( q )
+            q->parent = p->parent;
+    }
+
+    /// \brief rotate the child i of p up. \return the child.
+    template<class Augment>
+    static avl_hook *rotate( avl_hook *&root, avl_hook *p, int i, const Augment &augment )
+    {
+        avl_hook *c = p->children[i], *g = c->children[1 - i];
+        p->children[i] = g;
+        if ( g )
+            g->parent = p;
+        replace_child( root, p, c );
+        c->children[1 - i] = p;
+        p->parent = c;
+        update( p, augment );
+        update( c, augment );
+        return c;
+    }
+
+    /// \brief update p and its ancestors, rotating unbalanced ones.
+    template<class Augment>
+    static void rebalance( avl_hook *&root, avl_hook *p, const Augment &augment )
+    {
+        for ( ; p; p = p->parent )
         {
-            while ( true )
+            const int oldHeight = p->height;
+            update( p, augment );
+            const int balance = height( p->children[IRIGHT] ) - height( p->children[ILEFT] );
+            if ( balance > 1 || balance < -1 )
             {
-                Node *prev = nextNode( p, 0 );
-                if ( prev && _keyLess( v, prev->kv.first ) )
-                {
-                    p = prev;
-                }
-                else
-                {
-                    return iterator( p );
-                }
+                const int i = balance > 1 ? IRIGHT : ILEFT;
+                avl_hook *c = p->children[i];
+                if ( height( c->children[1 - i] ) > height( c->children[i] ) )
+                    rotate( root, c, 1 - i, augment );
+                p = rotate( root, p, i, augment );
             }
+            else if ( std::is_same_v<Augment, no_augment> && p->height == oldHeight )
+                break; // ancestors are unchanged unless they are augmented.
         }
-        for ( ; p && !_keyLess( v, p->kv.first ); p = nextNode( p ) )
-            ;
-        return iterator( p );
     }
-    std::pair<iterator, bool> insert( const value_type &kv )
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief bidirectional in-order iterator of nodes derived from avl_hook. *it is Traits::value( node ).
+template<class Node, class Traits, bool IsConst>
+class avl_iterator
+{
+    using node_type = std::conditional_t<IsConst, const Node, Node>;
+    using hook_type = std::conditional_t<IsConst, const avl_hook, avl_hook>;
+    template<class, class, bool>
+    friend class avl_iterator;
+
+    node_type *m_p = nullptr;
+    avl_hook *const *m_ppRoot = nullptr; // to decrement end().
+
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = std::remove_reference_t<decltype( Traits::value( std::declval<Node &>() ) )>;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::conditional_t<IsConst, const value_type &, value_type &>;
+    using pointer = std::conditional_t<IsConst, const value_type *, value_type *>;
+
+    avl_iterator() = default;
+    avl_iterator( node_type *p, avl_hook *const *ppRoot ) : m_p( p ), m_ppRoot( ppRoot )
+    {
+    }
+    template<bool C = IsConst, class = std::enable_if_t<C>>
+    avl_iterator( const avl_iterator<Node, Traits, false> &a ) : m_p( a.m_p ), m_ppRoot( a.m_ppRoot )
+    {
+    }
+
+    reference operator*() const
+    {
+        return Traits::value( *m_p );
+    }
+    pointer operator->() const
+    {
+        return &Traits::value( *m_p );
+    }
+    avl_iterator &operator++()
+    {
+        m_p = static_cast<node_type *>( avl_algo::next_node<hook_type>( m_p, avl_algo::IRIGHT ) );
+        return *this;
+    }
+    avl_iterator &operator--()
+    {
+        m_p = static_cast<node_type *>( m_p ? avl_algo::next_node<hook_type>( m_p, avl_algo::ILEFT )
+                                            : avl_algo::extreme<hook_type>( *m_ppRoot, avl_algo::IRIGHT ) );
+        return *this;
+    }
+    avl_iterator operator++( int )
+    {
+        auto r = *this;
+        ++*this;
+        return r;
+    }
+    avl_iterator operator--( int )
+    {
+        auto r = *this;
+        --*this;
+        return r;
+    }
+    bool operator==( const avl_iterator &a ) const
+    {
+        return m_p == a.m_p;
+    }
+    bool operator!=( const avl_iterator &a ) const
     {
-        ++_size;
-        if ( !_root )
+        return m_p != a.m_p;
+    }
+
+    node_type *node() const
+    {
+        return m_p;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief intrusive_bst: AVL tree of caller-owned objects with unique keys. T derives from avl_hook, and KeyOf returns the key of a T.
+/// It never allocates. An object is in at most one tree at a time, and must stay alive and keep its key while it's in the tree.
+/// Usage:
+///     struct Order : avl_hook { int64_t price; ... };
+///     struct OrderPrice { int64_t operator()( const Order &o ) const { return o.price; } };
+///     intrusive_bst<Order, OrderPrice> book;
+///     book.insert( order );
+///     book.erase( order );
+/// Not thread-safe.
+template<class T, class KeyOf, class KeyCompare = std::less<>>
+class intrusive_bst
+{
+    static_assert( std::is_base_of_v<avl_hook, T>, "T must derive from avl_hook" );
+
+    struct Traits
+    {
+        static T &value( T &x )
         {
-            _root = new Node( kv );
-            return std::make_pair( _root, true );
+            return x;
         }
-        Node *p = _root;
-        while ( true )
+        static const T &value( const T &x )
         {
-            if ( _keyLess( p->kv.first, kv.first ) )
-            {
-                if ( p->children[IRIGHT] )
-                {
-                    p = p->children[IRIGHT];
-                }
-                else
-                {
-                    p = SuperType::addChild( p, new Node( kv ), IRIGHT );
-                    break;
-                }
-            }
-            else if ( _keyLess( kv.first, p->kv.first ) )
-            {
-                if ( p->children[ILEFT] )
-                {
-                    p = p->children[ILEFT];
-                }
-                else
-                {
-                    p = SuperType::addChild( p, new Node( kv ), ILEFT );
-                    break;
-                }
-            }
+            return x;
+        }
+    };
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using key_compare = KeyCompare;
+    using iterator = avl_iterator<T, Traits, false>;
+    using const_iterator = avl_iterator<T, Traits, true>;
+
+    explicit intrusive_bst( const KeyOf &keyOf = KeyOf(), const KeyCompare &less = KeyCompare() ) : m_keyOf( keyOf ), m_less( less )
+    {
+    }
+    intrusive_bst( const intrusive_bst & ) = delete;
+    intrusive_bst &operator=( const intrusive_bst & ) = delete;
+    intrusive_bst( intrusive_bst &&a ) : m_keyOf( a.m_keyOf ), m_less( a.m_less )
+    {
+        swap( a );
+    }
+    intrusive_bst &operator=( intrusive_bst &&a )
+    {
+        if ( this != &a )
+        {
+            clear();
+            swap( a );
+        }
+        return *this;
+    }
+    ~intrusive_bst()
+    {
+        clear();
+    }
+
+    void swap( intrusive_bst &a )
+    {
+        std::swap( m_keyOf, a.m_keyOf );
+        std::swap( m_less, a.m_less );
+        std::swap( m_pRoot, a.m_pRoot );
+        std::swap( m_size, a.m_size );
+    }
+
+    iterator begin()
+    {
+        return make_iterator( avl_algo::extreme( m_pRoot, avl_algo::ILEFT ) );
+    }
+    iterator end()
+    {
+        return make_iterator( nullptr );
+    }
+    const_iterator begin() const
+    {
+        return make_iterator( avl_algo::extreme( m_pRoot, avl_algo::ILEFT ) );
+    }
+    const_iterator end() const
+    {
+        return make_iterator( nullptr );
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+    /// \brief height of the tree, 0 if empty.
+    int height() const
+    {
+        return avl_algo::height( m_pRoot );
+    }
+
+    /// \return the iterator of x, and false if an object of the same key exists, which is returned instead.
+    std::pair<iterator, bool> insert( T &x )
+    {
+        auto pos = find_insert_pos( m_keyOf( x ) );
+        if ( pos.first && pos.second < 0 )
+            return {make_iterator( pos.first ), false};
+        avl_algo::link( m_pRoot, pos.first, pos.second, &x, avl_algo::no_augment() );
+        ++m_size;
+        return {make_iterator( &x ), true};
+    }
+
+    /// \brief unlink x. \pre x is in this tree.
+    /// \return the iterator following x.
+    iterator erase( T &x )
+    {
+        auto pNext = avl_algo::next_node<avl_hook>( &x, avl_algo::IRIGHT );
+        avl_algo::unlink( m_pRoot, &x, avl_algo::no_augment() );
+        --m_size;
+        return make_iterator( pNext );
+    }
+    iterator erase( const_iterator it )
+    {
+        return erase( const_cast<T &>( *it ) );
+    }
+
+    iterator iterator_to( T &x )
+    {
+        return make_iterator( &x );
+    }
+
+    template<class K>
+    iterator find( const K &k )
+    {
+        auto it = lower_bound( k );
+        return it != end() && !m_less( k, key( it.node() ) ) ? it : end();
+    }
+    template<class K>
+    const_iterator find( const K &k ) const
+    {
+        return const_cast<intrusive_bst *>( this )->find( k );
+    }
+    template<class K>
+    bool contains( const K &k ) const
+    {
+        return find( k ) != end();
+    }
+    /// \return the first object whose key is not less than k.
+    template<class K>
+    iterator lower_bound( const K &k )
+    {
+        return make_iterator( avl_algo::partition_point( m_pRoot, [&]( avl_hook *p ) { return m_less( key( p ), k ); } ) );
+    }
+    /// \return the first object whose key is greater than k.
+    template<class K>
+    iterator upper_bound( const K &k )
+    {
+        return make_iterator( avl_algo::partition_point( m_pRoot, [&]( avl_hook *p ) { return !m_less( k, key( p ) ); } ) );
+    }
+
+    /// \brief unlink all objects.
+    void clear()
+    {
+        avl_algo::dispose( m_pRoot, []( avl_hook *p ) { p->parent = nullptr; } );
+        m_pRoot = nullptr;
+        m_size = 0;
+    }
+
+    /// \brief check order, parent links, heights and balance, for tests.
+    bool verify() const
+    {
+        size_t n = 0;
+        auto check = [&]( const avl_hook *p ) {
+            auto l = p->children[avl_algo::ILEFT], r = p->children[avl_algo::IRIGHT];
+            return ( !l || m_less( key( l ), key( p ) ) ) && ( !r || m_less( key( p ), key( r ) ) );
+        };
+        return avl_algo::verify( m_pRoot, nullptr, n, check ) >= 0 && n == m_size;
+    }
+
+protected:
+    decltype( auto ) key( const avl_hook *p ) const
+    {
+        return m_keyOf( static_cast<const T &>( *p ) );
+    }
+
+    iterator make_iterator( avl_hook *p )
+    {
+        return {static_cast<T *>( p ), &m_pRoot};
+    }
+    const_iterator make_iterator( const avl_hook *p ) const
+    {
+        return {static_cast<const T *>( p ), &m_pRoot};
+    }
+
+    /// \return {parent, child index} to link a node of key k, or {node, -1} if the key exists.
+    template<class K>
+    std::pair<avl_hook *, int> find_insert_pos( const K &k ) const
+    {
+        avl_hook *p = m_pRoot, *parent = nullptr;
+        int i = avl_algo::ILEFT;
+        while ( p )
+        {
+            if ( m_less( k, key( p ) ) )
+                i = avl_algo::ILEFT;
+            else if ( m_less( key( p ), k ) )
+                i = avl_algo::IRIGHT;
             else
-            {
-                --_size;
-                return std::make_pair( iterator( p ), false );
-            }
+                return {p, -1};
+            parent = p;
+            p = p->children[i];
+        }
+        return {parent, i};
+    }
+
+    KeyOf m_keyOf;
+    KeyCompare m_less;
+    avl_hook *m_pRoot = nullptr;
+    size_t m_size = 0;
+};
+
+namespace internal
+{
+    template<class KeyType, class ValueType>
+    struct BstNode : avl_hook
+    {
+        std::pair<const KeyType, ValueType> kv;
+
+        template<class... Args>
+        BstNode( Args &&... args ) : kv( std::forward<Args>( args )... )
+        {
+        }
+    };
+
+    template<class Node>
+    struct BstNodeKey
+    {
+        const auto &operator()( const Node &n ) const
+        {
+            return n.kv.first;
+        }
+    };
+
+    /// \brief allocates nodes from Alloc rebound to Node.
+    template<class Node, class Alloc>
+    struct BstNodeAlloc
+    {
+        typename std::allocator_traits<Alloc>::template rebind_alloc<Node> m_alloc;
+
+        template<class... Args>
+        Node *create( Args &&... args )
+        {
+            auto p = m_alloc.allocate( 1 );
+            if ( !p )
+                throw std::bad_alloc();
+            return new ( p ) Node( std::forward<Args>( args )... );
+        }
+        void destroy( Node *p )
+        {
+            p->~Node();
+            m_alloc.deallocate( p, 1 );
+        }
+        void swap( BstNodeAlloc &a )
+        {
+            std::swap( m_alloc, a.m_alloc );
+        }
+    };
+
+    /// \brief allocates nodes from an ObjectPool, created at the first allocation.
+    template<class Node>
+    struct BstNodeAlloc<Node, void>
+    {
+        std::unique_ptr<ObjectPool<Node, alignof( Node ), false, false>> m_pPool;
+
+        template<class... Args>
+        Node *create( Args &&... args )
+        {
+            if ( !m_pPool )
+                m_pPool.reset( new ObjectPool<Node, alignof( Node ), false, false>( 64 ) );
+            auto p = m_pPool->create( std::forward<Args>( args )... );
+            if ( !p )
+                throw std::bad_alloc();
+            return p;
+        }
+        void destroy( Node *p )
+        {
+            m_pPool->destroy( p );
+        }
+        void swap( BstNodeAlloc &a )
+        {
+            std::swap( m_pPool, a.m_pPool );
+        }
+    };
+} // namespace internal
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief binary_search_tree: ordered map with unique keys, as an AVL tree, so sorted input doesn't degrade it into a list.
+/// \tparam Alloc allocator of nodes, rebound to the node type. If void, nodes are allocated from an ObjectPool owned by the tree, created
+/// at the first insert.
+/// Use intrusive_bst for keys living in caller-owned objects. Iterators stay valid until their element is erased. Not thread-safe.
+template<typename KeyType, typename ValueType, typename KeyCompare = std::less<KeyType>, typename Alloc = void>
+class binary_search_tree : protected intrusive_bst<internal::BstNode<KeyType, ValueType>,
+                                                   internal::BstNodeKey<internal::BstNode<KeyType, ValueType>>,
+                                                   KeyCompare>
+{
+    using Node = internal::BstNode<KeyType, ValueType>;
+    using base_type = intrusive_bst<Node, internal::BstNodeKey<Node>, KeyCompare>;
+
+    struct Traits
+    {
+        static auto &value( Node &n )
+        {
+            return n.kv;
+        }
+        static const auto &value( const Node &n )
+        {
+            return n.kv;
+        }
+    };
+
+public:
+    using key_type = KeyType;
+    using mapped_type = ValueType;
+    using value_type = std::pair<const KeyType, ValueType>;
+    using size_type = std::size_t;
+    using key_compare = KeyCompare;
+    using iterator = avl_iterator<Node, Traits, false>;
+    using const_iterator = avl_iterator<Node, Traits, true>;
+
+    explicit binary_search_tree( const KeyCompare &less = KeyCompare() ) : base_type( {}, less )
+    {
+    }
+    template<class Iter>
+    binary_search_tree( Iter first, Iter last, const KeyCompare &less = KeyCompare() ) : base_type( {}, less )
+    {
+        for ( ; first != last; ++first )
+            insert( *first );
+    }
+    binary_search_tree( std::initializer_list<std::pair<KeyType, ValueType>> il, const KeyCompare &less = KeyCompare() )
+        : binary_search_tree( il.begin(), il.end(), less )
+    {
+    }
+    binary_search_tree( const binary_search_tree &a ) : base_type( {}, a.m_less )
+    {
+        copy_from( a );
+    }
+    binary_search_tree( binary_search_tree &&a ) : base_type( {}, a.m_less )
+    {
+        swap( a );
+    }
+    binary_search_tree &operator=( const binary_search_tree &a )
+    {
+        if ( this != &a )
+        {
+            clear();
+            copy_from( a );
         }
-        return std::make_pair( p, true );
+        return *this;
+    }
+    binary_search_tree &operator=( binary_search_tree &&a )
+    {
+        if ( this != &a )
+        {
+            clear();
+            swap( a );
+        }
+        return *this;
+    }
+    ~binary_search_tree()
+    {
+        clear();
+    }
+
+    void swap( binary_search_tree &a )
+    {
+        base_type::swap( a );
+        m_alloc.swap( a.m_alloc );
+    }
+
+    using base_type::empty;
+    using base_type::height;
+    using base_type::size;
+    using base_type::verify;
+
+    iterator begin()
+    {
+        return make_iterator( base_type::begin() );
+    }
+    iterator end()
+    {
+        return make_iterator( base_type::end() );
+    }
+    const_iterator begin() const
+    {
+        return const_cast<binary_search_tree *>( this )->begin();
+    }
+    const_iterator end() const
+    {
+        return const_cast<binary_search_tree *>( this )->end();
+    }
+    iterator root()
+    {
+        return make_iterator( static_cast<Node *>( this->m_pRoot ) );
+    }
+    /// \brief the last element, or end() if empty.
+    iterator last()
+    {
+        return make_iterator( static_cast<Node *>( avl_algo::extreme( this->m_pRoot, avl_algo::IRIGHT ) ) );
+    }
+
+    /// \brief construct the value from args if key k doesn't exist.
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace( const KeyType &k, Args &&... args )
+    {
+        auto pos = this->find_insert_pos( k );
+        if ( pos.first && pos.second < 0 )
+            return {make_iterator( static_cast<Node *>( pos.first ) ), false};
+        auto p = m_alloc.create( std::piecewise_construct, std::forward_as_tuple( k ), std::forward_as_tuple( std::forward<Args>( args )... ) );
+        avl_algo::link( this->m_pRoot, pos.first, pos.second, p, avl_algo::no_augment() );
+        ++this->m_size;
+        return {make_iterator( p ), true};
     }
+    std::pair<iterator, bool> insert( const std::pair<KeyType, ValueType> &kv )
+    {
+        return try_emplace( kv.first, kv.second );
+    }
+    ValueType &operator[]( const KeyType &k )
+    {
+        return try_emplace( k ).first->second;
+    }
+    ValueType &at( const KeyType &k )
+    {
+        auto it = find( k );
+        if ( it == end() )
+            throw std::out_of_range( "binary_search_tree::at" );
+        return it->second;
+    }
+
+    /// \return the iterator following the erased one.
+    iterator erase( const_iterator it )
+    {
+        auto p = const_cast<Node *>( it.node() );
+        auto res = base_type::erase( *p );
+        m_alloc.destroy( p );
+        return make_iterator( res );
+    }
+    size_t erase( const KeyType &k )
+    {
+        auto it = find( k );
+        if ( it == end() )
+            return 0;
+        erase( it );
+        return 1;
+    }
+
+    template<class K>
+    iterator find( const K &k )
+    {
+        return make_iterator( base_type::find( k ) );
+    }
+    template<class K>
+    const_iterator find( const K &k ) const
+    {
+        return const_cast<binary_search_tree *>( this )->find( k );
+    }
+    template<class K>
+    bool contains( const K &k ) const
+    {
+        return find( k ) != end();
+    }
+    template<class K>
+    size_t count( const K &k ) const
+    {
+        return contains( k );
+    }
+    template<class K>
+    iterator lower_bound( const K &k )
+    {
+        return make_iterator( base_type::lower_bound( k ) );
+    }
+    template<class K>
+    iterator upper_bound( const K &k )
+    {
+        return make_iterator( base_type::upper_bound( k ) );
+    }
+
+    void clear()
+    {
+        avl_algo::dispose( this->m_pRoot, [&]( avl_hook *p ) { m_alloc.destroy( static_cast<Node *>( p ) ); } );
+        this->m_pRoot = nullptr;
+        this->m_size = 0;
+    }
+
+protected:
+    iterator make_iterator( Node *p )
+    {
+        return {p, &this->m_pRoot};
+    }
+    iterator make_iterator( typename base_type::iterator it )
+    {
+        return make_iterator( it.node() );
+    }
+
+    // O(n), as a perfectly balanced tree.
+    void copy_from( const binary_search_tree &a )
+    {
+        std::vector<Node *> nodes;
+        nodes.reserve( a.size() );
+        for ( auto &kv : a )
+            nodes.push_back( m_alloc.create( kv ) );
+        this->m_pRoot = avl_algo::build( nodes.data(), nodes.size(), nullptr, avl_algo::no_augment() );
+        this->m_size = nodes.size();
+    }
+
+    internal::BstNodeAlloc<Node, Alloc> m_alloc;
 };
 
 } // namespace ftl
-#endif
@@ -0,0 +1,1031 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <ftl/flat_ordered_map.h>
+#include <ftl/mem_pool.h>
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+namespace ftl
+{
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief BTreeMap: B+-tree ordered map with the interface of FlatOrderedMap, for maps large enough that the O(n) memmove of a flat
+/// map on insert/erase dominates. Insert and erase move at most one node of elements.
+/// - Nodes are NodeBytes large and cache line aligned. Leaves keep keys and values in separate arrays, so a search touches only keys.
+///   Arithmetic keys ordered by operator< are searched in leaves with simd_lower_bound.
+/// - Leaves are linked, so iteration is a linear scan of leaves.
+/// - Nodes are allocated from MemPools owned by the map, created at the first insert.
+/// Iterators are invalidated by insert/erase. *it is std::pair<const K&, V&>, as FlatSplitMap.
+/// Not thread-safe.
+template<class K, class V, class LessThan = std::less<K>, std::size_t NodeBytes = 512, class AlignedAlloc = MmapAlignedAlloc>
+class BTreeMap
+{
+    static constexpr std::size_t CACHE_LINE = 64;
+    static constexpr unsigned LEAF_SLOTS = unsigned( std::max<std::size_t>( 4, ( NodeBytes - 32 ) / ( sizeof( K ) + sizeof( V ) ) ) );
+    static constexpr unsigned INNER_SLOTS = unsigned( std::max<std::size_t>( 4, ( NodeBytes - 16 ) / ( sizeof( K ) + sizeof( void * ) ) ) );
+    static constexpr unsigned MIN_LEAF = LEAF_SLOTS / 2, MIN_INNER = INNER_SLOTS / 2; // nodes below are rebalanced at erase.
+    static constexpr unsigned MAX_DEPTH = 32;
+    static constexpr bool use_simd = is_simd_key_v<K> && is_natural_less_v<LessThan, K>;
+
+    template<class T, unsigned N>
+    struct RawArray
+    {
+        alignas( T ) unsigned char buf[sizeof( T ) * N];
+
+        T *data()
+        {
+            return reinterpret_cast<T *>( buf );
+        }
+        const T *data() const
+        {
+            return reinterpret_cast<const T *>( buf );
+        }
+        T &operator[]( unsigned i )
+        {
+            return data()[i];
+        }
+        const T &operator[]( unsigned i ) const
+        {
+            return data()[i];
+        }
+    };
+
+    struct alignas( CACHE_LINE ) Leaf
+    {
+        Leaf *pPrev = nullptr, *pNext = nullptr;
+        unsigned count = 0;
+        RawArray<K, LEAF_SLOTS> keys;
+        RawArray<V, LEAF_SLOTS> values;
+    };
+
+    // children[i] holds keys in [keys[i-1], keys[i]).
+    struct alignas( CACHE_LINE ) Inner
+    {
+        unsigned count = 0; // number of keys, children[0..count] are valid.
+        RawArray<K, INNER_SLOTS> keys;
+        void *children[INNER_SLOTS + 1];
+    };
+
+    // inner nodes and child indexes from root to the parent of a leaf.
+    struct Path
+    {
+        Inner *nodes[MAX_DEPTH];
+        unsigned idx[MAX_DEPTH];
+    };
+
+    struct NodePools
+    {
+        MemPool<false, false, AlignedAlloc> leaves, inners;
+
+        NodePools()
+        {
+            init( leaves, sizeof( Leaf ), alignof( Leaf ) );
+            init( inners, sizeof( Inner ), alignof( Inner ) );
+        }
+
+        static void init( MemPool<false, false, AlignedAlloc> &pool, std::size_t size, std::size_t alignment )
+        {
+            AllocRequest r{size, std::max<std::size_t>( 4096 / size, 1 ), alignment};
+            r.alignupToSlabGranularity = true;
+            r.maxSlotsPerSlab = 1024;
+            pool.init( r );
+        }
+    };
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<K, V>;
+    using size_type = std::size_t;
+    using key_compare = LessThan;
+
+    template<bool IsConst>
+    class Iterator
+    {
+        using map_type = std::conditional_t<IsConst, const BTreeMap, BTreeMap>;
+        using mapped_ref = std::conditional_t<IsConst, const V &, V &>;
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = std::pair<const K &, mapped_ref>;
+        using reference = value_type;
+        struct pointer
+        {
+            value_type kv;
+            const value_type *operator->() const
+            {
+                return &kv;
+            }
+        };
+
+        Iterator() = default;
+        Iterator( map_type *pMap, Leaf *pLeaf, unsigned i ) : m_pMap( pMap ), m_pLeaf( pLeaf ), m_i( i )
+        {
+        }
+        template<bool C = IsConst, typename = std::enable_if_t<C>>
+        Iterator( const Iterator<false> &it ) : m_pMap( it.m_pMap ), m_pLeaf( it.m_pLeaf ), m_i( it.m_i )
+        {
+        }
+
+        const K &key() const
+        {
+            return m_pLeaf->keys[m_i];
+        }
+        mapped_ref value() const
+        {
+            return m_pLeaf->values[m_i];
+        }
+
+        reference operator*() const
+        {
+            return {key(), value()};
+        }
+        pointer operator->() const
+        {
+            return {**this};
+        }
+
+        Iterator &operator++()
+        {
+            if ( ++m_i == m_pLeaf->count )
+            {
+                m_pLeaf = m_pLeaf->pNext;
+                m_i = 0;
+            }
+            return *this;
+        }
+        Iterator operator++( int )
+        {
+            auto it = *this;
+            ++*this;
+            return it;
+        }
+        Iterator &operator--()
+        {
+            if ( !m_pLeaf ) // end
+            {
+                m_pLeaf = m_pMap->m_pLast;
+                m_i = m_pLeaf->count;
+            }
+            else if ( m_i == 0 )
+            {
+                m_pLeaf = m_pLeaf->pPrev;
+                m_i = m_pLeaf->count;
+            }
+            --m_i;
+            return *this;
+        }
+        Iterator operator--( int )
+        {
+            auto it = *this;
+            --*this;
+            return it;
+        }
+
+        bool operator==( const Iterator &a ) const
+        {
+            return m_pLeaf == a.m_pLeaf && m_i == a.m_i;
+        }
+        bool operator!=( const Iterator &a ) const
+        {
+            return !( *this == a );
+        }
+
+    private:
+        friend class BTreeMap;
+        friend class Iterator<true>;
+        map_type *m_pMap = nullptr;
+        Leaf *m_pLeaf = nullptr; // nullptr for end.
+        unsigned m_i = 0;
+    };
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    BTreeMap( const LessThan &less = LessThan{} ) : m_less( less )
+    {
+    }
+
+    template<class InputIter>
+    BTreeMap( InputIter it, InputIter itEnd, const LessThan &less = LessThan{} ) : m_less( less )
+    {
+        insert_bulk( it, itEnd );
+    }
+
+    BTreeMap( const std::initializer_list<value_type> &il, const LessThan &less = LessThan{} ) : BTreeMap( il.begin(), il.end(), less )
+    {
+    }
+
+    BTreeMap( const BTreeMap &a ) : m_less( a.m_less )
+    {
+        build_sorted( a.begin(), a.end(), a.size() );
+    }
+
+    BTreeMap( BTreeMap &&a ) : m_less( a.m_less )
+    {
+        swap( a );
+    }
+
+    BTreeMap &operator=( const BTreeMap &a )
+    {
+        if ( this != &a )
+        {
+            BTreeMap tmp( a );
+            swap( tmp );
+        }
+        return *this;
+    }
+
+    BTreeMap &operator=( BTreeMap &&a )
+    {
+        if ( this != &a )
+        {
+            clear();
+            swap( a );
+        }
+        return *this;
+    }
+
+    ~BTreeMap()
+    {
+        clear();
+    }
+
+    void swap( BTreeMap &a )
+    {
+        std::swap( m_pRoot, a.m_pRoot );
+        std::swap( m_pFirst, a.m_pFirst );
+        std::swap( m_pLast, a.m_pLast );
+        std::swap( m_height, a.m_height );
+        std::swap( m_size, a.m_size );
+        std::swap( m_less, a.m_less );
+        std::swap( m_pPools, a.m_pPools );
+    }
+
+    size_type size() const
+    {
+        return m_size;
+    }
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    /// \brief destroy all elements. Node memory is kept in the pools for reuse.
+    void clear()
+    {
+        if ( m_pRoot )
+            destroy_subtree( m_pRoot, 0 );
+        m_pRoot = nullptr;
+        m_pFirst = m_pLast = nullptr;
+        m_height = 0;
+        m_size = 0;
+    }
+
+    iterator begin()
+    {
+        return {this, m_pFirst, 0};
+    }
+    iterator end()
+    {
+        return {this, nullptr, 0};
+    }
+    const_iterator begin() const
+    {
+        return {this, m_pFirst, 0};
+    }
+    const_iterator end() const
+    {
+        return {this, nullptr, 0};
+    }
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+    const_iterator cend() const
+    {
+        return end();
+    }
+
+    typename iterator::reference front()
+    {
+        return *begin();
+    }
+    typename const_iterator::reference front() const
+    {
+        return *begin();
+    }
+    typename iterator::reference back()
+    {
+        return *std::prev( end() );
+    }
+    typename const_iterator::reference back() const
+    {
+        return *std::prev( end() );
+    }
+
+    template<class KT>
+    iterator lower_bound( const KT &k )
+    {
+        auto pos = bound<false>( k );
+        return {this, pos.first, pos.second};
+    }
+    template<class KT>
+    const_iterator lower_bound( const KT &k ) const
+    {
+        auto pos = bound<false>( k );
+        return {this, pos.first, pos.second};
+    }
+
+    template<class KT>
+    iterator upper_bound( const KT &k )
+    {
+        auto pos = bound<true>( k );
+        return {this, pos.first, pos.second};
+    }
+    template<class KT>
+    const_iterator upper_bound( const KT &k ) const
+    {
+        auto pos = bound<true>( k );
+        return {this, pos.first, pos.second};
+    }
+
+    template<class KT>
+    iterator find( const KT &k )
+    {
+        auto it = lower_bound( k );
+        return ( it != end() && !m_less( k, it.key() ) ) ? it : end();
+    }
+    template<class KT>
+    const_iterator find( const KT &k ) const
+    {
+        auto it = lower_bound( k );
+        return ( it != end() && !m_less( k, it.key() ) ) ? it : end();
+    }
+
+    template<class KT>
+    std::pair<iterator, iterator> equal_range( const KT &k )
+    {
+        auto it = find( k );
+        return {it, it == end() ? it : std::next( it )};
+    }
+    template<class KT>
+    std::pair<const_iterator, const_iterator> equal_range( const KT &k ) const
+    {
+        auto it = find( k );
+        return {it, it == end() ? it : std::next( it )};
+    }
+
+    template<class KT>
+    bool contains( const KT &k ) const
+    {
+        return find( k ) != end();
+    }
+    template<class KT>
+    size_type count( const KT &k ) const
+    {
+        return contains( k );
+    }
+
+    V &operator[]( const K &k )
+    {
+        return try_emplace( k ).first.value();
+    }
+
+    // throws std::out_of_range
+    const V &operator[]( const K &k ) const
+    {
+        return at( k );
+    }
+    const V &at( const K &k ) const
+    {
+        auto it = find( k );
+        if ( it == end() )
+            throw std::out_of_range( "No key vale" );
+        return it.value();
+    }
+    V &at( const K &k )
+    {
+        return const_cast<V &>( static_cast<const BTreeMap *>( this )->at( k ) );
+    }
+
+    /// \return <iterator points to k, Inserted>.
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace( const K &k, Args &&... args )
+    {
+        if ( !m_pRoot )
+        {
+            m_pRoot = m_pFirst = m_pLast = new_leaf();
+            m_height = 1;
+        }
+        Path path;
+        auto pLeaf = find_leaf( k, &path );
+        auto i = leaf_index<false>( pLeaf, k );
+        if ( i < pLeaf->count && !m_less( k, pLeaf->keys[i] ) )
+            return {{this, pLeaf, i}, false};
+
+        if ( pLeaf->count == LEAF_SLOTS )
+        {
+            // appending to the last leaf leaves it full, so sequential inserts fill leaves.
+            const auto nLeft = ( i == LEAF_SLOTS && !pLeaf->pNext ) ? LEAF_SLOTS - 1 : LEAF_SLOTS / 2;
+            auto pRight = split_leaf( pLeaf, nLeft );
+            insert_child( path, int( m_height ) - 2, pRight->keys[0], pRight );
+            if ( i > nLeft )
+            {
+                pLeaf = pRight;
+                i -= nLeft;
+            }
+        }
+        insert_at( pLeaf->values.data(), pLeaf->count, i, std::forward<Args>( args )... );
+        insert_at( pLeaf->keys.data(), pLeaf->count, i, k );
+        ++pLeaf->count;
+        ++m_size;
+        return {{this, pLeaf, i}, true};
+    }
+
+    template<class VT>
+    std::pair<iterator, bool> insert_or_assign( const K &k, VT &&v )
+    {
+        auto res = try_emplace( k, std::forward<VT>( v ) );
+        if ( !res.second )
+            res.first.value() = std::forward<VT>( v );
+        return res;
+    }
+
+    std::pair<iterator, bool> insert( const value_type &kv )
+    {
+        return try_emplace( kv.first, kv.second );
+    }
+
+    // return <iterator points to val, Inserted>.
+    std::pair<iterator, bool> update( const value_type &kv, bool bInsertIfNotFound = true )
+    {
+        if ( bInsertIfNotFound )
+            return insert_or_assign( kv.first, kv.second );
+        auto it = find( kv.first );
+        if ( it != end() )
+            it.value() = kv.second;
+        return {it, false};
+    }
+    std::pair<iterator, bool> update( value_type &&kv, bool bInsertIfNotFound = true )
+    {
+        if ( bInsertIfNotFound )
+            return insert_or_assign( kv.first, std::move( kv.second ) );
+        auto it = find( kv.first );
+        if ( it != end() )
+            it.value() = std::move( kv.second );
+        return {it, false};
+    }
+
+    /// \brief insert a batch. An empty map is built bottom-up from the sorted batch with full nodes.
+    /// A key found in the map or repeated in the batch keeps the first value, or the last one if bAssignExisting.
+    /// \return number of elements inserted.
+    template<class InputIter>
+    size_type insert_bulk( InputIter it, InputIter itEnd, bool bAssignExisting = false )
+    {
+        if ( !empty() )
+        {
+            const auto n = size();
+            for ( ; it != itEnd; ++it )
+            {
+                auto &&kv = *it;
+                if ( bAssignExisting )
+                    insert_or_assign( kv.first, std::forward<decltype( kv )>( kv ).second );
+                else
+                    try_emplace( kv.first, std::forward<decltype( kv )>( kv ).second );
+            }
+            return size() - n;
+        }
+        std::vector<value_type> batch( it, itEnd );
+        std::stable_sort( batch.begin(), batch.end(), [&]( const auto &a, const auto &b ) { return m_less( a.first, b.first ); } );
+        auto itOut = batch.begin();
+        for ( auto itIn = batch.begin(); itIn != batch.end(); )
+        {
+            auto itRunEnd = std::next( itIn );
+            while ( itRunEnd != batch.end() && !m_less( itIn->first, itRunEnd->first ) )
+                ++itRunEnd;
+            auto &kv = bAssignExisting ? *std::prev( itRunEnd ) : *itIn;
+            if ( &kv != &*itOut )
+                *itOut = std::move( kv );
+            ++itOut;
+            itIn = itRunEnd;
+        }
+        batch.erase( itOut, batch.end() );
+        build_sorted( std::make_move_iterator( batch.begin() ), std::make_move_iterator( batch.end() ), batch.size() );
+        return size();
+    }
+
+    template<class KT>
+    size_type erase( const KT &k )
+    {
+        if ( !m_pRoot )
+            return 0;
+        Path path;
+        auto pLeaf = find_leaf( k, &path );
+        auto i = leaf_index<false>( pLeaf, k );
+        if ( i == pLeaf->count || m_less( k, pLeaf->keys[i] ) )
+            return 0;
+        erase_at( pLeaf->keys.data(), pLeaf->count, i );
+        erase_at( pLeaf->values.data(), pLeaf->count, i );
+        --pLeaf->count;
+        --m_size;
+        rebalance_leaf( path, pLeaf );
+        return 1;
+    }
+
+    /// \return iterator following the erased element.
+    iterator erase( const_iterator it )
+    {
+        K k = it.key(); // elements may move at rebalance, so find the next one by key.
+        erase( k );
+        return lower_bound( k );
+    }
+    iterator erase( iterator it )
+    {
+        return erase( const_iterator( it ) );
+    }
+
+    /// \brief erase all elements satisfying pred( std::pair<const K&, V&> ).
+    /// \return number of elements erased.
+    template<class Pred>
+    size_type bulk_erase( Pred &&pred )
+    {
+        std::vector<value_type> kept;
+        kept.reserve( size() );
+        for ( auto pLeaf = m_pFirst; pLeaf; pLeaf = pLeaf->pNext )
+            for ( unsigned i = 0; i < pLeaf->count; ++i )
+            {
+                typename iterator::value_type kv{pLeaf->keys[i], pLeaf->values[i]};
+                if ( !pred( kv ) )
+                    kept.emplace_back( std::move( pLeaf->keys[i] ), std::move( pLeaf->values[i] ) );
+            }
+        const auto n = size() - kept.size();
+        clear();
+        build_sorted( std::make_move_iterator( kept.begin() ), std::make_move_iterator( kept.end() ), kept.size() );
+        return n;
+    }
+
+    /// \brief number of levels, 0 if empty.
+    unsigned height() const
+    {
+        return m_height;
+    }
+
+    /// \brief check ordering, links and separators. For tests.
+    bool verify() const
+    {
+        if ( !m_pRoot )
+            return m_size == 0 && !m_pFirst && !m_pLast;
+        size_type n = 0;
+        const Leaf *pPrevLeaf = nullptr;
+        if ( !verify_subtree( m_pRoot, 0, nullptr, nullptr, n, pPrevLeaf ) )
+            return false;
+        return n == m_size && pPrevLeaf == m_pLast && !m_pLast->pNext;
+    }
+
+protected:
+    /// \tparam Upper if true, index of the first key greater than k, else the first key not less than k.
+    template<bool Upper, class KT>
+    unsigned leaf_index( const Leaf *pLeaf, const KT &k ) const
+    {
+        if constexpr ( Upper )
+            return unsigned( branchless_lower_bound( pLeaf->keys.data(), pLeaf->count, k, [&]( const K &a, const KT &b ) { return !m_less( b, a ); } ) );
+        // only for K itself: a transparent less compares other key types as they are, and K( k ) could truncate them.
+        else if constexpr ( use_simd && std::is_same_v<KT, K> )
+            return unsigned( simd_lower_bound( pLeaf->keys.data(), pLeaf->count, k ) );
+        else
+            return unsigned( branchless_lower_bound( pLeaf->keys.data(), pLeaf->count, k, m_less ) );
+    }
+
+    template<class KT>
+    Leaf *find_leaf( const KT &k, Path *pPath ) const
+    {
+        auto p = m_pRoot;
+        for ( unsigned level = 0; level + 1 < m_height; ++level )
+        {
+            auto pInner = static_cast<Inner *>( p );
+            auto i = unsigned( branchless_lower_bound( pInner->keys.data(), pInner->count, k, [&]( const K &a, const KT &b ) { return !m_less( b, a ); } ) );
+            if ( pPath )
+            {
+                pPath->nodes[level] = pInner;
+                pPath->idx[level] = i;
+            }
+            p = pInner->children[i];
+        }
+        return static_cast<Leaf *>( p );
+    }
+
+    template<bool Upper, class KT>
+    std::pair<Leaf *, unsigned> bound( const KT &k ) const
+    {
+        if ( !m_pRoot )
+            return {nullptr, 0};
+        auto pLeaf = find_leaf( k, nullptr );
+        auto i = leaf_index<Upper>( pLeaf, k );
+        if ( i == pLeaf->count ) // keys of the next leaf are not less than the separator, which is greater than k.
+            return {pLeaf->pNext, 0};
+        return {pLeaf, i};
+    }
+
+    Leaf *new_leaf()
+    {
+        if ( !m_pPools )
+            m_pPools.reset( new NodePools );
+        auto p = m_pPools->leaves.malloc();
+        if ( !p )
+            throw std::bad_alloc();
+        return new ( p ) Leaf; // default-initialized, slots stay raw.
+    }
+
+    Inner *new_inner()
+    {
+        auto p = m_pPools->inners.malloc();
+        if ( !p )
+            throw std::bad_alloc();
+        return new ( p ) Inner;
+    }
+
+    void free_leaf( Leaf *p )
+    {
+        p->~Leaf();
+        m_pPools->leaves.free( p );
+    }
+
+    void free_inner( Inner *p )
+    {
+        p->~Inner();
+        m_pPools->inners.free( p );
+    }
+
+    // elements are constructed and destroyed explicitly in RawArray.
+    template<class T, class... Args>
+    static void insert_at( T *a, unsigned count, unsigned i, Args &&... args )
+    {
+        if ( i == count )
+        {
+            new ( a + count ) T( std::forward<Args>( args )... );
+            return;
+        }
+        new ( a + count ) T( std::move( a[count - 1] ) );
+        std::move_backward( a + i, a + count - 1, a + count );
+        a[i] = T( std::forward<Args>( args )... );
+    }
+
+    template<class T>
+    static void erase_at( T *a, unsigned count, unsigned i )
+    {
+        std::move( a + i + 1, a + count, a + i );
+        a[count - 1].~T();
+    }
+
+    // move n elements to uninitialized dst.
+    template<class T>
+    static void relocate( T *src, unsigned n, T *dst )
+    {
+        std::uninitialized_move( src, src + n, dst );
+        std::destroy( src, src + n );
+    }
+
+    void link_after( Leaf *pLeaf, Leaf *pNew )
+    {
+        pNew->pPrev = pLeaf;
+        pNew->pNext = pLeaf->pNext;
+        if ( pLeaf->pNext )
+            pLeaf->pNext->pPrev = pNew;
+        else
+            m_pLast = pNew;
+        pLeaf->pNext = pNew;
+    }
+
+    void unlink( Leaf *pLeaf )
+    {
+        ( pLeaf->pPrev ? pLeaf->pPrev->pNext : m_pFirst ) = pLeaf->pNext;
+        ( pLeaf->pNext ? pLeaf->pNext->pPrev : m_pLast ) = pLeaf->pPrev;
+    }
+
+    /// \brief keep nLeft elements in pLeaf and move the others to a new right sibling.
+    Leaf *split_leaf( Leaf *pLeaf, unsigned nLeft )
+    {
+        auto pRight = new_leaf();
+        pRight->count = pLeaf->count - nLeft;
+        relocate( pLeaf->keys.data() + nLeft, pRight->count, pRight->keys.data() );
+        relocate( pLeaf->values.data() + nLeft, pRight->count, pRight->values.data() );
+        pLeaf->count = nLeft;
+        link_after( pLeaf, pRight );
+        return pRight;
+    }
+
+    void insert_into_inner( Inner *p, unsigned i, const K &sep, void *pChild )
+    {
+        insert_at( p->keys.data(), p->count, i, sep );
+        std::move_backward( p->children + i + 1, p->children + p->count + 1, p->children + p->count + 2 );
+        p->children[i + 1] = pChild;
+        ++p->count;
+    }
+
+    /// \brief insert pChild after path.nodes[level]->children[path.idx[level]], splitting full nodes up to the root.
+    void insert_child( Path &path, int level, const K &sep, void *pChild )
+    {
+        if ( level < 0 ) // the root was split.
+        {
+            auto pRoot = new_inner();
+            pRoot->children[0] = m_pRoot;
+            insert_into_inner( pRoot, 0, sep, pChild );
+            m_pRoot = pRoot;
+            ++m_height;
+            assert( m_height <= MAX_DEPTH );
+            return;
+        }
+        auto p = path.nodes[level];
+        const auto i = path.idx[level];
+        if ( p->count < INNER_SLOTS )
+        {
+            insert_into_inner( p, i, sep, pChild );
+            return;
+        }
+        // split: keys[mid] moves up, the right node takes keys after it and children[mid+1..count].
+        constexpr unsigned mid = INNER_SLOTS / 2;
+        auto pRight = new_inner();
+        pRight->count = p->count - mid - 1;
+        relocate( p->keys.data() + mid + 1, pRight->count, pRight->keys.data() );
+        std::copy( p->children + mid + 1, p->children + p->count + 1, pRight->children );
+        K up = std::move( p->keys[mid] );
+        p->keys[mid].~K();
+        p->count = mid;
+        if ( i <= mid )
+            insert_into_inner( p, i, sep, pChild );
+        else
+            insert_into_inner( pRight, i - mid - 1, sep, pChild );
+        insert_child( path, level - 1, up, pRight );
+    }
+
+    // remove keys[i] and children[i+1].
+    static void remove_from_inner( Inner *p, unsigned i )
+    {
+        erase_at( p->keys.data(), p->count, i );
+        std::move( p->children + i + 2, p->children + p->count + 1, p->children + i + 1 );
+        --p->count;
+    }
+
+    void rebalance_leaf( Path &path, Leaf *pLeaf )
+    {
+        if ( m_height == 1 )
+        {
+            if ( pLeaf->count == 0 )
+            {
+                free_leaf( pLeaf );
+                m_pRoot = m_pFirst = m_pLast = nullptr;
+                m_height = 0;
+            }
+            return;
+        }
+        if ( pLeaf->count >= MIN_LEAF )
+            return;
+        const int level = int( m_height ) - 2;
+        auto pParent = path.nodes[level];
+        const auto idx = path.idx[level];
+        if ( idx < pParent->count ) // has right sibling
+        {
+            auto pRight = static_cast<Leaf *>( pParent->children[idx + 1] );
+            if ( pRight->count > MIN_LEAF )
+            {
+                new ( &pLeaf->keys[pLeaf->count] ) K( std::move( pRight->keys[0] ) );
+                new ( &pLeaf->values[pLeaf->count] ) V( std::move( pRight->values[0] ) );
+                ++pLeaf->count;
+                erase_at( pRight->keys.data(), pRight->count, 0 );
+                erase_at( pRight->values.data(), pRight->count, 0 );
+                --pRight->count;
+                pParent->keys[idx] = pRight->keys[0];
+                return;
+            }
+            merge_leaves( pLeaf, pRight );
+            remove_from_inner( pParent, idx );
+        }
+        else
+        {
+            auto pLeft = static_cast<Leaf *>( pParent->children[idx - 1] );
+            if ( pLeft->count > MIN_LEAF )
+            {
+                const auto last = pLeft->count - 1;
+                insert_at( pLeaf->keys.data(), pLeaf->count, 0, std::move( pLeft->keys[last] ) );
+                insert_at( pLeaf->values.data(), pLeaf->count, 0, std::move( pLeft->values[last] ) );
+                ++pLeaf->count;
+                pLeft->keys[last].~K();
+                pLeft->values[last].~V();
+                --pLeft->count;
+                pParent->keys[idx - 1] = pLeaf->keys[0];
+                return;
+            }
+            merge_leaves( pLeft, pLeaf );
+            remove_from_inner( pParent, idx - 1 );
+        }
+        rebalance_inner( path, level );
+    }
+
+    // move all elements of pRight to pLeft and free pRight.
+    void merge_leaves( Leaf *pLeft, Leaf *pRight )
+    {
+        relocate( pRight->keys.data(), pRight->count, pLeft->keys.data() + pLeft->count );
+        relocate( pRight->values.data(), pRight->count, pLeft->values.data() + pLeft->count );
+        pLeft->count += pRight->count;
+        unlink( pRight );
+        free_leaf( pRight );
+    }
+
+    void rebalance_inner( Path &path, int level )
+    {
+        auto p = path.nodes[level];
+        if ( level == 0 )
+        {
+            if ( p->count == 0 ) // the root has one child.
+            {
+                m_pRoot = p->children[0];
+                free_inner( p );
+                --m_height;
+            }
+            return;
+        }
+        if ( p->count >= MIN_INNER )
+            return;
+        auto pParent = path.nodes[level - 1];
+        const auto idx = path.idx[level - 1];
+        if ( idx < pParent->count )
+        {
+            auto pRight = static_cast<Inner *>( pParent->children[idx + 1] );
+            if ( pRight->count > MIN_INNER ) // rotate left through the parent.
+            {
+                new ( &p->keys[p->count] ) K( std::move( pParent->keys[idx] ) );
+                p->children[++p->count] = pRight->children[0];
+                pParent->keys[idx] = std::move( pRight->keys[0] );
+                erase_at( pRight->keys.data(), pRight->count, 0 );
+                std::move( pRight->children + 1, pRight->children + pRight->count + 1, pRight->children );
+                --pRight->count;
+                return;
+            }
+            merge_inners( p, pParent->keys[idx], pRight );
+            remove_from_inner( pParent, idx );
+        }
+        else
+        {
+            auto pLeft = static_cast<Inner *>( pParent->children[idx - 1] );
+            if ( pLeft->count > MIN_INNER ) // rotate right through the parent.
+            {
+                insert_at( p->keys.data(), p->count, 0, std::move( pParent->keys[idx - 1] ) );
+                std::move_backward( p->children, p->children + p->count + 1, p->children + p->count + 2 );
+                p->children[0] = pLeft->children[pLeft->count];
+                ++p->count;
+                pParent->keys[idx - 1] = std::move( pLeft->keys[pLeft->count - 1] );
+                pLeft->keys[pLeft->count - 1].~K();
+                --pLeft->count;
+                return;
+            }
+            merge_inners( pLeft, pParent->keys[idx - 1], p );
+            remove_from_inner( pParent, idx - 1 );
+        }
+        rebalance_inner( path, level - 1 );
+    }
+
+    // pLeft + sep + pRight -> pLeft, and free pRight.
+    void merge_inners( Inner *pLeft, const K &sep, Inner *pRight )
+    {
+        new ( &pLeft->keys[pLeft->count] ) K( sep );
+        relocate( pRight->keys.data(), pRight->count, pLeft->keys.data() + pLeft->count + 1 );
+        std::copy( pRight->children, pRight->children + pRight->count + 1, pLeft->children + pLeft->count + 1 );
+        pLeft->count += pRight->count + 1;
+        free_inner( pRight );
+    }
+
+    /// \brief build from n sorted unique key-value pairs, nodes evenly filled. \pre empty().
+    template<class InputIter>
+    void build_sorted( InputIter it, InputIter itEnd, size_type n )
+    {
+        assert( empty() );
+        if ( n == 0 )
+            return;
+        struct Child
+        {
+            void *p;
+            const K *pMinKey; // separator before p.
+        };
+        std::vector<Child> level;
+        const auto nLeaves = ( n + LEAF_SLOTS - 1 ) / LEAF_SLOTS;
+        for ( size_type iLeaf = 0; iLeaf < nLeaves; ++iLeaf )
+        {
+            auto pLeaf = new_leaf();
+            const auto count = unsigned( n * ( iLeaf + 1 ) / nLeaves - n * iLeaf / nLeaves );
+            for ( ; pLeaf->count < count; ++it )
+            {
+                auto &&kv = *it;
+                new ( &pLeaf->keys[pLeaf->count] ) K( std::forward<decltype( kv )>( kv ).first );
+                new ( &pLeaf->values[pLeaf->count++] ) V( std::forward<decltype( kv )>( kv ).second );
+            }
+            if ( m_pLast )
+                link_after( m_pLast, pLeaf );
+            else
+                m_pFirst = m_pLast = pLeaf;
+            level.push_back( {pLeaf, &pLeaf->keys[0]} );
+        }
+        assert( it == itEnd );
+        m_size = n;
+        m_height = 1;
+        while ( level.size() > 1 )
+        {
+            std::vector<Child> parents;
+            const auto nChildren = level.size(), nNodes = ( nChildren + INNER_SLOTS ) / ( INNER_SLOTS + 1 );
+            for ( size_type iNode = 0, iChild = 0; iNode < nNodes; ++iNode )
+            {
+                auto pInner = new_inner();
+                const auto iEnd = nChildren * ( iNode + 1 ) / nNodes;
+                parents.push_back( {pInner, level[iChild].pMinKey} );
+                pInner->children[0] = level[iChild++].p;
+                for ( ; iChild < iEnd; ++iChild )
+                {
+                    new ( &pInner->keys[pInner->count] ) K( *level[iChild].pMinKey );
+                    pInner->children[++pInner->count] = level[iChild].p;
+                }
+            }
+            level.swap( parents );
+            ++m_height;
+        }
+        m_pRoot = level[0].p;
+    }
+
+    void destroy_subtree( void *p, unsigned level )
+    {
+        if ( level + 1 == m_height )
+        {
+            auto pLeaf = static_cast<Leaf *>( p );
+            std::destroy( pLeaf->keys.data(), pLeaf->keys.data() + pLeaf->count );
+            std::destroy( pLeaf->values.data(), pLeaf->values.data() + pLeaf->count );
+            free_leaf( pLeaf );
+            return;
+        }
+        auto pInner = static_cast<Inner *>( p );
+        for ( unsigned i = 0; i <= pInner->count; ++i )
+            destroy_subtree( pInner->children[i], level + 1 );
+        std::destroy( pInner->keys.data(), pInner->keys.data() + pInner->count );
+        free_inner( pInner );
+    }
+
+    // keys in subtree are in [*pLow, *pHigh).
+    bool verify_subtree( const void *p, unsigned level, const K *pLow, const K *pHigh, size_type &n, const Leaf *&pPrevLeaf ) const
+    {
+        auto inRange = [&]( const K &k ) { return ( !pLow || !m_less( k, *pLow ) ) && ( !pHigh || m_less( k, *pHigh ) ); };
+        if ( level + 1 == m_height )
+        {
+            auto pLeaf = static_cast<const Leaf *>( p );
+            if ( pLeaf->count == 0 || pLeaf->pPrev != pPrevLeaf || ( pPrevLeaf ? pPrevLeaf->pNext != pLeaf : m_pFirst != pLeaf ) )
+                return false;
+            for ( unsigned i = 0; i < pLeaf->count; ++i )
+                if ( !inRange( pLeaf->keys[i] ) || ( i > 0 && !m_less( pLeaf->keys[i - 1], pLeaf->keys[i] ) ) )
+                    return false;
+            n += pLeaf->count;
+            pPrevLeaf = pLeaf;
+            return true;
+        }
+        auto pInner = static_cast<const Inner *>( p );
+        if ( level > 0 && pInner->count == 0 )
+            return false;
+        for ( unsigned i = 0; i <= pInner->count; ++i )
+        {
+            const K *pChildLow = i == 0 ? pLow : &pInner->keys[i - 1];
+            const K *pChildHigh = i == pInner->count ? pHigh : &pInner->keys[i];
+            if ( i < pInner->count && !inRange( pInner->keys[i] ) )
+                return false;
+            if ( !verify_subtree( pInner->children[i], level + 1, pChildLow, pChildHigh, n, pPrevLeaf ) )
+                return false;
+        }
+        return true;
+    }
+
+    void *m_pRoot = nullptr;
+    Leaf *m_pFirst = nullptr, *m_pLast = nullptr;
+    unsigned m_height = 0;
+    size_type m_size = 0;
+    LessThan m_less;
+    std::unique_ptr<NodePools> m_pPools; // created at the first insert.
+};
+
+} // namespace ftl
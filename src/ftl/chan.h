@@ -21,18 +21,80 @@
 #include <ftl/mpsc_bounded_queue.h>
 #include <ftl/spmc_bounded_queue.h>
 #include <ftl/mem_pool.h>
+#include <ftl/thread_cache.h>
+
+#include <atomic>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 namespace ftl
 {
 
+/// \brief ChanNotifier wakes up a consumer blocked in ChanSelector::select() when a watched chan receives an object.
+/// Producers only pay an eventfd write when a consumer is actually sleeping; otherwise notify() is a fence and a load.
+class ChanNotifier
+{
+protected:
+    int m_eventFd = -1;
+    std::atomic<int> m_nWaiters{0};
+
+public:
+    ChanNotifier() : m_eventFd( eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) )
+    {
+    }
+    ChanNotifier( const ChanNotifier & ) = delete;
+    ChanNotifier &operator=( const ChanNotifier & ) = delete;
+
+    ~ChanNotifier()
+    {
+        if ( m_eventFd >= 0 )
+            ::close( m_eventFd );
+    }
+
+    /// \brief pollable fd which becomes readable when notified.
+    int fd() const
+    {
+        return m_eventFd;
+    }
+
+    /// \brief called by producers after an object was pushed.
+    void notify()
+    {
+        // pairs with the fence in begin_wait(): either the waiter sees the pushed object or we see the waiter.
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        if ( m_nWaiters.load( std::memory_order_relaxed ) > 0 )
+        {
+            std::uint64_t one = 1;
+            [[maybe_unused]] auto n = ::write( m_eventFd, &one, sizeof( one ) );
+        }
+    }
+
+    /// \brief consumer announces it's going to sleep. Chans must be re-checked after this call before sleeping.
+    void begin_wait()
+    {
+        m_nWaiters.fetch_add( 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+    }
+
+    /// \brief consumer woke up. Reset the eventfd counter.
+    void end_wait()
+    {
+        m_nWaiters.fetch_sub( 1, std::memory_order_relaxed );
+        std::uint64_t cnt;
+        [[maybe_unused]] auto n = ::read( m_eventFd, &cnt, sizeof( cnt ) );
+    }
+};
+
 /// \brief Chan sends objects from producer threads to consumer threads.
 template<class T, class Queue = ftl::SPSCRingQueue<T>>
 class Chan
 {
 protected:
     Queue m_queue;
+    std::atomic<ChanNotifier *> m_pNotifier{nullptr}; // set by a selector on its own thread while producers send.
 
 public:
+    using value_type = T;
     constexpr static bool support_multiple_producer_threads = Queue::support_multiple_producer_threads,
                           support_multiple_consumer_threads = Queue::support_multiple_consumer_threads;
 
@@ -51,7 +113,11 @@ public:
     template<class... Args>
     bool send( Args &&... args )
     {
-        return m_queue.emplace( std::forward<Args>( args )... );
+        if ( !m_queue.emplace( std::forward<Args>( args )... ) )
+            return false;
+        if ( auto pNotifier = m_pNotifier.load( std::memory_order_acquire ) )
+            pNotifier->notify();
+        return true;
     }
 
     /// \brief peek function exists only if it does NOT support_multiple_consumer_threads.
@@ -62,74 +128,136 @@ public:
     }
     bool recv( T *pObj )
     {
-        m_queue.pop( pObj );
+        return m_queue.pop( pObj );
     }
 
     bool empty() const
     {
         return m_queue.empty();
     }
+
+    /// \brief set by ChanSelector. A chan can be watched by only one selector.
+    void set_notifier( ChanNotifier *pNotifier )
+    {
+        m_pNotifier.store( pNotifier, std::memory_order_release );
+    }
+};
+
+/// \brief Storage of an object sent by PooledChan. The object is at offset 0 so that T* and PooledChanSlot<T>* are interchangeable.
+template<class T>
+struct PooledChanSlot
+{
+    typename std::aligned_storage<sizeof( T ), alignof( T )>::type obj;
+    PooledChanSlot *pNext = nullptr; // link in producer's free list or return list.
+    void *pOwner = nullptr; // PooledChan::ProducerCache of the producer thread which created the object.
 };
 
 /// \brief PooledChan FIFO queue with object pool. The Chan sends pointers to objects from producer threads to consumer threads.
-template<class T, class FIFOQueue, class PoolT = ftl::ObjectPool<T *>>
+/// Zero allocation in steady state:
+///   - Each producer thread creates objects from its own thread-local cache. The cache is refilled from PoolT only when it's empty.
+///   - Consumers return released objects to the producer's cache through a lock-free return list, which the producer grabs in one
+///     exchange when its local free list is empty.
+/// \tparam FIFOQueue queue of T*, eg. MPSCBoundedQueue<T*>.
+/// \tparam PoolT pool of PooledChanSlot<T>: T* allocate(), void deallocate(T*), bool init(size_t), void clear().
+/// When a producer thread exits, its cache is adopted by the next new producer thread, so thread churn doesn't grow the pool.
+template<class T, class FIFOQueue, class PoolT = ftl::ObjectPool<PooledChanSlot<T>>>
 struct PooledChan
 {
     using Msg = T;
     using Pool = PoolT;
+    using Slot = PooledChanSlot<T>;
 
     struct Deleter
     {
-        PooledChan &del;
+        PooledChan *pChan = nullptr;
 
         void operator()( T *p )
         {
-            if ( p )
-            {
-                p->~T();
-                del.Release( p );
-            }
+            pChan->release( p );
         }
     };
     using MsgPtr = std::unique_ptr<T, Deleter>;
+    /// \brief pointer-sized handle of a T derived from intrusive_ref_counter<T>, see create_intrusive().
+    using MsgRef = intrusive_ptr<T>;
 
     /// \brief default construct but not inited. init() must be called before in use.
     PooledChan() = default;
 
     /// @param queSize Buffer/Queue size.
     /// @param initialAllocates preallocated count of objects.
-    PooledChan( size_t queSize, size_t initialAllocates ) : m_queue( queSize ), m_pool( initialAllocates )
+    PooledChan( size_t queSize, size_t initialAllocates ) : m_pool( initialAllocates ), m_queue( queSize )
     {
     }
 
+    PooledChan( const PooledChan & ) = delete;
+    PooledChan &operator=( const PooledChan & ) = delete;
+
+    /// \brief return cached objects to pool, so that only objects never released stay allocated, eg. reported as leaks by PoolDebugger.
+    ~PooledChan()
+    {
+        m_caches.for_each( [this]( ProducerCache &cache ) { cache.drain( m_pool ); } );
+    }
+
     bool init( size_t queSize, size_t initialAllocates )
     {
         return m_queue.init( queSize ) && m_pool.init( initialAllocates );
     }
 
-    /// \brief create an object to send.
+    /// \brief create an object to send. Called by producer threads.
+    /// \return nullptr if pool is exhausted.
     template<class... Args>
     T *create( Args &&... args )
     {
-        return m_pool.create( std::forward<Args>( args )... );
+        auto pSlot = local_cache().allocate( m_pool );
+        if ( !pSlot )
+            return nullptr;
+        return new ( &pSlot->obj ) T( std::forward<Args>( args )... );
+    }
+
+    template<class... Args>
+    MsgPtr create_unique( Args &&... args )
+    {
+        return MsgPtr( create( std::forward<Args>( args )... ), Deleter{this} );
     }
 
+    /// \brief create a T derived from intrusive_ref_counter<T>, which is released to this chan when the last reference is gone.
+    /// The reference is handed over to the consumer by send() and recv_intrusive(), so a non-atomic counter is enough unless
+    /// references are shared by threads.
     template<class... Args>
-    std::unique_ptr<T, Deleter> create_unique( Args &&... args )
+    MsgRef create_intrusive( Args &&... args )
     {
-        return std::unique_ptr<T, Deleter>( m_pool.create( std::forward<Args>( args )... ), Deleter{*this} );
+        auto p = create( std::forward<Args>( args )... );
+        if ( !p )
+            return nullptr;
+        p->set_recycler( []( void *pChan, T *p ) { static_cast<PooledChan *>( pChan )->release( p ); }, this );
+        return MsgRef( p );
     }
 
     /// Buffers must be sent in the order of allocation.
     bool send( T *p )
     {
-        return p ? m_queue.push( p ) : false;
+        if ( !p || !m_queue.push( p ) )
+            return false;
+        if ( auto pNotifier = m_pNotifier.load( std::memory_order_acquire ) )
+            pNotifier->notify();
+        return true;
     }
 
-    bool send( std::unique_ptr<T, Deleter> p )
+    bool send( MsgPtr p )
     {
-        auto ret = p ? m_queue.push( p.get() ) : false;
-        p.release();
+        auto ret = send( p.get() );
+        if ( ret )
+            p.release();
+        return ret;
+    }
+
+    /// \pre p is the only reference.
+    bool send( MsgRef p )
+    {
+        assert( !p || p->use_count() == 1 );
+        auto ret = send( p.get() );
+        if ( ret )
+            p.detach();
         return ret;
     }
 
@@ -137,31 +265,40 @@ struct PooledChan
     template<bool IsSingleConsumer = !FIFOQueue::support_multiple_consumer_threads>
     std::enable_if_t<IsSingleConsumer, T *> peek()
     {
-        return m_queue.top();
+        auto pp = m_queue.top();
+        return pp ? *pp : nullptr;
     }
 
     /// \brief recv an object that must be released.
     T *recv()
     {
         T *res;
-        if ( m_queue.pop( res ) )
+        if ( m_queue.pop( &res ) )
             return res;
         return nullptr;
     }
 
     /// \brief recv a unique_ptr that auto releases object to pool.
-    std::unique_ptr<T, Deleter> recv_unique()
+    MsgPtr recv_unique()
     {
-        return std::unique_ptr<T, Deleter>( recv(), Deleter{*this} );
+        return MsgPtr( recv(), Deleter{this} );
     }
 
+    /// \brief recv an object created by create_intrusive().
+    MsgRef recv_intrusive()
+    {
+        return MsgRef( recv(), false );
+    }
+
+    /// \brief destroy object and return it to the cache of its producer. Can be called by any thread.
     /// \param p previously obtained by calling recv or peek.
     void release( T *p )
     {
         if ( !p )
             return;
         p->~T();
-        m_pool.deallocate( p );
+        auto pSlot = reinterpret_cast<Slot *>( p );
+        static_cast<ProducerCache *>( pSlot->pOwner )->give_back( pSlot );
     }
 
     /// \brief test whether queue is empty.
@@ -170,6 +307,19 @@ struct PooledChan
         return m_queue.empty();
     }
 
+    /// \brief set by ChanSelector. A chan can be watched by only one selector.
+    void set_notifier( ChanNotifier *pNotifier )
+    {
+        m_pNotifier.store( pNotifier, std::memory_order_release );
+    }
+
+    /// \brief number of objects allocated from pool, including objects cached by producers.
+    /// It does not change in steady state.
+    size_t pool_allocated_size() const
+    {
+        return m_pool.allocated_size();
+    }
+
     /// \brief non-thread-safe clear the queue and return all queued objects to pool.
     void clear_queue()
     {
@@ -181,19 +331,78 @@ struct PooledChan
     void clear()
     {
         clear_queue();
+        m_caches.for_each( []( ProducerCache &cache ) { cache.reset(); } );
         m_pool.clear();
     }
 
+protected:
+    /// \brief per-producer-thread cache.
+    struct ProducerCache
+    {
+        alignas( 64 ) std::atomic<Slot *> returned{nullptr}; // pushed by consumers.
+        alignas( 64 ) Slot *freeList = nullptr; // accessed only by the producer.
+        std::atomic<bool> adopted{true}; // false after the producer thread exits.
+
+        Slot *allocate( Pool &pool )
+        {
+            if ( !freeList )
+                freeList = returned.exchange( nullptr, std::memory_order_acquire ); // take all, no ABA.
+            if ( auto pSlot = freeList )
+            {
+                freeList = pSlot->pNext;
+                return pSlot;
+            }
+            auto pSlot = reinterpret_cast<Slot *>( pool.allocate() );
+            if ( pSlot )
+                pSlot->pOwner = this;
+            return pSlot;
+        }
+
+        void give_back( Slot *pSlot )
+        {
+            auto pHead = returned.load( std::memory_order_relaxed );
+            do
+            {
+                pSlot->pNext = pHead;
+            } while ( !returned.compare_exchange_weak( pHead, pSlot, std::memory_order_release, std::memory_order_relaxed ) );
+        }
+
+        void reset()
+        {
+            freeList = nullptr;
+            returned = nullptr;
+        }
+
+        void drain( Pool &pool )
+        {
+            for ( auto pList : {freeList, returned.exchange( nullptr )} )
+                for ( auto pSlot = pList; pSlot; )
+                {
+                    auto pNext = pSlot->pNext;
+                    pool.deallocate( pSlot );
+                    pSlot = pNext;
+                }
+            freeList = nullptr;
+        }
+    };
+
+    ProducerCache &local_cache()
+    {
+        return m_caches.local();
+    }
+
 protected:
     Pool m_pool;
     FIFOQueue m_queue;
+    std::atomic<ChanNotifier *> m_pNotifier{nullptr}; // set by a selector on its own thread while producers send.
+    ThreadCacheRegistry<ProducerCache> m_caches;
 };
 
 template<class T>
-using SPMCPooledChan = PooledChan<T, ftl::SPMCBoundedQueue<T>>;
+using SPMCPooledChan = PooledChan<T, ftl::SPMCBoundedQueue<T *>>;
 
 template<class T>
-using MPSCPooledChan = PooledChan<T, ftl::MPSCBoundedQueue<T>>;
+using MPSCPooledChan = PooledChan<T, ftl::MPSCBoundedQueue<T *>>;
 
 /// \brief Objects are sent in the same order of object creation.
 template<class T>
@@ -0,0 +1,234 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <ftl/chan.h>
+
+#include <chrono>
+#include <vector>
+#include <sys/epoll.h>
+
+namespace ftl
+{
+
+enum class SelectPolicy
+{
+    Fair, // round robin: scanning starts after the last selected source.
+    Priority // sources added earlier are always preferred.
+};
+
+/// \brief ChanSelector waits on a set of Chan/PooledChan and file descriptors (eg. sockets) like Go's select.
+/// All chans share one eventfd wakeup, so an idle consumer sleeps in epoll_wait instead of spinning over chans.
+///
+/// Usage:
+///     ChanSelector sel;
+///     auto iA = sel.add( chanA ), iB = sel.add( chanB ), iSock = sel.add_fd( sockfd );
+///     for ( int idx; ( idx = sel.select( 100 ) ) >= 0; )
+///         if ( idx == iA ) chanA.recv( &obj ); ...
+///
+/// \note select() must be called by a single consumer thread. A selected chan is only a hint of readiness: recv() may still fail when
+/// other consumers of a multi-consumer chan win the race. A chan can be watched by only one selector.
+class ChanSelector
+{
+protected:
+    struct Source
+    {
+        void *pChan = nullptr;
+        bool ( *pfnReady )( const void * ) = nullptr;
+        void ( *pfnDetach )( void * ) = nullptr;
+        int fd = -1; // >= 0 for fd source.
+        bool fdReady = false;
+    };
+
+    constexpr static std::uint64_t NOTIFIER_TOKEN = ~std::uint64_t( 0 );
+
+    ChanNotifier m_notifier;
+    int m_epollFd = -1;
+    std::vector<Source> m_sources;
+    std::size_t m_nFds = 0;
+    std::size_t m_nextIdx = 0; // next scan start for SelectPolicy::Fair.
+    SelectPolicy m_policy;
+
+public:
+    ChanSelector( SelectPolicy policy = SelectPolicy::Fair ) : m_epollFd( epoll_create1( EPOLL_CLOEXEC ) ), m_policy( policy )
+    {
+        epoll_event evt{};
+        evt.events = EPOLLIN;
+        evt.data.u64 = NOTIFIER_TOKEN;
+        epoll_ctl( m_epollFd, EPOLL_CTL_ADD, m_notifier.fd(), &evt );
+    }
+    ChanSelector( const ChanSelector & ) = delete;
+    ChanSelector &operator=( const ChanSelector & ) = delete;
+
+    ~ChanSelector()
+    {
+        for ( auto &src : m_sources )
+            if ( src.pfnDetach )
+                src.pfnDetach( src.pChan ); // chans may outlive selector.
+        if ( m_epollFd >= 0 )
+            ::close( m_epollFd );
+    }
+
+    bool inited() const
+    {
+        return m_epollFd >= 0 && m_notifier.fd() >= 0;
+    }
+
+    /// \brief watch a Chan or PooledChan.
+    /// \return source index returned by select().
+    template<class ChanT>
+    int add( ChanT &chan )
+    {
+        chan.set_notifier( &m_notifier );
+        Source src;
+        src.pChan = &chan;
+        src.pfnReady = []( const void *p ) { return !static_cast<const ChanT *>( p )->empty(); };
+        src.pfnDetach = []( void *p ) { static_cast<ChanT *>( p )->set_notifier( nullptr ); };
+        m_sources.push_back( src );
+        return int( m_sources.size() - 1 );
+    }
+
+    /// \brief stop watching chan. Must be called before chan is destroyed if the selector lives longer.
+    template<class ChanT>
+    void remove( ChanT &chan )
+    {
+        for ( auto &src : m_sources )
+            if ( src.pChan == &chan )
+            {
+                chan.set_notifier( nullptr );
+                src = Source{};
+            }
+    }
+
+    /// \brief watch a file descriptor, eg. a socket or an EpollThread-managed fd.
+    /// \param events epoll events, EPOLLIN by default. The fd is level-triggered.
+    /// \return source index returned by select(). -1 for error.
+    int add_fd( int fd, std::uint32_t events = EPOLLIN )
+    {
+        epoll_event evt{};
+        evt.events = events;
+        evt.data.u64 = m_sources.size();
+        if ( epoll_ctl( m_epollFd, EPOLL_CTL_ADD, fd, &evt ) )
+            return -1;
+        Source src;
+        src.fd = fd;
+        m_sources.push_back( src );
+        ++m_nFds;
+        return int( m_sources.size() - 1 );
+    }
+
+    bool remove_fd( int fd )
+    {
+        for ( auto &src : m_sources )
+            if ( src.fd == fd )
+            {
+                src.fd = -1;
+                src.fdReady = false;
+                --m_nFds;
+                return 0 == epoll_ctl( m_epollFd, EPOLL_CTL_DEL, fd, nullptr );
+            }
+        return false;
+    }
+
+    std::size_t size() const
+    {
+        return m_sources.size();
+    }
+
+    /// \brief non-blocking check.
+    /// \return index of a ready source or -1.
+    int try_select()
+    {
+        if ( m_nFds )
+            poll_fds( 0 );
+        return scan();
+    }
+
+    /// \brief block until a source is ready.
+    /// \param timeoutMillisec -1 to wait forever.
+    /// \return index of a ready source, or -1 when timeout.
+    int select( int timeoutMillisec = -1 )
+    {
+        using Clock = std::chrono::steady_clock;
+        const auto deadline = Clock::now() + std::chrono::milliseconds( timeoutMillisec );
+        for ( ;; )
+        {
+            int idx = try_select();
+            if ( idx >= 0 )
+                return idx;
+
+            m_notifier.begin_wait();
+            idx = scan(); // re-check after announcing waiter, otherwise a notify() may be lost.
+            if ( idx < 0 )
+            {
+                int waitMillisec = -1;
+                if ( timeoutMillisec >= 0 )
+                    waitMillisec = int( std::max<std::int64_t>(
+                            0, std::chrono::duration_cast<std::chrono::milliseconds>( deadline - Clock::now() ).count() ) );
+                const bool notified = poll_fds( waitMillisec );
+                if ( !notified && timeoutMillisec >= 0 && Clock::now() >= deadline )
+                {
+                    m_notifier.end_wait();
+                    return scan();
+                }
+            }
+            m_notifier.end_wait();
+            if ( idx >= 0 )
+                return idx;
+        }
+    }
+
+protected:
+    /// \return true if any event (notification or fd) is received.
+    bool poll_fds( int timeoutMillisec )
+    {
+        constexpr int MAX_EVENTS = 16;
+        epoll_event events[MAX_EVENTS];
+        int n = epoll_wait( m_epollFd, events, MAX_EVENTS, timeoutMillisec );
+        for ( int i = 0; i < n; ++i )
+        {
+            if ( events[i].data.u64 != NOTIFIER_TOKEN )
+                m_sources[events[i].data.u64].fdReady = true;
+        }
+        return n > 0;
+    }
+
+    /// \brief scan sources in policy order. A ready fd is consumed from the ready set when it's selected.
+    int scan()
+    {
+        const auto n = m_sources.size();
+        const auto start = m_policy == SelectPolicy::Fair ? m_nextIdx : 0;
+        for ( std::size_t k = 0; k < n; ++k )
+        {
+            auto idx = start + k;
+            if ( idx >= n )
+                idx -= n;
+            auto &src = m_sources[idx];
+            bool ready = src.pfnReady ? src.pfnReady( src.pChan ) : src.fdReady;
+            if ( ready )
+            {
+                src.fdReady = false;
+                m_nextIdx = idx + 1 == n ? 0 : idx + 1;
+                return int( idx );
+            }
+        }
+        return -1;
+    }
+};
+
+} // namespace ftl
@@ -1,16 +1,45 @@
 #pragma once
 #include <ftl/alloc_common.h>
+#include <ftl/sys_alloc.h>
 
 namespace ftl
 {
 
+/// @brief grow by the accumulated size, ie. total size doubles. The first chunk has initGrowValue slots.
+class DoubleAccumulatedGrowthPolicy
+{
+public:
+    DoubleAccumulatedGrowthPolicy( size_t initGrowValue = 0 ) : m_growValue( initGrowValue ? initGrowValue : 1 )
+    {
+    }
+
+    // @return min number of slots of next chunk.
+    size_t grow_to( size_t totalSize ) const
+    {
+        return totalSize ? totalSize : m_growValue;
+    }
+
+    size_t &get_grow_value()
+    {
+        return m_growValue;
+    }
+    size_t get_grow_value() const
+    {
+        return m_growValue;
+    }
+
+protected:
+    size_t m_growValue;
+};
+
 // The cache line size is 64 bytes (on modern intel x86_64 processors), but we use 128 bytes to avoid false sharing because the
 // prefetcher may read two cache lines.  See section 2.1.5.4 of the intel manual:
 // http://www.intel.com/content/dam/doc/manual/64-ia-32-architectures-optimization-manual.pdf
 // This is also the value intel uses in TBB to avoid false sharing:
 // https://www.threadingbuildingblocks.org/docs/help/reference/memory_allocation/cache_aligned_allocator_cls.htm
 // FALSE_SHARING_SIZE 128
-template<class T, class GrowthPolicy = DoubleAccumulatedGrowthPolicy, size_t Align = 128>
+// AlignedAlloc: eg. LatencyCriticalAlignedAlloc<> to prefault and lock chunks.
+template<class T, class GrowthPolicy = DoubleAccumulatedGrowthPolicy, size_t Align = 128, class AlignedAlloc = StdAlignedAlloc>
 class ChunkAllocator : protected GrowthPolicy
 {
     // memory layout : ChunckInfo| slot1 | slot2 | ... |
@@ -33,10 +62,12 @@ class ChunkAllocator : protected GrowthPolicy
         ChunkInfo *m_pNext = nullptr;
         unsigned m_cap = 0; // total slots
         unsigned m_size = 0; // used slots
+        size_t m_bytes = 0; // chunk size
 
-        void init( unsigned cap )
+        void init( unsigned cap, size_t bytes )
         {
             m_cap = cap;
+            m_bytes = bytes;
             m_size = 0;
             m_pNext = nullptr;
         }
@@ -83,10 +114,10 @@ class ChunkAllocator : protected GrowthPolicy
         assert( minSlots );
         size_t nbytes = ChunkInfoSize + SlotSize * minSlots;
         nbytes = align_up( nbytes, BoundarySize );
-        auto pChunk = static_cast<ChunkInfo *>( std::aligned_alloc( Align, nbytes ) );
+        auto pChunk = static_cast<ChunkInfo *>( AlignedAlloc::aligned_alloc( Align, nbytes ) );
         if ( pChunk )
         {
-            pChunk->init( ( nbytes - ChunkInfoSize ) / SlotSize );
+            pChunk->init( ( nbytes - ChunkInfoSize ) / SlotSize, nbytes );
         }
         // std::cout << "alloc addr: " << pChunk << ", slots:" << pChunk->m_cap << ", bytes:" << nbytes << std::endl;
         assert( pChunk );
@@ -128,6 +159,20 @@ public:
         for ( auto pChunk = m_pChunkList; pChunk; pChunk = pChunk->m_pNext )
             pChunk->clear();
     }
+    /// @brief release all chunks but the newest (largest) one to OS.
+    /// @pre all slots are recycled by clear().
+    void trim()
+    {
+        if ( !m_pChunkList )
+            return;
+        auto pKeep = m_pChunkList;
+        m_pChunkList = pKeep->m_pNext;
+        destroy();
+        pKeep->m_pNext = nullptr;
+        m_pChunkList = pKeep;
+        m_totalSlots = pKeep->m_cap;
+    }
+
     // destroy all, but no deallocate provided.
     void destroy()
     {
@@ -136,7 +181,7 @@ public:
             auto p = m_pChunkList;
             m_pChunkList = m_pChunkList->m_pNext;
             // std::cout << "free addr:" << p << ", slots:" << p->m_cap << std::endl;
-            std::free( p );
+            AlignedAlloc::free( p, p->m_bytes );
         }
         m_totalSlots = 0;
     }
@@ -16,9 +16,21 @@
  */
 
 #pragma once
+#include <ftl/alloc_common.h>
+#include <ftl/vector.h> // relocate
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
 #include <exception>
-#include <ftl/intrusive_list.h>
+#include <iterator>
 #include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace ftl
 {
@@ -80,357 +92,737 @@ struct inline_stack_allocator
     char *mCurr = nullptr; // points to free memory
 };
 
-template<typename T, typename ObjectAlloc = std::allocator<T>>
-class circular_queue
-{
-protected:
-    size_t mCapacity = 0;
-    ObjectAlloc mAlloc;
-    T *mBuf = nullptr;
-    T *pFront = nullptr; // points to first available
-    T *pEnd = nullptr; // points to free memory block
-    size_t mSize = 0;
 
-public:
-    using this_type = circular_queue;
+namespace internal
+{
+    /// \brief a field of circular_queue which snapshot readers load concurrently with the owner thread.
+    template<class T>
+    struct RelaxedAtomic
+    {
+        std::atomic<T> m_v;
 
-    //- iterator support
+        RelaxedAtomic( T v = T() ) : m_v( v )
+        {
+        }
+        RelaxedAtomic &operator=( const RelaxedAtomic &a )
+        {
+            return *this = T( a );
+        }
+        operator T() const
+        {
+            return m_v.load( std::memory_order_relaxed );
+        }
+        RelaxedAtomic &operator=( T v )
+        {
+            m_v.store( v, std::memory_order_relaxed );
+            return *this;
+        }
+    };
 
-    using value_type = T;
-    using node_type = T *;
+    /// \brief seqlock of circular_queue. Writes of the owner thread are odd sequences, a snapshot is valid if the sequence was even and
+    /// unchanged across the copy. Buffers replaced by growth are retired instead of freed, as a reader may still copy from them.
+    template<class T, bool Enabled>
+    struct RingSeqLock
+    {
+        template<class U>
+        using field_type = RelaxedAtomic<U>;
 
-    using iterator = gen_iterator<this_type, false>;
-    using const_iterator = gen_iterator<this_type, true>;
+        std::atomic<size_t> m_seq{0};
+        std::vector<std::pair<T *, size_t>> m_retired;
 
-    bool is_end( const node_type &n ) const
+        void write_begin()
+        {
+            m_seq.store( m_seq.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_release );
+        }
+        void write_end()
+        {
+            m_seq.store( m_seq.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+        }
+        /// \brief fence between publishing a buffer and its capacity.
+        void publish_fence()
+        {
+            std::atomic_thread_fence( std::memory_order_release );
+        }
+        size_t read_begin() const
+        {
+            size_t seq;
+            while ( ( seq = m_seq.load( std::memory_order_acquire ) ) & 1 )
+                std::this_thread::yield();
+            return seq;
+        }
+        bool read_validate( size_t seq ) const
+        {
+            std::atomic_thread_fence( std::memory_order_acquire );
+            return m_seq.load( std::memory_order_relaxed ) == seq;
+        }
+        template<class Alloc>
+        void retire( Alloc &, T *p, size_t n )
+        {
+            m_retired.emplace_back( p, n );
+        }
+        template<class Alloc>
+        void free_retired( Alloc &alloc )
+        {
+            for ( auto &pn : m_retired )
+                alloc.deallocate( pn.first, pn.second );
+            m_retired.clear();
+        }
+    };
+    template<class T>
+    struct RingSeqLock<T, false>
     {
-        return !n;
-    }
-    bool next( node_type &n ) const
+        template<class U>
+        using field_type = U;
+
+        void write_begin()
+        {
+        }
+        void write_end()
+        {
+        }
+        void publish_fence()
+        {
+        }
+        template<class Alloc>
+        void retire( Alloc &alloc, T *p, size_t n )
+        {
+            alloc.deallocate( p, n );
+        }
+        template<class Alloc>
+        void free_retired( Alloc & )
+        {
+        }
+    };
+
+    inline constexpr size_t ceil_pow2( size_t n )
     {
-        if ( !n )
-            return false;
-        n = inc( n );
-        if ( n == pEnd || n == pFront ) // the end
-            n = node_type();
-        return true;
+        size_t r = 1;
+        while ( r < n )
+            r *= 2;
+        return r;
     }
-    bool prev( node_type &n ) const
+
+    template<class T, size_t N>
+    struct InlineRingBuffer
     {
-        if ( !n )
-            return false;
-        n = dec( n );
-        if ( n == pEnd || n == pFront ) // the end
-            n = node_type();
-        return true;
-    }
-    value_type *get_value( const node_type &n ) const
+        static_assert( is_pow2( N ) );
+        alignas( T ) char m_inlineBuf[sizeof( T ) * N];
+
+        T *inline_buffer()
+        {
+            return reinterpret_cast<T *>( m_inlineBuf );
+        }
+    };
+} // namespace internal
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief circular_queue is a deque-like ring buffer. The capacity is a power of 2, so positions wrap by masking. When full, it grows by
+/// doubling and relocates the elements once into the front of the new buffer (memcpy for trivially relocatable T).
+/// Bulk push_back( first, last ) and pop_front( out, n ) copy at most 2 contiguous segments, by memcpy for trivially copyable T.
+/// \tparam ReadSnapshot enable snapshot(), which copies the elements in another thread under a seqlock while the owner thread modifies
+/// the queue. T must be trivially copyable. The writes pay for the sequence updates, and buffers replaced by growth are kept until
+/// destruction. The queue must outlive the readers, and must not be moved or assigned while they read.
+template<typename T, typename ObjectAlloc = std::allocator<T>, bool ReadSnapshot = false>
+class circular_queue : protected internal::RingSeqLock<T, ReadSnapshot>
+{
+    static_assert( !ReadSnapshot || std::is_trivially_copyable_v<T>, "snapshot readers copy elements with memcpy" );
+
+protected:
+    using seq_base = internal::RingSeqLock<T, ReadSnapshot>;
+    template<class U>
+    using field_type = typename seq_base::template field_type<U>;
+
+    struct WriteGuard
     {
-        return n;
-    }
+        seq_base &seq;
+
+        explicit WriteGuard( seq_base &s ) : seq( s )
+        {
+            seq.write_begin();
+        }
+        ~WriteGuard()
+        {
+            seq.write_end();
+        }
+    };
+
+    ObjectAlloc mAlloc;
+    field_type<T *> mBuf = nullptr;
+    field_type<size_t> mCapacity = 0; // 0 or a power of 2.
+    field_type<size_t> mFront = 0; // position of the front in mBuf.
+    field_type<size_t> mSize = 0;
+    T *const mInlineBuf = nullptr; // not owned, eg. of inline_circular_queue.
+    const size_t mInlineCapacity = 0;
+
+    template<bool IsConst>
+    class iterator_
+    {
+        using queue_type = std::conditional_t<IsConst, const circular_queue, circular_queue>;
+        template<bool>
+        friend class iterator_;
+
+        queue_type *m_q = nullptr;
+        size_t m_i = 0; // index from the front.
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<IsConst, const T *, T *>;
+        using reference = std::conditional_t<IsConst, const T &, T &>;
+
+        iterator_() = default;
+        iterator_( queue_type *q, size_t i ) : m_q( q ), m_i( i )
+        {
+        }
+        template<bool C = IsConst, class = std::enable_if_t<C>>
+        iterator_( const iterator_<false> &a ) : m_q( a.m_q ), m_i( a.m_i )
+        {
+        }
+
+        reference operator*() const
+        {
+            return ( *m_q )[m_i];
+        }
+        pointer operator->() const
+        {
+            return &( *m_q )[m_i];
+        }
+        reference operator[]( difference_type n ) const
+        {
+            return ( *m_q )[m_i + n];
+        }
+        iterator_ &operator++()
+        {
+            ++m_i;
+            return *this;
+        }
+        iterator_ &operator--()
+        {
+            --m_i;
+            return *this;
+        }
+        iterator_ operator++( int )
+        {
+            auto r = *this;
+            ++m_i;
+            return r;
+        }
+        iterator_ operator--( int )
+        {
+            auto r = *this;
+            --m_i;
+            return r;
+        }
+        iterator_ &operator+=( difference_type n )
+        {
+            m_i += n;
+            return *this;
+        }
+        iterator_ &operator-=( difference_type n )
+        {
+            m_i -= n;
+            return *this;
+        }
+        iterator_ operator+( difference_type n ) const
+        {
+            return {m_q, m_i + n};
+        }
+        iterator_ operator-( difference_type n ) const
+        {
+            return {m_q, m_i - n};
+        }
+        difference_type operator-( const iterator_ &a ) const
+        {
+            return difference_type( m_i ) - difference_type( a.m_i );
+        }
+        bool operator==( const iterator_ &a ) const
+        {
+            return m_i == a.m_i;
+        }
+        bool operator!=( const iterator_ &a ) const
+        {
+            return m_i != a.m_i;
+        }
+        bool operator<( const iterator_ &a ) const
+        {
+            return m_i < a.m_i;
+        }
+        bool operator>( const iterator_ &a ) const
+        {
+            return m_i > a.m_i;
+        }
+        bool operator<=( const iterator_ &a ) const
+        {
+            return m_i <= a.m_i;
+        }
+        bool operator>=( const iterator_ &a ) const
+        {
+            return m_i >= a.m_i;
+        }
+    };
+
+public:
+    using this_type = circular_queue;
+    using value_type = T;
+    using size_type = size_t;
+    using iterator = iterator_<false>;
+    using const_iterator = iterator_<true>;
 
-    //--
     iterator begin()
     {
-        if ( empty() )
-            return iterator();
-        return iterator( pFront, this );
+        return {this, 0};
     }
     iterator end()
     {
-        return iterator();
+        return {this, mSize};
     }
-
     const_iterator begin() const
     {
         return cbegin();
     }
     const_iterator end() const
     {
-        return const_iterator();
+        return cend();
     }
     const_iterator cbegin() const
     {
-        if ( empty() )
-            return const_iterator();
-        return const_iterator( pFront, this );
+        return {this, 0};
     }
     const_iterator cend() const
     {
-        return const_iterator();
+        return {this, mSize};
     }
 
     T &operator[]( size_t i )
     {
         assert( i < mSize );
-        return *inc( pFront, i );
+        return *slot( i );
     }
     const T &operator[]( size_t i ) const
     {
         assert( i < mSize );
-        return *inc( pFront, i );
+        return *slot( i );
     }
 
 public:
-    circular_queue( size_t cap = 0, const ObjectAlloc &alloc = ObjectAlloc() )
-        : mCapacity( cap ),
-          mAlloc( alloc ),
-          mBuf( mCapacity ? mAlloc.allocate( mCapacity, nullptr ) : nullptr ),
-          pFront( mBuf ),
-          pEnd( mBuf ),
-          mSize( 0 )
-    {
-        if ( mCapacity > 0 && !mBuf )
+    /// \param cap initial capacity, rounded up to a power of 2.
+    explicit circular_queue( size_t cap = 0, const ObjectAlloc &alloc = ObjectAlloc() ) : mAlloc( alloc )
+    {
+        if ( cap && !reserve( cap ) )
             throw std::bad_alloc();
     }
-    circular_queue( circular_queue &&a ) : mCapacity( a.mCapacity ), mAlloc( std::move( a.mAlloc ) )
+    circular_queue( circular_queue &&a ) : seq_base(), mAlloc( a.mAlloc )
     {
-        mBuf = a.mBuf;
-        pFront = a.pFront;
-        pEnd = a.pEnd;
-        mSize = a.mSize;
-
-        a.mBuf = nullptr;
-        a.pFront = nullptr;
-        a.pEnd = nullptr;
-        a.mSize = 0;
+        *this = std::move( a );
     }
-    // exactly clone
-    circular_queue( const circular_queue &a )
-        : mCapacity( a.mCapacity ), mAlloc( a.mAlloc ), mBuf( mCapacity ? nullptr : mAlloc.allocate( mCapacity, nullptr ) )
+    circular_queue( const circular_queue &a ) : seq_base(), mAlloc( a.mAlloc )
     {
-        pFront = mBuf + ( a.pFront - a.mBuf );
-        pEnd = mBuf + ( a.pEnd - a.mBuf );
-        mSize = a.mSize;
-        for ( auto p = pFront, q = a.pFront; q != a.pEnd; ( p = inc( p ) ), ( q = q.inc( q ) ) )
-        {
-            new ( p ) T( *q );
-        }
+        if ( push_back( a.begin(), a.end() ) != a.size() )
+            throw std::bad_alloc();
     }
-    // copy contents, with mSize capacity
+    // copy contents, keeping the capacity.
     circular_queue &operator=( const circular_queue &a )
     {
-        clear();
-        reserve( a.size() );
-        mSize = a.size();
-        pFront = mBuf;
-        pEnd = mBuf + mSize;
-        for ( auto p = pFront, q = a.pFront; q != a.pEnd; ( p = inc( p ) ), ( q = a.inc( q ) ) )
+        if ( this != &a )
         {
-            new ( p ) T( *q );
+            clear();
+            if ( push_back( a.begin(), a.end() ) != a.size() )
+                throw std::bad_alloc();
         }
         return *this;
     }
-
+    /// \brief take the buffer of a, or relocate the elements if a keeps them inline.
     circular_queue &operator=( circular_queue &&a )
     {
-        ~circular_queue();
-        //        mAlloc = std::move(a.mAlloc);
-        mBuf = a.mBuf;
-        pFront = a.pFront;
-        pEnd = a.pEnd;
-        mSize = a.mSize;
-
-        a.mBuf = nullptr;
-        a.pFront = nullptr;
-        a.pEnd = nullptr;
-        a.mSize = 0;
+        if ( this == &a )
+            return *this;
+        clear();
+        if ( a.mBuf != a.mInlineBuf )
+        {
+            WriteGuard guard( *this ), guardA( a );
+            release( mBuf, mCapacity );
+            mBuf = a.mBuf;
+            this->publish_fence();
+            mCapacity = a.mCapacity;
+            mFront = a.mFront;
+            mSize = a.mSize;
+            a.mBuf = a.mInlineBuf;
+            a.mCapacity = a.mInlineCapacity;
+            a.mFront = 0;
+            a.mSize = 0;
+        }
+        else
+        {
+            if ( !reserve( a.mSize ) )
+                throw std::bad_alloc();
+            WriteGuard guard( *this ), guardA( a );
+            T *p = mBuf;
+            a.for_each_segment( 0, a.mSize, [&]( T *pSeg, size_t n ) {
+                relocate( pSeg, n, p );
+                p += n;
+            } );
+            mSize = a.mSize;
+            a.mFront = 0;
+            a.mSize = 0;
+        }
+        return *this;
     }
 
     ~circular_queue()
     {
         clear();
-        if ( mBuf )
-            mAlloc.deallocate( mBuf, mCapacity );
-        mBuf = nullptr;
+        release( mBuf, mCapacity );
+        this->free_retired( mAlloc );
     }
 
+    /// \brief grow the capacity to a power of 2 no less than cap, relocating the elements once to the front of the new buffer.
+    /// \return false if the allocator returns nullptr.
     bool reserve( size_t cap )
     {
         if ( cap <= mCapacity )
             return true;
-        auto size = mSize;
-        auto newBuf = mAlloc.allocate( mCapacity, nullptr );
-        if ( !newBuf )
+        size_t newCap = mCapacity ? mCapacity * 2 : 8;
+        while ( newCap < cap )
+            newCap *= 2;
+        T *pNew = mAlloc.allocate( newCap );
+        if ( !pNew )
             return false;
 
-        for ( auto p = newBuf, q = pFront; q != pEnd; ++p, ( q = inc( q ) ) )
-        {
-            new ( p ) T( *q );
-        }
-        ~circular_queue();
-        mCapacity = cap;
-        mBuf = newBuf;
-        pFront = mBuf;
-        pEnd = pFront + size;
-        mSize = size;
+        WriteGuard guard( *this );
+        T *pOld = mBuf, *p = pNew;
+        const size_t oldCap = mCapacity;
+        for_each_segment( 0, mSize, [&]( T *pSeg, size_t n ) {
+            relocate( pSeg, n, p );
+            p += n;
+        } );
+        mBuf = pNew;
+        this->publish_fence(); // a reader which sees the new capacity sees the new buffer.
+        mCapacity = newCap;
+        mFront = 0;
+        release( pOld, oldCap );
         return true;
     }
 
     template<class... Args>
     T &emplace_back( Args &&... args )
     {
-        if ( full() )
-        {
+        if ( !try_emplace_back( std::forward<Args>( args )... ) )
             throw std::bad_alloc();
-        }
-        T *p = new ( static_cast<void *>( pEnd ) ) T( std::forward<Args>( args )... );
-
-        ++mSize;
-        pEnd = inc( pEnd );
-        return *p;
+        return back();
     }
     template<class... Args>
     T &emplace_front( Args &&... args )
     {
-        if ( full() )
-        {
+        if ( !try_emplace_front( std::forward<Args>( args )... ) )
             throw std::bad_alloc();
-        }
-        pFront = dec( pFront );
-        T *p = new ( static_cast<void *>( pFront ) ) T( std::forward<Args>( args )... );
-
-        ++mSize;
-        return *p;
+        return front();
     }
+    /// \return false if the queue is full and fails to grow.
     bool push_back( const T &v )
     {
-        if ( full() )
-            return false;
-        emplace_back( v );
-        return true;
+        return try_emplace_back( v );
+    }
+    bool push_back( T &&v )
+    {
+        return try_emplace_back( std::move( v ) );
     }
     bool push_front( const T &v )
     {
-        if ( full() )
-            return false;
-        emplace_front( v );
-        return true;
+        return try_emplace_front( v );
+    }
+    bool push_front( T &&v )
+    {
+        return try_emplace_front( std::move( v ) );
+    }
+
+    /// \brief append [first, last), growing once for forward iterators. A range of pointers to trivially copyable T is copied by at most 2
+    /// memcpy. \pre the range is not in this queue.
+    /// \return number of elements appended.
+    template<class Iter>
+    size_t push_back( Iter first, Iter last )
+    {
+        using category = typename std::iterator_traits<Iter>::iterator_category;
+        if constexpr ( std::is_base_of_v<std::forward_iterator_tag, category> )
+        {
+            const size_t n = size_t( std::distance( first, last ) );
+            if ( !reserve( mSize + n ) )
+                return 0;
+            WriteGuard guard( *this );
+            for_each_segment( mSize, n, [&]( T *p, size_t k ) {
+                if constexpr ( std::is_pointer_v<Iter> && std::is_same_v<std::remove_cv_t<std::remove_pointer_t<Iter>>, T>
+                               && std::is_trivially_copyable_v<T> )
+                {
+                    std::memcpy( static_cast<void *>( p ), first, k * sizeof( T ) );
+                    first += k;
+                    mSize = mSize + k;
+                }
+                else
+                {
+                    for ( auto pEnd = p + k; p != pEnd; ++p, ++first )
+                    {
+                        new ( static_cast<void *>( p ) ) T( *first );
+                        mSize = mSize + 1;
+                    }
+                }
+            } );
+            return n;
+        }
+        else
+        {
+            size_t n = 0;
+            for ( ; first != last && push_back( *first ); ++first )
+                ++n;
+            return n;
+        }
     }
 
     template<typename Iterator>
     size_t insert( Iterator it, Iterator end )
     {
-        size_t i = 0;
-        for ( ; it != end && push_back( *it ); ++i, ++it )
-            ;
-        return i;
+        return push_back( it, end );
     }
 
     bool pop_front()
     {
-        if ( empty() )
-            return false;
-        reinterpret_cast<T *>( pFront )->~T();
-
-        --mSize;
-        pFront = inc( pFront );
-        return true;
+        return pop_front( 1 ) == 1;
     }
-
     bool pop_back()
     {
         if ( empty() )
             return false;
-        pEnd = dec( pEnd );
-        reinterpret_cast<T *>( pEnd )->~T();
-
-        --mSize;
+        WriteGuard guard( *this );
+        slot( mSize - 1 )->~T();
+        mSize = mSize - 1;
         return true;
     }
+
+    /// \brief pop up to n elements from the front.
+    /// \return number of elements popped.
+    size_t pop_front( size_t n )
+    {
+        n = std::min<size_t>( n, mSize );
+        if ( !n )
+            return 0;
+        WriteGuard guard( *this );
+        if constexpr ( !std::is_trivially_destructible_v<T> )
+            for_each_segment( 0, n, []( T *p, size_t k ) {
+                for ( auto pEnd = p + k; p != pEnd; ++p )
+                    p->~T();
+            } );
+        mFront = ( mFront + n ) & ( mCapacity - 1 );
+        mSize = mSize - n;
+        return n;
+    }
+    /// \brief move up to n elements from the front to out, by memcpy for trivially copyable T.
+    /// \return number of elements popped.
+    size_t pop_front( T *out, size_t n )
+    {
+        n = std::min<size_t>( n, mSize );
+        for_each_segment( 0, n, [&]( T *p, size_t k ) {
+            if constexpr ( std::is_trivially_copyable_v<T> )
+                std::memcpy( static_cast<void *>( out ), p, k * sizeof( T ) );
+            else
+                std::move( p, p + k, out );
+            out += k;
+        } );
+        return pop_front( n );
+    }
+
     T &front()
     {
-        return *reinterpret_cast<T *>( pFront );
+        assert( !empty() );
+        return *slot( 0 );
+    }
+    const T &front() const
+    {
+        assert( !empty() );
+        return *slot( 0 );
     }
     T &back()
     {
-        return *reinterpret_cast<T *>( dec( pEnd ) );
+        assert( !empty() );
+        return *slot( mSize - 1 );
+    }
+    const T &back() const
+    {
+        assert( !empty() );
+        return *slot( mSize - 1 );
     }
     bool empty() const
     {
         return mSize == 0;
     }
-
+    /// \brief the next push grows the buffer.
     bool full() const
     {
         return mSize == mCapacity;
     }
     void clear()
     {
-        while ( !empty() )
-            pop_front();
+        pop_front( mSize );
+        mFront = 0;
     }
     size_t size() const
     {
         return mSize;
     }
+    size_t capacity() const
+    {
+        return mCapacity;
+    }
 
-public:
-    node_type inc( node_type p, size_t step = 1 ) const
+    /// \brief copy up to n elements from the front to out, in a reader thread while the owner thread may modify the queue.
+    /// It retries until no write overlaps the copy.
+    /// \return number of elements copied.
+    template<bool B = ReadSnapshot>
+    std::enable_if_t<B, size_t> snapshot( T *out, size_t n ) const
     {
-        p += step;
-        if ( p >= mBuf + mCapacity )
-            p -= mCapacity;
-        return p;
+        size_t nSize;
+        while ( !try_snapshot( out, n, nSize ) )
+            ;
+        return std::min( n, nSize );
     }
-    node_type dec( node_type p, size_t step = 1 ) const
+    /// \brief readonly copy of all elements, see snapshot( out, n ).
+    template<bool B = ReadSnapshot>
+    std::enable_if_t<B, std::vector<T>> snapshot() const
     {
-        p -= step;
-        if ( p < mBuf )
-            p += mCapacity;
-        return p;
+        std::vector<T> res;
+        for ( size_t nSize = mSize;; )
+        {
+            res.resize( nSize );
+            if ( try_snapshot( res.data(), res.size(), nSize ) && nSize <= res.size() )
+            {
+                res.resize( nSize );
+                return res;
+            }
+        }
     }
-    T *allocate()
+
+protected:
+    /// \brief a queue using the buffer pInline of capacity cap until it grows.
+    circular_queue( T *pInline, size_t cap, const ObjectAlloc &alloc )
+        : mAlloc( alloc ), mBuf( pInline ), mCapacity( cap ), mInlineBuf( pInline ), mInlineCapacity( cap )
     {
-        assert( !mBuf );
-        mBuf = mAlloc.allocate( mCapacity, nullptr );
-        pFront = mBuf;
-        pEnd = mBuf;
-        return reinterpret_cast<T *>( mBuf );
+        assert( is_pow2( cap ) );
+    }
+
+    T *slot( size_t i ) const
+    {
+        return mBuf + ( ( mFront + i ) & ( mCapacity - 1 ) );
+    }
+
+    /// \brief call f( p, k ) for the at most 2 contiguous segments of [i, i + n) from the front.
+    template<class F>
+    void for_each_segment( size_t i, size_t n, F &&f ) const
+    {
+        if ( !n )
+            return;
+        const size_t pos = ( mFront + i ) & ( mCapacity - 1 ), k = std::min<size_t>( n, mCapacity - pos );
+        f( mBuf + pos, k );
+        if ( k < n )
+            f( mBuf + 0, n - k );
+    }
+
+    void release( T *p, size_t cap )
+    {
+        if ( p && p != mInlineBuf )
+            this->retire( mAlloc, p, cap );
+    }
+
+    // args may reference an element, so construct it before relocating.
+    template<class... Args>
+    bool try_emplace_back( Args &&... args )
+    {
+        if ( mSize == mCapacity )
+        {
+            T v( std::forward<Args>( args )... );
+            if ( !reserve( mSize + 1 ) )
+                return false;
+            return try_emplace_back( std::move( v ) );
+        }
+        WriteGuard guard( *this );
+        new ( static_cast<void *>( slot( mSize ) ) ) T( std::forward<Args>( args )... );
+        mSize = mSize + 1;
+        return true;
+    }
+    template<class... Args>
+    bool try_emplace_front( Args &&... args )
+    {
+        if ( mSize == mCapacity )
+        {
+            T v( std::forward<Args>( args )... );
+            if ( !reserve( mSize + 1 ) )
+                return false;
+            return try_emplace_front( std::move( v ) );
+        }
+        WriteGuard guard( *this );
+        const size_t front = ( mFront - 1 ) & ( mCapacity - 1 );
+        new ( static_cast<void *>( mBuf + front ) ) T( std::forward<Args>( args )... );
+        mFront = front;
+        mSize = mSize + 1;
+        return true;
+    }
+
+    /// \return false if a write overlapped.
+    bool try_snapshot( T *out, size_t n, size_t &nSize ) const
+    {
+        const auto seq = this->read_begin();
+        const size_t cap = mCapacity;
+        std::atomic_thread_fence( std::memory_order_acquire ); // mBuf holds at least cap elements, see reserve().
+        const T *buf = mBuf;
+        // fields may be torn until validated, keep the copy in [buf, buf + cap).
+        nSize = std::min<size_t>( mSize, cap );
+        const size_t k = std::min( n, nSize );
+        if ( k )
+        {
+            const size_t pos = mFront & ( cap - 1 ), k1 = std::min( k, cap - pos );
+            std::memcpy( static_cast<void *>( out ), buf + pos, k1 * sizeof( T ) );
+            std::memcpy( static_cast<void *>( out + k1 ), buf, ( k - k1 ) * sizeof( T ) );
+        }
+        return this->read_validate( seq );
     }
 };
 
-template<class T, size_t N>
-struct inline_circular_queue : public circular_queue<T, inline_stack_allocator<T, N>>
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief circular_queue which keeps the first N (rounded up to a power of 2) elements inline, and moves them to the heap when it grows.
+template<class T, size_t N, class ObjectAlloc = std::allocator<T>>
+class inline_circular_queue : private internal::InlineRingBuffer<T, internal::ceil_pow2( N )>, public circular_queue<T, ObjectAlloc>
 {
+    using inline_base = internal::InlineRingBuffer<T, internal::ceil_pow2( N )>;
+
+public:
     using this_type = inline_circular_queue;
-    using base_type = circular_queue<T, inline_stack_allocator<T, N>>;
-
-    using base_type::back;
-    using base_type::begin;
-    using base_type::cbegin;
-    using base_type::cend;
-    using base_type::clear;
-    using base_type::emplace_back;
-    using base_type::emplace_front;
-    using base_type::empty;
-    using base_type::end;
-    using base_type::front;
-    using base_type::full;
-    using base_type::insert;
-    using base_type::push_back;
-    using base_type::push_front;
-    using base_type::reserve;
-    using base_type::size;
-    using base_type::operator[];
-
-    // iterator
-    using base_type::const_iterator;
-    using base_type::is_end;
-    using base_type::iterator;
-    using base_type::next;
-    using base_type::node_type;
-    using base_type::value_type;
-
-    inline_circular_queue( const inline_circular_queue & ) = delete;
-    inline_circular_queue &operator=( inline_circular_queue & ) = delete;
-
-    inline_circular_queue() : base_type( N )
-    {
-    }
-    bool reserve( size_t n )
-    {
-        return n <= N;
+    using base_type = circular_queue<T, ObjectAlloc>;
+    static constexpr size_t INLINE_CAPACITY = internal::ceil_pow2( N );
+
+    explicit inline_circular_queue( const ObjectAlloc &alloc = ObjectAlloc() )
+        : inline_base(), base_type( inline_base::inline_buffer(), INLINE_CAPACITY, alloc )
+    {
+    }
+    inline_circular_queue( const inline_circular_queue &a ) : inline_circular_queue( a.mAlloc )
+    {
+        base_type::operator=( a );
+    }
+    inline_circular_queue( inline_circular_queue &&a ) : inline_circular_queue( a.mAlloc )
+    {
+        base_type::operator=( std::move( a ) );
+    }
+    inline_circular_queue &operator=( const inline_circular_queue &a )
+    {
+        base_type::operator=( a );
+        return *this;
+    }
+    inline_circular_queue &operator=( inline_circular_queue &&a )
+    {
+        base_type::operator=( std::move( a ) );
+        return *this;
+    }
+
+    bool using_inline() const
+    {
+        return base_type::mBuf == base_type::mInlineBuf;
     }
 };
 } // namespace ftl
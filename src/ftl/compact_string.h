@@ -0,0 +1,614 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <ftl/vector.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <type_traits>
+
+namespace ftl
+{
+
+namespace internal
+{
+    /// Concurrent hash() calls on a shared const string may both compute it and store the same value, so relaxed order is enough.
+    template<bool CacheHash>
+    struct HashCache
+    {
+        mutable std::atomic<std::size_t> m_hash{0}; // 0 if not computed.
+
+        HashCache() = default;
+        HashCache( const HashCache &a ) : m_hash( a.cached_hash() )
+        {
+        }
+
+        std::size_t cached_hash() const
+        {
+            return m_hash.load( std::memory_order_relaxed );
+        }
+        void set_hash( std::size_t h ) const
+        {
+            m_hash.store( h, std::memory_order_relaxed );
+        }
+        void invalidate_hash()
+        {
+            set_hash( 0 );
+        }
+    };
+    template<>
+    struct HashCache<false>
+    {
+        void invalidate_hash()
+        {
+        }
+    };
+} // namespace internal
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief CompactString is a null terminated char string of 24 bytes, which keeps up to 23 chars inline, like fbstring.
+///  - inline: chars, then the null terminator, and the last byte is 23 - size, which is the null terminator itself when size is 23.
+///  - heap: pointer, size and capacity. The top byte of capacity is the last byte of the string, where HEAP_FLAG is set.
+/// It has the interface of CStr, and is a drop-in StrT of DynNode, eg. jz::DynNode<CompactString<>>.
+/// The allocator is default constructed on use, as in DynNode, so Alloc must be stateless or reference a default resource, eg.
+/// SizeClassAllocatorRef. Growth tries Alloc::try_expand/reallocate (see grow_buffer).
+/// It's trivially relocatable: nothing points into the string itself.
+/// \tparam CacheHash cache hash() in an extra word (32 bytes in total), for long keys hashed repeatedly. Mutations reset the cache,
+/// including the non-const accessors. Const strings can be hashed concurrently.
+template<class Alloc = std::allocator<char>, bool CacheHash = false>
+class CompactString : protected internal::HashCache<CacheHash>
+{
+    static_assert( std::is_same_v<typename Alloc::value_type, char> );
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "CompactString keeps its heap flag in the top byte of capacity, which must be the last byte"
+#endif
+
+    using hash_base = internal::HashCache<CacheHash>;
+
+    struct Heap
+    {
+        char *pData;
+        std::size_t size;
+        std::size_t capacity; // with HEAP_FLAG in the top byte.
+    };
+    static constexpr std::size_t BYTES = sizeof( Heap );
+    static constexpr unsigned char HEAP_FLAG = 0x80;
+    static constexpr std::size_t HEAP_FLAG_BITS = std::size_t( HEAP_FLAG ) << ( 8 * ( sizeof( std::size_t ) - 1 ) );
+
+public:
+    using this_type = CompactString;
+    using value_type = char;
+    using allocator_type = Alloc;
+    using size_type = std::size_t;
+    using iterator = char *;
+    using const_iterator = const char *;
+    using is_trivially_relocatable = std::true_type;
+
+    static constexpr bool is_string = true;
+    static constexpr size_type inplace_capacity = BYTES - 1;
+    static constexpr size_type inplace_buffer_size = BYTES;
+    static constexpr auto npos = std::numeric_limits<size_type>::max();
+
+    CompactString()
+    {
+        set_inline_size( 0 );
+    }
+    CompactString( const char *s ) : CompactString( s, std::strlen( s ) )
+    {
+    }
+    CompactString( const char *s, size_type n )
+    {
+        init( s, n );
+    }
+    template<class Iter, typename = std::enable_if_t<!std::is_integral_v<Iter>>>
+    CompactString( Iter it, Iter itEnd )
+    {
+        set_inline_size( 0 );
+        push_back_iter( it, itEnd );
+    }
+    CompactString( size_type n, char c )
+    {
+        set_inline_size( 0 );
+        push_back( c, n );
+    }
+    CompactString( std::initializer_list<char> il ) : CompactString( il.begin(), il.size() )
+    {
+    }
+    /// from std::string, std::string_view etc.
+    template<class S, typename = std::enable_if_t<std::is_convertible_v<const S &, std::string_view> && !std::is_convertible_v<const S &, const char *>>>
+    explicit CompactString( const S &s ) : CompactString( std::string_view( s ).data(), std::string_view( s ).size() )
+    {
+    }
+    CompactString( const CompactString &a ) : hash_base( a )
+    {
+        init( a.data(), a.size() );
+    }
+    CompactString( CompactString &&a ) noexcept : hash_base( a )
+    {
+        std::memcpy( static_cast<void *>( &m_rep ), &a.m_rep, BYTES );
+        a.set_inline_size( 0 );
+        a.invalidate_hash();
+    }
+    ~CompactString()
+    {
+        if ( is_heap() )
+            deallocate( m_rep.heap.pData, heap_capacity() );
+    }
+
+    CompactString &operator=( const CompactString &a )
+    {
+        if ( this != &a )
+            assign( a.data(), a.size() );
+        return *this;
+    }
+    CompactString &operator=( CompactString &&a ) noexcept
+    {
+        if ( this != &a )
+        {
+            this->~CompactString();
+            new ( this ) CompactString( std::move( a ) );
+        }
+        return *this;
+    }
+    /// from const char *, std::string, std::string_view etc.
+    template<class S, typename = std::enable_if_t<std::is_convertible_v<const S &, std::string_view>>>
+    CompactString &operator=( const S &s )
+    {
+        std::string_view v( s );
+        assign( v.data(), v.size() );
+        return *this;
+    }
+
+    /// \brief replace content by [s, s + n). s may point into this string.
+    void assign( const char *s, size_type n )
+    {
+        this->invalidate_hash();
+        if ( n > capacity() )
+        {
+            CompactString tmp( s, n );
+            *this = std::move( tmp );
+            return;
+        }
+        std::memmove( begin_unsafe(), s, n );
+        set_size( n );
+    }
+
+    allocator_type get_allocator() const
+    {
+        return allocator_type{};
+    }
+
+    bool using_inplace() const
+    {
+        return !is_heap();
+    }
+    size_type size() const
+    {
+        return is_heap() ? m_rep.heap.size : inplace_capacity - size_type( m_rep.bytes[BYTES - 1] );
+    }
+    size_type length() const
+    {
+        return size();
+    }
+    bool empty() const
+    {
+        return size() == 0;
+    }
+    size_type capacity() const
+    {
+        return is_heap() ? heap_capacity() : inplace_capacity;
+    }
+    /// capacity including the null terminator.
+    size_type buffer_size() const
+    {
+        return capacity() + 1;
+    }
+
+    const char *data() const
+    {
+        return is_heap() ? m_rep.heap.pData : m_rep.bytes;
+    }
+    const char *c_str() const
+    {
+        return data();
+    }
+    char *data()
+    {
+        this->invalidate_hash();
+        return begin_unsafe();
+    }
+
+    iterator begin()
+    {
+        return data();
+    }
+    iterator end()
+    {
+        return data() + size();
+    }
+    const_iterator begin() const
+    {
+        return data();
+    }
+    const_iterator end() const
+    {
+        return data() + size();
+    }
+    const_iterator cbegin() const
+    {
+        return data();
+    }
+    const_iterator cend() const
+    {
+        return data() + size();
+    }
+
+    char &operator[]( size_type i )
+    {
+        return data()[i];
+    }
+    char operator[]( size_type i ) const
+    {
+        return data()[i];
+    }
+    char &front()
+    {
+        return data()[0];
+    }
+    char front() const
+    {
+        return data()[0];
+    }
+    char &back()
+    {
+        return data()[size() - 1];
+    }
+    char back() const
+    {
+        return data()[size() - 1];
+    }
+
+    operator std::string_view() const
+    {
+        return {data(), size()};
+    }
+    std::string_view view() const
+    {
+        return {data(), size()};
+    }
+
+    /// \brief std::hash of the chars, as std::string and std::string_view.
+    std::size_t hash() const
+    {
+        if constexpr ( CacheHash )
+        {
+            auto h = this->cached_hash();
+            if ( !h )
+            {
+                h = std::hash<std::string_view>()( view() );
+                this->set_hash( h );
+            }
+            return h;
+        }
+        else
+            return std::hash<std::string_view>()( view() );
+    }
+
+    /// \brief make capacity >= n, doubling when it grows.
+    /// \return false if the allocator fails.
+    bool reserve( size_type n )
+    {
+        const auto cap = capacity();
+        if ( n <= cap )
+            return true;
+        assert( n < HEAP_FLAG_BITS );
+        const auto newCap = std::max( n, 2 * cap );
+        const auto nsize = size();
+        Alloc alloc;
+        auto p = grow_buffer( alloc, begin_unsafe(), nsize + 1, cap + 1, newCap + 1, is_heap() );
+        if ( !p )
+            return false;
+        m_rep.heap.pData = p;
+        m_rep.heap.size = nsize;
+        m_rep.heap.capacity = newCap | HEAP_FLAG_BITS;
+        return true;
+    }
+
+    /// @return size of resulting string, or npos for failure.
+    size_type push_back( char c, size_type n = 1 )
+    {
+        const auto nsize = size();
+        if ( !reserve( nsize + n ) )
+            return npos;
+        this->invalidate_hash();
+        std::memset( begin_unsafe() + nsize, c, n );
+        set_size( nsize + n );
+        return nsize + n;
+    }
+
+    template<class... Args>
+    char *emplace_back( Args &&... args )
+    {
+        const auto nsize = size();
+        if ( push_back( char( std::forward<Args>( args )... ) ) == npos )
+            return nullptr;
+        return begin_unsafe() + nsize;
+    }
+
+    /// @return size of resulting string, or npos for failure.
+    template<class Iter>
+    size_type push_back_iter( Iter it, Iter itEnd )
+    {
+        const auto nsize = size();
+        if constexpr ( std::is_pointer_v<Iter> )
+            return append( &*it, size_type( itEnd - it ) );
+        else
+        {
+            const size_type n = std::distance( it, itEnd );
+            if ( !reserve( nsize + n ) )
+                return npos;
+            this->invalidate_hash();
+            std::copy( it, itEnd, begin_unsafe() + nsize );
+            set_size( nsize + n );
+            return nsize + n;
+        }
+    }
+
+    /// @return size of resulting string, or npos for failure. s may point into this string.
+    size_type append( const char *s, size_type n )
+    {
+        const auto nsize = size();
+        if ( n > capacity() - nsize )
+        {
+            const auto offset = s - data(); // s may be invalidated by growth.
+            const bool bInside = offset >= 0 && size_type( offset ) < nsize;
+            if ( !reserve( nsize + n ) )
+                return npos;
+            if ( bInside )
+                s = begin_unsafe() + offset;
+        }
+        this->invalidate_hash();
+        std::memmove( begin_unsafe() + nsize, s, n );
+        set_size( nsize + n );
+        return nsize + n;
+    }
+    size_type append( std::string_view s )
+    {
+        return append( s.data(), s.size() );
+    }
+
+    /// @return size of resulting string, or npos for failure.
+    size_type pop_back( size_type n = 1 )
+    {
+        const auto nsize = size();
+        if ( nsize < n )
+            return npos;
+        this->invalidate_hash();
+        set_size( nsize - n );
+        return nsize - n;
+    }
+
+    bool resize( size_type n, char c = '\0' )
+    {
+        const auto nsize = size();
+        if ( n > nsize )
+            return push_back( c, n - nsize ) == n;
+        return pop_back( nsize - n ) == n;
+    }
+
+    void clear()
+    {
+        this->invalidate_hash();
+        set_size( 0 );
+    }
+
+    void erase( iterator it, iterator itEnd )
+    {
+        if ( it == itEnd )
+            return;
+        const auto nsize = size();
+        this->invalidate_hash();
+        std::memmove( it, itEnd, size_type( end() - itEnd ) );
+        set_size( nsize - size_type( itEnd - it ) );
+    }
+
+    /// \brief move a heap string inline if it fits, or reallocate it to size.
+    void shrink_to_fit()
+    {
+        if ( is_heap() && heap_capacity() > size() )
+        {
+            CompactString tmp( data(), size() );
+            *this = std::move( tmp );
+        }
+    }
+
+    std::string_view sub_view( size_type pos, size_type maxlen = npos ) const
+    {
+        return pos >= size() ? std::string_view() : view().substr( pos, maxlen );
+    }
+    CompactString sub( size_type pos, size_type maxlen = npos ) const
+    {
+        auto v = sub_view( pos, maxlen );
+        return CompactString( v.data(), v.size() );
+    }
+    CompactString substr( size_type pos = 0, size_type n = npos ) const
+    {
+        return sub( pos, n );
+    }
+
+    int compare( std::string_view s ) const
+    {
+        return view().compare( s );
+    }
+
+    CompactString &operator+=( char c )
+    {
+        push_back( c );
+        return *this;
+    }
+    CompactString &operator+=( std::string_view s )
+    {
+        append( s );
+        return *this;
+    }
+
+    void swap( CompactString &a ) noexcept
+    {
+        std::swap( m_rep, a.m_rep );
+        if constexpr ( CacheHash )
+        {
+            auto h = this->cached_hash();
+            this->set_hash( a.cached_hash() );
+            a.set_hash( h );
+        }
+    }
+
+    template<class S>
+    friend auto operator==( const CompactString &a, const S &b ) -> decltype( std::string_view( b ), bool() )
+    {
+        if constexpr ( std::is_same_v<S, CompactString> && CacheHash )
+        {
+            auto ha = a.cached_hash(), hb = b.cached_hash();
+            if ( ha && hb && ha != hb )
+                return false;
+        }
+        return a.view() == std::string_view( b );
+    }
+    template<class S, typename = std::enable_if_t<!std::is_same_v<S, CompactString>>>
+    friend auto operator==( const S &a, const CompactString &b ) -> decltype( std::string_view( a ), bool() )
+    {
+        return b == a;
+    }
+    template<class S>
+    friend auto operator!=( const CompactString &a, const S &b ) -> decltype( std::string_view( b ), bool() )
+    {
+        return !( a == b );
+    }
+    template<class S, typename = std::enable_if_t<!std::is_same_v<S, CompactString>>>
+    friend auto operator!=( const S &a, const CompactString &b ) -> decltype( std::string_view( a ), bool() )
+    {
+        return !( b == a );
+    }
+    template<class S>
+    friend auto operator<( const CompactString &a, const S &b ) -> decltype( std::string_view( b ), bool() )
+    {
+        return a.view() < std::string_view( b );
+    }
+    template<class S, typename = std::enable_if_t<!std::is_same_v<S, CompactString>>>
+    friend auto operator<( const S &a, const CompactString &b ) -> decltype( std::string_view( a ), bool() )
+    {
+        return std::string_view( a ) < b.view();
+    }
+    template<class S>
+    friend auto operator<=( const CompactString &a, const S &b ) -> decltype( std::string_view( b ), bool() )
+    {
+        return a.view() <= std::string_view( b );
+    }
+
+    friend std::ostream &operator<<( std::ostream &os, const CompactString &s )
+    {
+        return os << s.view();
+    }
+
+private:
+    bool is_heap() const
+    {
+        return static_cast<unsigned char>( m_rep.bytes[BYTES - 1] ) & HEAP_FLAG;
+    }
+    size_type heap_capacity() const
+    {
+        return m_rep.heap.capacity & ~HEAP_FLAG_BITS;
+    }
+    char *begin_unsafe()
+    {
+        return is_heap() ? m_rep.heap.pData : m_rep.bytes;
+    }
+
+    void set_inline_size( size_type n )
+    {
+        m_rep.bytes[n] = '\0';
+        m_rep.bytes[BYTES - 1] = char( inplace_capacity - n ); // the null terminator when n == inplace_capacity.
+    }
+    void set_size( size_type n )
+    {
+        if ( is_heap() )
+        {
+            m_rep.heap.size = n;
+            m_rep.heap.pData[n] = '\0';
+        }
+        else
+            set_inline_size( n );
+    }
+
+    /// \pre not initialized.
+    void init( const char *s, size_type n )
+    {
+        if ( n <= inplace_capacity )
+        {
+            std::memcpy( m_rep.bytes, s, n );
+            set_inline_size( n );
+        }
+        else
+        {
+            assert( n < HEAP_FLAG_BITS );
+            auto p = Alloc().allocate( n + 1 );
+            std::memcpy( p, s, n );
+            p[n] = '\0';
+            m_rep.heap.pData = p;
+            m_rep.heap.size = n;
+            m_rep.heap.capacity = n | HEAP_FLAG_BITS;
+        }
+    }
+
+    static void deallocate( char *p, size_type cap )
+    {
+        Alloc().deallocate( p, cap + 1 );
+    }
+
+    union Rep
+    {
+        char bytes[BYTES];
+        Heap heap;
+    } m_rep;
+};
+
+using CompactStr = CompactString<>;
+
+} // namespace ftl
+
+namespace std
+{
+template<class Alloc, bool CacheHash>
+struct hash<ftl::CompactString<Alloc, CacheHash>>
+{
+    size_t operator()( const ftl::CompactString<Alloc, CacheHash> &s ) const noexcept
+    {
+        return s.hash();
+    }
+};
+} // namespace std
@@ -0,0 +1,452 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <ftl/alloc_common.h>
+#include <ftl/mem_pool.h>
+#include <ftl/reclaim.h>
+#include <ftl/sys_alloc.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace ftl
+{
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief ConcurrentHashMap is an open addressing (linear probing) hash map for concurrent lookups and updates.
+/// - Buckets point to immutable nodes allocated from a ThreadCachedMemPool. An update swaps in a new node, erase leaves a tombstone.
+/// - Reads are lock-free: they pin an EpochDomain, so replaced nodes and old tables are reclaimed only after concurrent readers finish.
+/// - Writes to the same key are serialized by one of NUM_STRIPES locks. Writes to different stripes claim empty buckets by CAS.
+/// - Resize is incremental: when the table is 3/4 used, a larger table is attached and every writer moves a chunk of MIGRATE_CHUNK
+///   buckets before its own write. Lookups search the old table, then the new one, so no operation waits for the whole rehash.
+///
+/// Usage:
+///     ConcurrentHashMap<std::uint64_t, Order> orders;
+///     orders.insert_or_assign( orderId, order );
+///     if ( auto order = orders.find( orderId ) ) ...
+///     orders.visit( orderId, []( const Order &order ) { ... } ); // no copy.
+template<class K, class V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>, class AlignedAlloc = MmapAlignedAlloc>
+class ConcurrentHashMap
+{
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using value_type = std::pair<const K, V>;
+
+    constexpr static std::size_t NUM_STRIPES = 64, MIGRATE_CHUNK = 64, MIN_CAPACITY = 16;
+
+protected:
+    struct Node
+    {
+        std::size_t hash;
+        value_type kv;
+    };
+
+    using Bucket = std::atomic<Node *>;
+
+    struct alignas( 64 ) Table
+    {
+        std::size_t capacity; // power of 2.
+        std::atomic<std::size_t> nUsed{0}; // buckets claimed by nodes, including tombstones.
+        std::atomic<Table *> pNext{nullptr}; // the table being migrated to.
+        std::atomic<std::size_t> migrateCursor{0}, nMigrated{0};
+
+        Table( std::size_t cap ) : capacity( cap )
+        {
+            for ( std::size_t i = 0; i < cap; ++i )
+                new ( &bucket( i ) ) Bucket( nullptr );
+        }
+
+        Bucket &bucket( std::size_t i )
+        {
+            return reinterpret_cast<Bucket *>( this + 1 )[i];
+        }
+
+        static std::size_t bytes( std::size_t cap )
+        {
+            return sizeof( Table ) + cap * sizeof( Bucket );
+        }
+    };
+
+    struct alignas( 64 ) Stripe
+    {
+        std::mutex lock;
+        std::atomic<std::ptrdiff_t> size{0}; // written under lock.
+    };
+
+    // bucket states other than node pointers. A null bucket ends a probe. MOVED_EMPTY also ends it: it was null when migrated.
+    static inline Node *const TOMBSTONE = reinterpret_cast<Node *>( 1 ), *const MOVED = reinterpret_cast<Node *>( 2 ),
+                              *const MOVED_EMPTY = reinterpret_cast<Node *>( 3 );
+
+    static bool is_node( const Node *p )
+    {
+        return std::uintptr_t( p ) > std::uintptr_t( MOVED_EMPTY );
+    }
+
+    struct Found
+    {
+        Table *pTable = nullptr;
+        std::size_t idx = 0;
+        Node *pNode = nullptr;
+    };
+
+    Hash m_hash;
+    KeyEqual m_equal;
+    ThreadCachedMemPool<false, AlignedAlloc> m_nodePool;
+    mutable reclaim::EpochDomain m_domain; // destroyed before m_nodePool, it reclaims retired nodes.
+    std::atomic<Table *> m_root;
+    Stripe m_stripes[NUM_STRIPES];
+
+public:
+    explicit ConcurrentHashMap( std::size_t initialCapacity = 64, const Hash &hash = Hash(), const KeyEqual &equal = KeyEqual() )
+        : m_hash( hash ),
+          m_equal( equal ),
+          m_nodePool( AllocRequest{sizeof( Node ), std::max<std::size_t>( initialCapacity / 2, 64 ), alignof( Node )} ),
+          m_root( create_table( capacity_for( initialCapacity ) ) )
+    {
+    }
+
+    ConcurrentHashMap( const ConcurrentHashMap & ) = delete;
+    ConcurrentHashMap &operator=( const ConcurrentHashMap & ) = delete;
+
+    /// \pre no concurrent access.
+    ~ConcurrentHashMap()
+    {
+        for ( auto pTable = m_root.load(); pTable; )
+        {
+            for ( std::size_t i = 0; i < pTable->capacity; ++i )
+                if ( auto p = pTable->bucket( i ).load( std::memory_order_relaxed ); is_node( p ) )
+                    destroy_node( p );
+            auto pNext = pTable->pNext.load();
+            destroy_table( pTable );
+            pTable = pNext;
+        }
+    }
+
+    /// \brief insert if key doesn't exist.
+    /// \return true if inserted.
+    bool insert( const K &key, const V &value )
+    {
+        return upsert( key, value, false );
+    }
+
+    /// \brief insert, or replace the value of existing key.
+    /// \return true if inserted, false if assigned.
+    template<class M>
+    bool insert_or_assign( const K &key, M &&value )
+    {
+        return upsert( key, std::forward<M>( value ), true );
+    }
+
+    /// \return true if erased.
+    bool erase( const K &key )
+    {
+        const auto h = hash_of( key );
+        reclaim::EpochDomain::Guard guard( m_domain );
+        help_migrate();
+        auto &stripe = stripe_of( h );
+        std::lock_guard<std::mutex> lock( stripe.lock );
+        auto found = find_node( key, h );
+        if ( !found.pNode )
+            return false;
+        found.pTable->bucket( found.idx ).store( TOMBSTONE, std::memory_order_release );
+        stripe.size.store( stripe.size.load( std::memory_order_relaxed ) - 1, std::memory_order_relaxed );
+        retire_node( found.pNode );
+        return true;
+    }
+
+    /// \brief lock-free lookup.
+    /// \return copy of value.
+    std::optional<V> find( const K &key ) const
+    {
+        std::optional<V> res;
+        visit( key, [&]( const V &value ) { res.emplace( value ); } );
+        return res;
+    }
+
+    /// \brief lock-free lookup. Call func( const V& ) if key is found. The value may be replaced concurrently, but it stays valid
+    /// until func returns.
+    template<class F>
+    bool visit( const K &key, F &&func ) const
+    {
+        reclaim::EpochDomain::Guard guard( m_domain );
+        if ( auto pNode = find_node( key, hash_of( key ) ).pNode )
+        {
+            func( static_cast<const V &>( pNode->kv.second ) );
+            return true;
+        }
+        return false;
+    }
+
+    bool contains( const K &key ) const
+    {
+        return visit( key, []( const V & ) {} );
+    }
+
+    /// \brief call func( const value_type& ) for each entry. An entry inserted, erased or moved by resize concurrently may be missed
+    /// or visited twice.
+    template<class F>
+    void for_each( F &&func ) const
+    {
+        reclaim::EpochDomain::Guard guard( m_domain );
+        for ( auto pTable = m_root.load( std::memory_order_acquire ); pTable; pTable = pTable->pNext.load( std::memory_order_acquire ) )
+            for ( std::size_t i = 0; i < pTable->capacity; ++i )
+                if ( auto p = pTable->bucket( i ).load( std::memory_order_acquire ); is_node( p ) )
+                    func( static_cast<const value_type &>( p->kv ) );
+    }
+
+    /// \brief number of entries. Exact only when there is no concurrent write.
+    std::size_t size() const
+    {
+        std::ptrdiff_t n = 0;
+        for ( auto &stripe : m_stripes )
+            n += stripe.size.load( std::memory_order_relaxed );
+        return std::size_t( std::max<std::ptrdiff_t>( n, 0 ) );
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /// \brief number of buckets of the current table.
+    std::size_t bucket_count() const
+    {
+        return m_root.load( std::memory_order_acquire )->capacity;
+    }
+
+    /// \brief whether an incremental resize is in progress.
+    bool resizing() const
+    {
+        return m_root.load( std::memory_order_acquire )->pNext.load( std::memory_order_acquire );
+    }
+
+protected:
+    std::size_t hash_of( const K &key ) const
+    {
+        std::uint64_t h = m_hash( key ); // mix, std::hash of integers is identity.
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return std::size_t( h );
+    }
+
+    Stripe &stripe_of( std::size_t h )
+    {
+        return m_stripes[( h >> 40 ) % NUM_STRIPES];
+    }
+
+    static std::size_t capacity_for( std::size_t n )
+    {
+        std::size_t cap = MIN_CAPACITY;
+        while ( cap < n )
+            cap *= 2;
+        return cap;
+    }
+
+    Table *create_table( std::size_t cap )
+    {
+        auto p = AlignedAlloc::aligned_alloc( alignof( Table ), Table::bytes( cap ) );
+        if ( !p )
+            throw std::bad_alloc();
+        return new ( p ) Table( cap );
+    }
+
+    static void destroy_table( Table *pTable )
+    {
+        const auto bytes = Table::bytes( pTable->capacity );
+        pTable->~Table();
+        AlignedAlloc::free( pTable, bytes );
+    }
+
+    template<class M>
+    Node *create_node( std::size_t h, const K &key, M &&value )
+    {
+        auto p = m_nodePool.malloc();
+        if ( !p )
+            throw std::bad_alloc();
+        return new ( p ) Node{h, value_type( key, std::forward<M>( value ) )};
+    }
+
+    void destroy_node( Node *p )
+    {
+        p->~Node();
+        m_nodePool.free( p );
+    }
+
+    void retire_node( Node *p )
+    {
+        m_domain.retire( reclaim::Retired{
+                p, []( void *pMap, void *p ) { static_cast<ConcurrentHashMap *>( pMap )->destroy_node( static_cast<Node *>( p ) ); }, this} );
+    }
+
+    /// \brief search the current table and the tables being migrated to.
+    /// \pre in an epoch guard.
+    Found find_node( const K &key, std::size_t h ) const
+    {
+        for ( auto pTable = m_root.load( std::memory_order_acquire ); pTable; pTable = pTable->pNext.load( std::memory_order_acquire ) )
+        {
+            const auto mask = pTable->capacity - 1;
+            for ( std::size_t k = 0, i = h & mask; k < pTable->capacity; ++k, i = ( i + 1 ) & mask )
+            {
+                auto p = pTable->bucket( i ).load( std::memory_order_acquire );
+                if ( !p || p == MOVED_EMPTY )
+                    break;
+                if ( is_node( p ) && p->hash == h && m_equal( p->kv.first, key ) )
+                    return Found{pTable, i, p};
+            }
+        }
+        return {};
+    }
+
+    /// \brief claim an empty bucket for pNode.
+    /// \return false if the table is full or being migrated.
+    bool claim( Table *pTable, Node *pNode )
+    {
+        const auto mask = pTable->capacity - 1;
+        for ( std::size_t k = 0, i = pNode->hash & mask; k < pTable->capacity; ++k, i = ( i + 1 ) & mask )
+        {
+            auto &bucket = pTable->bucket( i );
+            auto p = bucket.load( std::memory_order_acquire );
+            if ( !p && bucket.compare_exchange_strong( p, pNode, std::memory_order_acq_rel ) )
+            {
+                pTable->nUsed.fetch_add( 1, std::memory_order_relaxed );
+                return true;
+            }
+            if ( p == MOVED_EMPTY ) // no bucket after it may be claimed.
+                return false;
+        }
+        return false;
+    }
+
+    template<class M>
+    bool upsert( const K &key, M &&value, bool assign )
+    {
+        const auto h = hash_of( key );
+        reclaim::EpochDomain::Guard guard( m_domain );
+        Node *pNew = nullptr;
+        bool inserted = false;
+        for ( ;; )
+        {
+            help_migrate();
+            {
+                auto &stripe = stripe_of( h );
+                std::lock_guard<std::mutex> lock( stripe.lock );
+                auto found = find_node( key, h );
+                if ( found.pNode && !assign )
+                {
+                    if ( pNew )
+                        destroy_node( pNew );
+                    return false;
+                }
+                if ( !pNew )
+                    pNew = create_node( h, key, std::forward<M>( value ) );
+
+                auto pRoot = m_root.load( std::memory_order_acquire ), pNewest = pRoot;
+                while ( auto pNext = pNewest->pNext.load( std::memory_order_acquire ) )
+                    pNewest = pNext;
+                if ( found.pTable == pNewest ) // in place. Migration of the bucket waits for the stripe lock.
+                {
+                    found.pTable->bucket( found.idx ).store( pNew, std::memory_order_release );
+                    retire_node( found.pNode );
+                    return false;
+                }
+                // leave room for nodes migrated from the old table.
+                const auto maxUsed = pNewest == pRoot ? pNewest->capacity - 1 : pNewest->capacity / 2;
+                if ( pNewest->nUsed.load( std::memory_order_relaxed ) < maxUsed && claim( pNewest, pNew ) )
+                {
+                    if ( found.pNode ) // in an old table.
+                    {
+                        found.pTable->bucket( found.idx ).store( TOMBSTONE, std::memory_order_release );
+                        retire_node( found.pNode );
+                    }
+                    else
+                        stripe.size.store( stripe.size.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+                    inserted = !found.pNode;
+                    break;
+                }
+            }
+            // the newest table is full, or it's being migrated: help resize and retry.
+            if ( help_migrate() )
+                std::this_thread::yield(); // other threads may be finishing their chunks.
+            else
+                start_resize( 1 );
+        }
+        start_resize( 3 );
+        return inserted;
+    }
+
+    /// \brief attach a new table to the root table if it's used beyond loadNum/4.
+    void start_resize( std::size_t loadNum )
+    {
+        auto pTable = m_root.load( std::memory_order_acquire );
+        if ( pTable->pNext.load( std::memory_order_acquire ) || pTable->nUsed.load( std::memory_order_relaxed ) * 4 < pTable->capacity * loadNum )
+            return;
+        auto pNew = create_table( capacity_for( std::max<std::size_t>( size() * 4, pTable->capacity ) ) );
+        Table *pExpected = nullptr;
+        if ( !pTable->pNext.compare_exchange_strong( pExpected, pNew, std::memory_order_acq_rel ) )
+            destroy_table( pNew );
+    }
+
+    /// \brief migrate a chunk of buckets of the root table. The last migrator makes the new table root.
+    /// \return false if no migration is in progress.
+    bool help_migrate()
+    {
+        auto pTable = m_root.load( std::memory_order_acquire );
+        auto pNext = pTable->pNext.load( std::memory_order_acquire );
+        if ( !pNext )
+            return false;
+        const auto start = pTable->migrateCursor.fetch_add( MIGRATE_CHUNK, std::memory_order_relaxed );
+        if ( start >= pTable->capacity )
+            return true;
+        const auto end = std::min( start + MIGRATE_CHUNK, pTable->capacity );
+        for ( auto i = start; i < end; ++i )
+            migrate_bucket( pTable, pNext, i );
+        if ( pTable->nMigrated.fetch_add( end - start, std::memory_order_acq_rel ) + ( end - start ) == pTable->capacity )
+        {
+            m_root.store( pNext, std::memory_order_release );
+            m_domain.retire( reclaim::Retired{pTable, []( void *, void *p ) { destroy_table( static_cast<Table *>( p ) ); }, nullptr} );
+        }
+        return true;
+    }
+
+    void migrate_bucket( Table *pTable, Table *pNext, std::size_t i )
+    {
+        auto &bucket = pTable->bucket( i );
+        auto p = bucket.load( std::memory_order_acquire );
+        while ( !p ) // seal an empty bucket, so that no node is inserted after it's migrated.
+            if ( bucket.compare_exchange_weak( p, MOVED_EMPTY, std::memory_order_acq_rel ) )
+                return;
+        if ( !is_node( p ) )
+            return;
+        std::lock_guard<std::mutex> lock( stripe_of( p->hash ).lock );
+        p = bucket.load( std::memory_order_acquire ); // may have been replaced or erased.
+        if ( !is_node( p ) )
+            return;
+        [[maybe_unused]] auto claimed = claim( pNext, p ); // node is shared by new table before old bucket is marked moved.
+        assert( claimed );
+        bucket.store( MOVED, std::memory_order_release );
+    }
+};
+
+} // namespace ftl
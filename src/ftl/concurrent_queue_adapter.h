@@ -29,9 +29,19 @@ public:
     {
         return SuperType::push( v );
     }
+    bool try_push( T &&v, size_t )
+    {
+        return SuperType::emplace( std::move( v ) );
+    }
     bool try_pop( T &v, size_t = 0 )
     {
-        return SuperType::pop( &v );
+        std::aligned_storage_t<sizeof( T ), alignof( T )> buf; // pop() constructs into uninitialized memory.
+        auto p = reinterpret_cast<T *>( &buf );
+        if ( !SuperType::pop( p ) )
+            return false;
+        v = std::move( *p );
+        p->~T();
+        return true;
     }
 };
 
@@ -60,6 +70,10 @@ public:
     {
         return SuperType::try_enqueue( v );
     }
+    bool try_push( T &&v, std::size_t )
+    {
+        return SuperType::try_enqueue( std::move( v ) );
+    }
     bool try_pop( T &v, std::size_t usec = 0 )
     {
         return SuperType::wait_dequeue_timed( v, usec );
@@ -100,6 +114,10 @@ public:
     {
         return SuperType::try_enqueue( v );
     }
+    bool try_push( T &&v, size_t )
+    {
+        return SuperType::try_enqueue( std::move( v ) );
+    }
     bool try_pop( T &v, size_t = 0 )
     {
         return SuperType::try_dequeue( v );
@@ -131,6 +149,10 @@ public:
     {
         return SuperType::try_enqueue( v );
     }
+    bool try_push( T &&v, std::size_t )
+    {
+        return SuperType::try_enqueue( std::move( v ) );
+    }
     bool try_pop( T &v, std::size_t usec = 0 )
     {
         return SuperType::wait_dequeue_timed( v, usec );
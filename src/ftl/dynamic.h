@@ -515,7 +515,7 @@ bool dynamic_read_json( dynamic_var<K, Str> &dyn, std::istream &ss, std::ostream
                 err << " | error reading value for key=" << key;
                 return false;
             }
-            dyn.map_add_entry( Str( key ), std::move( child ) );
+            dyn.map_add_entry( K( key ), std::move( child ) ); // eg. interned as a Symbol.
         }
     }
     else if ( res == '[' ) // read vec
@@ -4,6 +4,13 @@
 #include <stdexcept>
 #include <vector>
 #include <map>
+#include <cstdint>
+#include <iterator>
+#include <cstring>
+#include <ftl/vector.h>
+#if defined( __SSE2__ )
+#include <immintrin.h>
+#endif
 
 
 namespace ftl
@@ -132,9 +139,9 @@ public:
 
     template<class InputIter>
     FlatOrderedMapBase( InputIter it, InputIter itEnd, const LessThan &less = LessThan{}, const allocator_type &alloc = allocator_type{} )
-        : base_type( it, itEnd, alloc ), m_less( less )
+        : base_type( alloc ), m_less( less )
     {
-        std::sort( base_type::begin(), base_type::end() );
+        insert_bulk( it, itEnd );
     }
 
     FlatOrderedMapBase( const std::initializer_list<value_type> &il ) : FlatOrderedMapBase( il.begin(), il.end() )
@@ -163,13 +170,71 @@ public:
 
     void update( const this_type &a, bool bInsertIfNotFound = true )
     {
-        for ( const auto &p : a )
-            update( p, bInsertIfNotFound );
+        if ( bInsertIfNotFound )
+            insert_bulk( a.begin(), a.end(), true );
+        else
+            for ( const auto &p : a )
+                update( p, false );
     }
     void update( this_type &&a, bool bInsertIfNotFound = true )
     {
-        for ( auto &&p : a )
-            update( std::move( p ), bInsertIfNotFound );
+        if ( bInsertIfNotFound )
+            insert_bulk( std::make_move_iterator( a.begin() ), std::make_move_iterator( a.end() ), true );
+        else
+            for ( auto &&p : a )
+                update( std::move( p ), false );
+    }
+
+    /// \brief insert a batch with one sort and one linear merge, O((n+m)+m*log(m)) instead of O(n*m) for m single inserts.
+    /// For a unique map, a key found in the map or repeated in the batch keeps the first value, or the last one if bAssignExisting.
+    /// For a multi map, all elements are inserted after existing equal keys.
+    /// \return number of elements inserted.
+    template<class InputIter>
+    size_t insert_bulk( InputIter it, InputIter itEnd, bool bAssignExisting = false )
+    {
+        const auto nOld = size();
+        base_type::insert( base_type::end(), it, itEnd );
+        const auto itMid = base_type::begin() + nOld;
+        std::stable_sort( itMid, base_type::end(), m_less );
+        if constexpr ( !is_multi_map )
+        {
+            // dedupe the batch, then drop keys existing in the map, assigning them if bAssignExisting.
+            auto itOld = base_type::begin(), itOut = itMid;
+            for ( auto itIn = itMid; itIn != base_type::end(); )
+            {
+                auto itRunEnd = std::next( itIn );
+                while ( itRunEnd != base_type::end() && !m_less( *itIn, *itRunEnd ) )
+                    ++itRunEnd;
+                auto &kv = bAssignExisting ? *std::prev( itRunEnd ) : *itIn;
+                itOld = std::lower_bound( itOld, itMid, kv, m_less );
+                if ( itOld != itMid && !m_less( kv, *itOld ) )
+                {
+                    if constexpr ( !is_set )
+                        if ( bAssignExisting )
+                            get_mapped( *itOld ) = std::move( get_mapped( kv ) );
+                }
+                else if ( &*itOut != &kv )
+                    *itOut++ = std::move( kv );
+                else
+                    ++itOut;
+                itIn = itRunEnd;
+            }
+            base_type::erase( itOut, base_type::end() );
+        }
+        const auto itNewMid = base_type::begin() + nOld;
+        if ( nOld != 0 && itNewMid != base_type::end() && m_less( *itNewMid, *std::prev( itNewMid ) ) ) // appending needs no merge.
+            std::inplace_merge( base_type::begin(), itNewMid, base_type::end(), m_less );
+        return size() - nOld;
+    }
+
+    /// \brief erase all elements satisfying pred( value ) in one pass.
+    /// \return number of elements erased.
+    template<class Pred>
+    size_t bulk_erase( Pred &&pred )
+    {
+        const auto n = size();
+        base_type::erase( std::remove_if( base_type::begin(), base_type::end(), std::forward<Pred>( pred ) ), base_type::end() );
+        return n - size();
     }
 
     this_type &operator+=( const this_type &a )
@@ -199,7 +264,7 @@ public:
     void erase( const K &k )
     {
         auto p = equal_range( k );
-        base_type::erase( p.first, p.second );
+        erase_at( p.first, p.second );
     }
 
     template<class KT>
@@ -272,18 +337,18 @@ public:
         auto it = lower_bound( get_key( val ) );
         if constexpr ( is_multi_map )
         {
-            return {*base_type::insert( it, val ), true};
+            return {insert_at( it, val ), true};
         }
         else
         {
             if ( it != base_type::end() && !m_less( val, *it ) )
             {
                 if constexpr ( !is_set )
-                    get_mapped( *it ) = val;
+                    get_mapped( *it ) = get_mapped( val );
                 return {it, false};
             }
             if ( bInsertIfNotFound )
-                return {*base_type::insert( it, val ), true};
+                return {insert_at( it, val ), true};
             return {base_type::end(), false};
         }
     }
@@ -293,7 +358,7 @@ public:
         auto it = lower_bound( get_key( val ) );
         if constexpr ( is_multi_map )
         {
-            return {*base_type::insert( it, std::move( val ) ), true};
+            return {insert_at( it, std::move( val ) ), true};
         }
         else
         {
@@ -304,7 +369,7 @@ public:
                 return {it, false};
             }
             if ( bInsertIfNotFound )
-                return {base_type::insert( it, std::move( val ) ), true};
+                return {insert_at( it, std::move( val ) ), true};
             return {base_type::end(), false};
         }
     }
@@ -314,14 +379,14 @@ public:
         auto it = lower_bound( get_key( val ) );
         if constexpr ( is_multi_map )
         {
-            return {base_type::insert( it, val ), true};
+            return {insert_at( it, val ), true};
         }
         else
         {
             if ( it != base_type::end() && !m_less( val, *it ) )
                 return {iterator{}, false};
             else
-                return {base_type::insert( it, val ), true};
+                return {insert_at( it, val ), true};
         }
     }
 
@@ -343,12 +408,12 @@ public:
     }
 
     template<class Iter>
-    int compare_sorted( Iter it, Iter itEnd )
+    int compare_sorted( Iter it, Iter itEnd ) const
     {
         return lexico_compare( base_type::begin(), base_type::end(), it, itEnd );
     }
     template<class AnyCollection>
-    int compare( const AnyCollection &a )
+    int compare( const AnyCollection &a ) const
     {
         return compare_sorted( a.begin(), a.end() );
     }
@@ -365,6 +430,53 @@ public:
     }
 
 protected:
+    /// Relocatable, but not trivially copyable elements (eg. pairs holding heap strings) of a std::vector are shifted by memmove,
+    /// instead of being move assigned one by one. std::vector already memmoves trivially copyable elements.
+    static constexpr bool shift_by_memmove = is_trivially_relocatable_v<value_type> && !std::is_trivially_copyable_v<value_type> &&
+                                             std::is_same_v<Vector, std::vector<value_type, allocator_type>>;
+
+    template<class Arg>
+    iterator insert_at( iterator it, Arg &&val )
+    {
+        if constexpr ( shift_by_memmove )
+        {
+            // append, then rotate the new element to its position bitwise.
+            const auto pos = it - base_type::begin();
+            base_type::emplace_back( std::forward<Arg>( val ) );
+            auto p = base_type::data() + pos;
+            if ( const size_t nTail = size() - 1 - pos )
+            {
+                alignas( value_type ) unsigned char buf[sizeof( value_type )];
+                std::memcpy( buf, static_cast<void *>( p + nTail ), sizeof( value_type ) );
+                std::memmove( static_cast<void *>( p + 1 ), static_cast<void *>( p ), nTail * sizeof( value_type ) );
+                std::memcpy( static_cast<void *>( p ), buf, sizeof( value_type ) );
+            }
+            return base_type::begin() + pos;
+        }
+        else
+            return base_type::insert( it, std::forward<Arg>( val ) );
+    }
+
+    void erase_at( iterator it, iterator itEnd )
+    {
+        if constexpr ( shift_by_memmove )
+        {
+            if ( std::distance( it, itEnd ) == 1 )
+            {
+                // rotate the erased element to the back bitwise, then pop it.
+                auto p = &*it;
+                const size_t nTail = base_type::end() - itEnd;
+                alignas( value_type ) unsigned char buf[sizeof( value_type )];
+                std::memcpy( buf, static_cast<void *>( p ), sizeof( value_type ) );
+                std::memmove( static_cast<void *>( p ), static_cast<void *>( p + 1 ), nTail * sizeof( value_type ) );
+                std::memcpy( static_cast<void *>( p + nTail ), buf, sizeof( value_type ) );
+                base_type::pop_back();
+                return;
+            }
+        }
+        base_type::erase( it, itEnd );
+    }
+
     static constexpr const K &get_key( const value_type &kv )
     {
         if constexpr ( is_set )
@@ -376,6 +488,17 @@ protected:
             return kv.first;
         }
     }
+    static constexpr const mapped_type &get_mapped( const value_type &kv )
+    {
+        if constexpr ( is_set )
+        {
+            return kv;
+        }
+        else
+        {
+            return kv.second;
+        }
+    }
     static constexpr mapped_type &get_mapped( value_type &kv )
     {
         if constexpr ( is_set )
@@ -445,4 +568,611 @@ template<class K,
          class Vector = std::vector<KVPair<K, void>, Allocator>>
 using FlatOrderedMultiSet = FlatOrderedMapBase<K, void, true, LessThan, Vector>;
 
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// Search in sorted key arrays.
+/// - simd_lower_bound: branchless binary search down to a 128-byte block, then count keys less than k with SSE2/AVX2 compares.
+///   For arithmetic keys of 4 or 8 bytes ordered by operator<.
+/// - branchless_lower_bound: the same without SIMD, for any key and comparator.
+/// - eytzinger_lower_bound: search in Eytzinger (BFS) order, where the next levels of a probe share a cache line that is prefetched.
+
+template<class K>
+constexpr bool is_simd_key_v = std::is_arithmetic_v<K> && !std::is_same_v<K, bool> && ( sizeof( K ) == 4 || sizeof( K ) == 8 );
+
+/// \brief LessThan orders K by operator<.
+template<class LessT, class K>
+constexpr bool is_natural_less_v = std::is_same_v<LessT, std::less<K>> || std::is_same_v<LessT, std::less<>> || std::is_same_v<LessT, Less> ||
+                                   std::is_same_v<LessT, LessThanOther<K>> || std::is_same_v<LessT, LessThan<K, K>>;
+
+/// \brief number of keys in [p, p+n) less than k. Keys that aren't is_simd_key_v are counted by a scalar loop.
+template<class K>
+std::size_t simd_count_less( const K *p, std::size_t n, const K k )
+{
+    std::size_t i = 0, cnt = 0;
+#if defined( __AVX2__ )
+    if constexpr ( std::is_same_v<K, float> )
+    {
+        const auto vk = _mm256_set1_ps( k );
+        for ( ; i + 8 <= n; i += 8 )
+            cnt += __builtin_popcount( _mm256_movemask_ps( _mm256_cmp_ps( _mm256_loadu_ps( p + i ), vk, _CMP_LT_OQ ) ) );
+    }
+    else if constexpr ( std::is_same_v<K, double> )
+    {
+        const auto vk = _mm256_set1_pd( k );
+        for ( ; i + 4 <= n; i += 4 )
+            cnt += __builtin_popcount( _mm256_movemask_pd( _mm256_cmp_pd( _mm256_loadu_pd( p + i ), vk, _CMP_LT_OQ ) ) );
+    }
+    else if constexpr ( sizeof( K ) == 4 && std::is_integral_v<K> )
+    {
+        // unsigned keys are compared as signed after flipping the sign bit.
+        const auto bias = _mm256_set1_epi32( std::is_signed_v<K> ? 0 : INT32_MIN );
+        const auto vk = _mm256_xor_si256( _mm256_set1_epi32( std::int32_t( k ) ), bias );
+        for ( ; i + 8 <= n; i += 8 )
+        {
+            auto v = _mm256_xor_si256( _mm256_loadu_si256( reinterpret_cast<const __m256i *>( p + i ) ), bias );
+            cnt += __builtin_popcount( _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpgt_epi32( vk, v ) ) ) );
+        }
+    }
+    else if constexpr ( sizeof( K ) == 8 && std::is_integral_v<K> )
+    {
+        const auto bias = _mm256_set1_epi64x( std::is_signed_v<K> ? 0 : INT64_MIN );
+        const auto vk = _mm256_xor_si256( _mm256_set1_epi64x( std::int64_t( k ) ), bias );
+        for ( ; i + 4 <= n; i += 4 )
+        {
+            auto v = _mm256_xor_si256( _mm256_loadu_si256( reinterpret_cast<const __m256i *>( p + i ) ), bias );
+            cnt += __builtin_popcount( _mm256_movemask_pd( _mm256_castsi256_pd( _mm256_cmpgt_epi64( vk, v ) ) ) );
+        }
+    }
+#elif defined( __SSE2__ )
+    if constexpr ( std::is_same_v<K, float> )
+    {
+        const auto vk = _mm_set1_ps( k );
+        for ( ; i + 4 <= n; i += 4 )
+            cnt += __builtin_popcount( _mm_movemask_ps( _mm_cmplt_ps( _mm_loadu_ps( p + i ), vk ) ) );
+    }
+    else if constexpr ( std::is_same_v<K, double> )
+    {
+        const auto vk = _mm_set1_pd( k );
+        for ( ; i + 2 <= n; i += 2 )
+            cnt += __builtin_popcount( _mm_movemask_pd( _mm_cmplt_pd( _mm_loadu_pd( p + i ), vk ) ) );
+    }
+    else if constexpr ( sizeof( K ) == 4 && std::is_integral_v<K> )
+    {
+        const auto bias = _mm_set1_epi32( std::is_signed_v<K> ? 0 : INT32_MIN );
+        const auto vk = _mm_xor_si128( _mm_set1_epi32( std::int32_t( k ) ), bias );
+        for ( ; i + 4 <= n; i += 4 )
+        {
+            auto v = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i *>( p + i ) ), bias );
+            cnt += __builtin_popcount( _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpgt_epi32( vk, v ) ) ) );
+        }
+    }
+#if defined( __SSE4_2__ )
+    else if constexpr ( sizeof( K ) == 8 && std::is_integral_v<K> )
+    {
+        const auto bias = _mm_set1_epi64x( std::is_signed_v<K> ? 0 : INT64_MIN );
+        const auto vk = _mm_xor_si128( _mm_set1_epi64x( std::int64_t( k ) ), bias );
+        for ( ; i + 2 <= n; i += 2 )
+        {
+            auto v = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i *>( p + i ) ), bias );
+            cnt += __builtin_popcount( _mm_movemask_pd( _mm_castsi128_pd( _mm_cmpgt_epi64( vk, v ) ) ) );
+        }
+    }
+#endif
+#endif
+    for ( ; i < n; ++i ) // tail, or all keys without SIMD support.
+        cnt += p[i] < k;
+    return cnt;
+}
+
+/// \return index of the first key in sorted [keys, keys+n) not less than k.
+template<class K>
+std::size_t simd_lower_bound( const K *keys, std::size_t n, const K &k )
+{
+    constexpr std::size_t BLOCK = 128 / sizeof( K );
+    // invariant: the result is in [base, base+n].
+    auto base = keys;
+    while ( n > BLOCK )
+    {
+        const auto half = n / 2;
+        base = base[half] < k ? base + half : base; // cmov
+        n -= half;
+    }
+    return std::size_t( base - keys ) + simd_count_less( base, n, k );
+}
+
+/// \return index of the first key in sorted [keys, keys+n) for which less( key, k ) is false.
+template<class K, class KT, class LessT>
+std::size_t branchless_lower_bound( const K *keys, std::size_t n, const KT &k, const LessT &less )
+{
+    if ( n == 0 )
+        return 0;
+    auto base = keys;
+    while ( n > 1 )
+    {
+        const auto half = n / 2;
+        base = less( base[half], k ) ? base + half : base;
+        n -= half;
+    }
+    return std::size_t( base - keys ) + less( *base, k );
+}
+
+/// \param eyt keys in Eytzinger order, 1-based: children of eyt[i] are eyt[2i] and eyt[2i+1].
+/// \return Eytzinger index of the first key not less than k, 0 if there is none.
+template<class K, class KT, class LessT>
+std::size_t eytzinger_lower_bound( const K *eyt, std::size_t n, const KT &k, const LessT &less )
+{
+    constexpr std::size_t PREFETCH_STRIDE = std::max<std::size_t>( 64 / sizeof( K ), 1 ); // descendants 4 levels down for 4-byte keys.
+    std::size_t i = 1;
+    while ( i <= n )
+    {
+        __builtin_prefetch( eyt + i * PREFETCH_STRIDE ); // doesn't fault past the end.
+        i = 2 * i + less( eyt[i], k );
+    }
+    // the path went right at the trailing 1 bits, the answer is where it last went left.
+    return i >> ( __builtin_ctzll( ~i ) + 1 );
+}
+
+enum class KeyLayout
+{
+    Sorted, // keys in sorted order.
+    Eytzinger, // plus a copy of keys in Eytzinger order for lookup, rebuilt at every insert/erase.
+};
+
+/// \brief FlatSplitMap: sorted map with keys and values in separate arrays, so lookups touch only keys.
+/// Arithmetic keys ordered by operator< are searched with simd_lower_bound. Other keys use branchless_lower_bound.
+/// KeyLayout::Eytzinger speeds up lookups in maps larger than cache, at the cost of O(n) rebuild per insert/erase.
+/// Iterators are in key order and invalidated by insert/erase. *it is std::pair<const K&, V&>.
+template<class K,
+         class V,
+         class LessThan = std::less<K>,
+         KeyLayout Layout = KeyLayout::Sorted,
+         class KeyAllocator = std::allocator<K>,
+         class ValueAllocator = std::allocator<V>>
+class FlatSplitMap
+{
+    static constexpr bool use_simd = is_simd_key_v<K> && is_natural_less_v<LessThan, K>;
+
+public:
+    using key_type = K;
+    using mapped_type = V;
+    using size_type = std::size_t;
+    using key_compare = LessThan;
+    using key_container = std::vector<K, KeyAllocator>;
+    using value_container = std::vector<V, ValueAllocator>;
+
+    template<bool IsConst>
+    class Iterator
+    {
+        using map_type = std::conditional_t<IsConst, const FlatSplitMap, FlatSplitMap>;
+        using mapped_ref = std::conditional_t<IsConst, const V &, V &>;
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = std::pair<const K &, mapped_ref>;
+        using reference = value_type;
+        struct pointer
+        {
+            value_type kv;
+            const value_type *operator->() const
+            {
+                return &kv;
+            }
+        };
+
+        Iterator() = default;
+        Iterator( map_type *pMap, size_type i ) : m_pMap( pMap ), m_i( i )
+        {
+        }
+        template<bool C = IsConst, typename = std::enable_if_t<C>>
+        Iterator( const Iterator<false> &it ) : m_pMap( it.m_pMap ), m_i( it.m_i )
+        {
+        }
+
+        const K &key() const
+        {
+            return m_pMap->m_keys[m_i];
+        }
+        mapped_ref value() const
+        {
+            return m_pMap->m_values[m_i];
+        }
+        size_type index() const
+        {
+            return m_i;
+        }
+
+        reference operator*() const
+        {
+            return {key(), value()};
+        }
+        pointer operator->() const
+        {
+            return {**this};
+        }
+        reference operator[]( difference_type n ) const
+        {
+            return *( *this + n );
+        }
+
+        Iterator &operator++()
+        {
+            ++m_i;
+            return *this;
+        }
+        Iterator operator++( int )
+        {
+            return {m_pMap, m_i++};
+        }
+        Iterator &operator--()
+        {
+            --m_i;
+            return *this;
+        }
+        Iterator operator--( int )
+        {
+            return {m_pMap, m_i--};
+        }
+        Iterator &operator+=( difference_type n )
+        {
+            m_i += n;
+            return *this;
+        }
+        Iterator &operator-=( difference_type n )
+        {
+            m_i -= n;
+            return *this;
+        }
+        Iterator operator+( difference_type n ) const
+        {
+            return {m_pMap, m_i + n};
+        }
+        Iterator operator-( difference_type n ) const
+        {
+            return {m_pMap, m_i - n};
+        }
+        difference_type operator-( const Iterator &a ) const
+        {
+            return difference_type( m_i ) - difference_type( a.m_i );
+        }
+
+        bool operator==( const Iterator &a ) const
+        {
+            return m_i == a.m_i;
+        }
+        bool operator!=( const Iterator &a ) const
+        {
+            return m_i != a.m_i;
+        }
+        bool operator<( const Iterator &a ) const
+        {
+            return m_i < a.m_i;
+        }
+
+    private:
+        friend class Iterator<true>;
+        map_type *m_pMap = nullptr;
+        size_type m_i = 0;
+    };
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    FlatSplitMap( const LessThan &less = LessThan{}, const KeyAllocator &keyAlloc = KeyAllocator{}, const ValueAllocator &valueAlloc = ValueAllocator{} )
+        : m_keys( keyAlloc ), m_values( valueAlloc ), m_less( less )
+    {
+        rebuild_index();
+    }
+
+    FlatSplitMap( const std::initializer_list<std::pair<K, V>> &il, const LessThan &less = LessThan{} ) : m_less( less )
+    {
+        rebuild_index();
+        insert_bulk( il.begin(), il.end() );
+    }
+
+    size_type size() const
+    {
+        return m_keys.size();
+    }
+    bool empty() const
+    {
+        return m_keys.empty();
+    }
+    void reserve( size_type n )
+    {
+        m_keys.reserve( n );
+        m_values.reserve( n );
+    }
+    void clear()
+    {
+        m_keys.clear();
+        m_values.clear();
+        rebuild_index();
+    }
+
+    /// \brief keys in sorted order.
+    const key_container &keys() const
+    {
+        return m_keys;
+    }
+    /// \brief values in the order of keys().
+    const value_container &values() const
+    {
+        return m_values;
+    }
+
+    iterator begin()
+    {
+        return {this, 0};
+    }
+    iterator end()
+    {
+        return {this, size()};
+    }
+    const_iterator begin() const
+    {
+        return {this, 0};
+    }
+    const_iterator end() const
+    {
+        return {this, size()};
+    }
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+    const_iterator cend() const
+    {
+        return end();
+    }
+
+    /// \return index in keys() of the first key not less than k.
+    template<class KT>
+    size_type lower_bound_index( const KT &k ) const
+    {
+        if constexpr ( Layout == KeyLayout::Eytzinger )
+            return m_eytRank[eytzinger_lower_bound( m_eytKeys.data(), size(), k, m_less )];
+        // only for K itself: a transparent less compares other key types as they are, and K( k ) could truncate them.
+        else if constexpr ( use_simd && std::is_same_v<KT, K> )
+            return simd_lower_bound( m_keys.data(), size(), k );
+        else
+            return branchless_lower_bound( m_keys.data(), size(), k, m_less );
+    }
+
+    template<class KT>
+    iterator lower_bound( const KT &k )
+    {
+        return {this, lower_bound_index( k )};
+    }
+    template<class KT>
+    const_iterator lower_bound( const KT &k ) const
+    {
+        return {this, lower_bound_index( k )};
+    }
+
+    template<class KT>
+    iterator upper_bound( const KT &k )
+    {
+        return {this, upper_bound_index( k )};
+    }
+    template<class KT>
+    const_iterator upper_bound( const KT &k ) const
+    {
+        return {this, upper_bound_index( k )};
+    }
+
+    template<class KT>
+    iterator find( const KT &k )
+    {
+        return {this, find_index( k )};
+    }
+    template<class KT>
+    const_iterator find( const KT &k ) const
+    {
+        return {this, find_index( k )};
+    }
+
+    template<class KT>
+    bool contains( const KT &k ) const
+    {
+        return find_index( k ) != size();
+    }
+    template<class KT>
+    size_type count( const KT &k ) const
+    {
+        return contains( k );
+    }
+
+    // throws std::out_of_range
+    const V &at( const K &k ) const
+    {
+        auto i = find_index( k );
+        if ( i == size() )
+            throw std::out_of_range( "No key vale" );
+        return m_values[i];
+    }
+    V &at( const K &k )
+    {
+        return const_cast<V &>( static_cast<const FlatSplitMap *>( this )->at( k ) );
+    }
+
+    V &operator[]( const K &k )
+    {
+        return try_emplace( k ).first.value();
+    }
+
+    /// \return <iterator points to k, Inserted>.
+    template<class... Args>
+    std::pair<iterator, bool> try_emplace( const K &k, Args &&... args )
+    {
+        auto i = lower_bound_index( k );
+        if ( i != size() && !m_less( k, m_keys[i] ) )
+            return {{this, i}, false};
+        m_values.emplace( m_values.begin() + i, std::forward<Args>( args )... );
+        m_keys.insert( m_keys.begin() + i, k );
+        rebuild_index();
+        return {{this, i}, true};
+    }
+
+    std::pair<iterator, bool> insert( const K &k, const V &v )
+    {
+        return try_emplace( k, v );
+    }
+    std::pair<iterator, bool> insert( const std::pair<K, V> &kv )
+    {
+        return try_emplace( kv.first, kv.second );
+    }
+
+    template<class VT>
+    std::pair<iterator, bool> insert_or_assign( const K &k, VT &&v )
+    {
+        auto res = try_emplace( k, std::forward<VT>( v ) );
+        if ( !res.second )
+            res.first.value() = std::forward<VT>( v );
+        return res;
+    }
+
+    iterator erase( iterator it )
+    {
+        return erase( const_iterator( it ) );
+    }
+    iterator erase( const_iterator it )
+    {
+        const auto i = it.index();
+        m_keys.erase( m_keys.begin() + i );
+        m_values.erase( m_values.begin() + i );
+        rebuild_index();
+        return {this, i};
+    }
+
+    template<class KT>
+    size_type erase( const KT &k )
+    {
+        auto i = find_index( k );
+        if ( i == size() )
+            return 0;
+        erase( const_iterator{this, i} );
+        return 1;
+    }
+
+    /// \brief insert a batch of key-value pairs with one sort and one linear merge into new arrays, see FlatOrderedMapBase::insert_bulk().
+    /// \return number of elements inserted.
+    template<class InputIter>
+    size_type insert_bulk( InputIter it, InputIter itEnd, bool bAssignExisting = false )
+    {
+        std::vector<std::pair<K, V>> batch( it, itEnd );
+        std::stable_sort( batch.begin(), batch.end(), [&]( const auto &a, const auto &b ) { return m_less( a.first, b.first ); } );
+
+        key_container keys( m_keys.get_allocator() );
+        value_container values( m_values.get_allocator() );
+        keys.reserve( size() + batch.size() );
+        values.reserve( size() + batch.size() );
+        size_type i = 0, nInserted = 0;
+        auto moveOld = [&]( size_type iEnd ) {
+            for ( ; i < iEnd; ++i )
+            {
+                keys.push_back( std::move( m_keys[i] ) );
+                values.push_back( std::move( m_values[i] ) );
+            }
+        };
+        for ( auto itIn = batch.begin(); itIn != batch.end(); )
+        {
+            auto itRunEnd = std::next( itIn );
+            while ( itRunEnd != batch.end() && !m_less( itIn->first, itRunEnd->first ) )
+                ++itRunEnd;
+            auto &kv = bAssignExisting ? *std::prev( itRunEnd ) : *itIn;
+            moveOld( size_type( std::lower_bound( m_keys.begin() + i, m_keys.end(), kv.first, m_less ) - m_keys.begin() ) );
+            if ( i < size() && !m_less( kv.first, m_keys[i] ) )
+            {
+                if ( bAssignExisting )
+                    m_values[i] = std::move( kv.second );
+            }
+            else
+            {
+                keys.push_back( std::move( kv.first ) );
+                values.push_back( std::move( kv.second ) );
+                ++nInserted;
+            }
+            itIn = itRunEnd;
+        }
+        moveOld( size() );
+        m_keys.swap( keys );
+        m_values.swap( values );
+        rebuild_index();
+        return nInserted;
+    }
+
+    /// \brief erase all elements satisfying pred( std::pair<const K&, V&> ) in one pass.
+    /// \return number of elements erased.
+    template<class Pred>
+    size_type bulk_erase( Pred &&pred )
+    {
+        size_type nKept = 0;
+        for ( size_type i = 0; i < size(); ++i )
+        {
+            typename iterator::value_type kv{m_keys[i], m_values[i]};
+            if ( pred( kv ) )
+                continue;
+            if ( nKept != i )
+            {
+                m_keys[nKept] = std::move( m_keys[i] );
+                m_values[nKept] = std::move( m_values[i] );
+            }
+            ++nKept;
+        }
+        const auto n = size() - nKept;
+        m_keys.erase( m_keys.begin() + nKept, m_keys.end() );
+        m_values.erase( m_values.begin() + nKept, m_values.end() );
+        rebuild_index();
+        return n;
+    }
+
+    void swap( FlatSplitMap &a )
+    {
+        std::swap( *this, a );
+    }
+
+protected:
+    template<class KT>
+    size_type find_index( const KT &k ) const
+    {
+        auto i = lower_bound_index( k );
+        return ( i != size() && !m_less( k, m_keys[i] ) ) ? i : size();
+    }
+
+    template<class KT>
+    size_type upper_bound_index( const KT &k ) const
+    {
+        return size_type( std::upper_bound( m_keys.begin(), m_keys.end(), k, m_less ) - m_keys.begin() );
+    }
+
+    void rebuild_index()
+    {
+        if constexpr ( Layout == KeyLayout::Eytzinger )
+        {
+            m_eytKeys.resize( size() + 1 );
+            m_eytRank.resize( size() + 1 );
+            m_eytRank[0] = std::uint32_t( size() ); // not found.
+            size_type rank = 0;
+            build_eytzinger( 1, rank );
+        }
+    }
+
+    // in-order traversal of the implicit tree visits keys in sorted order.
+    void build_eytzinger( size_type i, size_type &rank )
+    {
+        if ( i > size() )
+            return;
+        build_eytzinger( 2 * i, rank );
+        m_eytKeys[i] = m_keys[rank];
+        m_eytRank[i] = std::uint32_t( rank++ );
+        build_eytzinger( 2 * i + 1, rank );
+    }
+
+    key_container m_keys;
+    value_container m_values;
+    key_container m_eytKeys; // 1-based Eytzinger order, only for KeyLayout::Eytzinger.
+    std::vector<std::uint32_t> m_eytRank; // index in m_keys of m_eytKeys[i]; m_eytRank[0] is size().
+    LessThan m_less;
+};
+
 } // namespace ftl
@@ -16,10 +16,13 @@
  */
 
 #ifndef _INDEXED_TREE_H_
-#define _INDEXED_TREE_
+#define _INDEXED_TREE_H_
 
-#include <vector>
+#include <cassert>
+#include <cstddef>
 #include <functional>
+#include <iterator>
+#include <vector>
 
 // https://www.topcoder.com/community/data-science/data-science-tutorials/binary-indexed-trees/
 /*
@@ -41,6 +44,47 @@ This works well if the number of query operations are large and very few updates
 namespace ftl
 {
 
+namespace internal
+{
+    // Fenwick arrays below are 1-based, t[0] is unused, t[1..n] are nodes.
+
+    inline size_t lowbit( size_t i )
+    {
+        return i & ( 0 - i );
+    }
+
+    /// \brief turn values t[1..n] into a Fenwick array in O(n): each node pushes its range into its parent.
+    template<typename T, typename AccFunc>
+    void fenwick_build( T *t, size_t n, const AccFunc &acc )
+    {
+        for ( size_t i = 1; i <= n; ++i )
+        {
+            const size_t j = i + lowbit( i );
+            if ( j <= n )
+                t[j] = acc( t[i], t[j] );
+        }
+    }
+
+    template<typename T, typename AccFunc>
+    void fenwick_add( T *t, size_t n, size_t pos, const T &v, const AccFunc &acc )
+    {
+        for ( ; pos <= n; pos += lowbit( pos ) ) // add the last digit 1 to get higher level position.
+            t[pos] = acc( v, t[pos] );
+    }
+
+    /// \return the accumulation of the first pos values.
+    template<typename T, typename AccFunc>
+    T fenwick_prefix( const T *t, size_t pos, const AccFunc &acc )
+    {
+        T sum = T();
+        for ( ; pos > 0; pos &= pos - 1 ) // remove last bit 1 to get parent position.
+            sum = acc( t[pos], sum );
+        return sum;
+    }
+} // namespace internal
+
+/// \brief indexed_tree: point update, prefix query.
+/// AccType must be associative and commutative, with ValueType() as its identity, eg. std::plus.
 template<typename ValueType, typename AccType = std::plus<ValueType>, typename ContainerType = std::vector<ValueType>>
 class indexed_tree
 {
@@ -68,40 +112,37 @@ public:
         construct( it, N );
     }
 
+    size_t size() const
+    {
+        return biTree.size() - 1;
+    }
+    /// \brief new elements are ValueType().
     void resize( size_t size )
     {
         biTree.resize( size + 1 );
     }
     void add( size_t pos, const ValueType &v )
     {
+        assert( pos < size() );
         // index in BITree[] is 1 more than the index in arr[]
-        ++pos;
-        const size_t N = biTree.size();
-        while ( pos <= N )
-        {
-            biTree[pos] = accFunc( v, biTree[pos] );
-            pos += pos & ( -pos ); // add the last digit 1 to get higher level position.
-        }
+        internal::fenwick_add( biTree.data(), size(), pos + 1, v, accFunc );
     }
 
+    /// \brief replace all elements by N values from it, in O(N).
     template<typename Iterator>
     void construct( Iterator it, const size_t N = 0 )
     {
-        resize( N );
-        for ( size_t i = 0; i < N; ++i, ++it )
-        {
-            add( i, *it );
-        }
+        biTree.resize( N + 1 );
+        biTree[0] = ValueType();
+        for ( size_t i = 1; i <= N; ++i, ++it )
+            biTree[i] = *it;
+        internal::fenwick_build( biTree.data(), N, accFunc );
     }
 
     template<typename Iterator>
     void construct( Iterator it, Iterator itEnd )
     {
-        resize( std::distance( it, itEnd ) );
-        for ( size_t i = 0; it != itEnd; ++it, ++i )
-        {
-            add( i, *it );
-        }
+        construct( it, size_t( std::distance( it, itEnd ) ) );
     }
 
     // Returns sum of arr[0..index]. This function assumes
@@ -109,14 +150,18 @@ public:
     // array elements are stored in BITree[].
     ValueType getResult( size_t n ) const
     {
-        ValueType sum;
-        ++n;
-        while ( n > 0 )
-        {
-            sum = accFunc( biTree[n], sum );
-            n -= n & ( -n ); // remove last bit 1 to get parent position.
-        }
-        return sum;
+        assert( n < size() );
+        return internal::fenwick_prefix( biTree.data(), n + 1, accFunc );
+    }
+
+    /// \brief batched getResult: *out++ = getResult( i ) for each i in [first, last).
+    /// Queries are independent, so out-of-order cores already overlap their cache misses.
+    template<typename IndexIterator, typename OutputIterator>
+    OutputIterator getResults( IndexIterator first, IndexIterator last, OutputIterator out ) const
+    {
+        for ( ; first != last; ++first )
+            *out++ = getResult( size_t( *first ) );
+        return out;
     }
 
     ContainerType &getBiTree()
@@ -125,8 +170,181 @@ public:
     }
 };
 
+/// \brief range_indexed_tree: add a value to a range of elements and query sums of ranges, both in O(log n).
+/// Keeps two Fenwick arrays of the differences d[j] = a[j] - a[j-1] and of d[j] * j, then
+/// sum( a[0..i] ) = ( i + 1 ) * sum( d[0..i] ) - sum( d[j] * j, j <= i ).
+/// ValueType is arithmetic-like, with +, -, * and conversion from size_t.
+template<typename ValueType>
+class range_indexed_tree
+{
+public:
+    using value_type = ValueType;
+
+    explicit range_indexed_tree( size_t size = 0 ) : m_diff( size + 1 ), m_diffIdx( size + 1 )
+    {
+    }
+    template<typename Iterator>
+    range_indexed_tree( Iterator first, Iterator last )
+    {
+        assign( first, last );
+    }
+
+    size_t size() const
+    {
+        return m_diff.size() - 1;
+    }
+
+    /// \brief replace all elements by [first, last), in O(n).
+    template<typename Iterator>
+    void assign( Iterator first, Iterator last )
+    {
+        const size_t n = size_t( std::distance( first, last ) );
+        m_diff.assign( n + 1, ValueType() );
+        m_diffIdx.assign( n + 1, ValueType() );
+        ValueType prev = ValueType();
+        for ( size_t j = 1; j <= n; ++j, ++first )
+        {
+            const ValueType v = *first;
+            m_diff[j] = v - prev;
+            m_diffIdx[j] = m_diff[j] * ValueType( j - 1 );
+            prev = v;
+        }
+        internal::fenwick_build( m_diff.data(), n, std::plus<>() );
+        internal::fenwick_build( m_diffIdx.data(), n, std::plus<>() );
+    }
+
+    /// \brief add v to elements [first, last].
+    void range_add( size_t first, size_t last, const ValueType &v )
+    {
+        assert( first <= last && last < size() );
+        add_diff( first, v );
+        if ( last + 1 < size() )
+            add_diff( last + 1, ValueType() - v );
+    }
+    void add( size_t pos, const ValueType &v )
+    {
+        range_add( pos, pos, v );
+    }
+
+    /// \return sum of elements [0, pos].
+    ValueType prefix_sum( size_t pos ) const
+    {
+        assert( pos < size() );
+        return ValueType( pos + 1 ) * internal::fenwick_prefix( m_diff.data(), pos + 1, std::plus<>() )
+               - internal::fenwick_prefix( m_diffIdx.data(), pos + 1, std::plus<>() );
+    }
+    /// \return sum of elements [first, last].
+    ValueType range_sum( size_t first, size_t last ) const
+    {
+        assert( first <= last );
+        return first ? prefix_sum( last ) - prefix_sum( first - 1 ) : prefix_sum( last );
+    }
+    ValueType operator[]( size_t pos ) const
+    {
+        return range_sum( pos, pos );
+    }
+
+protected:
+    void add_diff( size_t pos, const ValueType &v )
+    {
+        internal::fenwick_add( m_diff.data(), size(), pos + 1, v, std::plus<>() );
+        internal::fenwick_add( m_diffIdx.data(), size(), pos + 1, ValueType( v * ValueType( pos ) ), std::plus<>() );
+    }
+
+    std::vector<ValueType> m_diff, m_diffIdx;
+};
+
+/// \brief indexed_tree_2d: point update and rectangle sum on a rows x cols grid, both in O(log rows * log cols), eg. volume by
+/// price level x time bucket.
+/// Nodes are stored row-major in one array, so assign() builds in O(rows * cols) with contiguous row additions the compiler vectorizes.
+template<typename ValueType>
+class indexed_tree_2d
+{
+public:
+    using value_type = ValueType;
+
+    indexed_tree_2d( size_t rows = 0, size_t cols = 0 )
+    {
+        resize( rows, cols );
+    }
+
+    size_t rows() const
+    {
+        return m_rows;
+    }
+    size_t cols() const
+    {
+        return m_cols;
+    }
+    /// \brief resize to rows x cols zeros.
+    void resize( size_t rows, size_t cols )
+    {
+        m_rows = rows;
+        m_cols = cols;
+        m_tree.assign( ( rows + 1 ) * ( cols + 1 ), ValueType() );
+    }
+
+    /// \brief replace all elements by rows x cols values in row-major order from it, in O(rows * cols).
+    template<typename Iterator>
+    void assign( size_t rows, size_t cols, Iterator it )
+    {
+        resize( rows, cols );
+        const size_t stride = cols + 1;
+        for ( size_t r = 1; r <= rows; ++r )
+        {
+            ValueType *row = &m_tree[r * stride];
+            for ( size_t c = 1; c <= cols; ++c, ++it )
+                row[c] = *it;
+            internal::fenwick_build( row, cols, std::plus<>() );
+        }
+        for ( size_t r = 1; r <= rows; ++r ) // then build the columns, a whole row at a time.
+        {
+            const size_t parent = r + internal::lowbit( r );
+            if ( parent <= rows )
+            {
+                const ValueType *src = &m_tree[r * stride];
+                ValueType *dst = &m_tree[parent * stride];
+                for ( size_t c = 1; c <= cols; ++c )
+                    dst[c] += src[c];
+            }
+        }
+    }
+
+    void add( size_t row, size_t col, const ValueType &v )
+    {
+        assert( row < m_rows && col < m_cols );
+        for ( size_t r = row + 1; r <= m_rows; r += internal::lowbit( r ) )
+            internal::fenwick_add( &m_tree[r * ( m_cols + 1 )], m_cols, col + 1, v, std::plus<>() );
+    }
+
+    /// \return sum of elements [0, row] x [0, col].
+    ValueType prefix_sum( size_t row, size_t col ) const
+    {
+        assert( row < m_rows && col < m_cols );
+        return prefix( row + 1, col + 1 );
+    }
+    /// \return sum of elements [row0, row1] x [col0, col1].
+    ValueType range_sum( size_t row0, size_t col0, size_t row1, size_t col1 ) const
+    {
+        assert( row0 <= row1 && row1 < m_rows && col0 <= col1 && col1 < m_cols );
+        return prefix( row1 + 1, col1 + 1 ) - prefix( row0, col1 + 1 ) - prefix( row1 + 1, col0 ) + prefix( row0, col0 );
+    }
+
+protected:
+    // sum of the first nrows x ncols elements.
+    ValueType prefix( size_t nrows, size_t ncols ) const
+    {
+        ValueType sum = ValueType();
+        for ( size_t r = nrows; r > 0; r &= r - 1 )
+            sum += internal::fenwick_prefix( &m_tree[r * ( m_cols + 1 )], ncols, std::plus<>() );
+        return sum;
+    }
+
+    std::vector<ValueType> m_tree; // ( rows + 1 ) x ( cols + 1 ), row 0 and column 0 unused.
+    size_t m_rows = 0, m_cols = 0;
+};
 
 } // namespace ftl
 
 
-#endif //
+#endif // _INDEXED_TREE_H_
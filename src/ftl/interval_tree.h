@@ -1,29 +1,528 @@
-#ifndef INTERVAL_TREE_H
-#define INTERVAL_TREE_H
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2018 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
 
+#pragma once
+#include <ftl/binary_search_tree.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <tuple>
 #include <utility>
-#include <binary_search_tree.h>
+#include <vector>
 
 namespace ftl
 {
 
-// {start: <end, max>}
-template<typename ValueType, typename KeyCompare = std::less<ValueType>>
-class interval_tree : public binary_search_tree<ValueType, std::pair<ValueType, ValueType>>
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief interval_tree: AVL tree of closed intervals [lo, hi] ordered by lo, each node augmented with the max hi of its subtree, eg.
+/// time windows or price bands of orders.
+/// - Insert and erase are O(log n). Overlap and stabbing queries skip subtrees ending before the query, O(log n + k log n) worst case
+///   for k results. See static_interval_tree for O(log n + k) queries of a bulk-built set.
+/// - Nodes are allocated from an ObjectPool owned by the tree, created at the first insert.
+/// - assign( first, last ) bulk-builds a perfectly balanced tree, O(n) if the range is sorted by lo.
+/// Intervals with the same lo are kept in insertion order. Not thread-safe.
+template<typename KeyType, typename ValueType, typename KeyCompare = std::less<KeyType>>
+class interval_tree
 {
 public:
-    typedef binary_search_tree<ValueType, std::pair<ValueType, ValueType>> SuperType;
-    typedef typename SuperType::Node Node;
-    typedef typename SuperType::iterator iterator;
-    typedef typename SuperType::value_type value_type;
+    using key_type = KeyType;
+    using interval_type = std::pair<KeyType, KeyType>; // closed [first, second].
+    using value_type = std::pair<const interval_type, ValueType>;
+    using size_type = std::size_t;
+    using key_compare = KeyCompare;
+
+protected:
+    enum
+    {
+        ILEFT = avl_algo::ILEFT,
+        IRIGHT = avl_algo::IRIGHT
+    };
+
+    struct Node : avl_hook
+    {
+        value_type kv;
+        KeyType maxHi; // max hi of the subtree.
 
-    typedef ValueType KeyType;
-    typedef std::pair<ValueType, ValueType> interval_type;
+        template<class... Args>
+        Node( const interval_type &iv, Args &&... args )
+            : kv( std::piecewise_construct, std::forward_as_tuple( iv ), std::forward_as_tuple( std::forward<Args>( args )... ) ),
+              maxHi( iv.second )
+        {
+        }
+    };
+
+    struct Traits
+    {
+        static value_type &value( Node &n )
+        {
+            return n.kv;
+        }
+        static const value_type &value( const Node &n )
+        {
+            return n.kv;
+        }
+    };
 
 public:
-    //	std::pair<value_type, bool> insert(const interval_type& aInterval) {
-    //	}
+    using iterator = avl_iterator<Node, Traits, false>;
+    using const_iterator = avl_iterator<Node, Traits, true>;
+
+    interval_tree( const KeyCompare &less = KeyCompare() ) : m_less( less )
+    {
+    }
+    template<class Iter>
+    interval_tree( Iter first, Iter last, const KeyCompare &less = KeyCompare() ) : m_less( less )
+    {
+        assign( first, last );
+    }
+    interval_tree( std::initializer_list<std::pair<interval_type, ValueType>> il, const KeyCompare &less = KeyCompare() ) : m_less( less )
+    {
+        assign( il.begin(), il.end() );
+    }
+    interval_tree( const interval_tree &a ) : m_less( a.m_less )
+    {
+        assign( a.begin(), a.end() );
+    }
+    interval_tree( interval_tree &&a ) : m_less( a.m_less )
+    {
+        swap( a );
+    }
+    interval_tree &operator=( const interval_tree &a )
+    {
+        if ( this != &a )
+            assign( a.begin(), a.end() );
+        return *this;
+    }
+    interval_tree &operator=( interval_tree &&a )
+    {
+        if ( this != &a )
+        {
+            clear();
+            swap( a );
+        }
+        return *this;
+    }
+    ~interval_tree()
+    {
+        clear();
+    }
+
+    void swap( interval_tree &a )
+    {
+        std::swap( m_pRoot, a.m_pRoot );
+        std::swap( m_size, a.m_size );
+        std::swap( m_less, a.m_less );
+        m_alloc.swap( a.m_alloc );
+    }
+
+    iterator begin()
+    {
+        return make_iterator( avl_algo::extreme( m_pRoot, ILEFT ) );
+    }
+    iterator end()
+    {
+        return make_iterator( nullptr );
+    }
+    const_iterator begin() const
+    {
+        return const_cast<interval_tree *>( this )->begin();
+    }
+    const_iterator end() const
+    {
+        return const_cast<interval_tree *>( this )->end();
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+    /// \brief height of the tree, 0 if empty.
+    int height() const
+    {
+        return avl_algo::height( m_pRoot );
+    }
+
+    /// \pre !( hi < lo ).
+    template<class... Args>
+    iterator emplace( const interval_type &iv, Args &&... args )
+    {
+        assert( !m_less( iv.second, iv.first ) );
+        Node *p = m_alloc.create( iv, std::forward<Args>( args )... );
+        avl_hook *q = m_pRoot, *parent = nullptr;
+        int i = ILEFT;
+        while ( q )
+        {
+            i = m_less( iv.first, node( q )->kv.first.first ) ? ILEFT : IRIGHT;
+            parent = q;
+            q = q->children[i];
+        }
+        avl_algo::link( m_pRoot, parent, i, p, augment() );
+        ++m_size;
+        return make_iterator( p );
+    }
+    iterator insert( const KeyType &lo, const KeyType &hi, const ValueType &v )
+    {
+        return emplace( interval_type( lo, hi ), v );
+    }
+    iterator insert( const std::pair<interval_type, ValueType> &kv )
+    {
+        return emplace( kv.first, kv.second );
+    }
+
+    /// \return iterator following the erased one.
+    iterator erase( const_iterator it )
+    {
+        auto p = const_cast<Node *>( it.node() );
+        assert( p );
+        auto pNext = avl_algo::next_node<avl_hook>( p, IRIGHT );
+        avl_algo::unlink( m_pRoot, p, augment() );
+        m_alloc.destroy( p );
+        --m_size;
+        return make_iterator( pNext );
+    }
+    /// \brief erase all intervals equal to iv.
+    /// \return number of erased intervals.
+    size_t erase( const interval_type &iv )
+    {
+        size_t n = 0;
+        for ( auto it = find( iv ); it != end() && equal( it->first, iv ); ++n )
+            it = erase( it );
+        return n;
+    }
+
+    /// \return the first interval equal to iv, or end().
+    iterator find( const interval_type &iv )
+    {
+        for ( auto it = lower_bound( iv.first ); it != end() && !m_less( iv.first, it->first.first ); ++it )
+            if ( equal( it->first, iv ) )
+                return it;
+        return end();
+    }
+    /// \return the first interval whose lo is not less than lo.
+    iterator lower_bound( const KeyType &lo )
+    {
+        return make_iterator( avl_algo::partition_point( m_pRoot, [&]( avl_hook *p ) { return m_less( node( p )->kv.first.first, lo ); } ) );
+    }
+
+    /// \brief call f( const value_type & ) for each interval overlapping [lo, hi], in order of lo.
+    /// \return number of overlapping intervals.
+    template<class F>
+    size_t for_each_overlap( const KeyType &lo, const KeyType &hi, F &&f ) const
+    {
+        return for_each_overlap( m_pRoot, lo, hi, f );
+    }
+    /// \brief call f( const value_type & ) for each interval containing x, in order of lo.
+    template<class F>
+    size_t for_each_stab( const KeyType &x, F &&f ) const
+    {
+        return for_each_overlap( m_pRoot, x, x, f );
+    }
+    /// \return any interval overlapping [lo, hi], or end(). O(log n).
+    iterator find_overlap( const KeyType &lo, const KeyType &hi )
+    {
+        avl_hook *p = m_pRoot;
+        while ( p && !overlaps( node( p )->kv.first, lo, hi ) )
+        {
+            auto pLeft = p->children[ILEFT];
+            p = pLeft && !m_less( node( pLeft )->maxHi, lo ) ? pLeft : p->children[IRIGHT];
+        }
+        return make_iterator( p );
+    }
+
+    /// \brief replace the contents by [first, last) of pair<interval_type, ValueType>, as a perfectly balanced tree.
+    /// O(n) if the range is sorted by lo, otherwise O(n log n).
+    template<class Iter>
+    void assign( Iter first, Iter last )
+    {
+        clear();
+        std::vector<Node *> nodes;
+        if constexpr ( std::is_base_of_v<std::forward_iterator_tag, typename std::iterator_traits<Iter>::iterator_category> )
+            nodes.reserve( std::distance( first, last ) );
+        for ( ; first != last; ++first )
+        {
+            assert( !m_less( first->first.second, first->first.first ) );
+            nodes.push_back( m_alloc.create( first->first, first->second ) );
+        }
+        auto lessLo = [&]( const Node *a, const Node *b ) { return m_less( a->kv.first.first, b->kv.first.first ); };
+        if ( !std::is_sorted( nodes.begin(), nodes.end(), lessLo ) )
+            std::stable_sort( nodes.begin(), nodes.end(), lessLo );
+        m_pRoot = avl_algo::build( nodes.data(), nodes.size(), nullptr, augment() );
+        m_size = nodes.size();
+    }
+
+    void clear()
+    {
+        avl_algo::dispose( m_pRoot, [&]( avl_hook *p ) { m_alloc.destroy( node( p ) ); } );
+        m_pRoot = nullptr;
+        m_size = 0;
+    }
+
+    /// \brief check order, parent links, heights, AVL balance and maxHi, for tests.
+    bool verify() const
+    {
+        size_t n = 0;
+        auto check = [&]( const avl_hook *h ) {
+            auto p = node( h );
+            KeyType maxHi = p->kv.first.second;
+            for ( int i : {ILEFT, IRIGHT} )
+                if ( auto c = node( p->children[i] ) )
+                {
+                    if ( i == ILEFT ? m_less( p->kv.first.first, c->kv.first.first ) : m_less( c->kv.first.first, p->kv.first.first ) )
+                        return false;
+                    if ( m_less( maxHi, c->maxHi ) )
+                        maxHi = c->maxHi;
+                }
+            return !m_less( maxHi, p->maxHi ) && !m_less( p->maxHi, maxHi );
+        };
+        return avl_algo::verify( m_pRoot, nullptr, n, check ) >= 0 && n == m_size;
+    }
+
+protected:
+    static Node *node( avl_hook *p )
+    {
+        return static_cast<Node *>( p );
+    }
+    static const Node *node( const avl_hook *p )
+    {
+        return static_cast<const Node *>( p );
+    }
+
+    iterator make_iterator( avl_hook *p )
+    {
+        return {node( p ), &m_pRoot};
+    }
+
+    /// \brief maintains maxHi of a node from its children.
+    auto augment() const
+    {
+        return [this]( avl_hook *h ) {
+            auto p = node( h );
+            p->maxHi = p->kv.first.second;
+            for ( auto c : p->children )
+                if ( c && m_less( p->maxHi, node( c )->maxHi ) )
+                    p->maxHi = node( c )->maxHi;
+        };
+    }
+
+    bool overlaps( const interval_type &iv, const KeyType &lo, const KeyType &hi ) const
+    {
+        return !m_less( iv.second, lo ) && !m_less( hi, iv.first );
+    }
+    bool equal( const interval_type &a, const interval_type &b ) const
+    {
+        return !m_less( a.first, b.first ) && !m_less( b.first, a.first ) && !m_less( a.second, b.second ) && !m_less( b.second, a.second );
+    }
+
+    template<class F>
+    size_t for_each_overlap( const avl_hook *h, const KeyType &lo, const KeyType &hi, F &f ) const
+    {
+        size_t n = 0;
+        for ( auto p = node( h ); p && !m_less( p->maxHi, lo ); p = node( p->children[IRIGHT] ) ) // nothing in the subtree ends at or after lo.
+        {
+            n += for_each_overlap( p->children[ILEFT], lo, hi, f );
+            if ( m_less( hi, p->kv.first.first ) ) // nor in the right subtree starts at or before hi.
+                break;
+            if ( !m_less( p->kv.first.second, lo ) )
+            {
+                f( p->kv );
+                ++n;
+            }
+        }
+        return n;
+    }
+
+    avl_hook *m_pRoot = nullptr;
+    size_t m_size = 0;
+    KeyCompare m_less;
+    internal::BstNodeAlloc<Node, void> m_alloc; // ObjectPool created at the first insert.
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief static_interval_tree: immutable centered interval tree of closed intervals [lo, hi], bulk-built from a range in flat arrays.
+/// Stabbing and overlap queries are O(log n + k) for k results.
+/// - Each node holds the intervals containing its center, sorted by lo and by hi descending. A stabbing query follows one path from the
+///   root and scans each node's list until the first interval not containing the point.
+/// - Intervals overlapping [lo, hi] either contain lo, or start in (lo, hi], which are found by binary search of intervals sorted by lo.
+/// Building is O(n log n); the tree depth is at most log2( n ) + 1, as the center of a node is the median lo of its intervals.
+template<typename KeyType, typename ValueType, typename KeyCompare = std::less<KeyType>>
+class static_interval_tree
+{
+public:
+    using key_type = KeyType;
+    using interval_type = std::pair<KeyType, KeyType>; // closed [first, second].
+    using value_type = std::pair<interval_type, ValueType>;
+    using size_type = std::size_t;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+    using iterator = const_iterator;
+
+protected:
+    struct Node
+    {
+        KeyType center;
+        std::uint32_t begin, end; // of the intervals containing center, in m_byLo and m_byHi.
+        std::int32_t children[2]; // -1 if none.
+    };
+
+public:
+    static_interval_tree( const KeyCompare &less = KeyCompare() ) : m_less( less )
+    {
+    }
+    template<class Iter>
+    static_interval_tree( Iter first, Iter last, const KeyCompare &less = KeyCompare() ) : m_less( less )
+    {
+        assign( first, last );
+    }
+
+    /// \brief rebuild from [first, last) of pair<interval_type, ValueType>.
+    template<class Iter>
+    void assign( Iter first, Iter last )
+    {
+        m_values.assign( first, last );
+        assert( m_values.size() < std::numeric_limits<std::uint32_t>::max() );
+        std::stable_sort( m_values.begin(), m_values.end(), [&]( auto &a, auto &b ) { return m_less( a.first.first, b.first.first ); } );
+        m_nodes.clear();
+        m_byLo.clear();
+        m_byHi.clear();
+        std::vector<std::uint32_t> idx( m_values.size() );
+        for ( std::uint32_t i = 0; i < idx.size(); ++i )
+            idx[i] = i;
+        m_root = build( idx );
+    }
+
+    const_iterator begin() const
+    {
+        return m_values.begin();
+    }
+    const_iterator end() const
+    {
+        return m_values.end();
+    }
+    size_t size() const
+    {
+        return m_values.size();
+    }
+    bool empty() const
+    {
+        return m_values.empty();
+    }
+
+    /// \brief call f( const value_type & ) for each interval containing x.
+    /// \return number of intervals containing x.
+    template<class F>
+    size_t for_each_stab( const KeyType &x, F &&f ) const
+    {
+        size_t n = 0;
+        for ( auto i = m_root; i >= 0; )
+        {
+            const auto &node = m_nodes[i];
+            if ( m_less( x, node.center ) ) // intervals of the node end at or after center, those starting at or before x contain it.
+            {
+                for ( auto j = node.begin; j < node.end && !m_less( x, m_values[m_byLo[j]].first.first ); ++j, ++n )
+                    f( m_values[m_byLo[j]] );
+                i = node.children[0];
+            }
+            else if ( m_less( node.center, x ) )
+            {
+                for ( auto j = node.begin; j < node.end && !m_less( m_values[m_byHi[j]].first.second, x ); ++j, ++n )
+                    f( m_values[m_byHi[j]] );
+                i = node.children[1];
+            }
+            else
+            {
+                for ( auto j = node.begin; j < node.end; ++j, ++n )
+                    f( m_values[m_byLo[j]] );
+                break;
+            }
+        }
+        return n;
+    }
+
+    /// \brief call f( const value_type & ) for each interval overlapping [lo, hi].
+    /// \return number of overlapping intervals.
+    template<class F>
+    size_t for_each_overlap( const KeyType &lo, const KeyType &hi, F &&f ) const
+    {
+        size_t n = for_each_stab( lo, f );
+        auto it = std::upper_bound( m_values.begin(), m_values.end(), lo, [&]( const KeyType &k, auto &v ) { return m_less( k, v.first.first ); } );
+        for ( ; it != m_values.end() && !m_less( hi, it->first.first ); ++it, ++n )
+            f( *it );
+        return n;
+    }
+
+    /// \brief depth of the tree, 0 if empty.
+    int depth() const
+    {
+        return depth( m_root );
+    }
+
+protected:
+    // idx is sorted by lo.
+    std::int32_t build( const std::vector<std::uint32_t> &idx )
+    {
+        if ( idx.empty() )
+            return -1;
+        const KeyType &center = m_values[idx[idx.size() / 2]].first.first;
+        std::vector<std::uint32_t> left, right;
+        const auto begin = std::uint32_t( m_byLo.size() );
+        for ( auto i : idx )
+        {
+            const auto &iv = m_values[i].first;
+            if ( m_less( iv.second, center ) )
+                left.push_back( i );
+            else if ( m_less( center, iv.first ) )
+                right.push_back( i );
+            else
+                m_byLo.push_back( i );
+        }
+        const auto end = std::uint32_t( m_byLo.size() );
+        m_byHi.insert( m_byHi.end(), m_byLo.begin() + begin, m_byLo.end() );
+        std::stable_sort( m_byHi.begin() + begin, m_byHi.end(), [&]( std::uint32_t a, std::uint32_t b ) {
+            return m_less( m_values[b].first.second, m_values[a].first.second );
+        } );
+
+        const auto i = std::int32_t( m_nodes.size() );
+        m_nodes.push_back( Node{center, begin, end, {-1, -1}} );
+        const auto l = build( left ), r = build( right );
+        m_nodes[i].children[0] = l;
+        m_nodes[i].children[1] = r;
+        return i;
+    }
+
+    int depth( std::int32_t i ) const
+    {
+        return i < 0 ? 0 : 1 + std::max( depth( m_nodes[i].children[0] ), depth( m_nodes[i].children[1] ) );
+    }
+
+    std::vector<value_type> m_values; // sorted by lo.
+    std::vector<Node> m_nodes; // preorder.
+    std::vector<std::uint32_t> m_byLo, m_byHi; // indexes of m_values, ranges of nodes.
+    std::int32_t m_root = -1;
+    KeyCompare m_less;
 };
 
 } // namespace ftl
-#endif
@@ -0,0 +1,257 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace ftl
+{
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief intrusive_ref_counter is a base class holding the reference count of Derived, used by intrusive_ptr<Derived>.
+/// When the last reference is released, the object is handed to its recycler, eg. ObjectPool::create_intrusive() sets one which
+/// destroys the object and returns its slot to the pool. Without a recycler the object is deleted.
+/// \tparam Atomic false if references are never shared by multiple threads at the same time. An object handed over through a queue
+/// may still use the non-atomic counter.
+///
+/// Usage:
+///     struct Order : ftl::intrusive_ref_counter<Order> { ... };
+///     ObjectPool<Order> pool( 64 );
+///     ftl::intrusive_ptr<Order> pOrder = pool.create_intrusive( ... ); // returned to pool when the last copy is gone.
+template<class Derived, bool Atomic = true>
+class intrusive_ref_counter
+{
+public:
+    using RefCount = std::conditional_t<Atomic, std::atomic<std::uint32_t>, std::uint32_t>;
+    /// \brief destroy the object and free its memory.
+    using RecycleFunc = void ( * )( void *pOwner, Derived *p );
+
+    intrusive_ref_counter() = default;
+
+    /// \brief a copied object has its own count and no recycler.
+    intrusive_ref_counter( const intrusive_ref_counter & )
+    {
+    }
+    intrusive_ref_counter &operator=( const intrusive_ref_counter & )
+    {
+        return *this;
+    }
+
+    void add_ref() const
+    {
+        if constexpr ( Atomic )
+            m_nRefs.fetch_add( 1, std::memory_order_relaxed );
+        else
+            ++m_nRefs;
+    }
+
+    /// \return true if it was the last reference and the object is recycled.
+    bool release_ref() const
+    {
+        if constexpr ( Atomic )
+        {
+            if ( m_nRefs.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+                return false;
+        }
+        else if ( --m_nRefs != 0 )
+            return false;
+        auto pThis = static_cast<Derived *>( const_cast<intrusive_ref_counter *>( this ) );
+        if ( m_pfnRecycle )
+            m_pfnRecycle( m_pOwner, pThis );
+        else
+            delete pThis;
+        return true;
+    }
+
+    std::uint32_t use_count() const
+    {
+        return m_nRefs;
+    }
+
+    /// \brief set by the pool which allocated the object.
+    void set_recycler( RecycleFunc pfnRecycle, void *pOwner )
+    {
+        m_pfnRecycle = pfnRecycle;
+        m_pOwner = pOwner;
+    }
+
+protected:
+    ~intrusive_ref_counter() = default;
+
+    mutable RefCount m_nRefs{0};
+    RecycleFunc m_pfnRecycle = nullptr;
+    void *m_pOwner = nullptr;
+};
+
+template<class Derived, bool Atomic>
+void intrusive_ptr_add_ref( const intrusive_ref_counter<Derived, Atomic> *p )
+{
+    p->add_ref();
+}
+
+template<class Derived, bool Atomic>
+void intrusive_ptr_release( const intrusive_ref_counter<Derived, Atomic> *p )
+{
+    p->release_ref();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief intrusive_ptr is a pointer-sized shared handle. T's reference count is managed by ADL found functions
+/// intrusive_ptr_add_ref( T* ) and intrusive_ptr_release( T* ), eg. by deriving from intrusive_ref_counter<T>.
+template<class T>
+class intrusive_ptr
+{
+    T *m_p = nullptr;
+
+public:
+    using element_type = T;
+
+    intrusive_ptr() = default;
+    intrusive_ptr( std::nullptr_t )
+    {
+    }
+
+    /// \param addRef false to adopt a reference, eg. one detached by detach().
+    intrusive_ptr( T *p, bool addRef = true ) : m_p( p )
+    {
+        if ( m_p && addRef )
+            intrusive_ptr_add_ref( m_p );
+    }
+
+    intrusive_ptr( const intrusive_ptr &a ) : intrusive_ptr( a.m_p )
+    {
+    }
+
+    template<class U, class = std::enable_if_t<std::is_convertible_v<U *, T *>>>
+    intrusive_ptr( const intrusive_ptr<U> &a ) : intrusive_ptr( a.get() )
+    {
+    }
+
+    intrusive_ptr( intrusive_ptr &&a ) noexcept : m_p( a.m_p )
+    {
+        a.m_p = nullptr;
+    }
+
+    template<class U, class = std::enable_if_t<std::is_convertible_v<U *, T *>>>
+    intrusive_ptr( intrusive_ptr<U> &&a ) noexcept : m_p( a.detach() )
+    {
+    }
+
+    ~intrusive_ptr()
+    {
+        if ( m_p )
+            intrusive_ptr_release( m_p );
+    }
+
+    intrusive_ptr &operator=( const intrusive_ptr &a )
+    {
+        intrusive_ptr( a ).swap( *this );
+        return *this;
+    }
+
+    intrusive_ptr &operator=( intrusive_ptr &&a ) noexcept
+    {
+        intrusive_ptr( std::move( a ) ).swap( *this );
+        return *this;
+    }
+
+    void reset()
+    {
+        intrusive_ptr().swap( *this );
+    }
+
+    void reset( T *p, bool addRef = true )
+    {
+        intrusive_ptr( p, addRef ).swap( *this );
+    }
+
+    /// \brief give up the reference without releasing it.
+    T *detach()
+    {
+        auto p = m_p;
+        m_p = nullptr;
+        return p;
+    }
+
+    void swap( intrusive_ptr &a ) noexcept
+    {
+        std::swap( m_p, a.m_p );
+    }
+
+    T *get() const
+    {
+        return m_p;
+    }
+    T &operator*() const
+    {
+        assert( m_p );
+        return *m_p;
+    }
+    T *operator->() const
+    {
+        assert( m_p );
+        return m_p;
+    }
+    explicit operator bool() const
+    {
+        return m_p != nullptr;
+    }
+
+    template<class U>
+    bool operator==( const intrusive_ptr<U> &a ) const
+    {
+        return m_p == a.get();
+    }
+    template<class U>
+    bool operator!=( const intrusive_ptr<U> &a ) const
+    {
+        return m_p != a.get();
+    }
+    bool operator==( std::nullptr_t ) const
+    {
+        return !m_p;
+    }
+    bool operator!=( std::nullptr_t ) const
+    {
+        return m_p;
+    }
+};
+
+/// \brief create a heap allocated object, which is deleted when the last reference is released.
+template<class T, class... Args>
+intrusive_ptr<T> make_intrusive( Args &&... args )
+{
+    return intrusive_ptr<T>( new T( std::forward<Args>( args )... ) );
+}
+
+} // namespace ftl
+
+namespace std
+{
+template<class T>
+struct hash<ftl::intrusive_ptr<T>>
+{
+    size_t operator()( const ftl::intrusive_ptr<T> &p ) const noexcept
+    {
+        return hash<T *>()( p.get() );
+    }
+};
+} // namespace std
@@ -21,6 +21,7 @@
 #include <ftl/thread_array.h>
 #include <ftl/log.h>
 #include <ftl/inplace_function.h>
+#include <ftl/intrusive_ptr.h>
 
 #include <sys/epoll.h>
 #include <unistd.h>
@@ -40,16 +41,12 @@ struct IOError
     int errorno = 0;
 }; // <bytesProcessed, errno> where bytesProcessed >= 0.
 
-struct SockInfo
+/// \brief SockInfo is reference counted by the epoll thread and io tasks. It's deleted when the last reference is released.
+struct SockInfo : ftl::intrusive_ref_counter<SockInfo>
 {
-    struct Deleter
-    {
-        void operator()( SockInfo *p )
-        {
-            p->release();
-        }
-    };
-    using Ptr = std::unique_ptr<SockInfo, Deleter>;
+    using Ptr = ftl::intrusive_ptr<SockInfo>;
+
+    virtual ~SockInfo() = default;
 
     // @return <bytesSent, errno>
     IOError recv( char *buf, unsigned bufsize )
@@ -64,12 +61,6 @@ struct SockInfo
         return {};
     }
 
-    /// \brief increment the referece. Must call release() ro release reference.
-    virtual SockInfo *inc_ref() = 0;
-
-    /// \brief release this object. Users should not directly delete this object.
-    virtual bool release() = 0;
-
     /// \brief close this sock
     virtual bool close() = 0;
 
@@ -169,11 +160,11 @@ struct IOEvents
     virtual ~IOEvents() = 0;
 
     // called by epoll thread when initializtion.
-    // SockInfo not share-owned by IOEvents and SockInfo::release should not be called
+    // SockInfo not share-owned by IOEvents and SockInfo::release_ref should not be called
     virtual void set_sock( SockInfo &sock ) = 0;
 
     /// \brief callback when IO read event is ready.
-    /// If it posts an event to io thread. sock.inc_ref() must be called before posting, and sock.release() when release the reference.
+    /// If it posts an event to io thread, the task must hold a SockInfo::Ptr.
     virtual void on_event_ready( SockInfo &sock, EVENT_TYPE ) = 0;
 
     /// \brief when required, epoll thread calls it to set io thread.
@@ -208,11 +199,7 @@ struct RecvBase : IOEvents
 
         if ( m_recvThread )
         {
-            m_pSock->inc_ref();
-            m_recvThread.put_task( [this]( std::size_t ) {
-                read_proc();
-                m_pSock->release();
-            } );
+            m_recvThread.put_task( [this, pSock = SockInfo::Ptr( m_pSock )]( std::size_t ) { read_proc(); } );
         }
         else
         {
@@ -319,9 +306,12 @@ template<size_t MsgBufferSize = 512>
 struct SendBase : IOEvents
 {
     using LoggerType = decltype( GET_LOGGER( "" ) );
-    using Msg = IOBuffer<MsgBufferSize>;
+    /// \brief a message is owned by one thread at a time, so the reference count is not atomic.
+    struct Msg : IOBuffer<MsgBufferSize>, ftl::intrusive_ref_counter<Msg, false>
+    {
+    };
     using Chan = ftl::MPSCPooledChan<Msg>; // multiple workers send, single SendingIOThread consume.
-    using MsgPtr = typename Chan::Ptr;
+    using MsgPtr = typename Chan::MsgRef;
 
     void set_sock( SockInfo &sock ) override
     {
@@ -343,7 +333,7 @@ struct SendBase : IOEvents
 
     MsgPtr create_msg()
     {
-        return m_chan.create_unique();
+        return m_chan.create_intrusive();
     }
 
     /// \brief post msg to the queue.
@@ -369,20 +359,18 @@ protected:
     void post_send_task()
     {
         assert( m_SendThread );
-        m_pSock->inc_ref();
-        m_SendThread.put_task( [this]( std::size_t ) {
-            while ( auto pMsg = m_chan.recv_unique() )
+        m_SendThread.put_task( [this, pSock = SockInfo::Ptr( m_pSock )]( std::size_t ) {
+            while ( auto pMsg = m_chan.recv_intrusive() )
             {
                 send_msg_proc( pMsg );
             }
-            m_pSock->release();
         } );
     }
     /// \return 0 for completed sending, or errno
     int send_msg_proc( MsgPtr &pMsg )
     {
         Msg &msg = *pMsg;
-        char *buf = &msg.data[0];
+        char *buf = &msg[0];
         while ( msg.m_pos != msg.size() )
         {
             auto res = m_pSock->send( buf + msg.m_pos, msg.size() - msg.m_pos );
@@ -397,7 +385,7 @@ protected:
                 }
                 else // retry triggered by SEND_EVENT.
                 {
-                    pMsg.release(); // keep message in the queue.
+                    pMsg.detach(); // keep message in the queue.
                 }
                 return res.errorno;
             }
@@ -436,43 +424,27 @@ protected:
         IOEvents *m_pRecvEvents = nullptr;
         IOEvents *m_pSendEvents = nullptr;
         EpollThread *m_parent = nullptr;
-        std::atomic<int> m_refcount = {1}; // object may be referenced in epoll thread, recv threads, send threads.
 
+        /// \brief the epoll thread holds a reference until the sock is closed. Recv and send tasks hold references while running.
         SockData( int sockfd, EpollThread *parent )
         {
             m_sock = sockfd;
             m_parent = parent;
+            add_ref();
         }
 
-        SockInfo *inc_ref() override
+        ~SockData() override
         {
-            m_refcount.fetch_add( 1 );
-            return this;
-        }
-
-        bool release() override
-        {
-            if ( dec_ref() != 0 )
-                return false;
             if ( m_pRecvEvents )
                 m_pRecvEvents->on_sock_closed();
             if ( m_pSendEvents )
                 m_pSendEvents->on_sock_closed();
-            return true;
         }
+
         bool close() override
         {
             return m_parent->close_sock( *this );
         }
-
-    protected:
-        int dec_ref()
-        {
-            auto nref = m_refcount.fetch_sub( 1 );
-            if ( nref == 1 )
-                release();
-            return nref - 1;
-        }
     };
 
     enum class EpollStatus
@@ -615,12 +587,12 @@ public:
         if ( pRecv && iRecvThreadIdx >= 0 )
         {
             sock->m_recvThreadIdx = iRecvThreadIdx % m_pRecvThreads->size();
-            pRecv->set_io_thread( m_pRecvThreads->get_thread_deleate( sock->m_recvThreadIdx ), IOEvents::READ_EVENT ); // send sending thread.
+            pRecv->set_io_thread( m_pRecvThreads->get_thread_delegate( sock->m_recvThreadIdx ), IOEvents::READ_EVENT ); // send sending thread.
         }
         if ( pSend && iSendThreadIdx >= 0 )
         {
             sock->m_sendThreadIdx = iSendThreadIdx % m_pSendThreads->size();
-            pSend->set_io_thread( m_pSendThreads->get_thread_deleate( sock->m_sendThreadIdx ), IOEvents::WRITE_EVENT ); // send sending thread.
+            pSend->set_io_thread( m_pSendThreads->get_thread_delegate( sock->m_sendThreadIdx ), IOEvents::WRITE_EVENT ); // send sending thread.
         }
         sock->m_pRecvEvents = pRecv;
         sock->m_pSendEvents = pSend;
@@ -632,23 +604,24 @@ public:
         if ( pRecv )
         {
             evt.events |= EPOLLIN;
-            pRecv->set_sock( sock );
+            pRecv->set_sock( *sock );
         }
         if ( pSend )
         {
             evt.events |= EPOLLOUT;
-            pSend->set_sock( sock );
+            pSend->set_sock( *sock );
         }
         evt.data.ptr = sock;
         if ( epoll_ctl( m_epollFd, EPOLL_CTL_ADD, sockFd, &evt ) )
         {
             CAT_E( m_logger, " Failed to add recv sock:", sockFd );
+            sock->m_pRecvEvents = sock->m_pSendEvents = nullptr; // not owned yet.
             delete sock;
             return nullptr;
         }
 
         CAT_I( m_logger, "Added sock ", sockFd );
-        return SockInfo::Ptr( &sock->inc_ref(), SockInfo::Deleter{} );
+        return SockInfo::Ptr( sock );
     }
 
 protected:
@@ -657,7 +630,7 @@ protected:
     {
         if ( sock.m_closed )
             return true;
-        if ( epoll_ctl( m_epollFd, EPOLL_CTL_DEL, sock.m_sock.m_sock, nullptr ) ) // this make sure sock be removed once.
+        if ( epoll_ctl( m_epollFd, EPOLL_CTL_DEL, sock.m_sock, nullptr ) ) // this make sure sock be removed once.
         {
             CAT_W( m_logger, " Failed to EPOLL_CTL_DEL sock:", sock );
             sock.m_closed = true;
@@ -674,7 +647,7 @@ protected:
     bool release_sock( SockData &sock )
     {
         auto sockfd = sock.m_sock;
-        if ( sock.release() )
+        if ( sock.release_ref() )
         {
             FMT_I( m_logger, " EPOLL_CTL_DEL released sock:{}", sockfd );
             return true;
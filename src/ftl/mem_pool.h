@@ -18,9 +18,19 @@
 #pragma once
 #include <memory>
 #include <atomic>
+#include <cstddef>
 #include <cassert>
 #include <ftl/alloc_common.h>
+#include <ftl/intrusive_ptr.h>
+#include <ftl/pool_debug.h>
 #include <ftl/sys_alloc.h>
+#include <ftl/thread_cache.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace ftl
 {
@@ -34,24 +44,37 @@ struct AllocRequest
 
     std::size_t slabAlignment = 8; // which is also the SlabHeader alignment.
     std::size_t slabGranularity = 4096; // page size.
-    bool alignupToSlabGranularity = false; // if true, may pre-allocate more slots than requested.
-    std::size_t maxSlotsPerSlab = 0; // applicable only if ConstGrowthStrategy is not true.
+    bool alignupToSlabGranularity = false; // if true, may pre-allocate more slots than requested. Huge page slabs always fill the pages got.
+    std::size_t maxSlotsPerSlab = 0; // cap of geometric growth. Applicable only if ConstGrowthStrategy is not true.
+    PageType pageType = PageType::Normal; // huge pages fall back to smaller pages when they are exhausted.
+    std::size_t keepFreeSlots = 0; // low-water mark: trim() keeps at least this many free slots for the next burst.
+    std::size_t preGrowFreeSlots = 0; // low-water mark: when free slots fall below it, malloc() requests pre_grow(), eg. by PoolMaintainer.
+    std::size_t reserveSlots = 0; // emergency reserve for threads which run out of slots while another thread is growing the pool.
 };
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// \brief MemPool preallocates slots. User calls MemPool::malloc() to allocate a slot.
 /// Multiple slots are allocated in a slab. Multiple slabs are linked into a list.
 /// \tparam IsAtomic if true, The Memory pool is thread-safe.
-/// \tparam ConstGrowthStrategy if false, count of slots in each new slab is double of previous value. Otherwise, always allocate the same size of
-/// slab.
-template<bool IsAtomic, bool ConstGrowthStrategy = true, class AlignedAlloc = MmapAlignedAlloc>
-class MemPool
+/// \tparam ConstGrowthStrategy if false, count of slots in each new slab is double of previous value, up to AllocRequest::maxSlotsPerSlab.
+/// Otherwise, always allocate the same size of slab.
+/// Growth is thread-safe. Only one thread allocates a slab at a time, others take slots from the emergency reserve instead of waiting,
+/// unless it's also exhausted. With AllocRequest::preGrowFreeSlots, a PoolMaintainer thread grows the pool ahead of time, so the slow path
+/// never runs on a latency-critical thread.
+/// Empty slabs are released to OS by trim(). A thread-safe pool keeps released slabs mapped, but drops their pages by madvise(MADV_DONTNEED),
+/// because a concurrent malloc() may still read a stale free slot. Released slabs are reused before new slabs are allocated.
+/// \tparam Debug if true, slots are checked for double free, overflow, use after free and leaks, see PoolDebugger. No cost if false.
+template<bool IsAtomic, bool ConstGrowthStrategy = true, class AlignedAlloc = MmapAlignedAlloc, bool Debug = FTL_POOL_DEBUG>
+class MemPool : protected PoolDebugger<Debug>
 {
 protected:
+    using Debugger = PoolDebugger<Debug>;
+
     struct SlabInfo
     {
         using size_type = unsigned;
-        unsigned slabSize, firstSlotOffset, slotSize, slotCount;
+        unsigned slabSize, firstSlotOffset, slotSize, slotCount, slabAlignment;
+        PageType pageType;
     };
 
     // slabs are linked into list. Each slab contains multiple slots which are can allocated by calling MemPool::malloc().
@@ -64,6 +87,8 @@ protected:
         using NextElemPtrType = std::conditional_t<IsAtomic, std::atomic<SlabHeader *>, SlabHeader *>;
         NextElemPtrType pNext{};
         SlabInfo info;
+        std::size_t nFreeSlots = 0; // counted by trim().
+        bool released = false; // pages are dropped by trim(). Guarded by m_slabLock.
 
         SlabHeader() = default;
         SlabHeader( const SlabInfo &info ) : info( info )
@@ -77,7 +102,9 @@ protected:
         NextElemPtrType pNext{};
     };
 
-    SlotHeader m_freeList;
+    // free slots may be popped and pushed back by other threads between loading head and CAS, so atomic head is tagged.
+    using FreeListHead = std::conditional_t<IsAtomic, AtomicTaggedPtr<SlotHeader>, SlotHeader *>;
+    FreeListHead m_freeList{};
     SlabHeader m_slabList;
 
     AllocRequest m_defaultAllocReq;
@@ -85,6 +112,12 @@ protected:
     using IntCounterType = std::conditional_t<IsAtomic, std::atomic<std::ptrdiff_t>, std::ptrdiff_t>;
     IntCounterType m_totalSlots = 0, m_allocatedSlots = 0; // for tracking allocations.
 
+    std::mutex m_slabLock; // serializes slab growth, reuse and trim. Not taken by malloc() fast path or free().
+    std::size_t m_lastSlabSlots = 0; // guarded by m_slabLock.
+    FreeListHead m_reserve{}; // emergency reserve.
+    IntCounterType m_reserveSize = 0;
+    std::atomic<bool> m_growRequested{false};
+
 
 public:
     MemPool() = default;
@@ -97,22 +130,46 @@ public:
         init( ar );
     }
 
+    /// \brief non-thread-safe move.
     MemPool( MemPool &&another )
+        : Debugger( another ), m_defaultAllocReq( another.m_defaultAllocReq ), m_lastSlabSlots( another.m_lastSlabSlots )
     {
-        m_freeList = another.m_freeList;
-        m_slabList = another.m_slabList;
-        m_defaultAllocReq = another.m_defaultAllocReq;
-        m_totalSlots = another.m_totalSlots;
-        m_allocatedSlots = another.m_allocatedSlots;
-
-        another.m_freeList.pNext = nullptr;
+        if constexpr ( IsAtomic )
+        {
+            m_freeList.store( another.m_freeList.load().ptr() );
+            m_reserve.store( another.m_reserve.load().ptr() );
+            m_slabList.pNext = another.m_slabList.pNext.load();
+            m_totalSlots = another.m_totalSlots.load();
+            m_allocatedSlots = another.m_allocatedSlots.load();
+            m_reserveSize = another.m_reserveSize.load();
+            another.m_freeList.store( nullptr );
+            another.m_reserve.store( nullptr );
+        }
+        else
+        {
+            m_freeList = another.m_freeList;
+            m_reserve = another.m_reserve;
+            m_slabList.pNext = another.m_slabList.pNext;
+            m_totalSlots = another.m_totalSlots;
+            m_allocatedSlots = another.m_allocatedSlots;
+            m_reserveSize = another.m_reserveSize;
+            another.m_freeList = nullptr;
+            another.m_reserve = nullptr;
+        }
         another.m_slabList.pNext = nullptr;
+        another.m_totalSlots = 0;
+        another.m_allocatedSlots = 0;
+        another.m_reserveSize = 0;
     }
 
     int init( const AllocRequest &ar )
     {
         m_defaultAllocReq = ar;
-        return allocate_slab( ar );
+        Debugger::init( std::max( ar.slotSize, sizeof( SlotHeader ) ) );
+        auto ret = allocate_slab( ar );
+        m_lastSlabSlots = std::max( ret, 0 );
+        top_up_reserve();
+        return ret;
     }
 
     // user may directly call allocate_slab to allocate a slab of slots.
@@ -123,22 +180,39 @@ public:
         if ( !populateSlabInfo( slabInfo, r, sizeof( SlabHeader ) ) )
             return -1;
 
-        auto pSlab = AlignedAlloc::aligned_alloc( slabInfo.slabSize, r.slabAlignment, r.slabGranularity ); // may use std::aligned_allocate
+        std::size_t slabLen = slabInfo.slabSize;
+        auto pSlab = AlignedAlloc::aligned_alloc( slabInfo.slabAlignment,
+                                                  slabInfo.slabSize,
+                                                  page_size( r.pageType ),
+                                                  true,
+                                                  r.pageType,
+                                                  &slabInfo.pageType,
+                                                  &slabLen ); // may use std::aligned_allocate
         if ( !pSlab ) // failed allocatation.
             return -1;
-        auto ret = segregate_slab( static_cast<Byte *>( pSlab ), slabInfo, m_slabList.pNext, m_freeList.pNext );
+        // huge pages may fall back to smaller ones, fill whatever was mapped with slots. Freed with the page type got.
+        if ( r.pageType != PageType::Normal )
+        {
+            slabInfo.slabSize = typename SlabInfo::size_type( slabLen );
+            slabInfo.slotCount = ( slabInfo.slabSize - slabInfo.firstSlotOffset ) / slabInfo.slotSize;
+        }
+        m_totalSlots += std::ptrdiff_t( slabInfo.slotCount ); // count before slots are visible to other threads.
+        auto ret = segregate_slab( static_cast<Byte *>( pSlab ), slabInfo, m_slabList.pNext, m_freeList );
         assert( ret > 0 );
-        if ( ret > 0 )
-            m_totalSlots += std::ptrdiff_t( ret );
         return ret;
     }
 
     ~MemPool()
     {
-        //        assert( free_size() == capacity() );
+        if constexpr ( Debugger::ENABLED )
+        {
+            for ( auto pSlab = next_of( &m_slabList ); pSlab; pSlab = next_of( pSlab ) )
+                if ( !pSlab->released )
+                    for_each_slot( *pSlab, [this]( SlotHeader *pSlot ) { Debugger::check_leak( pSlot ); } );
+        }
         while ( auto p = ftl::PopSinglyListNode<SlabHeader, &SlabHeader::pNext>( &m_slabList.pNext ) )
         {
-            AlignedAlloc::free( p, p->info.slabSize );
+            AlignedAlloc::free( p, p->info.slabSize, p->info.pageType );
         }
     }
 
@@ -152,35 +226,78 @@ public:
     void *malloc()
     {
         assert( inited() );
-        auto p = ftl::PopSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList.pNext );
+        auto p = ftl::PopSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList );
         if ( !p )
+            p = malloc_slow();
+        return take_slot( p );
+    }
+
+    /// \brief allocate a slot without growing pool. Lock-free if IsAtomic.
+    /// \return nullptr if no free slot.
+    void *try_malloc()
+    {
+        assert( inited() );
+        return take_slot( ftl::PopSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList ) );
+    }
+
+    /// \brief whether malloc() found free slots below AllocRequest::preGrowFreeSlots.
+    bool grow_requested() const
+    {
+        return m_growRequested.load( std::memory_order_relaxed );
+    }
+
+    /// \brief thread-safe. Grow the pool until free slots reach AllocRequest::preGrowFreeSlots.
+    /// Called by a non-latency-critical thread, eg. PoolMaintainer.
+    /// \return number of slots added.
+    int pre_grow()
+    {
+        m_growRequested.store( false, std::memory_order_relaxed );
+        std::lock_guard<std::mutex> guard( m_slabLock );
+        int nSlots = 0;
+        while ( free_size() < m_defaultAllocReq.preGrowFreeSlots )
         {
-            // slow path, auto allocate a slab
-            if constexpr ( !ConstGrowthStrategy )
-            {
-                /// \note not thread safe
-                m_defaultAllocReq.minSlotsPerSlab = m_totalSlots * 2;
-                if ( m_defaultAllocReq.maxSlotsPerSlab && m_defaultAllocReq.minSlotsPerSlab > m_defaultAllocReq.maxSlotsPerSlab )
-                    m_defaultAllocReq.minSlotsPerSlab = m_defaultAllocReq.maxSlotsPerSlab;
-            }
-            allocate_slab( m_defaultAllocReq );
-            p = ftl::PopSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList.pNext );
-        }
-        if ( p )
-        {
-            m_allocatedSlots += 1;
-            assert( m_allocatedSlots >= 0 && m_allocatedSlots <= m_totalSlots );
-            return p;
+            auto n = grow();
+            if ( n <= 0 )
+                break;
+            nSlots += n;
         }
-        return nullptr;
+        return nSlots;
     }
 
     /// \brief free an allocated slot.
     void free( void *p )
     {
+        if ( !Debugger::on_free( p ) )
+            return;
         m_allocatedSlots -= 1;
         assert( m_allocatedSlots >= 0 && m_allocatedSlots <= m_totalSlots );
-        ftl::PushSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList.pNext, reinterpret_cast<SlotHeader *>( p ) );
+        ftl::PushSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList, reinterpret_cast<SlotHeader *>( p ) );
+    }
+
+    /// \brief construct T, derived from intrusive_ref_counter<T>, in a slot. The slot is freed when the last reference is released.
+    /// \pre sizeof( T ) <= AllocRequest::slotSize and alignof( T ) <= AllocRequest::slotAlignment. The pool outlives the object.
+    /// \return nullptr if no slot is available.
+    template<class T, class... Args>
+    intrusive_ptr<T> create_intrusive( Args &&... args )
+    {
+        assert( sizeof( T ) <= m_defaultAllocReq.slotSize );
+        auto p = malloc();
+        if ( !p )
+            return nullptr;
+        auto pObj = new ( p ) T( std::forward<Args>( args )... );
+        pObj->set_recycler(
+                []( void *pOwner, T *pObj ) {
+                    pObj->~T();
+                    static_cast<MemPool *>( pOwner )->free( pObj );
+                },
+                this );
+        return intrusive_ptr<T>( pObj );
+    }
+
+    /// \brief check p is an allocated slot if Debug. Called before destroying the object in slot.
+    bool verify_allocated( const void *p ) const
+    {
+        return Debugger::verify_allocated( p );
     }
 
     std::size_t capacity() const
@@ -193,32 +310,251 @@ public:
         return m_totalSlots - m_allocatedSlots;
     }
 
+    /// \brief non-thread-safe. Return all slots to pool.
     void clear()
     {
-        new ( &m_freeList ) SlotHeader();
-        while ( auto pSlabHeader = ftl::PopSinglyListNode<SlabHeader, &SlabHeader::pNext>( &m_slabList.pNext ) )
+        new ( &m_freeList ) FreeListHead();
+        new ( &m_reserve ) FreeListHead();
+        m_reserveSize = 0;
+        for ( auto pSlab = next_of( &m_slabList ); pSlab; pSlab = next_of( pSlab ) )
         {
-            std::size_t k = 0;
-            for ( Byte *pSlot = reinterpret_cast<Byte *>( pSlabHeader ) + pSlabHeader->info.firstSlotOffset; k < pSlabHeader->info.slotCount;
-                  ++k, pSlot += pSlabHeader->info.slotSize )
+            if ( pSlab->released )
             {
-                ftl::PushSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList.pNext, reinterpret_cast<SlotHeader *>( pSlot ) );
+                pSlab->released = false;
+                m_totalSlots += std::ptrdiff_t( pSlab->info.slotCount );
             }
+            push_slots( *pSlab );
         }
         m_allocatedSlots = 0;
+        top_up_reserve();
+    }
+
+    /// \brief release empty slabs to OS, keeping at least AllocRequest::keepFreeSlots free slots.
+    /// Thread-safe if IsAtomic: malloc() and free() may run concurrently, eg. in a PoolMaintainer thread.
+    /// \return number of slabs released.
+    int trim()
+    {
+        std::lock_guard<std::mutex> guard( m_slabLock );
+        // own all free slots, so no slot of a releasing slab can be allocated meanwhile.
+        SlotHeader *pFreeSlots = detach_free_list();
+
+        std::vector<SlabHeader *> slabs; // sorted by address to find the owning slab of a slot.
+        for ( auto pSlab = next_of( &m_slabList ); pSlab; pSlab = next_of( pSlab ) )
+            if ( !pSlab->released )
+            {
+                pSlab->nFreeSlots = 0;
+                slabs.push_back( pSlab );
+            }
+        std::sort( slabs.begin(), slabs.end() );
+        auto slab_of = [&]( SlotHeader *pSlot ) {
+            return *--std::upper_bound( slabs.begin(), slabs.end(), reinterpret_cast<SlabHeader *>( pSlot ) );
+        };
+
+        std::size_t nFree = 0;
+        for ( auto pSlot = pFreeSlots; pSlot; pSlot = next_of( pSlot ), ++nFree )
+            ++slab_of( pSlot )->nFreeSlots;
+
+        int nReleased = 0;
+        for ( auto pSlab : slabs )
+        {
+            if ( pSlab->nFreeSlots == pSlab->info.slotCount && nFree >= m_defaultAllocReq.keepFreeSlots + pSlab->info.slotCount )
+            {
+                pSlab->released = true;
+                nFree -= pSlab->info.slotCount;
+                m_totalSlots -= std::ptrdiff_t( pSlab->info.slotCount );
+                ++nReleased;
+            }
+        }
+
+        // give back free slots of remaining slabs.
+        for ( auto pSlot = pFreeSlots; pSlot; )
+        {
+            auto pNext = next_of( pSlot );
+            if ( !slab_of( pSlot )->released )
+                ftl::PushSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList, pSlot );
+            pSlot = pNext;
+        }
+        if ( nReleased )
+            release_slabs();
+        return nReleased;
     }
 
 protected:
+    void *take_slot( SlotHeader *p )
+    {
+        if ( !p )
+            return nullptr;
+        Debugger::on_malloc( p );
+        m_allocatedSlots += 1;
+        assert( m_allocatedSlots >= 0 && m_allocatedSlots <= m_totalSlots );
+        if ( m_defaultAllocReq.preGrowFreeSlots && free_size() < m_defaultAllocReq.preGrowFreeSlots
+             && !m_growRequested.load( std::memory_order_relaxed ) )
+            m_growRequested.store( true, std::memory_order_relaxed );
+        return p;
+    }
+
+    SlotHeader *malloc_slow()
+    {
+        std::unique_lock<std::mutex> lock( m_slabLock, std::try_to_lock );
+        if ( !lock.owns_lock() )
+        {
+            // another thread is growing or trimming pool, don't wait for it.
+            if ( auto p = ftl::PopSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_reserve ) )
+            {
+                m_reserveSize -= 1;
+                return p;
+            }
+            lock.lock(); // reserve is exhausted.
+        }
+        auto p = ftl::PopSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList ); // slots may be added while waiting.
+        while ( !p && grow() > 0 )
+            p = ftl::PopSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList );
+        return p;
+    }
+
+    /// \brief reuse a released slab, or allocate a slab, and top up reserve.
+    /// \pre m_slabLock is locked.
+    /// \return number of slots added.
+    int grow()
+    {
+        int ret = 0;
+        if ( auto pSlab = reuse_released_slab() )
+            ret = pSlab->info.slotCount;
+        else
+        {
+            AllocRequest r = m_defaultAllocReq;
+            if constexpr ( !ConstGrowthStrategy )
+            {
+                r.minSlotsPerSlab = std::max( r.minSlotsPerSlab, m_lastSlabSlots * 2 );
+                if ( r.maxSlotsPerSlab )
+                    r.minSlotsPerSlab = std::min( r.minSlotsPerSlab, r.maxSlotsPerSlab );
+            }
+            ret = allocate_slab( r );
+            if ( ret > 0 )
+                m_lastSlabSlots = ret;
+        }
+        top_up_reserve();
+        return ret;
+    }
+
+    /// \pre m_slabLock is locked, or single-threaded.
+    void top_up_reserve()
+    {
+        for ( ; std::size_t( m_reserveSize ) < m_defaultAllocReq.reserveSlots; m_reserveSize += 1 )
+        {
+            auto p = ftl::PopSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList );
+            if ( !p )
+                break;
+            ftl::PushSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_reserve, p );
+        }
+    }
+
+    template<class NodeT>
+    static NodeT *next_of( NodeT *p )
+    {
+        if constexpr ( IsAtomic )
+            return p->pNext.load( std::memory_order_relaxed );
+        else
+            return p->pNext;
+    }
+
+    SlotHeader *detach_free_list()
+    {
+        if constexpr ( IsAtomic )
+        {
+            auto vHead = m_freeList.load();
+            while ( !m_freeList.compare_exchange_weak( vHead, nullptr ) ) // bump tag, so concurrent pops fail.
+                ;
+            return vHead.ptr();
+        }
+        else
+        {
+            auto p = m_freeList;
+            m_freeList = nullptr;
+            return p;
+        }
+    }
+
+    template<class F>
+    static void for_each_slot( SlabHeader &slab, F &&func )
+    {
+        std::size_t k = 0;
+        for ( Byte *pSlot = reinterpret_cast<Byte *>( &slab ) + slab.info.firstSlotOffset; k < slab.info.slotCount;
+              ++k, pSlot += slab.info.slotSize )
+            func( reinterpret_cast<SlotHeader *>( pSlot ) );
+    }
+
+    void push_slots( SlabHeader &slab )
+    {
+        for_each_slot( slab, [this]( SlotHeader *pSlot ) {
+            Debugger::on_slot_init( pSlot );
+            ftl::PushSinglyListNode<SlotHeader, &SlotHeader::pNext>( &m_freeList, pSlot );
+        } );
+    }
+
+    /// \brief free released slabs, or drop their pages if the pool is thread-safe.
+    /// \pre m_slabLock is locked.
+    void release_slabs()
+    {
+        if constexpr ( IsAtomic )
+        {
+            for ( auto pSlab = next_of( &m_slabList ); pSlab; pSlab = next_of( pSlab ) )
+            {
+                if ( !pSlab->released )
+                    continue;
+                // keep the page of header.
+                const auto pageSize = page_size( pSlab->info.pageType );
+                auto pBegin = ftl::align_up( std::size_t( pSlab ) + sizeof( SlabHeader ), pageSize );
+                auto pEnd = ( std::size_t( pSlab ) + pSlab->info.slabSize ) & ~( pageSize - 1 );
+                if ( pBegin < pEnd )
+                    madvise( reinterpret_cast<void *>( pBegin ), pEnd - pBegin, MADV_DONTNEED );
+            }
+        }
+        else
+        {
+            for ( auto pPrev = &m_slabList; auto pSlab = pPrev->pNext; )
+            {
+                if ( pSlab->released )
+                {
+                    pPrev->pNext = pSlab->pNext;
+                    AlignedAlloc::free( pSlab, pSlab->info.slabSize, pSlab->info.pageType );
+                }
+                else
+                    pPrev = pSlab;
+            }
+        }
+    }
+
+    /// \pre m_slabLock is locked.
+    SlabHeader *reuse_released_slab()
+    {
+        if constexpr ( IsAtomic )
+        {
+            for ( auto pSlab = next_of( &m_slabList ); pSlab; pSlab = next_of( pSlab ) )
+            {
+                if ( pSlab->released )
+                {
+                    pSlab->released = false;
+                    m_totalSlots += std::ptrdiff_t( pSlab->info.slotCount );
+                    push_slots( *pSlab );
+                    return pSlab;
+                }
+            }
+        }
+        return nullptr;
+    }
+
     // @return number of slots segregated. -1 for too small slot for slot header.
-    static int segregate_slab( ftl::Byte *slab,
-                               const SlabInfo &slabInfo,
-                               typename SlabHeader::NextElemPtrType &slatList,
-                               typename SlotHeader::NextElemPtrType &slotFreeList )
+    int segregate_slab( ftl::Byte *slab,
+                        const SlabInfo &slabInfo,
+                        typename SlabHeader::NextElemPtrType &slatList,
+                        FreeListHead &slotFreeList )
     {
         new ( slab ) SlabHeader( slabInfo );
         std::size_t k = 0;
         for ( auto pSlot = slab + slabInfo.firstSlotOffset; k < slabInfo.slotCount; ++k, pSlot += slabInfo.slotSize )
         {
+            Debugger::on_slot_init( pSlot );
             ftl::PushSinglyListNode<SlotHeader, &SlotHeader::pNext>( &slotFreeList, reinterpret_cast<SlotHeader *>( pSlot ) );
         }
         ftl::PushSinglyListNode<SlabHeader, &SlabHeader::pNext>( &slatList, reinterpret_cast<SlabHeader *>( slab ) );
@@ -232,10 +568,16 @@ protected:
         if ( r.slotSize == 0 || r.minSlotsPerSlab == 0 )
             return false;
 
-        slabInfo.firstSlotOffset =
-                ftl::align_up( r.slabAlignment + slabHeaderSize, r.slotAlignment ? r.slotAlignment : r.slotSize ) - r.slabAlignment;
-        slabInfo.slotSize = ftl::align_up( r.slotSize, r.slotAlignment );
+        // default slot alignment is slotSize if it's power of 2, otherwise max_align_t.
+        const std::size_t slotAlignment =
+                r.slotAlignment ? r.slotAlignment : ( is_pow2( r.slotSize ) ? r.slotSize : alignof( std::max_align_t ) );
+        slabInfo.slabAlignment = std::max( r.slabAlignment, slotAlignment ); // slab start is aligned for both SlabHeader and slots.
+        slabInfo.firstSlotOffset = ftl::align_up( slabHeaderSize, slotAlignment );
+        slabInfo.slotSize = ftl::align_up(
+                ftl::align_up( std::max( r.slotSize, sizeof( SlotHeader ) ), Debugger::TRAILER_ALIGN ) + Debugger::TRAILER_SIZE, slotAlignment );
         slabInfo.slabSize = slabInfo.firstSlotOffset + slabInfo.slotSize * r.minSlotsPerSlab;
+        slabInfo.pageType = r.pageType;
+        // a slab of huge pages is rounded up to the pages actually mapped by allocate_slab().
         if ( r.alignupToSlabGranularity )
             slabInfo.slabSize = ftl::align_up( slabInfo.slabSize, typename SlabInfo::size_type( r.slabGranularity ) );
 
@@ -244,6 +586,302 @@ protected:
     }
 };
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief SlotDepot is a MemPool<true> with a lock-free depot of full batches (MagazineSize slots each).
+/// Threads keep free slots in their own Magazine, which is refilled from or flushed to the depot, so most malloc/free calls touch no
+/// shared cache line. When the depot is empty, slots come from the underlying MemPool<true>.
+/// SlotDepot doesn't own magazines, see ThreadCachedMemPool and SizeClassAllocator.
+/// \note Slots are at least 2 pointers large.
+template<bool ConstGrowthStrategy = true, class AlignedAlloc = MmapAlignedAlloc, std::size_t MagazineSize = 32>
+class SlotDepot
+{
+protected:
+    struct FreeSlot
+    {
+        FreeSlot *pNext;
+        std::atomic<FreeSlot *> pNextBatch; // valid only for the first slot of a batch in depot.
+    };
+
+public:
+    /// \brief LIFO stack of free slots owned by a single thread.
+    struct Magazine
+    {
+        FreeSlot *pTop = nullptr;
+        std::size_t count = 0;
+
+        bool empty() const
+        {
+            return !pTop;
+        }
+    };
+
+    SlotDepot() = default;
+    SlotDepot( const AllocRequest &ar )
+    {
+        init( ar );
+    }
+
+    int init( const AllocRequest &ar )
+    {
+        AllocRequest r = ar;
+        r.slotSize = std::max( r.slotSize, sizeof( FreeSlot ) );
+        return m_pool.init( r );
+    }
+
+    bool inited() const
+    {
+        return m_pool.inited();
+    }
+
+    /// \brief allocate a slot from magazine owned by current thread.
+    void *malloc( Magazine &mag )
+    {
+        if ( !mag.pTop && !refill( mag ) )
+            return nullptr;
+        auto p = mag.pTop;
+        mag.pTop = p->pNext;
+        --mag.count;
+        return p;
+    }
+
+    /// \brief free a slot allocated by any thread to magazine owned by current thread.
+    void free( Magazine &mag, void *p )
+    {
+        auto pSlot = static_cast<FreeSlot *>( p );
+        pSlot->pNext = mag.pTop;
+        mag.pTop = pSlot;
+        if ( ++mag.count >= 2 * MagazineSize ) // keep a full magazine to avoid thrashing at the boundary.
+            flush( mag );
+    }
+
+    std::size_t capacity() const
+    {
+        return m_pool.capacity();
+    }
+
+    /// \brief non-thread-safe. Return all slots to pool. Magazines must be reset by caller.
+    void clear()
+    {
+        m_depot.store( nullptr );
+        m_pool.clear();
+    }
+
+    /// \brief thread-safe. Return depot batches to pool and release empty slabs. Slots cached in magazines are not released.
+    int trim()
+    {
+        while ( auto pBatch = ftl::PopSinglyListNode<FreeSlot, &FreeSlot::pNextBatch>( &m_depot ) )
+        {
+            for ( auto pSlot = pBatch; pSlot; )
+            {
+                auto pNext = pSlot->pNext;
+                m_pool.free( pSlot );
+                pSlot = pNext;
+            }
+        }
+        return m_pool.trim();
+    }
+
+    bool grow_requested() const
+    {
+        return m_pool.grow_requested();
+    }
+
+    /// \brief thread-safe. See MemPool::pre_grow().
+    int pre_grow()
+    {
+        return m_pool.pre_grow();
+    }
+
+protected:
+    bool refill( Magazine &mag )
+    {
+        if ( auto pBatch = ftl::PopSinglyListNode<FreeSlot, &FreeSlot::pNextBatch>( &m_depot ) )
+        {
+            mag.pTop = pBatch;
+            mag.count = MagazineSize;
+            return true;
+        }
+        // slow path: depot is empty.
+        for ( ; mag.count < MagazineSize; ++mag.count )
+        {
+            auto pSlot = static_cast<FreeSlot *>( m_pool.malloc() );
+            if ( !pSlot )
+                break;
+            pSlot->pNext = mag.pTop;
+            mag.pTop = pSlot;
+        }
+        return mag.pTop;
+    }
+
+    /// \brief move MagazineSize slots from magazine to depot.
+    void flush( Magazine &mag )
+    {
+        auto pBatch = mag.pTop, pLast = mag.pTop;
+        for ( std::size_t k = 1; k < MagazineSize; ++k )
+            pLast = pLast->pNext;
+        mag.pTop = pLast->pNext;
+        mag.count -= MagazineSize;
+        pLast->pNext = nullptr;
+        ftl::PushSinglyListNode<FreeSlot, &FreeSlot::pNextBatch>( &m_depot, pBatch );
+    }
+
+    MemPool<true, ConstGrowthStrategy, AlignedAlloc, false> m_pool; // slots are freed to magazines, out of sight of PoolDebugger.
+    AtomicTaggedPtr<FreeSlot> m_depot; // lock-free stack of full batches.
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief ThreadCachedMemPool is a thread-safe MemPool front-end with per-thread magazines over a SlotDepot.
+/// Counters are per-thread and aggregated only when capacity() / free_size() is read.
+template<bool ConstGrowthStrategy = true, class AlignedAlloc = MmapAlignedAlloc, std::size_t MagazineSize = 32>
+class ThreadCachedMemPool
+{
+protected:
+    using Depot = SlotDepot<ConstGrowthStrategy, AlignedAlloc, MagazineSize>;
+
+    struct alignas( 64 ) Magazine : Depot::Magazine
+    {
+        std::atomic<std::ptrdiff_t> nMallocs{0}, nFrees{0}; // written only by the owner thread.
+        std::atomic<bool> adopted{true};
+
+        void reset()
+        {
+            this->pTop = nullptr;
+            this->count = 0;
+            nMallocs = 0;
+            nFrees = 0;
+        }
+    };
+
+    Depot m_depot;
+    ThreadCacheRegistry<Magazine> m_magazines;
+
+public:
+    ThreadCachedMemPool() = default;
+    ThreadCachedMemPool( const AllocRequest &ar )
+    {
+        init( ar );
+    }
+
+    int init( const AllocRequest &ar )
+    {
+        return m_depot.init( ar );
+    }
+
+    bool inited() const
+    {
+        return m_depot.inited();
+    }
+
+    /// \brief allocate a slot.
+    void *malloc()
+    {
+        auto &mag = m_magazines.local();
+        auto p = m_depot.malloc( mag );
+        if ( p )
+            mag.nMallocs.store( mag.nMallocs.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+        return p;
+    }
+
+    /// \brief free a slot allocated by any thread.
+    void free( void *p )
+    {
+        auto &mag = m_magazines.local();
+        mag.nFrees.store( mag.nFrees.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+        m_depot.free( mag, p );
+    }
+
+    std::size_t capacity() const
+    {
+        return m_depot.capacity();
+    }
+
+    std::size_t free_size() const
+    {
+        std::ptrdiff_t nAllocated = 0;
+        m_magazines.for_each( [&]( const Magazine &mag ) {
+            nAllocated += mag.nMallocs.load( std::memory_order_relaxed ) - mag.nFrees.load( std::memory_order_relaxed );
+        } );
+        return capacity() - nAllocated;
+    }
+
+    /// \brief non-thread-safe. Return all slots to pool.
+    void clear()
+    {
+        m_magazines.for_each( []( Magazine &mag ) { mag.reset(); } );
+        m_depot.clear();
+    }
+
+    /// \brief thread-safe. Release empty slabs, see SlotDepot::trim().
+    int trim()
+    {
+        return m_depot.trim();
+    }
+
+    bool grow_requested() const
+    {
+        return m_depot.grow_requested();
+    }
+
+    /// \brief thread-safe. See MemPool::pre_grow().
+    int pre_grow()
+    {
+        return m_depot.pre_grow();
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief PoolMaintainer does slow-path work of a thread-safe pool in a background thread, so latency-critical threads never do it:
+/// - pre_grow() when malloc() requested it at the low-water mark AllocRequest::preGrowFreeSlots.
+/// - trim() every trimInterval if it's not zero.
+/// Usage:
+///     MemPool<true> pool( ar );
+///     PoolMaintainer maintainer( pool, std::chrono::milliseconds( 1 ), std::chrono::seconds( 1 ) );
+class PoolMaintainer
+{
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+    std::thread m_thread;
+
+public:
+    template<class PoolT>
+    PoolMaintainer( PoolT &pool,
+                    std::chrono::milliseconds pollInterval = std::chrono::milliseconds( 1 ),
+                    std::chrono::milliseconds trimInterval = std::chrono::milliseconds( 0 ) )
+        : m_thread( [this, &pool, pollInterval, trimInterval] {
+              using Clock = std::chrono::steady_clock;
+              auto tsTrim = Clock::now() + trimInterval;
+              std::unique_lock<std::mutex> lock( m_lock );
+              while ( !m_cond.wait_for( lock, pollInterval, [this] { return m_stop; } ) )
+              {
+                  lock.unlock();
+                  if ( pool.grow_requested() )
+                      pool.pre_grow();
+                  if ( trimInterval.count() && Clock::now() >= tsTrim )
+                  {
+                      pool.trim();
+                      tsTrim = Clock::now() + trimInterval;
+                  }
+                  lock.lock();
+              }
+          } )
+    {
+    }
+
+    PoolMaintainer( const PoolMaintainer & ) = delete;
+    PoolMaintainer &operator=( const PoolMaintainer & ) = delete;
+
+    ~PoolMaintainer()
+    {
+        {
+            std::lock_guard<std::mutex> guard( m_lock );
+            m_stop = true;
+        }
+        m_cond.notify_one();
+        m_thread.join();
+    }
+};
+
 struct DisableEnableSharedFromThis
 {
 };
@@ -255,7 +893,7 @@ struct DisableEnableSharedFromThis
 /// \tparam EnableFromThisBase if it's std::enable_shared_from_this, ObjectPool is referenced by managed objects. it avoids pool destruction before
 /// managed objects deletion.
 template<class T,
-         std::size_t Alignment = sizeof( T ),
+         std::size_t Alignment = alignof( T ),
          bool MultiThreaded = true,
          bool ConstGrowthStrategy = true,
          class EnableFromThisBase = DisableEnableSharedFromThis>
@@ -349,7 +987,7 @@ public:
     {
         auto pNode = allocate();
         if ( pNode )
-            new ( pNode ) T( std::forward<Args...>( args )... );
+            new ( pNode ) T( std::forward<Args>( args )... );
         return pNode;
     }
 
@@ -365,10 +1003,23 @@ public:
         return std::shared_ptr<T>( create( std::forward<Args>( args )... ), to_deleter() );
     }
 
+    /// \brief create T, derived from intrusive_ref_counter<T>, which is destroyed and returned to this pool when the last reference
+    /// is released. Unlike create_shared(), the handle is a single pointer and there is no control block to allocate.
+    /// \pre the pool outlives the object.
+    template<class... Args>
+    intrusive_ptr<T> create_intrusive( Args &&... args )
+    {
+        auto pObj = create( std::forward<Args>( args )... );
+        if ( !pObj )
+            return nullptr;
+        pObj->set_recycler( []( void *pOwner, T *pObj ) { static_cast<ObjectPool *>( pOwner )->destroy( pObj ); }, this );
+        return intrusive_ptr<T>( pObj );
+    }
+
     // If pool is is_shared_from_this, call this will change refcount.
     void destroy( T *pObj )
     {
-        if ( !pObj )
+        if ( !pObj || !m_memPool.verify_allocated( pObj ) )
             return;
         pObj->~T();
         deallocate( pObj );
@@ -386,13 +1037,13 @@ public:
     {
         return m_memPool.free_size();
     }
-    Deleter to_deleter() const
+    Deleter to_deleter()
     {
         return Deleter( *this );
     }
-    AllocatorRef to_allocator() const
+    AllocatorRef to_allocator()
     {
-        return Allocator( *this );
+        return AllocatorRef( *this );
     }
 };
 
@@ -0,0 +1,231 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <execinfo.h>
+#include <unistd.h>
+
+/// Build with -DFTL_POOL_DEBUG=1 to harden all pools, or instantiate MemPool<..., true> to harden a single pool.
+#ifndef FTL_POOL_DEBUG
+#define FTL_POOL_DEBUG 0
+#endif
+
+namespace ftl
+{
+
+enum class PoolError
+{
+    DoubleFree, // slot is freed twice.
+    InvalidFree, // pointer is not a slot of the pool, or its trailer is overwritten.
+    BufferOverflow, // canary after slot is overwritten.
+    UseAfterFree, // poison of a free slot is overwritten.
+    Leak // slot is still allocated when pool is destroyed.
+};
+
+inline const char *to_string( PoolError err )
+{
+    switch ( err )
+    {
+    case PoolError::DoubleFree:
+        return "double free";
+    case PoolError::InvalidFree:
+        return "invalid free";
+    case PoolError::BufferOverflow:
+        return "buffer overflow";
+    case PoolError::UseAfterFree:
+        return "use after free";
+    case PoolError::Leak:
+        return "leak";
+    }
+    return "unknown";
+}
+
+/// \param frames allocation stack of the slot for Leak, empty otherwise.
+using PoolErrorHandler = void ( * )( PoolError err, const void *pSlot, void *const *frames, int nFrames );
+
+/// \brief print error and stack to stderr. Abort unless it's a leak.
+inline void default_pool_error_handler( PoolError err, const void *pSlot, void *const *frames, int nFrames )
+{
+    std::fprintf( stderr, "ftl pool error: %s, slot:%p\n", to_string( err ), pSlot );
+    if ( nFrames > 0 )
+    {
+        std::fprintf( stderr, "allocated at:\n" );
+        backtrace_symbols_fd( frames, nFrames, STDERR_FILENO );
+    }
+    if ( err == PoolError::Leak )
+        return;
+    void *stack[32];
+    backtrace_symbols_fd( stack, backtrace( stack, 32 ), STDERR_FILENO );
+    std::abort();
+}
+
+inline std::atomic<PoolErrorHandler> &pool_error_handler()
+{
+    static std::atomic<PoolErrorHandler> s_handler{&default_pool_error_handler};
+    return s_handler;
+}
+
+/// \return previous handler.
+inline PoolErrorHandler set_pool_error_handler( PoolErrorHandler handler )
+{
+    return pool_error_handler().exchange( handler ? handler : &default_pool_error_handler );
+}
+
+/// \brief PoolDebugger checks slots of a MemPool. The disabled one is empty and all its hooks are no-op.
+template<bool Enabled>
+class PoolDebugger
+{
+public:
+    constexpr static bool ENABLED = false;
+    constexpr static std::size_t TRAILER_SIZE = 0, TRAILER_ALIGN = 1;
+
+    void init( std::size_t )
+    {
+    }
+    void on_slot_init( void * )
+    {
+    }
+    void on_malloc( void * )
+    {
+    }
+    bool on_free( void * )
+    {
+        return true;
+    }
+    bool verify_allocated( const void * ) const
+    {
+        return true;
+    }
+    void check_leak( const void * ) const
+    {
+    }
+};
+
+/// \brief enabled PoolDebugger appends a trailer to each slot:
+///     |SlotHeader|poison ... |canary|state|allocation stack|
+/// - Free slots are poisoned, a write to a free slot is reported by the next malloc() of it.
+/// - The canary between slots catches overflow when the slot is freed.
+/// - The state catches double free and invalid free. The slot is not returned to the pool then.
+/// - Allocation stacks of slots still live at pool destruction are reported as leaks.
+/// Errors go to the handler set by set_pool_error_handler().
+template<>
+class PoolDebugger<true>
+{
+protected:
+    constexpr static std::uint64_t CANARY = 0xC0DEC0DEFEEDFACEull;
+    constexpr static std::uint32_t FREE = 0xF4EEF4EE, ALLOCATED = 0xA110CA7E;
+    constexpr static unsigned char POISON = 0xDD;
+    constexpr static int MAX_FRAMES = 8;
+
+    struct SlotTrailer
+    {
+        std::uint64_t canary;
+        std::atomic<std::uint32_t> state;
+        std::uint32_t nFrames;
+        void *frames[MAX_FRAMES];
+    };
+
+    std::size_t m_trailerOffset = 0;
+
+    static void report( PoolError err, const void *pSlot, void *const *frames = nullptr, int nFrames = 0 )
+    {
+        pool_error_handler().load()( err, pSlot, frames, nFrames );
+    }
+
+    SlotTrailer *trailer_of( const void *p ) const
+    {
+        return reinterpret_cast<SlotTrailer *>( const_cast<char *>( static_cast<const char *>( p ) ) + m_trailerOffset );
+    }
+
+public:
+    constexpr static bool ENABLED = true;
+    constexpr static std::size_t TRAILER_SIZE = sizeof( SlotTrailer ), TRAILER_ALIGN = alignof( SlotTrailer );
+
+    /// \param slotSize size of slot excluding trailer.
+    void init( std::size_t slotSize )
+    {
+        m_trailerOffset = ( slotSize + TRAILER_ALIGN - 1 ) & ~( TRAILER_ALIGN - 1 );
+    }
+
+    /// \brief poison a slot of a new slab, or a slot returned by MemPool::clear().
+    void on_slot_init( void *p )
+    {
+        std::memset( static_cast<char *>( p ) + sizeof( void * ), POISON, m_trailerOffset - sizeof( void * ) );
+        auto pTrailer = trailer_of( p );
+        pTrailer->canary = CANARY;
+        pTrailer->state.store( FREE, std::memory_order_relaxed );
+        pTrailer->nFrames = 0;
+    }
+
+    void on_malloc( void *p )
+    {
+        auto pBytes = static_cast<const unsigned char *>( p );
+        for ( auto k = sizeof( void * ); k < m_trailerOffset; ++k ) // the first word is the free list link.
+            if ( pBytes[k] != POISON )
+            {
+                report( PoolError::UseAfterFree, p );
+                break;
+            }
+        auto pTrailer = trailer_of( p );
+        pTrailer->state.store( ALLOCATED, std::memory_order_relaxed );
+        pTrailer->nFrames = std::uint32_t( backtrace( pTrailer->frames, MAX_FRAMES ) );
+    }
+
+    /// \return false if the slot must not be returned to the pool.
+    bool on_free( void *p )
+    {
+        auto pTrailer = trailer_of( p );
+        if ( pTrailer->canary != CANARY )
+            report( PoolError::BufferOverflow, p );
+        auto state = pTrailer->state.exchange( FREE, std::memory_order_relaxed );
+        if ( state != ALLOCATED )
+        {
+            if ( state != FREE )
+                pTrailer->state.store( state, std::memory_order_relaxed );
+            report( state == FREE ? PoolError::DoubleFree : PoolError::InvalidFree, p );
+            return false;
+        }
+        pTrailer->canary = CANARY;
+        std::memset( static_cast<char *>( p ) + sizeof( void * ), POISON, m_trailerOffset - sizeof( void * ) );
+        return true;
+    }
+
+    /// \brief check a slot before its object is destroyed, eg. by ObjectPool::destroy().
+    bool verify_allocated( const void *p ) const
+    {
+        auto state = trailer_of( p )->state.load( std::memory_order_relaxed );
+        if ( state == ALLOCATED )
+            return true;
+        report( state == FREE ? PoolError::DoubleFree : PoolError::InvalidFree, p );
+        return false;
+    }
+
+    /// \brief report the slot if it's still allocated.
+    void check_leak( const void *p ) const
+    {
+        auto pTrailer = trailer_of( p );
+        if ( pTrailer->state.load( std::memory_order_relaxed ) == ALLOCATED )
+            report( PoolError::Leak, p, pTrailer->frames, int( pTrailer->nFrames ) );
+    }
+};
+
+} // namespace ftl
@@ -191,7 +191,7 @@ namespace reactor
             }
 
 #else
-            while ( !events.try_push( e, 1000000 ) )
+            while ( !events.try_push( std::move( e ), 1000000 ) ) // not moved from if it fails.
             {
 #ifdef _REACTOR_DBG
                 ss << name << " failed to push event " << e;
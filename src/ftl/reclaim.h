@@ -0,0 +1,346 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <ftl/thread_cache.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace ftl
+{
+/// Deferred memory reclamation for lock-free structures: a node unlinked by one thread is retired instead of freed, and reclaimed once
+/// no concurrent reader can still hold a pointer to it.
+/// - HazardDomain: readers publish the pointers they dereference in hazard slots. Bounded garbage, a store and a fence per pointer.
+/// - EpochDomain: readers pin the global epoch in a Guard scope. Cheaper reads, but a stalled reader delays all reclamation.
+/// Retired objects go to a per-thread retire list, which is scanned when it reaches scanThreshold, so the cost is amortized.
+/// Retire lists of exited threads are adopted by new threads (see ThreadCacheRegistry) and reclaimed at domain destruction.
+namespace reclaim
+{
+    /// \brief a retired object, reclaimed by calling pfnReclaim( pCtx, p ) when it's unreachable.
+    struct Retired
+    {
+        void *p;
+        void ( *pfnReclaim )( void *pCtx, void *p );
+        void *pCtx;
+
+        void reclaim() const
+        {
+            pfnReclaim( pCtx, p );
+        }
+    };
+
+    template<class T>
+    Retired make_retired( T *p )
+    {
+        return Retired{p, []( void *, void *p ) { delete static_cast<T *>( p ); }, nullptr};
+    }
+
+    constexpr std::size_t DEFAULT_SCAN_THRESHOLD = 64;
+
+    //////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// \brief HazardDomain: a retired object is reclaimed when it's not in any hazard slot.
+    /// Usage:
+    ///     HazardDomain<>::Guard guard; // takes a hazard slot of this thread.
+    ///     auto pHead = guard.protect( m_head ); // safe to dereference until guard is reset or destroyed.
+    ///     if ( pHead && m_head.compare_exchange_strong( pHead, pHead->pNext ) )
+    ///         HazardDomain<>::instance().retire( pHead );
+    /// \tparam SlotsPerThread max number of Guards alive at the same time in a thread.
+    template<std::size_t SlotsPerThread = 4>
+    class HazardDomain
+    {
+        static_assert( SlotsPerThread > 0 && SlotsPerThread < 32 );
+
+        struct ThreadRecord
+        {
+            std::atomic<bool> adopted{true};
+            std::atomic<const void *> hazards[SlotsPerThread]{};
+            unsigned usedSlots = 0; // bitmask of slots taken by Guards. Accessed only by the owner thread.
+            std::vector<Retired> retired;
+            std::vector<const void *> protectedPtrs; // scratch buffer for scan.
+        };
+
+        ThreadCacheRegistry<ThreadRecord> m_records;
+        const std::size_t m_scanThreshold;
+
+    public:
+        /// \brief Guard owns a hazard slot of current thread.
+        class Guard
+        {
+            ThreadRecord &m_record;
+            unsigned m_slot = 0;
+
+        public:
+            explicit Guard( HazardDomain &domain = instance() ) : m_record( domain.m_records.local() )
+            {
+                assert( m_record.usedSlots != ( 1u << SlotsPerThread ) - 1 && "no free hazard slot" );
+                while ( m_record.usedSlots & ( 1u << m_slot ) )
+                    ++m_slot;
+                m_record.usedSlots |= 1u << m_slot;
+            }
+            Guard( const Guard & ) = delete;
+            Guard &operator=( const Guard & ) = delete;
+
+            ~Guard()
+            {
+                reset();
+                m_record.usedSlots &= ~( 1u << m_slot );
+            }
+
+            /// \brief load src and protect the loaded pointer.
+            template<class T>
+            T *protect( const std::atomic<T *> &src )
+            {
+                auto p = src.load( std::memory_order_relaxed );
+                for ( ;; )
+                {
+                    m_record.hazards[m_slot].store( p, std::memory_order_seq_cst );
+                    auto pNow = src.load( std::memory_order_acquire ); // p may have been retired before it was published.
+                    if ( pNow == p )
+                        return p;
+                    p = pNow;
+                }
+            }
+
+            /// \brief protect a pointer known to be reachable, eg. already protected by another guard.
+            void set( const void *p )
+            {
+                m_record.hazards[m_slot].store( p, std::memory_order_seq_cst );
+            }
+
+            void reset()
+            {
+                m_record.hazards[m_slot].store( nullptr, std::memory_order_release );
+            }
+        };
+
+        explicit HazardDomain( std::size_t scanThreshold = DEFAULT_SCAN_THRESHOLD ) : m_scanThreshold( std::max<std::size_t>( scanThreshold, 1 ) )
+        {
+        }
+        HazardDomain( const HazardDomain & ) = delete;
+        HazardDomain &operator=( const HazardDomain & ) = delete;
+
+        /// \pre no Guard is alive and no thread uses the domain.
+        ~HazardDomain()
+        {
+            m_records.for_each( []( ThreadRecord &record ) {
+                for ( auto &r : record.retired )
+                    r.reclaim();
+                record.retired.clear();
+            } );
+        }
+
+        static HazardDomain &instance()
+        {
+            static HazardDomain s_domain;
+            return s_domain;
+        }
+
+        /// \brief reclaim p by delete when it's not protected. p must be unlinked already.
+        template<class T>
+        void retire( T *p )
+        {
+            retire( make_retired( p ) );
+        }
+
+        void retire( const Retired &r )
+        {
+            auto &record = m_records.local();
+            record.retired.push_back( r );
+            if ( record.retired.size() >= m_scanThreshold )
+                scan( record );
+        }
+
+        /// \brief reclaim unprotected objects retired by current thread.
+        /// \return number of objects reclaimed.
+        std::size_t flush()
+        {
+            return scan( m_records.local() );
+        }
+
+        /// \brief number of objects retired but not reclaimed, by all threads. Exact only when other threads are quiescent.
+        std::size_t retired_size() const
+        {
+            std::size_t n = 0;
+            m_records.for_each( [&]( const ThreadRecord &record ) { n += record.retired.size(); } );
+            return n;
+        }
+
+    protected:
+        std::size_t scan( ThreadRecord &record )
+        {
+            std::atomic_thread_fence( std::memory_order_seq_cst ); // pairs with the store in Guard::protect.
+            auto &ptrs = record.protectedPtrs;
+            ptrs.clear();
+            m_records.for_each( [&]( const ThreadRecord &r ) {
+                for ( auto &hazard : r.hazards )
+                    if ( auto p = hazard.load( std::memory_order_acquire ) )
+                        ptrs.push_back( p );
+            } );
+            std::sort( ptrs.begin(), ptrs.end() );
+
+            auto itKeep = std::partition( record.retired.begin(), record.retired.end(), [&]( const Retired &r ) {
+                return std::binary_search( ptrs.begin(), ptrs.end(), static_cast<const void *>( r.p ) );
+            } );
+            const auto n = std::size_t( record.retired.end() - itKeep );
+            for ( auto it = itKeep; it != record.retired.end(); ++it )
+                it->reclaim();
+            record.retired.erase( itKeep, record.retired.end() );
+            return n;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    /// \brief EpochDomain: an object retired in epoch e is reclaimed when the global epoch reaches e + 2. The global epoch advances
+    /// only when every pinned thread has observed the current one, so no reader pinned before the object was unlinked is still running.
+    /// Usage:
+    ///     EpochDomain::Guard guard; // pin. Guards may nest.
+    ///     auto pHead = m_head.load( std::memory_order_acquire ); // safe to dereference until guard is destroyed.
+    ///     if ( pHead && m_head.compare_exchange_strong( pHead, pHead->pNext ) )
+    ///         EpochDomain::instance().retire( pHead );
+    class EpochDomain
+    {
+        struct ThreadRecord
+        {
+            std::atomic<bool> adopted{true};
+            std::atomic<std::uint64_t> epoch{0}; // epoch pinned by current thread, 0 if not pinned.
+            unsigned nesting = 0; // accessed only by the owner thread.
+            std::vector<std::pair<std::uint64_t, Retired>> retired; // in order of epoch.
+        };
+
+        ThreadCacheRegistry<ThreadRecord> m_records;
+        std::atomic<std::uint64_t> m_epoch{1};
+        const std::size_t m_scanThreshold;
+
+    public:
+        /// \brief Guard pins current thread to the global epoch.
+        class Guard
+        {
+            ThreadRecord &m_record;
+
+        public:
+            explicit Guard( EpochDomain &domain = instance() ) : m_record( domain.m_records.local() )
+            {
+                if ( m_record.nesting++ == 0 )
+                {
+                    m_record.epoch.store( domain.m_epoch.load( std::memory_order_relaxed ), std::memory_order_release );
+                    std::atomic_thread_fence( std::memory_order_seq_cst ); // publish before reading shared pointers.
+                }
+            }
+            Guard( const Guard & ) = delete;
+            Guard &operator=( const Guard & ) = delete;
+
+            ~Guard()
+            {
+                if ( --m_record.nesting == 0 )
+                    m_record.epoch.store( 0, std::memory_order_release );
+            }
+        };
+
+        explicit EpochDomain( std::size_t scanThreshold = DEFAULT_SCAN_THRESHOLD ) : m_scanThreshold( std::max<std::size_t>( scanThreshold, 1 ) )
+        {
+        }
+        EpochDomain( const EpochDomain & ) = delete;
+        EpochDomain &operator=( const EpochDomain & ) = delete;
+
+        /// \pre no Guard is alive and no thread uses the domain.
+        ~EpochDomain()
+        {
+            m_records.for_each( []( ThreadRecord &record ) {
+                for ( auto &r : record.retired )
+                    r.second.reclaim();
+                record.retired.clear();
+            } );
+        }
+
+        static EpochDomain &instance()
+        {
+            static EpochDomain s_domain;
+            return s_domain;
+        }
+
+        /// \brief reclaim p by delete after all current readers are gone. p must be unlinked already.
+        template<class T>
+        void retire( T *p )
+        {
+            retire( make_retired( p ) );
+        }
+
+        void retire( const Retired &r )
+        {
+            auto &record = m_records.local();
+            record.retired.emplace_back( m_epoch.load( std::memory_order_seq_cst ), r );
+            if ( record.retired.size() >= m_scanThreshold )
+                scan( record );
+        }
+
+        /// \brief try to advance the epoch and reclaim objects retired by current thread.
+        /// \return number of objects reclaimed.
+        std::size_t flush()
+        {
+            return scan( m_records.local() );
+        }
+
+        /// \brief advance the global epoch if all pinned threads have observed it.
+        /// \return the global epoch.
+        std::uint64_t try_advance()
+        {
+            auto epoch = m_epoch.load( std::memory_order_seq_cst );
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            bool canAdvance = true;
+            m_records.for_each( [&]( const ThreadRecord &record ) {
+                auto pinned = record.epoch.load( std::memory_order_acquire ); // synchronizes with pin and unpin of the reader.
+                canAdvance = canAdvance && ( !pinned || pinned == epoch );
+            } );
+            if ( !canAdvance )
+                return epoch;
+            if ( m_epoch.compare_exchange_strong( epoch, epoch + 1, std::memory_order_acq_rel ) )
+                return epoch + 1;
+            return epoch; // advanced by another thread.
+        }
+
+        std::uint64_t epoch() const
+        {
+            return m_epoch.load( std::memory_order_relaxed );
+        }
+
+        /// \brief number of objects retired but not reclaimed, by all threads. Exact only when other threads are quiescent.
+        std::size_t retired_size() const
+        {
+            std::size_t n = 0;
+            m_records.for_each( [&]( const ThreadRecord &record ) { n += record.retired.size(); } );
+            return n;
+        }
+
+    protected:
+        std::size_t scan( ThreadRecord &record )
+        {
+            const auto epoch = try_advance();
+            auto it = record.retired.begin();
+            for ( ; it != record.retired.end() && it->first + 2 <= epoch; ++it )
+                it->second.reclaim();
+            const auto n = std::size_t( it - record.retired.begin() );
+            record.retired.erase( record.retired.begin(), it );
+            return n;
+        }
+    };
+
+} // namespace reclaim
+} // namespace ftl
@@ -18,13 +18,11 @@
 #ifndef _SHAREDOBJECTPOOL_H_
 #define _SHAREDOBJECTPOOL_H_
 
-#include <ftl/gen_itertor.h>
-#include <ftl/intrusive_list.h>
-#include <ftl/circular_queue.h>
+#include <ftl/mem_pool.h>
 
 #include <memory>
 #include <cassert>
-#include <iostream>
+#include <type_traits>
 
 
 namespace ftl
@@ -56,270 +54,232 @@ protected:
     safe_enable_shared_from_this &operator=( const safe_enable_shared_from_this & ) = delete;
 };
 
-template<typename ChildT, typename Object, typename ObjectAlloc = std::allocator<Object>, typename QueueT = ftl::intrusive_singly_list<Object>>
-class shared_object_pool_base
+namespace internal
 {
-public:
-    typedef shared_object_pool_base this_type;
-    // should be protected
-    shared_object_pool_base( const ObjectAlloc &alloc = ObjectAlloc() ) : objectAlloc( alloc ), allocatedCount( 0 )
+    /// \brief the control block which std::allocate_shared<Object>( Alloc ) allocates by Alloc rebound to it, with Object inside.
+    template<class Object, class Alloc>
+    struct SharedControlBlock
     {
-    }
-
-    static const size_t obj_size = sizeof( Object );
-
-    friend ChildT;
-
-protected:
-    typedef QueueT ObjectQ;
-    ObjectAlloc objectAlloc;
-    ObjectQ freeQ;
-    size_t allocatedCount = 0;
-    size_t freeCount = 0; // for debug only
+#if defined( __GLIBCXX__ )
+        using type = std::_Sp_counted_ptr_inplace<std::remove_cv_t<Object>, Alloc, __gnu_cxx::__default_lock_policy>;
+#elif defined( _LIBCPP_VERSION )
+        using type = std::__shared_ptr_emplace<std::remove_cv_t<Object>, Alloc>;
+#else
+        struct type // layout guess: vptr, 2 counters, allocator and object. Checked by shared_object_pool_base::allocator::allocate().
+        {
+            void *vptr;
+            long counts[2];
+            Alloc alloc;
+            Object object;
+        };
+#endif
+    };
+} // namespace internal
+
+/// \brief shared_object_pool_base creates shared/unique objects in slots of a lock-free pool.
+/// - create_shared() embeds the shared_ptr control block in the slot by std::allocate_shared, so there is one slot per object.
+/// - Objects can be released by any thread. Each object holds a reference to the pool, so the pool lives until the last object is
+///   released, even if all Ptr are gone.
+/// \tparam Fixed if true, pool never grows and slots are in a lock-free MemPool. Otherwise, slots are in a ThreadCachedMemPool.
+template<typename ChildT, typename Object, bool Fixed, typename AlignedAlloc = MmapAlignedAlloc>
+class shared_object_pool_base
+{
 public:
-    struct object_destroy;
-    friend object_destroy;
-    typedef std::shared_ptr<Object> shared_object_ptr;
-    typedef std::unique_ptr<Object, object_destroy> unique_object_ptr;
-    typedef std::shared_ptr<ChildT> Ptr;
+    using this_type = shared_object_pool_base;
+    using shared_object_ptr = std::shared_ptr<Object>;
+    using Ptr = std::shared_ptr<ChildT>;
 
-    struct default_destroy
+    /// \brief destroy object and return slot to pool.
+    struct object_destroy
     {
+        this_type *pPool = nullptr;
+
         void operator()( Object *p )
         {
+            assert( p && pPool || !p );
             if ( p )
+            {
                 p->~Object();
+                pPool->free_slot( p );
+            }
         }
     };
+    using unique_object_ptr = std::unique_ptr<Object, object_destroy>;
 
-    struct object_destroy
+    /// \brief allocator of std::allocate_shared. The control block with object is allocated in the slot reserved by create_shared().
+    /// Slots are sized by the control block type, so it's a compile error rather than a heap fallback if they don't match.
+    template<class T>
+    class allocator
     {
-        Ptr pPool; // ensure pool existence
-        object_destroy( const Ptr &p = nullptr ) : pPool( p )
+        template<class U>
+        friend class allocator;
+
+        this_type *m_pPool;
+        void *m_pSlot;
+
+    public:
+        using value_type = T;
+
+        template<class U>
+        struct rebind
+        {
+            using other = allocator<U>;
+        };
+
+        allocator( this_type *pPool, void *pSlot ) : m_pPool( pPool ), m_pSlot( pSlot )
         {
         }
-        object_destroy( const object_destroy &d ) : pPool( d.pPool )
+
+        template<class U>
+        allocator( const allocator<U> &a ) : m_pPool( a.m_pPool ), m_pSlot( a.m_pSlot )
         {
-            //            std::cout << "return_object(return_object&)" << std::endl;
         }
-        object_destroy( object_destroy &&d ) : pPool( std::move( d.pPool ) )
+
+        T *allocate( [[maybe_unused]] std::size_t n )
         {
+            static_assert( fits_slot<T>(), "the shared_ptr control block doesn't fit in a slot, see internal::SharedControlBlock" );
+            assert( n == 1 && m_pSlot );
+            return static_cast<T *>( m_pSlot );
         }
-        object_destroy &operator=( const object_destroy &d )
+
+        void deallocate( T *p, std::size_t )
         {
-            pPool = d.pPool;
-            return *this;
+            m_pPool->free_slot( p );
         }
-        object_destroy &operator=( object_destroy &&d )
+
+        template<class U>
+        bool operator==( const allocator<U> &a ) const
         {
-            pPool = std::move( d.pPool );
-            return *this;
+            return m_pPool == a.m_pPool;
         }
 
-        void operator()( Object *p )
+        template<class U>
+        bool operator!=( const allocator<U> &a ) const
         {
-            assert( p && pPool || !p );
-            // return it to freeQ
-            if ( p )
-            { // todo lock
-                ++pPool->freeCount;
-                default_destroy destroy;
-                destroy( p );
-                pPool->freeQ.push( *p );
-            }
-            //            std::cout << "destroy Object: allocated:" << pPool->allocatedCount << ", free size:" << pPool->freeQ.size() << std::endl;
+            return m_pPool != a.m_pPool;
         }
     };
 
-    template<bool bOneByOne = true>
-    void destroy()
+    using control_block = typename internal::SharedControlBlock<Object, allocator<Object>>::type;
+    static constexpr std::size_t SLOT_ALIGNMENT = alignof( control_block );
+    static constexpr std::size_t SLOT_SIZE = sizeof( control_block );
+
+    template<class T>
+    static constexpr bool fits_slot()
     {
-        assert( allocatedCount == freeCount );
-        //        std::cout << "~shared_object_pool_base, allocated size:" << allocatedCount << " == freeQ size:" << freeQ.size() << std::endl;
-        if ( !freeQ.empty() )
-        { // todo lock
-            while ( !freeQ.empty() )
-            {
-                objectAlloc.deallocate( reinterpret_cast<Object *>( &freeQ.top() ), 1 );
-                freeQ.pop();
-            }
-        }
+        return sizeof( T ) <= SLOT_SIZE && alignof( T ) <= SLOT_ALIGNMENT;
+    }
+
+    /// \brief create pool. The pool is deleted when the returned Ptr and all objects are released.
+    template<typename... Args>
+    static Ptr create_me( Args &&... args )
+    {
+        return Ptr( new ChildT( std::forward<Args>( args )... ), []( ChildT *p ) { p->release_ref(); } );
     }
 
+    /// \return nullptr if a fixed pool is exhausted.
     template<typename... Args>
     shared_object_ptr create_shared( Args &&... args )
     {
-        if ( auto p = static_cast<ChildT *>( this )->get_or_allocate() )
-        {
-            new ( p ) Object( std::forward<Args>( args )... );
-            return {p, object_destroy( static_cast<ChildT *>( this )->me_ptr() )};
-        }
-        else
-            return {};
+        if ( auto p = get_or_allocate() )
+            return std::allocate_shared<Object>( allocator<Object>( this, p ), std::forward<Args>( args )... );
+        return {};
     }
 
+    /// \return nullptr if a fixed pool is exhausted.
     template<typename... Args>
     unique_object_ptr create_unique( Args &&... args )
     {
-        if ( auto p = static_cast<ChildT *>( this )->get_or_allocate() )
+        static_assert( fits_slot<Object>() );
+        if ( auto p = get_or_allocate() )
         {
             new ( p ) Object( std::forward<Args>( args )... );
-            return {p, object_destroy( static_cast<ChildT *>( this )->me_ptr() )};
+            return {static_cast<Object *>( p ), object_destroy{this}};
         }
-        else
-            return {nullptr, {}};
+        return {nullptr, {}};
     }
 
+    /// \brief number of free slots.
     size_t size() const
     {
-        return freeQ.size();
-    }
-
-    size_t allocate( size_t n = 1 )
-    {
-        for ( size_t i = 0; i < n; ++i )
-        {
-            if ( auto p = objectAlloc.allocate( 1 ) )
-                freeQ.push( *p );
-            else
-                return i;
-        }
-        return n;
+        return m_pool.free_size();
     }
 
+    /// \brief release empty slabs. No-op for a fixed pool, which can't get its slots back once released.
     void clear()
     {
-        while ( !freeQ.empty() )
-        {
-            objectAlloc.deallocate( &freeQ.top(), 1 );
-            freeQ.pop();
-        }
+        if constexpr ( !Fixed )
+            m_pool.trim();
     }
-};
-
 
-template<typename ChildT,
-         typename Object,
-         size_t CapacityT,
-         typename ObjectAlloc = std::allocator<Object>,
-         typename QueueT = ftl::intrusive_singly_list<Object>>
-class fixed_shared_pool_base : public shared_object_pool_base<ChildT, Object, ObjectAlloc, QueueT>
-{
 protected:
-    Object *mObjects;
-
-public:
-    using this_type = fixed_shared_pool_base;
-    using base_type = shared_object_pool_base<ChildT, Object, ObjectAlloc, QueueT>;
-
-    static const size_t capacity = CapacityT;
+    friend ChildT;
+    using SlotPool = std::conditional_t<Fixed, MemPool<true, true, AlignedAlloc>, ThreadCachedMemPool<false, AlignedAlloc>>;
 
-    // should be protected
-    fixed_shared_pool_base( const ObjectAlloc &alloc = ObjectAlloc() ) : base_type( alloc )
+    shared_object_pool_base( size_t nSlots )
     {
-        mObjects = base_type::objectAlloc.allocate( CapacityT, nullptr );
-        for ( size_t i = 0; i < CapacityT; ++i )
-            base_type::freeQ.push( *( mObjects + i ) );
+        AllocRequest ar{SLOT_SIZE, std::max<size_t>( nSlots, 1 ), SLOT_ALIGNMENT};
+        ar.maxSlotsPerSlab = 4096;
+        m_pool.init( ar );
     }
+    shared_object_pool_base( const shared_object_pool_base & ) = delete;
+    shared_object_pool_base &operator=( const shared_object_pool_base & ) = delete;
 
-    ~fixed_shared_pool_base()
+    /// \brief allocate a slot and add a reference for the object.
+    void *get_or_allocate()
     {
-        //        assert( base_type::freeQ.size() == CapacityT );
-        //        std::cout << "~fixed_shared_pool_base, allocated size:" << base_type::allocatedCount << " == freeQ size:" <<
-        //        base_type::freeQ.size()
-        //                  << std::endl;
-        if ( mObjects )
-        { // todo lock
-            base_type::objectAlloc.deallocate( mObjects, CapacityT );
-            mObjects = nullptr;
-        }
+        void *p;
+        if constexpr ( Fixed )
+            p = m_pool.try_malloc();
+        else
+            p = m_pool.malloc();
+        if ( p )
+            m_nRefs.fetch_add( 1, std::memory_order_relaxed );
+        return p;
     }
 
-    size_t size() const
+    void free_slot( void *p )
     {
-        return base_type::freeQ.size();
+        m_pool.free( p );
+        release_ref();
     }
 
-    size_t allocate( size_t )
+    void release_ref()
     {
-        return 0;
+        if ( m_nRefs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+            delete static_cast<ChildT *>( this );
     }
+
+    SlotPool m_pool;
+    std::atomic<size_t> m_nRefs{1}; // objects and the Ptr returned by create_me().
 };
 
-template<typename Object, typename ObjectAlloc = std::allocator<Object>>
-class shared_object_pool : public shared_object_pool_base<shared_object_pool<Object, ObjectAlloc>, Object, ObjectAlloc>,
-                           public safe_enable_shared_from_this<shared_object_pool<Object, ObjectAlloc>>
+/// \brief growable pool of shared objects. Create by create_me().
+template<typename Object, typename AlignedAlloc = MmapAlignedAlloc>
+class shared_object_pool : public shared_object_pool_base<shared_object_pool<Object, AlignedAlloc>, Object, false, AlignedAlloc>
 {
 public:
     using this_type = shared_object_pool;
-    using base_type = shared_object_pool_base<this_type, Object, ObjectAlloc>;
-
-    friend struct safe_enable_shared_from_this<this_type>::Alloc;
-
-    shared_object_pool( const ObjectAlloc &alloc = ObjectAlloc() ) : base_type( alloc )
-    {
-    }
-    ~shared_object_pool()
-    {
-        static_cast<base_type *>( this )->destroy();
-    }
-
-    auto me_ptr()
-    {
-        return this->shared_from_this();
-    }
+    using base_type = shared_object_pool_base<this_type, Object, false, AlignedAlloc>;
 
-    Object *get_or_allocate()
+    /// \param initialCapacity slots of the first slab. Slabs double in size.
+    shared_object_pool( size_t initialCapacity = 64 ) : base_type( initialCapacity )
     {
-        // todo lock
-        Object *p = nullptr;
-        if ( !base_type::freeQ.empty() )
-        {
-            p = &base_type::freeQ.top();
-            base_type::freeQ.pop();
-        }
-        else
-        {
-            // if freeQ empty
-            ++base_type::allocatedCount;
-            p = base_type::objectAlloc.allocate( 1, nullptr );
-        }
-        return p;
     }
 };
 
-template<typename Object, size_t CapacityT, typename ObjectAlloc = std::allocator<Object>>
-class fixed_shared_pool : public fixed_shared_pool_base<fixed_shared_pool<Object, CapacityT, ObjectAlloc>, Object, CapacityT, ObjectAlloc>,
-                          public safe_enable_shared_from_this<fixed_shared_pool<Object, CapacityT, ObjectAlloc>>
+/// \brief pool of CapacityT shared objects. Create by create_me().
+template<typename Object, size_t CapacityT, typename AlignedAlloc = MmapAlignedAlloc>
+class fixed_shared_pool : public shared_object_pool_base<fixed_shared_pool<Object, CapacityT, AlignedAlloc>, Object, true, AlignedAlloc>
 {
 public:
     using this_type = fixed_shared_pool;
-    using base_type = fixed_shared_pool_base<this_type, Object, CapacityT, ObjectAlloc>;
-
-    friend struct safe_enable_shared_from_this<this_type>::Alloc;
-
-    fixed_shared_pool( const ObjectAlloc &alloc = ObjectAlloc() ) : base_type( alloc )
-    {
-    }
+    using base_type = shared_object_pool_base<this_type, Object, true, AlignedAlloc>;
 
-    auto me_ptr()
-    {
-        return this->shared_from_this();
-    }
+    static const size_t capacity = CapacityT;
 
-    Object *get_or_allocate()
+    fixed_shared_pool() : base_type( CapacityT )
     {
-        // todo lock
-        Object *p = nullptr;
-        if ( !base_type::freeQ.empty() )
-        {
-            //            using OBJECTPTR = Object*;
-            //            auto &r = base_type::freeQ.top(); //reinterpret_cast<Object*>(base_type::freeQ.top<Object*>());
-            //            auto &rr = reinterpret_cast<OBJECTPTR&>(r);
-            p = &base_type::freeQ.top();
-            base_type::freeQ.pop();
-        }
-        return p;
     }
 };
 } // namespace ftl
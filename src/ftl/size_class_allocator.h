@@ -0,0 +1,315 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <ftl/mem_pool.h>
+
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <string>
+
+namespace ftl
+{
+
+/// \brief Size classes of SizeClassAllocator, similar to tcmalloc's.
+///  - 16, 32, 48, ..., 128: 16 bytes apart.
+///  - 160, 192, 224, 256, 320, ..., 32K: 4 classes per power of 2, so internal fragmentation is less than 25%.
+/// Requests of 8 bytes or less are served by the 16-byte class because a free slot holds 2 links.
+struct SizeClasses
+{
+    static constexpr std::size_t MIN_SIZE = 16;
+    static constexpr std::size_t MAX_SIZE = 32 * 1024;
+    static constexpr std::size_t SMALL_SIZE = 128; // max size of 16-byte spaced classes.
+    static constexpr std::size_t NUM_SMALL_CLASSES = SMALL_SIZE / MIN_SIZE;
+    static constexpr std::size_t NUM_CLASSES = NUM_SMALL_CLASSES + 4 * 8; // 4 classes per power of 2 in (128, 32K].
+    static constexpr std::size_t MAX_SLOT_ALIGNMENT = 4096;
+    static constexpr std::size_t SLAB_SIZE = 64 * 1024; // target slab size.
+    static constexpr std::size_t MIN_SLOTS_PER_SLAB = 8;
+
+    /// \pre 0 < size <= MAX_SIZE
+    static constexpr std::size_t class_index( std::size_t size )
+    {
+        if ( size <= SMALL_SIZE )
+            return size <= MIN_SIZE ? 0 : ( size - 1 ) / MIN_SIZE;
+        const std::size_t k = log2( size - 1 ); // 2^k < size <= 2^(k+1)
+        return NUM_SMALL_CLASSES + ( k - 7 ) * 4 + ( ( size - 1 ) >> ( k - 2 ) ) - 4;
+    }
+
+    static constexpr std::size_t class_size( std::size_t idx )
+    {
+        if ( idx < NUM_SMALL_CLASSES )
+            return ( idx + 1 ) * MIN_SIZE;
+        const std::size_t j = idx - NUM_SMALL_CLASSES, k = 7 + j / 4;
+        return ( 5 + j % 4 ) << ( k - 2 );
+    }
+
+    /// \brief every slot of a class is aligned to the lowest set bit of class size, up to MAX_SLOT_ALIGNMENT.
+    static constexpr std::size_t class_alignment( std::size_t idx )
+    {
+        const auto size = class_size( idx );
+        return std::min( size & ( ~size + 1 ), MAX_SLOT_ALIGNMENT );
+    }
+
+    /// \return class index for size and alignment, or NUM_CLASSES if it's a large object.
+    static constexpr std::size_t lookup( std::size_t size, std::size_t alignment )
+    {
+        if ( size > MAX_SIZE || alignment > MAX_SLOT_ALIGNMENT )
+            return NUM_CLASSES;
+        if ( alignment <= MIN_SIZE )
+            return class_index( size );
+        auto idx = class_index( std::max( size, alignment ) );
+        while ( idx < NUM_CLASSES && class_alignment( idx ) < alignment ) // rare, over-aligned request.
+            ++idx;
+        return idx;
+    }
+
+protected:
+    /// \pre n > 0
+    static constexpr std::size_t log2( std::size_t n )
+    {
+        return 63 - __builtin_clzll( n );
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief SizeClassAllocator is a general-purpose thread-safe allocator for variable-sized objects.
+/// Each size class is a SlotDepot (MemPool slabs with a lock-free depot), and each thread caches a magazine per class, so small
+/// allocations usually touch only thread-local memory. Objects larger than SizeClasses::MAX_SIZE are mmap'ed by AlignedAlloc.
+/// Slabs of a class are allocated on the first use of the class.
+///
+/// Usage:
+///     SizeClassAllocator<> alloc;
+///     ftl::Vector<int, 0, SizeClassAllocatorRef<int>> vec( SizeClassAllocatorRef<int>( alloc ) );
+///     std::pmr::vector<int> pmrVec( &alloc );
+///
+/// \note Sized deallocation: free() must be called with the same size and alignment as malloc(), like std::pmr::memory_resource.
+/// Slabs are released only when allocator is destroyed.
+template<class AlignedAlloc = MmapAlignedAlloc, std::size_t MagazineSize = 32>
+class SizeClassAllocator : public std::pmr::memory_resource
+{
+protected:
+    using Depot = SlotDepot<true, AlignedAlloc, MagazineSize>;
+    static constexpr std::size_t NUM_CLASSES = SizeClasses::NUM_CLASSES;
+    static constexpr std::size_t LARGE_GRANULARITY = 4096;
+
+    struct alignas( 64 ) ThreadCache
+    {
+        typename Depot::Magazine magazines[NUM_CLASSES];
+        std::atomic<std::ptrdiff_t> nBytes{0}; // bytes of size classes, written only by the owner thread.
+        std::atomic<bool> adopted{true};
+    };
+
+    Depot m_depots[NUM_CLASSES];
+    std::once_flag m_inits[NUM_CLASSES];
+    ThreadCacheRegistry<ThreadCache> m_caches;
+    std::atomic<std::ptrdiff_t> m_largeBytes{0};
+
+public:
+    SizeClassAllocator() = default;
+    SizeClassAllocator( const SizeClassAllocator & ) = delete;
+    SizeClassAllocator &operator=( const SizeClassAllocator & ) = delete;
+
+    /// \brief process-wide allocator, used by default constructed SizeClassAllocatorRef.
+    static SizeClassAllocator &instance()
+    {
+        static SizeClassAllocator s_alloc;
+        return s_alloc;
+    }
+
+    /// \return nullptr if failed.
+    void *malloc( std::size_t size, std::size_t alignment = alignof( std::max_align_t ) )
+    {
+        const auto idx = SizeClasses::lookup( size, alignment );
+        if ( idx == NUM_CLASSES )
+            return malloc_large( size, alignment );
+        auto &cache = m_caches.local();
+        auto &mag = cache.magazines[idx];
+        if ( mag.empty() )
+            std::call_once( m_inits[idx], [&] { init_class( idx ); } );
+        auto p = m_depots[idx].malloc( mag );
+        if ( p )
+            add( cache.nBytes, SizeClasses::class_size( idx ) );
+        return p;
+    }
+
+    /// \brief free memory allocated by any thread.
+    void free( void *p, std::size_t size, std::size_t alignment = alignof( std::max_align_t ) )
+    {
+        if ( !p )
+            return;
+        const auto idx = SizeClasses::lookup( size, alignment );
+        if ( idx == NUM_CLASSES )
+            return free_large( p, size );
+        auto &cache = m_caches.local();
+        add( cache.nBytes, -std::ptrdiff_t( SizeClasses::class_size( idx ) ) );
+        m_depots[idx].free( cache.magazines[idx], p );
+    }
+
+    /// \brief bytes in use, including internal fragmentation of size classes and page rounding of large objects.
+    std::size_t allocated_bytes() const
+    {
+        std::ptrdiff_t n = m_largeBytes.load( std::memory_order_relaxed );
+        m_caches.for_each( [&]( const ThreadCache &cache ) { n += cache.nBytes.load( std::memory_order_relaxed ); } );
+        return n;
+    }
+
+    /// \brief number of slots in slabs of the size class which size falls into.
+    std::size_t class_capacity( std::size_t size ) const
+    {
+        const auto idx = SizeClasses::lookup( size, alignof( std::max_align_t ) );
+        return idx == NUM_CLASSES ? 0 : m_depots[idx].capacity();
+    }
+
+protected:
+    void *do_allocate( std::size_t bytes, std::size_t alignment ) override
+    {
+        if ( auto p = malloc( bytes, alignment ) )
+            return p;
+        throw std::bad_alloc();
+    }
+
+    void do_deallocate( void *p, std::size_t bytes, std::size_t alignment ) override
+    {
+        free( p, bytes, alignment );
+    }
+
+    bool do_is_equal( const std::pmr::memory_resource &other ) const noexcept override
+    {
+        return this == &other;
+    }
+
+    void init_class( std::size_t idx )
+    {
+        AllocRequest ar;
+        ar.slotSize = SizeClasses::class_size( idx );
+        ar.slotAlignment = SizeClasses::class_alignment( idx );
+        ar.minSlotsPerSlab = std::max( SizeClasses::MIN_SLOTS_PER_SLAB, SizeClasses::SLAB_SIZE / ar.slotSize );
+        ar.slabGranularity = LARGE_GRANULARITY;
+        ar.alignupToSlabGranularity = true;
+        m_depots[idx].init( ar );
+    }
+
+    void *malloc_large( std::size_t size, std::size_t alignment )
+    {
+        const auto len = ftl::align_up( size, LARGE_GRANULARITY );
+        // not populated: like malloc, large objects are usually not touched all at once.
+        auto p = AlignedAlloc::aligned_alloc( std::max( alignment, LARGE_GRANULARITY ), len, LARGE_GRANULARITY, false );
+        if ( p )
+            m_largeBytes.fetch_add( len, std::memory_order_relaxed );
+        return p;
+    }
+
+    void free_large( void *p, std::size_t size )
+    {
+        const auto len = ftl::align_up( size, LARGE_GRANULARITY );
+        m_largeBytes.fetch_sub( len, std::memory_order_relaxed );
+        AlignedAlloc::free( p, len );
+    }
+
+    static void add( std::atomic<std::ptrdiff_t> &counter, std::ptrdiff_t n )
+    {
+        counter.store( counter.load( std::memory_order_relaxed ) + n, std::memory_order_relaxed );
+    }
+};
+
+/// \brief Standard allocator referencing a SizeClassAllocator. Default constructed one references SizeClassAllocator::instance(), so it
+/// can be used by containers which default-construct allocators, eg. DynNode.
+template<class T, class AllocT = SizeClassAllocator<>>
+class SizeClassAllocatorRef
+{
+    template<class U, class A>
+    friend class SizeClassAllocatorRef;
+
+    AllocT *m_pAlloc;
+
+public:
+    using value_type = T;
+
+    template<class U>
+    struct rebind
+    {
+        using other = SizeClassAllocatorRef<U, AllocT>;
+    };
+
+    SizeClassAllocatorRef() : m_pAlloc( &AllocT::instance() )
+    {
+    }
+
+    SizeClassAllocatorRef( AllocT &alloc ) : m_pAlloc( &alloc )
+    {
+    }
+
+    template<class U>
+    SizeClassAllocatorRef( const SizeClassAllocatorRef<U, AllocT> &a ) : m_pAlloc( a.m_pAlloc )
+    {
+    }
+
+    T *allocate( std::size_t n )
+    {
+        if ( auto p = m_pAlloc->malloc( n * sizeof( T ), alignof( T ) ) )
+            return static_cast<T *>( p );
+        throw std::bad_alloc();
+    }
+
+    void deallocate( T *p, std::size_t n )
+    {
+        m_pAlloc->free( p, n * sizeof( T ), alignof( T ) );
+    }
+
+    /// \brief grow in place if n and newN elements are in the same size class. ftl::Vector calls it before allocating a new buffer.
+    bool try_expand( T *, std::size_t n, std::size_t newN ) const
+    {
+        const auto idx = SizeClasses::lookup( newN * sizeof( T ), alignof( T ) );
+        return idx < SizeClasses::NUM_CLASSES && idx == SizeClasses::lookup( n * sizeof( T ), alignof( T ) );
+    }
+
+    AllocT &resource() const
+    {
+        return *m_pAlloc;
+    }
+
+    template<class U>
+    bool operator==( const SizeClassAllocatorRef<U, AllocT> &a ) const
+    {
+        return m_pAlloc == a.m_pAlloc;
+    }
+
+    template<class U>
+    bool operator!=( const SizeClassAllocatorRef<U, AllocT> &a ) const
+    {
+        return m_pAlloc != a.m_pAlloc;
+    }
+};
+
+template<class CharT = char>
+using SizeClassString = std::basic_string<CharT, std::char_traits<CharT>, SizeClassAllocatorRef<CharT>>;
+
+} // namespace ftl
+
+namespace std
+{
+/// \brief hash strings allocated by SizeClassAllocatorRef like std::string, eg. for DynNode<SizeClassString<>> map keys.
+template<class CharT, class AllocT>
+struct hash<basic_string<CharT, char_traits<CharT>, ftl::SizeClassAllocatorRef<CharT, AllocT>>>
+{
+    size_t operator()( const basic_string<CharT, char_traits<CharT>, ftl::SizeClassAllocatorRef<CharT, AllocT>> &s ) const noexcept
+    {
+        return hash<basic_string_view<CharT>>()( basic_string_view<CharT>( s.data(), s.size() ) );
+    }
+};
+} // namespace std
@@ -63,7 +63,7 @@ public:
 
     /// @return false when full. Note: the front element mayb be in process of dequeue.
     template<class... Args>
-    bool emplate( Args &&... args )
+    bool emplace( Args &&... args )
     {
         auto iEnd = m_end.load( std::memory_order_acquire ) % m_bufsize;
         auto iNext = ( iEnd + 1 ) % m_bufsize;
@@ -28,7 +28,7 @@ template<class T, class AllocT = std::allocator<T>>
 class SPSCRingQueue
 {
     AllocT mAlloc;
-    const size_t mCap = 0;
+    size_t mCap = 0;
     T *mBuf = nullptr;
     std::atomic<size_t> mPushPos = 0, mPopPos = 0;
 
@@ -53,9 +53,9 @@ public:
             init( mCap );
     }
 
-    SPSCRingQueue( const SPSCRingQueue &a ) : mAlloc( a.alloc )
+    SPSCRingQueue( const SPSCRingQueue &a ) : mAlloc( a.mAlloc )
     {
-        init( mCap );
+        init( a.mCap );
     }
 
     bool init( size_t cap )
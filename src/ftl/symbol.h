@@ -0,0 +1,302 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <ftl/arena.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace ftl
+{
+
+class SymbolTable;
+
+/// \brief interned chars of a Symbol, immutable once published.
+struct SymbolData
+{
+    std::size_t hash;
+    std::uint32_t size;
+    char chars[1]; // size chars and the null terminator.
+
+    std::string_view view() const
+    {
+        return {chars, size};
+    }
+
+    static const SymbolData &empty()
+    {
+        static const SymbolData s_empty{std::hash<std::string_view>()( {} ), 0, {'\0'}};
+        return s_empty;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief Symbol is a handle of an interned string. Equal strings interned by the same SymbolTable are the same pointer, so a Symbol
+/// compares and hashes as a pointer, eg. as keys of DynNode, dynamic_var or std::unordered_map.
+/// Symbols constructed from strings are interned by SymbolTable::instance().
+/// Usage:
+///     static const Symbol PRICE( "price" ); // intern once.
+///     jz::DynNode<std::string, Symbol> node; // keys are interned by the reader.
+///     jz::jsonSerializer.read( node, ss, err );
+///     auto price = node[PRICE].toDouble(); // hash and compare a pointer.
+/// \note Symbols of different tables never compare equal, even if they have the same chars.
+class Symbol
+{
+    const SymbolData *m_p = &SymbolData::empty();
+
+public:
+    using value_type = char;
+    using const_iterator = const char *;
+    using iterator = const_iterator;
+
+    Symbol() = default;
+    explicit Symbol( const SymbolData *p ) : m_p( p )
+    {
+    }
+    /// intern s by SymbolTable::instance().
+    Symbol( const char *s );
+    explicit Symbol( std::string_view s );
+
+    std::string_view view() const
+    {
+        return m_p->view();
+    }
+    operator std::string_view() const
+    {
+        return view();
+    }
+    const char *c_str() const
+    {
+        return m_p->chars;
+    }
+    const char *data() const
+    {
+        return m_p->chars;
+    }
+    std::size_t size() const
+    {
+        return m_p->size;
+    }
+    bool empty() const
+    {
+        return m_p->size == 0;
+    }
+    const_iterator begin() const
+    {
+        return m_p->chars;
+    }
+    const_iterator end() const
+    {
+        return m_p->chars + m_p->size;
+    }
+    /// \brief hash of the chars, as std::hash<std::string_view>.
+    std::size_t string_hash() const
+    {
+        return m_p->hash;
+    }
+    const SymbolData *get() const
+    {
+        return m_p;
+    }
+
+    bool operator==( const Symbol &a ) const
+    {
+        return m_p == a.m_p;
+    }
+    bool operator!=( const Symbol &a ) const
+    {
+        return m_p != a.m_p;
+    }
+    /// \brief order of addresses, not of chars.
+    bool operator<( const Symbol &a ) const
+    {
+        return std::less<const SymbolData *>()( m_p, a.m_p );
+    }
+
+    friend std::ostream &operator<<( std::ostream &os, const Symbol &s )
+    {
+        return os << s.view();
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/// \brief SymbolTable interns strings. Reads are lock-free: find() and intern() of an existing symbol probe an open addressing table of
+/// atomic pointers. Inserts are serialized by a mutex, and chars are allocated from an Arena owned by the table.
+/// The table doubles at half load. Readers may still probe an old table, so old tables are kept until the table is destroyed; they
+/// hold less than the live one in total.
+/// Symbols are never removed: intern field names, enum-like values etc., not arbitrary user input.
+class SymbolTable
+{
+    struct Table
+    {
+        const std::size_t capacity; // power of 2.
+        std::unique_ptr<std::atomic<const SymbolData *>[]> slots;
+
+        explicit Table( std::size_t cap ) : capacity( cap ), slots( new std::atomic<const SymbolData *>[cap] )
+        {
+            for ( std::size_t i = 0; i < cap; ++i )
+                slots[i].store( nullptr, std::memory_order_relaxed );
+        }
+    };
+
+    std::atomic<Table *> m_pTable;
+    std::atomic<std::size_t> m_size{0};
+    std::mutex m_lock; // serializes inserts.
+    std::vector<std::unique_ptr<Table>> m_tables; // all tables, the last one is live.
+    Arena m_arena;
+
+public:
+    explicit SymbolTable( std::size_t initCapacity = 1024 )
+    {
+        std::size_t cap = 16;
+        while ( cap < 2 * initCapacity )
+            cap *= 2;
+        m_tables.emplace_back( new Table( cap ) );
+        m_pTable.store( m_tables.back().get(), std::memory_order_release );
+    }
+    SymbolTable( const SymbolTable & ) = delete;
+    SymbolTable &operator=( const SymbolTable & ) = delete;
+
+    /// \brief process-wide table, used by Symbol( const char * ).
+    static SymbolTable &instance()
+    {
+        static SymbolTable s_table;
+        return s_table;
+    }
+
+    /// \return the interned symbol of s, or the empty Symbol if s is not interned (and not empty). Lock-free.
+    Symbol find( std::string_view s ) const
+    {
+        if ( auto p = find( s, std::hash<std::string_view>()( s ) ) )
+            return Symbol( p );
+        return {};
+    }
+
+    /// \brief lock-free if s is already interned.
+    Symbol intern( std::string_view s )
+    {
+        if ( s.empty() )
+            return {};
+        const auto h = std::hash<std::string_view>()( s );
+        if ( auto p = find( s, h ) )
+            return Symbol( p );
+
+        std::lock_guard<std::mutex> guard( m_lock );
+        if ( auto p = find( s, h ) ) // interned by another thread.
+            return Symbol( p );
+        assert( s.size() <= std::numeric_limits<std::uint32_t>::max() );
+        auto pData = static_cast<SymbolData *>( m_arena.malloc( offsetof( SymbolData, chars ) + s.size() + 1, alignof( SymbolData ) ) );
+        if ( !pData )
+            throw std::bad_alloc();
+        pData->hash = h;
+        pData->size = std::uint32_t( s.size() );
+        std::memcpy( pData->chars, s.data(), s.size() );
+        pData->chars[s.size()] = '\0';
+
+        auto pTable = m_pTable.load( std::memory_order_relaxed );
+        const auto n = m_size.load( std::memory_order_relaxed ) + 1;
+        if ( 2 * n > pTable->capacity )
+            pTable = grow( *pTable );
+        insert( *pTable, pData, std::memory_order_release ); // publish the chars.
+        m_size.store( n, std::memory_order_relaxed );
+        return Symbol( pData );
+    }
+
+    /// \brief number of interned symbols, excluding the empty one.
+    std::size_t size() const
+    {
+        return m_size.load( std::memory_order_relaxed );
+    }
+
+    std::size_t capacity() const
+    {
+        return m_pTable.load( std::memory_order_acquire )->capacity;
+    }
+
+protected:
+    const SymbolData *find( std::string_view s, std::size_t h ) const
+    {
+        if ( s.empty() )
+            return &SymbolData::empty();
+        const auto pTable = m_pTable.load( std::memory_order_acquire );
+        const auto mask = pTable->capacity - 1;
+        for ( auto i = h & mask;; i = ( i + 1 ) & mask )
+        {
+            auto p = pTable->slots[i].load( std::memory_order_acquire );
+            if ( !p )
+                return nullptr;
+            if ( p->hash == h && p->view() == s )
+                return p;
+        }
+    }
+
+    static void insert( Table &table, const SymbolData *p, std::memory_order mo )
+    {
+        const auto mask = table.capacity - 1;
+        auto i = p->hash & mask;
+        while ( table.slots[i].load( std::memory_order_relaxed ) )
+            i = ( i + 1 ) & mask;
+        table.slots[i].store( p, mo );
+    }
+
+    /// \pre m_lock is locked.
+    Table *grow( const Table &table )
+    {
+        m_tables.emplace_back( new Table( table.capacity * 2 ) );
+        auto pTable = m_tables.back().get();
+        for ( std::size_t i = 0; i < table.capacity; ++i )
+            if ( auto p = table.slots[i].load( std::memory_order_relaxed ) )
+                insert( *pTable, p, std::memory_order_relaxed );
+        m_pTable.store( pTable, std::memory_order_release ); // publish the filled table.
+        return pTable;
+    }
+};
+
+inline Symbol::Symbol( const char *s ) : Symbol( SymbolTable::instance().intern( s ) )
+{
+}
+inline Symbol::Symbol( std::string_view s ) : Symbol( SymbolTable::instance().intern( s ) )
+{
+}
+
+} // namespace ftl
+
+namespace std
+{
+/// \brief hash of the pointer. Use Symbol::string_hash() for the hash of chars.
+template<>
+struct hash<ftl::Symbol>
+{
+    size_t operator()( const ftl::Symbol &s ) const noexcept
+    {
+        auto x = reinterpret_cast<std::uintptr_t>( s.get() );
+        return size_t( ( x >> 4 ) * 0x9E3779B97F4A7C15ull ); // mix, as the low bits of aligned pointers are 0.
+    }
+};
+} // namespace std
@@ -3,11 +3,46 @@
 #include <ftl/alloc_common.h>
 #include <sys/mman.h>
 //#include <hugetlbfs.h>
+#include <algorithm>
+#include <alloca.h>
 #include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
 
 namespace ftl
 {
 
+/// \brief page type of mmap'ed memory. Huge pages reduce TLB misses of large pools.
+enum class PageType
+{
+    Normal, // 4K pages.
+    TransparentHuge, // 4K pages advised by madvise(MADV_HUGEPAGE) to be merged into 2MB transparent huge pages.
+    Huge2M, // hugetlbfs pages, which must be reserved, eg. /proc/sys/vm/nr_hugepages.
+    Huge1G,
+};
+
+inline constexpr std::size_t page_size( PageType pageType )
+{
+    switch ( pageType )
+    {
+    case PageType::TransparentHuge:
+    case PageType::Huge2M:
+        return std::size_t( 1 ) << 21;
+    case PageType::Huge1G:
+        return std::size_t( 1 ) << 30;
+    default:
+        return 4096;
+    }
+}
+
 namespace internal
 {
 
@@ -75,39 +110,268 @@ inline bool sys_unlock( const Byte *p, std::size_t uiLen )
     return 0 == munlock( p, uiLen );
 }
 
+/// \brief touch every page so that no page fault happens on first use.
+inline void sys_prefault( Byte *p, std::size_t uiLen, std::size_t uiPageSize = 4096 )
+{
+    for ( std::size_t off = 0; off < uiLen; off += uiPageSize )
+        reinterpret_cast<volatile Byte *>( p )[off] = 0;
+}
+
+/// \brief MmapAlignedAlloc mmaps memory of PageType.
+/// Explicit huge pages gracefully fall back when they are exhausted: Huge1G -> Huge2M -> TransparentHuge -> Normal. Length is rounded up
+/// to the page size of each tier as it is tried, so a fallback maps and prefaults no more than that tier needs. Free with the length and
+/// page type returned by pLenGot and pPageTypeGot.
 struct MmapAlignedAlloc
 {
-    static void *aligned_alloc( std::size_t uiAlignment, std::size_t uiLen, std::size_t uiGranularity = 4096, bool populatePageTable = true )
+    /// \param pPageTypeGot if not null, returns the page type actually mapped.
+    /// \param pLenGot if not null, returns the length actually mapped.
+    static void *aligned_alloc( std::size_t uiAlignment,
+                                std::size_t uiLen,
+                                std::size_t uiGranularity = 4096,
+                                bool populatePageTable = true,
+                                PageType pageType = PageType::Normal,
+                                PageType *pPageTypeGot = nullptr,
+                                std::size_t *pLenGot = nullptr )
     {
         assert( is_pow2( uiAlignment ) );
+        const std::size_t uiLenRequested = uiLen;
 
-        int iFlags = MAP_ANONYMOUS | MAP_PRIVATE;
-        //    if ( pageType == PageType::Huge )
-        //    {
-        //        iFlags |= MAP_HUGETLB;
-        //    }
+        const int iPopulate = populatePageTable ? MAP_POPULATE : 0;
+        Byte *p = nullptr;
+        switch ( pageType )
+        {
+        case PageType::Huge1G:
+            uiLen = ftl::align_up( uiLenRequested, page_size( PageType::Huge1G ) );
+            p = internal::mmap_aligned_impl( uiLen,
+                                             uiAlignment,
+                                             page_size( PageType::Huge1G ),
+                                             PROT_READ | PROT_WRITE,
+                                             MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB | ( 30 << MAP_HUGE_SHIFT ) | iPopulate );
+            if ( p )
+                break;
+            pageType = PageType::Huge2M;
+            [[fallthrough]];
+        case PageType::Huge2M:
+            uiLen = ftl::align_up( uiLenRequested, page_size( PageType::Huge2M ) );
+            p = internal::mmap_aligned_impl( uiLen,
+                                             uiAlignment,
+                                             page_size( PageType::Huge2M ),
+                                             PROT_READ | PROT_WRITE,
+                                             MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB | ( 21 << MAP_HUGE_SHIFT ) | iPopulate );
+            if ( p )
+                break;
+            pageType = PageType::TransparentHuge;
+            [[fallthrough]];
+        case PageType::TransparentHuge:
+            // align to huge page, and advise before populating, otherwise the pages are already 4K.
+            uiLen = ftl::align_up( uiLenRequested, page_size( PageType::TransparentHuge ) );
+            p = internal::mmap_aligned_impl( uiLen,
+                                             std::max( uiAlignment, page_size( PageType::TransparentHuge ) ),
+                                             std::min( uiGranularity, page_size( PageType::Normal ) ),
+                                             PROT_READ | PROT_WRITE,
+                                             MAP_ANONYMOUS | MAP_PRIVATE );
+            if ( p && madvise( p, uiLen, MADV_HUGEPAGE ) ) // THP is disabled.
+                pageType = PageType::Normal;
+            if ( p && populatePageTable )
+                sys_prefault( p, uiLen );
+            break;
+        default:
+            uiLen = ftl::align_up( uiLenRequested, page_size( PageType::Normal ) );
+            p = internal::mmap_aligned_impl( uiLen, uiAlignment, uiGranularity, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | iPopulate );
+        }
+        if ( pPageTypeGot )
+            *pPageTypeGot = pageType;
+        if ( pLenGot )
+            *pLenGot = uiLen;
+        return p;
+    }
+
+    /// \brief unmap align_up( uiLen, page_size( pageType ) ) bytes, which is exactly the mapped length given the length and page type got.
+    static bool free( void *p, std::size_t uiLen, PageType pageType = PageType::Normal )
+    {
+        return 0 == munmap( p, ftl::align_up( uiLen, page_size( pageType ) ) );
+    }
+};
 
-        if ( populatePageTable )
+/// \brief LatencyCriticalAlignedAlloc is an AlignedAlloc policy whose memory never page-faults after allocation: pages are prefaulted
+/// by the allocating thread and locked by mlock. Use it for memory touched on the hot path, eg. queue buffers and pool slabs:
+///     MemPool<true, true, LatencyCriticalAlignedAlloc<>> pool;
+///     SPSCRingQueue<Msg, LatencyCriticalAllocator<Msg>> queue( 1024 );
+/// \tparam NumaLocal bind pages to the NUMA node of the allocating thread (MPOL_LOCAL), regardless of the process memory policy.
+/// \tparam RequireLock if true, fail the allocation when mlock fails (eg. RLIMIT_MEMLOCK is exceeded). Otherwise, locking is best-effort.
+template<bool NumaLocal = false, bool RequireLock = false>
+struct LatencyCriticalAlignedAlloc
+{
+    static void *aligned_alloc( std::size_t uiAlignment,
+                                std::size_t uiLen,
+                                std::size_t uiGranularity = 4096,
+                                bool = true,
+                                PageType pageType = PageType::Normal,
+                                PageType *pPageTypeGot = nullptr,
+                                std::size_t *pLenGot = nullptr )
+    {
+        PageType got;
+        auto p = static_cast<Byte *>( MmapAlignedAlloc::aligned_alloc( uiAlignment, uiLen, uiGranularity, false, pageType, &got, &uiLen ) );
+        if ( !p )
+            return nullptr;
+        if constexpr ( NumaLocal )
+        {
+            constexpr int MPOL_LOCAL_MODE = 4; // MPOL_LOCAL in linux/mempolicy.h
+            syscall( SYS_mbind, p, uiLen, MPOL_LOCAL_MODE, nullptr, 0, 0 );
+        }
+        sys_prefault( p, uiLen, page_size( got ) );
+        if ( !sys_lock( p, uiLen ) && RequireLock )
         {
-            iFlags |= MAP_POPULATE;
+            MmapAlignedAlloc::free( p, uiLen, got );
+            return nullptr;
         }
+        if ( pPageTypeGot )
+            *pPageTypeGot = got;
+        if ( pLenGot )
+            *pLenGot = uiLen;
+        return p;
+    }
 
-        return internal::mmap_aligned_impl( uiLen, uiAlignment, uiGranularity, PROT_READ | PROT_WRITE, iFlags );
+    static bool free( void *p, std::size_t uiLen, PageType pageType = PageType::Normal )
+    {
+        return MmapAlignedAlloc::free( p, uiLen, pageType ); // munmap unlocks pages.
+    }
+};
+
+/// \brief AlignedAllocAdapter is a standard allocator on top of an AlignedAlloc policy, so the policy can be plugged into containers
+/// and queues. Every allocate() is a system allocation, which suits buffers allocated once at initialization.
+template<class T, class AlignedAlloc = LatencyCriticalAlignedAlloc<>>
+struct AlignedAllocAdapter
+{
+    using value_type = T;
+    static constexpr std::size_t ALIGNMENT = std::max<std::size_t>( alignof( T ), 64 ); // cache line
+
+    template<class U>
+    struct rebind
+    {
+        using other = AlignedAllocAdapter<U, AlignedAlloc>;
+    };
+
+    AlignedAllocAdapter() = default;
+    template<class U>
+    AlignedAllocAdapter( const AlignedAllocAdapter<U, AlignedAlloc> & )
+    {
+    }
+
+    T *allocate( std::size_t n )
+    {
+        if ( auto p = AlignedAlloc::aligned_alloc( ALIGNMENT, n * sizeof( T ) ) )
+            return static_cast<T *>( p );
+        throw std::bad_alloc();
     }
 
-    static bool free( void *p, std::size_t uiLen )
+    void deallocate( T *p, std::size_t n )
     {
-        return 0 == munmap( p, uiLen );
+        AlignedAlloc::free( p, n * sizeof( T ) );
+    }
+
+    template<class U>
+    bool operator==( const AlignedAllocAdapter<U, AlignedAlloc> & ) const
+    {
+        return true;
+    }
+    template<class U>
+    bool operator!=( const AlignedAllocAdapter<U, AlignedAlloc> & ) const
+    {
+        return false;
     }
 };
 
+/// \brief MallocAllocator is a standard allocator on malloc, which can grow a buffer without moving elements one by one:
+///  - try_expand() succeeds in place if the malloc chunk already has room, see malloc_usable_size().
+///  - reallocate() is realloc, which extends the chunk when possible, and remaps pages (mremap) of large mmap'ed chunks instead of copying.
+/// ftl::Vector uses them when it grows, reallocate() only for trivially relocatable elements.
+template<class T>
+struct MallocAllocator
+{
+    static_assert( alignof( T ) <= alignof( std::max_align_t ) );
+    using value_type = T;
+
+    template<class U>
+    struct rebind
+    {
+        using other = MallocAllocator<U>;
+    };
+
+    MallocAllocator() = default;
+    template<class U>
+    MallocAllocator( const MallocAllocator<U> & )
+    {
+    }
+
+    T *allocate( std::size_t n )
+    {
+        if ( auto p = std::malloc( n * sizeof( T ) ) )
+            return static_cast<T *>( p );
+        throw std::bad_alloc();
+    }
+
+    void deallocate( T *p, std::size_t )
+    {
+        std::free( p );
+    }
+
+    bool try_expand( T *p, std::size_t, std::size_t newN )
+    {
+        return malloc_usable_size( p ) >= newN * sizeof( T );
+    }
+
+    /// \return nullptr if it fails, p is intact.
+    T *reallocate( T *p, std::size_t, std::size_t newN )
+    {
+        return static_cast<T *>( std::realloc( p, newN * sizeof( T ) ) );
+    }
+
+    template<class U>
+    bool operator==( const MallocAllocator<U> & ) const
+    {
+        return true;
+    }
+    template<class U>
+    bool operator!=( const MallocAllocator<U> & ) const
+    {
+        return false;
+    }
+};
+
+template<class T, bool NumaLocal = false>
+using LatencyCriticalAllocator = AlignedAllocAdapter<T, LatencyCriticalAlignedAlloc<NumaLocal>>;
+
+/// \brief warm up the process at startup of a latency-critical thread: lock all current and future pages in RAM, and prefault stack
+/// of current thread, so that no page fault happens after initialization.
+/// \note with lockAll, later allocations fail once locked memory exceeds RLIMIT_MEMLOCK (ulimit -l).
+/// \return false if memory cannot be locked, eg. RLIMIT_MEMLOCK is too small.
+inline bool sys_warm_up( std::size_t uiStackBytes = 256 * 1024, bool lockAll = true )
+{
+    const bool locked = !lockAll || 0 == mlockall( MCL_CURRENT | MCL_FUTURE );
+    auto pStack = static_cast<Byte *>( alloca( uiStackBytes ) );
+    sys_prefault( pStack, uiStackBytes );
+    return locked;
+}
+
 struct StdAlignedAlloc
 {
-    static void *aligned_alloc( std::size_t uiAlignment, std::size_t uiLen, std::size_t = 4096, bool = true )
+    /// \note pageType is ignored, memory is always of PageType::Normal.
+    static void *aligned_alloc( std::size_t uiAlignment,
+                                std::size_t uiLen,
+                                std::size_t = 4096,
+                                bool = true,
+                                PageType = PageType::Normal,
+                                PageType *pPageTypeGot = nullptr,
+                                std::size_t *pLenGot = nullptr )
     {
+        if ( pPageTypeGot )
+            *pPageTypeGot = PageType::Normal;
+        if ( pLenGot )
+            *pLenGot = uiLen;
         return std::aligned_alloc( uiAlignment, uiLen );
     }
-    static bool free( void *p, std::size_t len = 0 )
+    static bool free( void *p, std::size_t = 0, PageType = PageType::Normal )
     {
         std::free( p );
         return true;
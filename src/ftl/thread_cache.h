@@ -0,0 +1,139 @@
+/*
+ * This file is part of the ftl (Fast Template Library) distribution (https://github.com/adenzhang/ftl).
+ * Copyright (c) 2020 Aden Zhang.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ftl
+{
+
+/// \brief ThreadCacheRegistry gives each thread its own CacheT per owner object (eg. a pool or a chan).
+/// - local() costs one thread_local compare in the common case, and takes a lock only the first time a thread uses the owner.
+/// - Caches are shared by the owner and the thread, either may die first. When a thread exits, its caches are released and adopted by
+///   the next new thread, so objects cached by exited threads are not stranded.
+/// - When the owner dies, each thread drops its entry at its next lookup, so threads outliving many owners don't accumulate caches.
+/// \tparam CacheT must have member: std::atomic<bool> adopted{true};
+template<class CacheT>
+class ThreadCacheRegistry
+{
+public:
+    using CachePtr = std::shared_ptr<CacheT>;
+
+    ThreadCacheRegistry() = default;
+    ThreadCacheRegistry( const ThreadCacheRegistry & ) = delete;
+    ThreadCacheRegistry &operator=( const ThreadCacheRegistry & ) = delete;
+
+    /// \brief get cache of current thread.
+    CacheT &local()
+    {
+        static thread_local LastEntry tlLast;
+        static thread_local ThreadEntries tlEntries;
+        if ( tlLast.ownerId == m_id )
+            return *tlLast.pCache;
+        auto &entries = tlEntries.entries;
+        for ( std::size_t i = 0; i < entries.size(); )
+        {
+            if ( entries[i].ownerId == m_id )
+            {
+                tlLast = LastEntry{m_id, entries[i].pCache.get()};
+                return *tlLast.pCache;
+            }
+            if ( entries[i].pOwnerAlive.expired() ) // the owner is destroyed.
+            {
+                entries[i] = std::move( entries.back() );
+                entries.pop_back();
+            }
+            else
+                ++i;
+        }
+        // first time this thread uses this owner. Adopt the cache of an exited thread if any.
+        std::lock_guard<std::mutex> guard( m_lock );
+        CachePtr pCache;
+        for ( auto &pOrphan : m_caches )
+        {
+            bool adopted = false;
+            if ( pOrphan->adopted.compare_exchange_strong( adopted, true, std::memory_order_acquire ) )
+            {
+                pCache = pOrphan;
+                break;
+            }
+        }
+        if ( !pCache )
+            pCache = m_caches.emplace_back( std::make_shared<CacheT>() );
+        entries.push_back( ThreadEntry{m_id, m_pAlive, pCache} );
+        tlLast = LastEntry{m_id, pCache.get()};
+        return *pCache;
+    }
+
+    /// \brief visit all caches, including caches of exited threads. Used for aggregating statistics or resetting.
+    template<class F>
+    void for_each( F &&func ) const
+    {
+        std::lock_guard<std::mutex> guard( m_lock );
+        for ( const auto &pCache : m_caches )
+            func( *pCache );
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> guard( m_lock );
+        return m_caches.size();
+    }
+
+protected:
+    struct LastEntry
+    {
+        std::uint64_t ownerId = 0;
+        CacheT *pCache = nullptr;
+    };
+
+    struct ThreadEntry
+    {
+        std::uint64_t ownerId;
+        std::weak_ptr<void> pOwnerAlive;
+        CachePtr pCache;
+    };
+
+    /// \brief caches used by a thread. A thread may use multiple owners.
+    struct ThreadEntries
+    {
+        std::vector<ThreadEntry> entries;
+
+        ~ThreadEntries()
+        {
+            for ( auto &entry : entries )
+                entry.pCache->adopted.store( false, std::memory_order_release );
+        }
+    };
+
+    static std::uint64_t next_id()
+    {
+        static std::atomic<std::uint64_t> s_nextId{1};
+        return s_nextId.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    const std::uint64_t m_id = next_id(); // ids are never reused, unlike addresses.
+    const std::shared_ptr<void> m_pAlive = std::make_shared<char>(); // expires with the owner, threads check it with weak_ptrs.
+    mutable std::mutex m_lock;
+    std::vector<CachePtr> m_caches;
+};
+
+} // namespace ftl
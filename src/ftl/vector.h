@@ -19,6 +19,8 @@
 #include <type_traits>
 #include <memory>
 #include <cstring>
+#include <limits>
+#include <utility>
 
 /// @brief Generic VectorBase<T, BuferSize, Alloc, bool HasSizeVar, bool HasNullValue>.
 /// It can be used as inplace vector/string, small-buffer-optimized vector/string, and dynamic allocated vector/string.
@@ -29,6 +31,111 @@
 namespace ftl
 {
 
+/// @brief is_trivially_relocatable<T>: moving a T to another address and destroying the source is equivalent to memcpy, ie. a T
+/// holds no pointer into itself. Containers relocate such elements with memcpy/memmove/realloc instead of move and destroy one by one.
+/// True for trivially copyable types. A class opts in by a member `using is_trivially_relocatable = std::true_type;`, and a type
+/// which can't be modified by specializing this trait.
+/// @note std::string of libstdc++ points into its own SSO buffer, so it's not relocatable.
+template<class T, typename = void>
+struct is_trivially_relocatable : std::is_trivially_copyable<T>
+{
+};
+
+template<class T>
+struct is_trivially_relocatable<T, std::void_t<typename T::is_trivially_relocatable>> : T::is_trivially_relocatable
+{
+};
+
+template<class T1, class T2>
+struct is_trivially_relocatable<std::pair<T1, T2>, void>
+    : std::bool_constant<is_trivially_relocatable<T1>::value && is_trivially_relocatable<T2>::value>
+{
+};
+
+template<class T>
+struct is_trivially_relocatable<std::allocator<T>, void> : std::true_type
+{
+};
+
+template<class T, class D>
+struct is_trivially_relocatable<std::unique_ptr<T, D>, void> : is_trivially_relocatable<D>
+{
+};
+
+template<class T>
+struct is_trivially_relocatable<std::shared_ptr<T>, void> : std::true_type
+{
+};
+
+template<class T>
+inline constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<T>::value;
+
+/// @brief move n elements from pSrc to uninitialized pDest, and destroy the sources. The ranges don't overlap.
+template<class T>
+void relocate( T *pSrc, size_t n, T *pDest )
+{
+    if constexpr ( is_trivially_relocatable_v<T> )
+    {
+        if ( n )
+            std::memcpy( static_cast<void *>( pDest ), static_cast<const void *>( pSrc ), sizeof( T ) * n );
+    }
+    else
+    {
+        for ( size_t i = 0; i < n; ++i, ++pSrc, ++pDest )
+        {
+            new ( pDest ) T( std::move( *pSrc ) );
+            pSrc->~T();
+        }
+    }
+}
+
+template<class Alloc, class T, typename = void>
+struct has_try_expand : std::false_type
+{
+};
+template<class Alloc, class T>
+struct has_try_expand<Alloc, T, std::void_t<decltype( std::declval<Alloc &>().try_expand( std::declval<T *>(), size_t(), size_t() ) )>>
+    : std::true_type
+{
+};
+
+template<class Alloc, class T, typename = void>
+struct has_reallocate : std::false_type
+{
+};
+template<class Alloc, class T>
+struct has_reallocate<Alloc, T, std::void_t<decltype( std::declval<Alloc &>().reallocate( std::declval<T *>(), size_t(), size_t() ) )>>
+    : std::true_type
+{
+};
+
+/// @brief grow buffer p of capacity n, which holds nsize elements, to capacity newN. Tries in order:
+///  - alloc.try_expand( p, n, newN ): grow in place, elements stay where they are.
+///  - alloc.reallocate( p, n, newN ): realloc, only if T is trivially relocatable since the bytes are copied.
+///  - allocate a new buffer, relocate elements and deallocate p.
+/// @param bOwned false if p is not allocated by alloc, eg. it's an inplace buffer, or nullptr.
+/// @return the new buffer, or nullptr if it fails, in which case p is intact.
+template<class T, class Alloc>
+T *grow_buffer( Alloc &alloc, T *p, size_t nsize, size_t n, size_t newN, bool bOwned )
+{
+    if ( bOwned )
+    {
+        if constexpr ( has_try_expand<Alloc, T>::value )
+        {
+            if ( alloc.try_expand( p, n, newN ) )
+                return p;
+        }
+        if constexpr ( has_reallocate<Alloc, T>::value && is_trivially_relocatable_v<T> )
+            return alloc.reallocate( p, n, newN );
+    }
+    auto pBuf = alloc.allocate( newN );
+    if ( !pBuf )
+        return nullptr;
+    relocate( p, nsize, pBuf );
+    if ( bOwned )
+        alloc.deallocate( p, n );
+    return pBuf;
+}
 
 // destroy elements in [pbeing, middle), and move [middle, pend) to begin.
 template<class T>
@@ -37,11 +144,14 @@ void destroy( T *pbegin, T *middle, T *pend )
     using Distance = std::ptrdiff_t;
     if ( pbegin != middle )
     {
-        if constexpr ( std::is_trivially_copyable_v<T> )
+        if constexpr ( is_trivially_relocatable_v<T> )
         {
             // for(; middle != pend; ++pbegin, ++middle)
             //     *pbegin = *middle;
-            std::memmove( pbegin, middle, sizeof( T ) * ( pend - middle ) );
+            if constexpr ( !std::is_trivially_destructible_v<T> )
+                for ( auto p = pbegin; p != middle; ++p )
+                    p->~T();
+            std::memmove( static_cast<void *>( pbegin ), static_cast<const void *>( middle ), sizeof( T ) * ( pend - middle ) );
         }
         else if constexpr ( std::is_move_assignable_v<T> )
         {
@@ -465,19 +575,11 @@ struct SboStorage<Impl,
         auto newCap = HasNullValue ? ( n + 1 ) : n;
         if ( m_size == capacity() )
             newCap = std::max( 2 * m_bufferSize, newCap ); // double capacity
-        auto pBuf = m_alloc.allocate( newCap );
+        auto pBuf = grow_buffer( m_alloc, m_begin, m_size, m_bufferSize, newCap, !using_inplace() );
         if ( !pBuf )
             return false;
-        auto pSrc = m_begin, pDest = pBuf;
-        for ( size_t i = 0; i < m_size; ++i, ++pSrc, ++pDest )
-        {
-            new ( pDest ) T( std::move( *pSrc ) );
-            pSrc->~T();
-        }
         if constexpr ( HasNullValue )
-            *pDest = NullValue;
-        if ( !using_inplace() )
-            m_alloc.deallocate( m_begin, m_bufferSize );
+            pBuf[m_size] = NullValue;
         m_begin = pBuf;
         m_bufferSize = newCap;
         return true;
@@ -577,7 +679,7 @@ struct SboStorage<Impl,
     }
     size_type capacity() const
     {
-        return HasNullValue ? ( m_bufferSize - 1 ) : m_bufferSize;
+        return HasNullValue && m_bufferSize ? ( m_bufferSize - 1 ) : m_bufferSize;
     }
 
     bool reserve( size_t n )
@@ -587,19 +689,11 @@ struct SboStorage<Impl,
         auto newCap = HasNullValue ? ( n + 1 ) : n;
         if ( m_size == capacity() )
             newCap = std::max( 2 * m_bufferSize, newCap ); // double capacity
-        auto pBuf = m_alloc.allocate( newCap );
+        auto pBuf = grow_buffer( m_alloc, m_begin, m_size, m_bufferSize, newCap, m_begin != nullptr );
         if ( !pBuf )
             return false;
-        auto pSrc = m_begin, pDest = pBuf;
-        for ( size_t i = 0; i < m_size; ++i, ++pSrc, ++pDest )
-        {
-            new ( pDest ) T( std::move( *pSrc ) );
-            pSrc->~T();
-        }
         if constexpr ( HasNullValue )
-            *pDest = NullValue;
-        if ( !using_inplace() )
-            m_alloc.deallocate( m_begin, m_bufferSize );
+            pBuf[m_size] = NullValue;
         m_begin = pBuf;
         m_bufferSize = newCap;
         return true;
@@ -614,7 +708,8 @@ struct SboStorage<Impl,
     {
         m_size = n;
         if constexpr ( HasNullValue )
-            m_begin[n] = NullValue;
+            if ( m_begin ) // empty string may have no buffer.
+                m_begin[n] = NullValue;
     }
 
     Alloc &get_allocator()
@@ -694,6 +789,9 @@ public:
 
     static constexpr auto npos = std::numeric_limits<size_t>::max();
 
+    /// Inplace elements are relocatable as they are. With an inplace buffer, m_begin may point into the object itself.
+    using is_trivially_relocatable = std::bool_constant<has_allocator ? N == 0 && is_trivially_relocatable_v<Alloc> : is_trivially_relocatable_v<T>>;
+
     VectorBase() = default;
 
     template<class Iter>
@@ -773,6 +871,30 @@ public:
         push_back_iter( a.begin(), a.end() );
     }
 
+    // the implicit one would share the buffer. The copy allocates from a's allocator.
+    VectorBase( const VectorBase &a ) : VectorBase( a, std::bool_constant<has_allocator>() )
+    {
+    }
+    VectorBase( const VectorBase &a, std::true_type /*has_allocator*/ ) : base_type( a.get_allocator() )
+    {
+        push_back_iter( a.begin(), a.end() );
+    }
+    VectorBase( const VectorBase &a, std::false_type /*has_allocator*/ ) : base_type()
+    {
+        push_back_iter( a.begin(), a.end() );
+    }
+
+    // reuses the buffer. If a copy throws, this is left a valid vector rather than a destroyed object.
+    this_type &operator=( const VectorBase &a )
+    {
+        if ( this != &a )
+        {
+            clear();
+            push_back_iter( a.begin(), a.end() );
+        }
+        return *this;
+    }
+
     ~VectorBase()
     {
         clear();
@@ -818,17 +940,17 @@ public:
         return *this;
     }
 
-    template<class U, size_t M, class A, bool bSize, bool bNull, class NullT, T NullV>
+    template<class U, size_t M, class A, bool bSize, bool bNull, class NullT, NullT NullV>
     this_type &operator+=( const VectorBase<U, M, A, bSize, bNull, NullT, NullV> &a )
     {
-        push_back_iter( a.begin().a.end() );
+        push_back_iter( a.begin(), a.end() );
         return *this;
     }
 
-    template<class U, size_t M, class A, bool bSize, bool bNull, class NullT, T NullV>
+    template<class U, size_t M, class A, bool bSize, bool bNull, class NullT, NullT NullV>
     this_type &operator+=( VectorBase<U, M, A, bSize, bNull, NullT, NullV> &&a )
     {
-        push_back_moveiter( a.begin().a.end() );
+        push_back_moveiter( a.begin(), a.end() );
         return *this;
     }
 
@@ -889,7 +1011,7 @@ public:
     }
     const T &back() const
     {
-        return *( begin() + size - 1 );
+        return *( begin() + size() - 1 );
     }
     T &back()
     {
@@ -922,7 +1044,7 @@ public:
             return nullptr;
         auto pElem = base_type::begin() + n;
         new ( pElem ) T( std::forward<Args>( args )... );
-        set_size( n + 1 );
+        base_type::set_size( n + 1 );
         return pElem;
     }
 
@@ -1100,7 +1222,12 @@ public:
     void erase( iterator it, iterator itEnd )
     {
         auto n = std::distance( it, itEnd );
-        if ( n > 0 )
+        if ( n > 0 && is_trivially_relocatable_v<T> )
+        {
+            ftl::destroy( it, itEnd, end() );
+            base_type::set_size( size() - n );
+        }
+        else if ( n > 0 )
         {
             for ( auto pend = end(); itEnd != pend; ++itEnd, ++it ) // todo fix bug
                 std::swap( *it, *itEnd );
@@ -0,0 +1,151 @@
+#include <ftl/unittest.h>
+#include <ftl/arena.h>
+#include <ftl/Jzjson.h>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+using namespace ftl;
+
+ADD_TEST_CASE( Arena_tests )
+{
+    SECTION( "bump" )
+    {
+        Arena arena( 256 );
+        REQUIRE_EQ( 0u, arena.capacity() );
+        auto p1 = static_cast<char *>( arena.malloc( 10 ) );
+        auto p2 = static_cast<char *>( arena.malloc( 8, 8 ) );
+        REQUIRE( p1 && p2 );
+        REQUIRE_EQ( p1 + 16, p2 );
+        REQUIRE_EQ( 18u, arena.allocated_bytes() );
+        auto p3 = arena.malloc( 1, 64 );
+        REQUIRE( std::size_t( p3 ) % 64 == 0 );
+
+        arena.free( p3, 1 ); // last allocation is rolled back.
+        REQUIRE_EQ( 18u, arena.allocated_bytes() );
+        arena.free( p1, 10 ); // no-op
+        REQUIRE_EQ( 18u, arena.allocated_bytes() );
+
+        // larger than a chunk.
+        auto pBig = static_cast<char *>( arena.malloc( 10000 ) );
+        std::memset( pBig, 1, 10000 );
+        REQUIRE( arena.capacity() >= 256 + 10000 );
+    }
+
+    SECTION( "checkpoint_and_chunk_reuse" )
+    {
+        Arena arena( 1024 );
+        arena.malloc( 100 );
+        auto cp = arena.checkpoint();
+        for ( int i = 0; i < 100; ++i )
+            arena.malloc( 100 );
+        const auto cap = arena.capacity();
+        REQUIRE( cap > 1024 * 8 );
+
+        arena.rollback( cp );
+        REQUIRE_EQ( 100u, arena.allocated_bytes() );
+        for ( int k = 0; k < 10; ++k ) // steady state: no new chunks.
+        {
+            auto cp2 = arena.checkpoint();
+            for ( int i = 0; i < 100; ++i )
+                arena.malloc( 100 );
+            arena.rollback( cp2 );
+        }
+        REQUIRE_EQ( cap, arena.capacity() );
+
+        arena.reset();
+        REQUIRE_EQ( 0u, arena.allocated_bytes() );
+        REQUIRE_EQ( cap, arena.capacity() );
+        arena.release();
+        REQUIRE_EQ( 0u, arena.capacity() );
+    }
+
+    SECTION( "scope_and_allocators" )
+    {
+        Arena arena;
+        REQUIRE( !Arena::current() );
+        {
+            Arena::Scope scope( arena );
+            REQUIRE_EQ( &arena, Arena::current() );
+            std::vector<int, ArenaAllocatorRef<int>> vec;
+            for ( int i = 0; i < 1000; ++i )
+                vec.push_back( i );
+            REQUIRE_EQ( 999, vec.back() );
+
+            std::pmr::vector<std::pmr::string> strs( &arena );
+            for ( int i = 0; i < 100; ++i )
+                strs.emplace_back( "a string longer than small string buffer " + std::to_string( i ) );
+            REQUIRE_EQ( 100u, strs.size() );
+            {
+                Arena inner;
+                Arena::Scope innerScope( inner );
+                ArenaString<> s( "another string longer than small string buffer" );
+                REQUIRE( inner.allocated_bytes() > 0 );
+            }
+            REQUIRE_EQ( &arena, Arena::current() );
+            REQUIRE( arena.allocated_bytes() > 1000 * sizeof( int ) );
+        }
+        REQUIRE( !Arena::current() );
+        REQUIRE_EQ( 0u, arena.allocated_bytes() );
+    }
+
+    SECTION( "dyn_node_per_message" )
+    {
+        using Node = jz::DynNode<ArenaString<>>;
+        Arena arena;
+        std::size_t cap = 0;
+        for ( int i = 0; i < 10; ++i )
+        {
+            Arena::Scope scope( arena );
+            std::stringstream ss( R"(
+{ action: addOrder, qty: )" + std::to_string( i ) + R"(, others: { "first name": "a name longer than small string buffer", scores: [2, 3] } }
+)" );
+            Node node;
+            REQUIRE( jz::jzonSerializer.read( node, ss, std::cerr ) );
+            REQUIRE_EQ( node["action"].str(), "addOrder" );
+            REQUIRE_EQ( node["qty"].toInt(), i );
+            REQUIRE_EQ( node["others"]["scores"][1].toInt(), 3 );
+            REQUIRE( arena.allocated_bytes() > 0 );
+            if ( i == 0 )
+                cap = arena.capacity();
+            REQUIRE_EQ( cap, arena.capacity() ); // chunks are reused.
+        }
+        REQUIRE_EQ( 0u, arena.allocated_bytes() );
+    }
+}
+
+ADD_TEST_CASE( Arena_bench )
+{
+    constexpr int N = 10000;
+    const std::string msg = R"(
+{ action: addOrder, qty: 14, price: 100.5, account: "an account name longer than small string buffer", tags: [a, b, c, d],
+  others: { "first name": "a name longer than small string buffer", scores: [2, 3, 5, 7, 11] } }
+)";
+
+    auto bench = [&]( auto &&parse, const char *name ) {
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( int i = 0; i < N; ++i )
+            parse();
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " parse latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+    };
+
+    bench(
+            [&] {
+                std::stringstream ss( msg );
+                jz::DynNode<> node;
+                REQUIRE( jz::jzonSerializer.read( node, ss, std::cerr ) );
+            },
+            "DynNode<std::string>" );
+
+    Arena arena;
+    bench(
+            [&] {
+                Arena::Scope scope( arena );
+                std::stringstream ss( msg );
+                jz::DynNode<ArenaString<>> node;
+                REQUIRE( jz::jzonSerializer.read( node, ss, std::cerr ) );
+            },
+            "DynNode<ArenaString> in Arena::Scope" );
+}
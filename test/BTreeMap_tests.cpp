@@ -0,0 +1,215 @@
+#include <ftl/unittest.h>
+#include <ftl/btree_map.h>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace ftl;
+
+ADD_TEST_CASE( BTreeMap_tests )
+{
+    SECTION( "basic" )
+    {
+        BTreeMap<int, std::string> m = {{2, "b"}, {1, "a"}, {2, "x"}};
+        REQUIRE_EQ( 2u, m.size() );
+        REQUIRE( m.front().first == 1 && m.back().second == "b" );
+        m[-1] = "z";
+        REQUIRE_EQ( -1, m.begin()->first );
+        REQUIRE( !m.insert( {2, "y"} ).second );
+        REQUIRE( !m.update( {2, "c"} ).second );
+        REQUIRE_EQ( std::string( "c" ), m.at( 2 ) );
+        REQUIRE( m.find( 3 ) == m.end() );
+        REQUIRE_EQ( 2, m.lower_bound( 2 ).key() );
+        REQUIRE_EQ( 2, m.upper_bound( 1 ).key() );
+        REQUIRE( m.upper_bound( 2 ) == m.end() );
+        auto range = m.equal_range( 1 );
+        REQUIRE( std::next( range.first ) == range.second );
+        REQUIRE_EQ( 1u, m.erase( -1 ) );
+        REQUIRE_EQ( 0u, m.erase( -1 ) );
+        REQUIRE( m.update( {5, "e"}, false ).first == m.end() );
+
+        const auto &cm = m;
+        std::string all;
+        for ( auto kv : cm )
+            all += std::to_string( kv.first ) + kv.second;
+        REQUIRE_EQ( std::string( "1a2c" ), all );
+        REQUIRE( m.verify() );
+
+        m.clear();
+        REQUIRE( m.empty() && m.begin() == m.end() && m.verify() );
+    }
+
+    SECTION( "transparent less" )
+    {
+        // a double key must not be truncated to int on the way to the SIMD search.
+        BTreeMap<int, int, std::less<>> m;
+        for ( int i = 0; i < 1000; ++i )
+            m.insert( {i, i} );
+        REQUIRE( m.find( 2.5 ) == m.end() && m.count( 2.5 ) == 0 );
+        REQUIRE_EQ( 3, m.lower_bound( 2.5 ).key() );
+        REQUIRE_EQ( 3, m.upper_bound( 2.5 ).key() );
+        REQUIRE_EQ( 500, m.find( 500.0 )->second );
+        REQUIRE( m.lower_bound( 998.5 ).key() == 999 && m.lower_bound( 999.5 ) == m.end() );
+    }
+
+    SECTION( "random_ops" )
+    {
+        // small nodes make a deep tree.
+        using Map = BTreeMap<int, int, std::less<int>, 128>;
+        Map m;
+        std::map<int, int> ref;
+        std::mt19937 rng( 3 );
+        auto same = [&]( const Map &a ) {
+            return a.size() == ref.size() && std::equal( a.begin(), a.end(), ref.begin(), ref.end(), []( auto kv1, auto &kv2 ) {
+                       return kv1.first == kv2.first && kv1.second == kv2.second;
+                   } );
+        };
+        for ( int round = 0; round < 4; ++round )
+        {
+            for ( int i = 0; i < 5000; ++i )
+            {
+                int k = int( rng() % 4000 ), op = int( rng() % 4 );
+                if ( op == 0 )
+                    REQUIRE_EQ( ref.erase( k ), m.erase( k ) );
+                else if ( op == 1 && !ref.empty() ) // erase at the front, as the best price of a book.
+                {
+                    auto it = m.erase( m.begin() );
+                    ref.erase( ref.begin() );
+                    REQUIRE( ref.empty() ? it == m.end() : it.key() == ref.begin()->first );
+                }
+                else
+                {
+                    ref[k] = i;
+                    m[k] = i;
+                }
+            }
+            REQUIRE( m.verify() );
+            REQUIRE( same( m ) );
+            REQUIRE( m.height() > 2 );
+            for ( int k = -1; k <= 4000; k += 7 )
+            {
+                REQUIRE( ( m.lower_bound( k ) == m.end() ) == ( ref.lower_bound( k ) == ref.end() ) );
+                REQUIRE( ( m.upper_bound( k ) == m.end() ) == ( ref.upper_bound( k ) == ref.end() ) );
+                if ( ref.lower_bound( k ) != ref.end() )
+                    REQUIRE_EQ( ref.lower_bound( k )->first, m.lower_bound( k ).key() );
+                if ( ref.upper_bound( k ) != ref.end() )
+                    REQUIRE_EQ( ref.upper_bound( k )->first, m.upper_bound( k ).key() );
+            }
+            // reverse iteration
+            auto itRef = ref.rbegin();
+            for ( auto it = m.end(); it != m.begin(); ++itRef )
+                REQUIRE_EQ( itRef->first, ( --it ).key() );
+        }
+
+        Map copy = m;
+        REQUIRE( copy.verify() && same( copy ) );
+        Map moved = std::move( copy );
+        REQUIRE( copy.empty() && moved.verify() && same( moved ) );
+        copy = moved;
+        REQUIRE( copy.verify() && same( copy ) );
+
+        const auto nRefSize = ref.size();
+        for ( auto it = ref.begin(); it != ref.end(); )
+            it = it->first % 2 == 0 ? ref.erase( it ) : std::next( it );
+        REQUIRE_EQ( nRefSize - ref.size(), m.bulk_erase( []( auto &kv ) { return kv.first % 2 == 0; } ) );
+        REQUIRE( m.verify() && same( m ) );
+
+        while ( !ref.empty() ) // erase all, the tree shrinks to empty.
+        {
+            auto k = ref.begin()->first;
+            REQUIRE_EQ( 1u, m.erase( k ) );
+            ref.erase( k );
+        }
+        REQUIRE( m.verify() && m.empty() && m.height() == 0 );
+    }
+
+    SECTION( "bulk" )
+    {
+        using Map = BTreeMap<int, int, std::less<int>, 128>;
+        std::vector<std::pair<int, int>> batch;
+        for ( int i = 0; i < 1000; ++i )
+            batch.emplace_back( ( i * 7919 ) % 1000, i );
+        batch.emplace_back( 5, -1 );
+        Map m;
+        REQUIRE_EQ( 1000u, m.insert_bulk( batch.begin(), batch.end(), true ) );
+        REQUIRE( m.verify() );
+        REQUIRE_EQ( -1, m[5] );
+        REQUIRE_EQ( 0u, m.insert_bulk( batch.begin(), batch.end() ) );
+        std::vector<std::pair<int, int>> more = {{-1, 0}, {1000, 0}, {5, 5}};
+        REQUIRE_EQ( 2u, m.insert_bulk( more.begin(), more.end() ) );
+        REQUIRE_EQ( -1, m[5] );
+        REQUIRE( m.verify() && m.size() == 1002 );
+    }
+
+    SECTION( "strings" )
+    {
+        BTreeMap<std::string, std::string, std::less<>, 256> m;
+        for ( int i = 0; i < 2000; ++i )
+            m[std::to_string( i * 13 % 2000 )] = std::string( 20, char( 'a' + i % 26 ) ); // not SSO.
+        REQUIRE( m.verify() );
+        REQUIRE( m.contains( "1999" ) ); // heterogeneous lookup.
+        for ( int i = 0; i < 2000; i += 2 )
+            REQUIRE_EQ( 1u, m.erase( std::to_string( i ) ) );
+        REQUIRE( m.verify() && m.size() == 1000 );
+    }
+}
+
+ADD_TEST_CASE( BTreeMap_bench )
+{
+    using Price = std::int64_t;
+    constexpr int NLEVELS = 50000, NOPS = 200000;
+
+    // churn near the best price, as on one side of an order book: erase a level near the front and insert another.
+    auto bench = [&]( auto &map, const char *name ) {
+        std::mt19937_64 rng( 5 );
+        std::vector<Price> levels;
+        for ( Price p = 0; p < NLEVELS; ++p )
+            levels.push_back( p * 2 );
+        for ( auto p : levels )
+            map.update( std::make_pair( p, p ) );
+
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( int i = 0; i < NOPS; ++i )
+        {
+            auto p = Price( rng() % 64 ) * 2;
+            map.erase( p );
+            map.update( std::make_pair( p, p ) );
+        }
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " " << NLEVELS << " levels, erase+insert near front latency(ns):"
+                  << double( ( tsStop - tsStart ).count() ) / NOPS << std::endl;
+
+        Price sum = 0;
+        tsStart = std::chrono::steady_clock::now();
+        for ( int i = 0; i < NOPS; ++i )
+        {
+            auto it = map.find( Price( rng() % NLEVELS ) * 2 );
+            sum += it != map.end();
+        }
+        tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " find latency(ns):" << double( ( tsStop - tsStart ).count() ) / NOPS << std::endl;
+
+        tsStart = std::chrono::steady_clock::now();
+        for ( auto kv : map )
+            sum += kv.second;
+        tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " iterate latency(ns):" << double( ( tsStop - tsStart ).count() ) / map.size() << std::endl;
+        return sum;
+    };
+
+    struct StdMap : std::map<Price, Price>
+    {
+        void update( const std::pair<Price, Price> &kv )
+        {
+            insert_or_assign( kv.first, kv.second );
+        }
+    };
+    FlatOrderedMap<Price, Price> flatMap;
+    BTreeMap<Price, Price> btreeMap;
+    StdMap stdMap;
+    auto sum = bench( stdMap, "std::map" );
+    REQUIRE_EQ( sum, bench( flatMap, "FlatOrderedMap" ) );
+    REQUIRE_EQ( sum, bench( btreeMap, "BTreeMap" ) );
+}
@@ -0,0 +1,150 @@
+#include <ftl/unittest.h>
+#include <ftl/binary_search_tree.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace ftl;
+
+namespace
+{
+struct Order : avl_hook
+{
+    std::int64_t price;
+    int qty;
+
+    Order( std::int64_t price = 0, int qty = 0 ) : price( price ), qty( qty )
+    {
+    }
+};
+struct OrderPrice
+{
+    std::int64_t operator()( const Order &o ) const
+    {
+        return o.price;
+    }
+};
+} // namespace
+
+ADD_TEST_CASE( BinarySearchTree_tests )
+{
+    SECTION( "sorted" )
+    {
+        binary_search_tree<int, std::string> t = {{2, "b"}, {1, "a"}, {2, "x"}};
+        REQUIRE( t.size() == 2 && t.begin()->second == "a" && t.last()->second == "b" );
+        for ( int i = 3; i < 10000; ++i ) // sorted input stays balanced.
+            REQUIRE( t.insert( {i, std::to_string( i )} ).second );
+        REQUIRE( t.verify() && t.height() <= 14 );
+        REQUIRE( !t.insert( {5, "y"} ).second && t.at( 5 ) == "5" );
+        t[-1] = "z";
+        REQUIRE( t.begin()->first == -1 && t.size() == 10000 );
+        REQUIRE( t.lower_bound( 100 )->first == 100 && t.upper_bound( 100 )->first == 101 );
+        REQUIRE( t.find( 10000 ) == t.end() && t.contains( 9999 ) && t.count( 0 ) == 0 );
+        REQUIRE( ( --t.end() )->first == 9999 );
+
+        for ( int i = 0; i < 10000; i += 2 )
+            REQUIRE_EQ( size_t( i > 0 ), t.erase( i ) );
+        REQUIRE( t.verify() && t.size() == 5001 ); // -1 and the odd keys.
+        auto it = t.erase( t.find( 1 ) );
+        REQUIRE( it->first == 3 );
+    }
+
+    SECTION( "random" )
+    {
+        binary_search_tree<int, int> t;
+        std::map<int, int> ref;
+        std::mt19937 rng( 9 );
+        for ( int i = 0; i < 20000; ++i )
+        {
+            int k = int( rng() % 5000 );
+            if ( rng() % 3 == 0 )
+                REQUIRE_EQ( ref.erase( k ), t.erase( k ) );
+            else
+            {
+                ref[k] = i;
+                t[k] = i;
+            }
+        }
+        REQUIRE( t.verify() && t.size() == ref.size() );
+        REQUIRE( std::equal( t.begin(), t.end(), ref.begin(), ref.end() ) );
+
+        auto copy = t;
+        REQUIRE( copy.verify() && std::equal( copy.begin(), copy.end(), ref.begin(), ref.end() ) );
+        auto moved = std::move( copy );
+        REQUIRE( copy.empty() && moved.size() == ref.size() );
+        copy = moved;
+        moved.clear();
+        REQUIRE( moved.empty() && copy.size() == ref.size() );
+
+        binary_search_tree<std::string, int, std::less<>, std::allocator<char>> s; // nodes from std::allocator.
+        for ( int i = 0; i < 100; ++i )
+            s.try_emplace( std::string( 20, char( 'a' + i % 26 ) ) + std::to_string( i ), i );
+        REQUIRE( s.verify() && s.size() == 100 && s.find( std::string( 20, 'b' ) + "1" )->second == 1 );
+    }
+
+    SECTION( "intrusive" )
+    {
+        std::vector<Order> orders;
+        for ( int i = 0; i < 1000; ++i )
+            orders.emplace_back( i * 10, i );
+        intrusive_bst<Order, OrderPrice> book;
+        for ( auto &o : orders )
+            REQUIRE( book.insert( o ).second );
+        Order dup( 50, -1 );
+        REQUIRE( !book.insert( dup ).second && book.size() == 1000 );
+        REQUIRE( book.verify() && book.height() <= 11 );
+        REQUIRE( &*book.find( 500 ) == &orders[50] && book.find( 505 ) == book.end() );
+        REQUIRE( book.lower_bound( 505 )->qty == 51 && book.upper_bound( 510 )->qty == 52 );
+
+        for ( int i = 0; i < 1000; i += 3 )
+            book.erase( orders[i] );
+        REQUIRE( book.verify() && !book.contains( 0 ) && book.contains( 10 ) );
+        auto it = book.erase( book.iterator_to( orders[1] ) );
+        REQUIRE( &*it == &orders[2] );
+        REQUIRE( book.insert( orders[0] ).second && book.begin()->qty == 0 ); // unlinked objects can be inserted again.
+        book.clear();
+        REQUIRE( book.empty() && orders[2].parent == nullptr );
+    }
+}
+
+ADD_TEST_CASE( BinarySearchTree_bench )
+{
+    constexpr int N = 200000;
+    std::vector<int> sorted( N ), shuffled( N );
+    for ( int i = 0; i < N; ++i )
+        sorted[i] = shuffled[i] = i;
+    std::shuffle( shuffled.begin(), shuffled.end(), std::mt19937( 13 ) );
+
+    auto bench = [&]( auto &map, const std::vector<int> &keys, const char *name ) {
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( auto k : keys )
+            map.insert( {k, k} );
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " insert latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+
+        long sum = 0;
+        tsStart = std::chrono::steady_clock::now();
+        for ( auto k : shuffled )
+            sum += map.find( k )->second;
+        tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " find latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+
+        tsStart = std::chrono::steady_clock::now();
+        for ( auto k : keys )
+            map.erase( k );
+        tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " erase latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+        return sum;
+    };
+    for ( auto *keys : {&sorted, &shuffled} )
+    {
+        std::cout << ( keys == &sorted ? "sorted keys" : "random keys" ) << std::endl;
+        std::map<int, int> stdMap;
+        binary_search_tree<int, int> bst;
+        auto sum = bench( stdMap, *keys, "std::map" );
+        REQUIRE_EQ( sum, bench( bst, *keys, "binary_search_tree" ) );
+    }
+}
@@ -0,0 +1,112 @@
+#include <ftl/unittest.h>
+#include <ftl/chan_select.h>
+#include <thread>
+
+using namespace ftl;
+
+ADD_TEST_CASE( ChanSelect_tests )
+{
+    using IntChan = Chan<int>;
+    using MPSCIntChan = Chan<int, MPSCBoundedQueue<int>>;
+
+    SECTION( "timeout" )
+    {
+        IntChan a( 8 );
+        ChanSelector sel;
+        REQUIRE( sel.inited() );
+        REQUIRE_EQ( 0, sel.add( a ) );
+        REQUIRE_EQ( -1, sel.try_select() );
+        auto tsStart = std::chrono::steady_clock::now();
+        REQUIRE_EQ( -1, sel.select( 20 ) );
+        REQUIRE( std::chrono::steady_clock::now() - tsStart >= std::chrono::milliseconds( 20 ) );
+    }
+
+    SECTION( "priority" )
+    {
+        IntChan a( 8 ), b( 8 );
+        ChanSelector sel( SelectPolicy::Priority );
+        auto ia = sel.add( a ), ib = sel.add( b );
+        REQUIRE( b.send( 1 ) );
+        REQUIRE( a.send( 2 ) );
+        REQUIRE_EQ( ia, sel.select( 0 ) );
+        REQUIRE_EQ( ia, sel.select( 0 ) ); // a is not consumed yet
+        int v;
+        REQUIRE( a.recv( &v ) );
+        REQUIRE_EQ( 2, v );
+        REQUIRE_EQ( ib, sel.select( 0 ) );
+    }
+
+    SECTION( "fair" )
+    {
+        IntChan a( 8 ), b( 8 );
+        ChanSelector sel( SelectPolicy::Fair );
+        auto ia = sel.add( a ), ib = sel.add( b );
+        REQUIRE( a.send( 1 ) );
+        REQUIRE( b.send( 2 ) );
+        REQUIRE_EQ( ia, sel.select( 0 ) );
+        REQUIRE_EQ( ib, sel.select( 0 ) );
+        REQUIRE_EQ( ia, sel.select( 0 ) );
+    }
+
+    SECTION( "fd" )
+    {
+        IntChan a( 8 );
+        int fds[2];
+        REQUIRE_EQ( 0, pipe( fds ) );
+        ChanSelector sel;
+        sel.add( a );
+        auto ifd = sel.add_fd( fds[0] );
+        REQUIRE( ifd >= 0 );
+        ssize_t nWritten = 0;
+        std::thread th( [&] {
+            std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+            char c = 'x';
+            nWritten = write( fds[1], &c, 1 );
+        } );
+        REQUIRE_EQ( ifd, sel.select( 1000 ) );
+        th.join();
+        REQUIRE_EQ( 1, nWritten );
+        REQUIRE( sel.remove_fd( fds[0] ) );
+        close( fds[0] );
+        close( fds[1] );
+    }
+
+    SECTION( "blocking_multiple_producers" )
+    {
+        constexpr int N = 100000, NCHANS = 4;
+        MPSCIntChan chans[NCHANS];
+        ChanSelector sel;
+        for ( auto &chan : chans )
+        {
+            REQUIRE( chan.init( 64 ) );
+            sel.add( chan );
+        }
+        std::vector<std::thread> producers;
+        for ( int k = 0; k < NCHANS; ++k )
+            producers.emplace_back( [&, k] {
+                for ( int i = 1; i <= N; ++i )
+                {
+                    while ( !chans[k].send( i ) )
+                        std::this_thread::yield();
+                    if ( i % 1000 == 0 )
+                        std::this_thread::sleep_for( std::chrono::microseconds( 100 ) ); // let consumer sleep
+                }
+            } );
+        long long sum = 0;
+        int count = 0;
+        while ( count < N * NCHANS )
+        {
+            auto idx = sel.select( 1000 );
+            REQUIRE( idx >= 0 );
+            int v;
+            if ( chans[idx].recv( &v ) )
+            {
+                sum += v;
+                ++count;
+            }
+        }
+        for ( auto &th : producers )
+            th.join();
+        REQUIRE_EQ( (long long)N * ( N + 1 ) / 2 * NCHANS, sum );
+    }
+}
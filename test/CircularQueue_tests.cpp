@@ -0,0 +1,181 @@
+#include <ftl/unittest.h>
+#include <ftl/circular_queue.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ftl;
+
+ADD_TEST_CASE( CircularQueue_tests )
+{
+    SECTION( "ring" )
+    {
+        circular_queue<int> q( 3 );
+        REQUIRE( q.capacity() == 8 && q.empty() );
+        std::deque<int> ref;
+        for ( int i = 0; i < 1000; ++i ) // wraps around, then grows while wrapped.
+        {
+            if ( i % 3 == 2 )
+            {
+                q.pop_front();
+                ref.pop_front();
+            }
+            else if ( i % 5 == 0 )
+            {
+                q.push_front( i );
+                ref.push_front( i );
+            }
+            else
+            {
+                q.push_back( i );
+                ref.push_back( i );
+            }
+        }
+        REQUIRE( q.size() == ref.size() && std::equal( q.begin(), q.end(), ref.begin(), ref.end() ) );
+        REQUIRE( q.front() == ref.front() && q.back() == ref.back() && q[5] == ref[5] );
+        REQUIRE( q.capacity() == 512 );
+        REQUIRE( ( q.end() - q.begin() ) == std::ptrdiff_t( q.size() ) );
+        REQUIRE( *( q.cend() - 1 ) == q.back() && q.cbegin()[2] == ref[2] );
+        REQUIRE( q.pop_back() && q.size() == ref.size() - 1 );
+
+        q.push_back( q.front() ); // aliases an element.
+        REQUIRE( q.back() == ref.front() );
+        q.clear();
+        REQUIRE( q.empty() && !q.pop_front() && !q.pop_back() );
+    }
+
+    SECTION( "bulk" )
+    {
+        circular_queue<int> q( 8 );
+        std::vector<int> src( 100 );
+        std::iota( src.begin(), src.end(), 0 );
+        REQUIRE( q.push_back( src.data(), src.data() + 6 ) == 6 );
+        REQUIRE( q.pop_front( 5 ) == 5 );
+        REQUIRE( q.push_back( src.data() + 6, src.data() + 12 ) == 6 ); // wraps
+        int out[10];
+        REQUIRE( q.pop_front( out, 10 ) == 7 );
+        REQUIRE( out[0] == 5 && out[6] == 11 && q.empty() );
+
+        REQUIRE( q.push_back( src.begin(), src.end() ) == 100 );
+        std::list<int> l = {-1, -2};
+        REQUIRE( q.insert( l.begin(), l.end() ) == 2 );
+        REQUIRE( q.size() == 102 && q[99] == 99 && q.back() == -2 );
+
+        circular_queue<std::string> qs;
+        std::vector<std::string> strs = {std::string( 40, 'a' ), "b", "c"};
+        for ( int i = 0; i < 5; ++i )
+            qs.push_back( strs.begin(), strs.end() );
+        REQUIRE( qs.pop_front( 4 ) == 4 );
+        std::string sout[3];
+        REQUIRE( qs.pop_front( sout, 3 ) == 3 );
+        REQUIRE( sout[0] == "b" && sout[2] == std::string( 40, 'a' ) && qs.size() == 8 && qs.front() == "b" );
+    }
+
+    SECTION( "copy_move" )
+    {
+        circular_queue<std::string> a;
+        for ( int i = 0; i < 20; ++i )
+            a.emplace_back( std::to_string( i ) );
+        a.pop_front( 3 );
+        auto b = a;
+        REQUIRE( std::equal( a.begin(), a.end(), b.begin(), b.end() ) );
+        auto c = std::move( a );
+        REQUIRE( a.empty() && std::equal( b.begin(), b.end(), c.begin(), c.end() ) );
+        a = c;
+        REQUIRE( a.size() == 17 && a.front() == "3" );
+
+        inline_circular_queue<std::string, 6> iq; // 8 inline.
+        REQUIRE( iq.capacity() == 8 && iq.using_inline() );
+        for ( int i = 0; i < 8; ++i )
+            iq.push_back( std::to_string( i ) );
+        auto iq2 = iq;
+        auto iq3 = std::move( iq2 ); // relocates inline elements.
+        REQUIRE( iq3.using_inline() && iq3.size() == 8 && iq3.back() == "7" && iq2.empty() );
+        iq.push_back( "8" );
+        REQUIRE( !iq.using_inline() && iq.capacity() == 16 && iq.front() == "0" );
+        iq3 = std::move( iq ); // takes the heap buffer.
+        REQUIRE( !iq3.using_inline() && iq3.size() == 9 && iq.using_inline() && iq.empty() );
+        iq.push_back( "x" );
+        REQUIRE( iq.front() == "x" );
+    }
+
+    SECTION( "snapshot" )
+    {
+        // the owner thread keeps a window of consecutive numbers, a reader checks every snapshot is consecutive.
+        // the owner keeps going until the reader has taken enough snapshots, so a late-starting reader is still exercised.
+        circular_queue<long, std::allocator<long>, true> q;
+        std::atomic<bool> done{false};
+        std::atomic<long> nRead{0};
+        long nBad = 0;
+        std::thread reader( [&] {
+            while ( !done.load() )
+            {
+                auto v = q.snapshot();
+                for ( size_t i = 1; i < v.size(); ++i )
+                    nBad += v[i] != v[i - 1] + 1;
+                ++nRead;
+            }
+        } );
+        long next = 0;
+        for ( int round = 0; round < 2000 || nRead.load() < 100; ++round )
+        {
+            for ( int i = 0; i < 50; ++i )
+                q.push_back( next++ );
+            q.pop_front( round % 2 ? 60 : 30 );
+            if ( round >= 2000 )
+                std::this_thread::yield();
+        }
+        done = true;
+        reader.join();
+        REQUIRE( nBad == 0 && nRead.load() >= 100 );
+        long out[4];
+        REQUIRE( q.snapshot( out, 4 ) == std::min<size_t>( 4, q.size() ) );
+    }
+}
+
+ADD_TEST_CASE( CircularQueue_bench )
+{
+    constexpr int N = 10000000, BATCH = 64;
+    auto bench = [&]( auto &q, const char *name ) {
+        long sum = 0;
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( int i = 0; i < N; ++i )
+        {
+            q.push_back( i );
+            if ( q.size() > 1000 )
+            {
+                sum += q.front();
+                q.pop_front();
+            }
+        }
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " push_back/pop_front latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+        return sum;
+    };
+    std::deque<long> dq;
+    circular_queue<long> cq;
+    auto sum = bench( dq, "std::deque" );
+    REQUIRE_EQ( sum, bench( cq, "circular_queue" ) );
+
+    std::vector<long> batch( BATCH );
+    long out[BATCH], sum2 = 0;
+    auto tsStart = std::chrono::steady_clock::now();
+    for ( int i = 0; i < N; i += BATCH )
+    {
+        std::iota( batch.begin(), batch.end(), long( i ) );
+        cq.push_back( batch.data(), batch.data() + BATCH );
+        if ( cq.size() > 1000 )
+        {
+            cq.pop_front( out, BATCH );
+            sum2 += out[BATCH - 1];
+        }
+    }
+    auto tsStop = std::chrono::steady_clock::now();
+    std::cout << "- circular_queue bulk push_back/pop_front latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+    REQUIRE( sum2 > 0 );
+}
@@ -0,0 +1,137 @@
+#include <ftl/unittest.h>
+#include <ftl/compact_string.h>
+#include <ftl/size_class_allocator.h>
+#include <ftl/Jzjson.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace ftl;
+
+ADD_TEST_CASE( CompactString_tests )
+{
+    static_assert( sizeof( CompactStr ) == 24 );
+    static_assert( sizeof( CompactString<std::allocator<char>, true> ) == 32 );
+    static_assert( is_trivially_relocatable_v<CompactStr> );
+
+    SECTION( "inline" )
+    {
+        CompactStr s;
+        REQUIRE( s.empty() && s.using_inplace() && *s.c_str() == 0 );
+        s = "price";
+        REQUIRE( s == "price" && s.size() == 5 && s.capacity() == 23 );
+
+        CompactStr full( std::string( 23, 'x' ) ); // the last byte is both the size and the null terminator.
+        REQUIRE( full.using_inplace() && full.size() == 23 && full.c_str()[23] == 0 );
+        REQUIRE( full.pop_back( 3 ) == 20 );
+        REQUIRE( full.size() == 20 && full.c_str()[20] == 0 );
+
+        CompactStr a = "abc";
+        a += 'd';
+        a += std::string_view( "ef" );
+        REQUIRE( a == "abcdef" && a.back() == 'f' && a.front() == 'a' );
+        a.erase( a.begin() + 1, a.begin() + 3 );
+        REQUIRE( a == "adef" );
+        REQUIRE( a.substr( 1, 2 ) == "de" );
+        REQUIRE( a.sub_view( 2 ) == "ef" );
+        REQUIRE( a.compare( "b" ) < 0 && "adeg" > std::string_view( a ) );
+        REQUIRE( a < CompactStr( "b" ) && a != "ade" );
+    }
+
+    SECTION( "heap" )
+    {
+        CompactStr s( 23, 'a' );
+        s += 'b'; // 24 chars don't fit.
+        REQUIRE( !s.using_inplace() && s.size() == 24 && s.capacity() >= 46 && s.c_str()[24] == 0 );
+        s.append( s.data(), s.size() ); // self append across growth.
+        REQUIRE( s == std::string( 23, 'a' ) + "b" + std::string( 23, 'a' ) + "b" );
+
+        CompactStr copy( s ), moved( std::move( s ) );
+        REQUIRE( copy == moved && copy.data() != moved.data() );
+        REQUIRE( s.empty() && s.using_inplace() );
+
+        moved.resize( 10 );
+        moved.shrink_to_fit();
+        REQUIRE( moved.using_inplace() && moved == std::string( 10, 'a' ) );
+        copy = moved;
+        REQUIRE( copy == moved );
+        copy.swap( s );
+        REQUIRE( copy.empty() && s == moved );
+
+        CompactString<SizeClassAllocatorRef<char>> sc( std::string( 100, 'z' ) );
+        REQUIRE( sc.size() == 100 && !sc.using_inplace() );
+    }
+
+    SECTION( "hash" )
+    {
+        CompactString<std::allocator<char>, true> s( std::string( 40, 'k' ) );
+        REQUIRE( s.hash() == std::hash<std::string>()( std::string( 40, 'k' ) ) );
+        s[0] = 'x'; // invalidates the cache.
+        REQUIRE( s.hash() == std::hash<std::string_view>()( s ) );
+
+        const CompactString<std::allocator<char>, true> shared( std::string( 50, 's' ) );
+        std::size_t hashes[4] = {};
+        std::vector<std::thread> threads;
+        for ( auto &h : hashes )
+            threads.emplace_back( [&] { h = shared.hash(); } ); // fills the cache concurrently.
+        for ( auto &th : threads )
+            th.join();
+        for ( auto h : hashes )
+            REQUIRE_EQ( std::hash<std::string_view>()( shared ), h );
+
+        std::unordered_map<CompactStr, int> m;
+        m["qty"] = 1;
+        m[CompactStr( std::string( 30, 'p' ) )] = 2;
+        REQUIRE( m.at( "qty" ) == 1 && m.at( CompactStr( std::string( 30, 'p' ) ) ) == 2 );
+    }
+
+    SECTION( "dyn_node" )
+    {
+        std::stringstream ss( R"({ addOrder { qty 12, side "buy it", price 23.3, comment "a comment longer than twenty-three chars" } })" );
+        jz::DynNode<CompactStr> node;
+        REQUIRE( jz::jzonSerializer.read( node, ss, std::cerr ) );
+        REQUIRE( node["addOrder"]["side"].str() == "buy it" );
+        REQUIRE( node["addOrder"]["qty"].toInt() == 12 );
+        REQUIRE( node["addOrder"]["comment"].str().size() == 40 );
+        REQUIRE( node.childWithKey( "addOrder" )["price"].toDouble() == 23.3 );
+    }
+}
+
+ADD_TEST_CASE( CompactString_bench )
+{
+    constexpr int N = 1000000;
+    std::cout << "- sizeof std::string:" << sizeof( std::string ) << ", String:" << sizeof( String ) << ", CompactStr:" << sizeof( CompactStr )
+              << std::endl;
+
+    // keys of 16 to 23 chars are inline in CompactStr, but allocated by std::string.
+    std::vector<std::string> src;
+    for ( int i = 0; i < N; ++i )
+        src.push_back( "order_field_" + std::to_string( i % 100000 ) );
+
+    auto bench = [&]( auto tag, const char *name ) {
+        using Str = decltype( tag );
+        auto tsStart = std::chrono::steady_clock::now();
+        std::vector<Str> keys;
+        keys.reserve( N );
+        for ( auto &s : src )
+            keys.emplace_back( s.data(), s.size() );
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " construct latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+
+        std::unordered_map<Str, int> map;
+        for ( int i = 0; i < 100000; ++i )
+            map[keys[i]] = i;
+        std::size_t sum = 0;
+        tsStart = std::chrono::steady_clock::now();
+        for ( auto &k : keys )
+            sum += map.find( k )->second;
+        tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " hash map find latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+        return sum;
+    };
+    auto sum = bench( std::string(), "std::string" );
+    REQUIRE_EQ( sum, bench( CompactStr(), "CompactStr" ) );
+    REQUIRE_EQ( sum, ( bench( CompactString<std::allocator<char>, true>(), "CompactString with cached hash" ) ) );
+}
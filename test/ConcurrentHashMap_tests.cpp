@@ -0,0 +1,203 @@
+#include <ftl/unittest.h>
+#include <ftl/concurrent_hash_map.h>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace ftl;
+
+ADD_TEST_CASE( ConcurrentHashMap_tests )
+{
+    SECTION( "basic" )
+    {
+        ConcurrentHashMap<int, std::string> map;
+        REQUIRE( map.empty() );
+        REQUIRE( map.insert( 1, "one" ) );
+        REQUIRE( !map.insert( 1, "uno" ) );
+        REQUIRE_EQ( std::string( "one" ), *map.find( 1 ) );
+        REQUIRE( !map.insert_or_assign( 1, std::string( "uno" ) ) );
+        REQUIRE_EQ( std::string( "uno" ), *map.find( 1 ) );
+        REQUIRE( map.insert_or_assign( 2, "two" ) );
+        REQUIRE_EQ( 2u, map.size() );
+        REQUIRE( !map.find( 3 ) );
+
+        std::size_t len = 0;
+        REQUIRE( map.visit( 2, [&]( const std::string &s ) { len = s.size(); } ) );
+        REQUIRE_EQ( 3u, len );
+
+        REQUIRE( map.erase( 1 ) );
+        REQUIRE( !map.erase( 1 ) );
+        REQUIRE( !map.contains( 1 ) );
+        REQUIRE( map.contains( 2 ) );
+        REQUIRE_EQ( 1u, map.size() );
+    }
+
+    SECTION( "incremental_resize" )
+    {
+        constexpr int N = 10000;
+        ConcurrentHashMap<int, int> map( 16 );
+        bool sawResizing = false;
+        for ( int i = 0; i < N; ++i )
+        {
+            REQUIRE( map.insert( i, i * 2 ) );
+            sawResizing = sawResizing || map.resizing();
+            if ( i % 97 == 0 ) // all keys are reachable while migrating.
+                for ( int k = 0; k <= i; k += 13 )
+                    REQUIRE_EQ( k * 2, map.find( k ).value_or( -1 ) );
+        }
+        REQUIRE( sawResizing );
+        REQUIRE_EQ( std::size_t( N ), map.size() );
+        REQUIRE( map.bucket_count() >= N );
+        for ( int i = 0; i < N; ++i )
+            REQUIRE_EQ( i * 2, map.find( i ).value_or( -1 ) );
+
+        std::size_t n = 0;
+        map.for_each( [&]( const std::pair<const int, int> &kv ) {
+            n += kv.second == kv.first * 2;
+        } );
+        REQUIRE_EQ( std::size_t( N ), n );
+    }
+
+    SECTION( "tombstones" )
+    {
+        ConcurrentHashMap<int, int> map( 64 );
+        for ( int round = 0; round < 100; ++round ) // erased buckets are compacted by resize, table doesn't grow.
+        {
+            for ( int i = 0; i < 32; ++i )
+                map.insert( round * 32 + i, i );
+            for ( int i = 0; i < 32; ++i )
+                REQUIRE( map.erase( round * 32 + i ) );
+        }
+        REQUIRE( map.empty() );
+        REQUIRE( map.bucket_count() <= 128 );
+    }
+
+    SECTION( "concurrent" )
+    {
+        constexpr int N = 20000, NWRITERS = 3, NREADERS = 2;
+        ConcurrentHashMap<int, std::string> map( 16 );
+        std::atomic<bool> stop{false};
+        std::atomic<int> nBad{0};
+        std::vector<std::thread> threads;
+        for ( int k = 0; k < NWRITERS; ++k )
+            threads.emplace_back( [&, k] {
+                for ( int i = k; i < N; i += NWRITERS )
+                {
+                    map.insert( i, std::to_string( i ) );
+                    if ( i % 3 == 0 )
+                        map.insert_or_assign( i, std::to_string( i ) + "!" );
+                    if ( i % 5 == 0 )
+                        map.erase( i );
+                }
+            } );
+        for ( int k = 0; k < NREADERS; ++k )
+            threads.emplace_back( [&] {
+                std::mt19937 rng( 1 );
+                while ( !stop )
+                {
+                    int key = int( rng() % N );
+                    map.visit( key, [&]( const std::string &s ) {
+                        if ( s.compare( 0, std::string::npos, std::to_string( key ) ) != 0 && s != std::to_string( key ) + "!" )
+                            ++nBad;
+                    } );
+                }
+            } );
+        for ( int k = 0; k < NWRITERS; ++k )
+            threads[k].join();
+        stop = true;
+        for ( int k = NWRITERS; k < NWRITERS + NREADERS; ++k )
+            threads[k].join();
+        REQUIRE_EQ( 0, nBad.load() );
+
+        std::size_t n = 0;
+        for ( int i = 0; i < N; ++i )
+        {
+            auto value = map.find( i );
+            if ( i % 5 == 0 )
+                REQUIRE( !value );
+            else
+            {
+                REQUIRE( value );
+                REQUIRE_EQ( std::to_string( i ) + ( i % 3 == 0 ? "!" : "" ), *value );
+                ++n;
+            }
+        }
+        REQUIRE_EQ( n, map.size() );
+    }
+}
+
+ADD_TEST_CASE( ConcurrentHashMap_bench )
+{
+    constexpr int NKEYS = 100000, NOPS = 200000, NTHREADS = 4;
+
+    struct MutexMap
+    {
+        std::mutex lock;
+        std::unordered_map<std::uint64_t, std::uint64_t> map;
+
+        bool find( std::uint64_t key )
+        {
+            std::lock_guard<std::mutex> guard( lock );
+            return map.count( key );
+        }
+        void insert_or_assign( std::uint64_t key, std::uint64_t value )
+        {
+            std::lock_guard<std::mutex> guard( lock );
+            map.insert_or_assign( key, value );
+        }
+        void erase( std::uint64_t key )
+        {
+            std::lock_guard<std::mutex> guard( lock );
+            map.erase( key );
+        }
+    };
+    struct LockFreeMap : ConcurrentHashMap<std::uint64_t, std::uint64_t>
+    {
+        bool find( std::uint64_t key )
+        {
+            return contains( key );
+        }
+    };
+
+    auto bench = [&]( auto &map, int writePercent, const char *name ) {
+        for ( int i = 0; i < NKEYS; i += 2 )
+            map.insert_or_assign( i, i );
+        std::vector<std::thread> threads;
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( int k = 0; k < NTHREADS; ++k )
+            threads.emplace_back( [&, k] {
+                std::mt19937 rng( k );
+                for ( int i = 0; i < NOPS; ++i )
+                {
+                    std::uint64_t key = rng() % NKEYS;
+                    if ( int( rng() % 100 ) >= writePercent )
+                        map.find( key );
+                    else if ( i % 2 )
+                        map.insert_or_assign( key, key );
+                    else
+                        map.erase( key );
+                }
+            } );
+        for ( auto &th : threads )
+            th.join();
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " " << NTHREADS << " threads, " << writePercent
+                  << "% writes, latency(ns):" << double( ( tsStop - tsStart ).count() ) / ( NOPS * NTHREADS ) << std::endl;
+    };
+
+    for ( int writePercent : {10, 50} )
+    {
+        {
+            MutexMap map;
+            bench( map, writePercent, "std::unordered_map + std::mutex" );
+        }
+        {
+            LockFreeMap map;
+            bench( map, writePercent, "ConcurrentHashMap" );
+        }
+    }
+}
@@ -1,5 +1,22 @@
 #include <ftl/unittest.h>
 #include <ftl/flat_ordered_map.h>
+#include <chrono>
+#include <map>
+#include <random>
+
+namespace
+{
+/// heap allocated payload, relocatable or not.
+template<bool Relocatable>
+struct Payload : ftl::Vector<int>
+{
+    using is_trivially_relocatable = std::bool_constant<Relocatable>;
+
+    Payload( int v = 0 ) : ftl::Vector<int>( size_t( 4 ), v )
+    {
+    }
+};
+} // namespace
 
 ADD_TEST_CASE( FlatOrderedMap_tests )
 {
@@ -22,4 +39,279 @@ ADD_TEST_CASE( FlatOrderedMap_tests )
         s.erase( "aa" );
         REQUIRE( s.front() == "ab" );
     }
+    SECTION( "bulk" )
+    {
+        ftl::FlatOrderedMap<int, int> m = {{5, 0}, {1, 0}, {3, 0}, {1, 1}};
+        REQUIRE_EQ( 3u, m.size() );
+        REQUIRE_EQ( 0, m[1] ); // first one wins, as in std::map.
+
+        std::vector<std::pair<int, int>> batch = {{4, 4}, {3, 3}, {0, 0}, {4, 44}, {9, 9}};
+        REQUIRE_EQ( 3u, m.insert_bulk( batch.begin(), batch.end() ) );
+        REQUIRE( ( m == std::vector<std::pair<int, int>>{{0, 0}, {1, 0}, {3, 0}, {4, 4}, {5, 0}, {9, 9}} ) );
+        REQUIRE_EQ( 0u, m.insert_bulk( batch.begin(), batch.end(), true ) );
+        REQUIRE( ( m == std::vector<std::pair<int, int>>{{0, 0}, {1, 0}, {3, 3}, {4, 44}, {5, 0}, {9, 9}} ) );
+
+        REQUIRE_EQ( 3u, m.bulk_erase( []( auto &kv ) { return kv.second == 0; } ) );
+        REQUIRE( ( m == std::vector<std::pair<int, int>>{{3, 3}, {4, 44}, {9, 9}} ) );
+
+        ftl::FlatOrderedMap<int, int> m2 = {{2, 2}, {4, 4}};
+        m += m2;
+        REQUIRE( ( m == std::vector<std::pair<int, int>>{{2, 2}, {3, 3}, {4, 4}, {9, 9}} ) );
+
+        ftl::FlatOrderedMultiSet<int> ms = {3, 1, 3};
+        std::vector<int> more = {3, 0, 2};
+        REQUIRE_EQ( 3u, ms.insert_bulk( more.begin(), more.end() ) );
+        REQUIRE( ( ms == std::vector<int>{0, 1, 2, 3, 3, 3} ) );
+    }
+    SECTION( "relocatable" )
+    {
+        // elements are shifted by memmove on insert and erase.
+        ftl::FlatOrderedMap<int, Payload<true>> m;
+        std::map<int, int> ref;
+        std::mt19937 rng( 7 );
+        for ( int i = 0; i < 5000; ++i )
+        {
+            int k = int( rng() % 1000 );
+            if ( rng() % 3 == 0 )
+            {
+                m.erase( k );
+                ref.erase( k );
+            }
+            else
+            {
+                m[k] = Payload<true>( i );
+                ref[k] = i;
+            }
+        }
+        REQUIRE_EQ( ref.size(), m.size() );
+        REQUIRE( std::equal( m.begin(), m.end(), ref.begin(), ref.end(), []( auto &kv, auto &kvRef ) {
+            return kv.first == kvRef.first && kv.second.size() == 4 && kv.second.back() == kvRef.second;
+        } ) );
+    }
+}
+
+ADD_TEST_CASE( FlatSplitMap_tests )
+{
+    auto checkLowerBound = [&]( auto key ) {
+        using K = decltype( key );
+        std::mt19937_64 rng( 7 );
+        for ( std::size_t n : {0, 1, 2, 7, 31, 32, 33, 100, 257, 1000} )
+        {
+            std::vector<K> keys;
+            for ( std::size_t i = 0; i < n; ++i )
+                keys.push_back( K( rng() ) );
+            std::sort( keys.begin(), keys.end() );
+            keys.erase( std::unique( keys.begin(), keys.end() ), keys.end() );
+            ftl::FlatSplitMap<K, int, std::less<K>, ftl::KeyLayout::Eytzinger> eytMap;
+            for ( auto k : keys )
+                eytMap[k] = 0;
+
+            std::vector<K> probes = keys;
+            for ( std::size_t i = 0; i < 100; ++i )
+                probes.push_back( K( rng() ) );
+            probes.push_back( std::numeric_limits<K>::lowest() );
+            probes.push_back( std::numeric_limits<K>::max() );
+            for ( auto k : probes )
+            {
+                auto expected = std::size_t( std::lower_bound( keys.begin(), keys.end(), k ) - keys.begin() );
+                REQUIRE_EQ( expected, ftl::simd_lower_bound( keys.data(), keys.size(), k ) );
+                REQUIRE_EQ( expected, ftl::branchless_lower_bound( keys.data(), keys.size(), k, std::less<K>{} ) );
+                REQUIRE_EQ( expected, eytMap.lower_bound_index( k ) );
+            }
+        }
+    };
+
+    SECTION( "lower_bound" )
+    {
+        checkLowerBound( std::int32_t() );
+        checkLowerBound( std::uint32_t() );
+        checkLowerBound( std::int64_t() );
+        checkLowerBound( std::uint64_t() );
+        checkLowerBound( float() );
+        checkLowerBound( double() );
+        checkLowerBound( std::int16_t() ); // no SIMD
+    }
+
+    SECTION( "int map" )
+    {
+        ftl::FlatSplitMap<int, std::string> m = {{2, "b"}, {1, "a"}};
+        REQUIRE( m.begin().key() == 1 && m.size() == 2 );
+        m[-1] = "z";
+        REQUIRE( m.begin()->first == -1 && m.begin()->second == "z" );
+        REQUIRE( !m.insert( 2, "x" ).second );
+        REQUIRE( !m.insert_or_assign( 2, "c" ).second );
+        REQUIRE_EQ( std::string( "c" ), m.at( 2 ) );
+        REQUIRE( m.find( 3 ) == m.end() );
+        REQUIRE_EQ( 2, m.lower_bound( 2 ).key() );
+        REQUIRE( m.upper_bound( 2 ) == m.end() );
+        REQUIRE_EQ( 1u, m.erase( -1 ) );
+        REQUIRE_EQ( 0u, m.erase( -1 ) );
+        REQUIRE( ( m.keys() == std::vector<int>{1, 2} ) );
+        REQUIRE( ( m.values() == std::vector<std::string>{"a", "c"} ) );
+
+        std::string all;
+        for ( auto kv : m )
+            all += std::to_string( kv.first ) + kv.second;
+        REQUIRE_EQ( std::string( "1a2c" ), all );
+    }
+
+    SECTION( "transparent less" )
+    {
+        // a double key must not be truncated to int on the way to the SIMD search.
+        ftl::FlatSplitMap<int, int, std::less<>> m;
+        ftl::FlatSplitMap<int, int, std::less<>, ftl::KeyLayout::Eytzinger> eytMap;
+        for ( int i = 0; i < 40; ++i )
+        {
+            m.insert( i, i );
+            eytMap.insert( i, i );
+        }
+        REQUIRE( m.find( 2.5 ) == m.end() && !m.contains( 2.5 ) && eytMap.find( 2.5 ) == eytMap.end() );
+        REQUIRE_EQ( 3, m.lower_bound( 2.5 ).key() );
+        REQUIRE_EQ( 3, eytMap.lower_bound( 2.5 ).key() );
+        REQUIRE_EQ( 2, m.find( 2.0 ).value() );
+        REQUIRE_EQ( 0, m.lower_bound( -0.5 ).key() );
+    }
+
+    SECTION( "eytzinger map" )
+    {
+        ftl::FlatSplitMap<double, int, std::less<double>, ftl::KeyLayout::Eytzinger> m;
+        for ( int i = 100; i > 0; --i )
+            m.insert( i * 0.5, i );
+        REQUIRE_EQ( 100u, m.size() );
+        for ( int i = 1; i <= 100; ++i )
+            REQUIRE_EQ( i, m.find( i * 0.5 ).value() );
+        REQUIRE( !m.contains( 0.25 ) );
+        REQUIRE_EQ( 10.5, m.erase( m.find( 10.0 ) ).key() );
+        REQUIRE( !m.contains( 10.0 ) );
+        REQUIRE( std::is_sorted( m.keys().begin(), m.keys().end() ) );
+    }
+
+    SECTION( "bulk" )
+    {
+        ftl::FlatSplitMap<int, int, std::less<int>, ftl::KeyLayout::Eytzinger> m = {{5, 0}, {1, 0}, {3, 0}};
+        std::vector<std::pair<int, int>> batch = {{4, 4}, {3, 3}, {0, 0}, {4, 44}, {9, 9}};
+        REQUIRE_EQ( 3u, m.insert_bulk( batch.begin(), batch.end() ) );
+        REQUIRE( ( m.keys() == std::vector<int>{0, 1, 3, 4, 5, 9} ) );
+        REQUIRE( ( m.values() == std::vector<int>{0, 0, 0, 4, 0, 9} ) );
+        REQUIRE_EQ( 0u, m.insert_bulk( batch.begin(), batch.end(), true ) );
+        REQUIRE( ( m.values() == std::vector<int>{0, 0, 3, 44, 0, 9} ) );
+        REQUIRE_EQ( 3u, m.bulk_erase( []( auto &kv ) { return kv.second == 0; } ) );
+        REQUIRE( ( m.keys() == std::vector<int>{3, 4, 9} ) );
+        REQUIRE_EQ( 44, m.at( 4 ) ); // index is rebuilt.
+        REQUIRE( !m.contains( 5 ) );
+    }
+
+    SECTION( "string map" )
+    {
+        ftl::FlatSplitMap<std::string, int, std::less<>, ftl::KeyLayout::Eytzinger> m;
+        m["cd"] = 1;
+        m["ab"] = 2;
+        REQUIRE( m.begin().key() == "ab" );
+        REQUIRE( m.contains( "cd" ) ); // heterogeneous lookup
+        REQUIRE( !m.contains( "aa" ) );
+    }
+}
+
+ADD_TEST_CASE( FlatSplitMap_bench )
+{
+    constexpr int NLOOKUPS = 1000000;
+    using Price = std::int64_t;
+
+    auto bench = [&]( auto &map, auto &&lookup, const std::vector<Price> &probes, const char *name ) {
+        std::int64_t sum = 0;
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( int i = 0; i < NLOOKUPS; ++i )
+            sum += lookup( map, probes[i & ( probes.size() - 1 )] );
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " " << map.size() << " keys, find latency(ns):" << double( ( tsStop - tsStart ).count() ) / NLOOKUPS
+                  << std::endl;
+        return sum;
+    };
+
+    for ( std::size_t n : {1000, 10000} )
+    {
+        std::mt19937_64 rng( 1 );
+        std::map<Price, Price> stdMap;
+        while ( stdMap.size() < n )
+        {
+            auto price = Price( rng() % ( n * 4 ) );
+            stdMap[price] = price;
+        }
+        ftl::FlatOrderedMap<Price, Price> pairMap;
+        ftl::FlatSplitMap<Price, Price> splitMap;
+        ftl::FlatSplitMap<Price, Price, std::less<Price>, ftl::KeyLayout::Eytzinger> eytMap;
+        for ( auto &kv : stdMap )
+        {
+            pairMap.insert( kv );
+            splitMap.insert( kv );
+            eytMap.insert( kv );
+        }
+        std::vector<Price> probes( 1 << 16 );
+        for ( auto &price : probes )
+            price = Price( rng() % ( n * 4 ) );
+
+        auto sum = bench( stdMap, []( auto &m, Price k ) { auto it = m.find( k ); return it == m.end() ? 0 : it->second; }, probes, "std::map" );
+        REQUIRE_EQ( sum, bench( pairMap, []( auto &m, Price k ) { auto it = m.find( k ); return it == m.end() ? 0 : it->second; }, probes, "FlatOrderedMap" ) );
+        REQUIRE_EQ( sum, bench( splitMap, []( auto &m, Price k ) { auto it = m.find( k ); return it == m.end() ? 0 : it.value(); }, probes, "FlatSplitMap" ) );
+        REQUIRE_EQ( sum, bench( eytMap, []( auto &m, Price k ) { auto it = m.find( k ); return it == m.end() ? 0 : it.value(); }, probes, "FlatSplitMap Eytzinger" ) );
+    }
+}
+
+ADD_TEST_CASE( FlatOrderedMap_bulk_bench )
+{
+    using Price = std::int64_t;
+    auto timeit = [&]( auto &&f, const char *name ) {
+        auto tsStart = std::chrono::steady_clock::now();
+        f();
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " latency(ns):" << double( ( tsStop - tsStart ).count() ) << std::endl;
+    };
+
+    std::mt19937_64 rng( 1 );
+    constexpr std::size_t NSNAPSHOT = 20000, NREFRESH = 1000;
+    std::vector<std::pair<Price, Price>> snapshot( NSNAPSHOT ), refresh( NREFRESH );
+    for ( auto &kv : snapshot )
+        kv = {Price( rng() % ( NSNAPSHOT * 4 ) ), 1};
+    for ( auto &kv : refresh )
+        kv = {Price( rng() % ( NSNAPSHOT * 4 ) ), 2};
+
+    ftl::FlatOrderedMap<Price, Price> m1, m2;
+    timeit( [&] { for ( auto &kv : snapshot ) m1.update( kv ); }, "FlatOrderedMap 20k snapshot by update()" );
+    timeit( [&] { m2.insert_bulk( snapshot.begin(), snapshot.end(), true ); }, "FlatOrderedMap 20k snapshot by insert_bulk()" );
+    REQUIRE( m1 == m2 );
+    timeit( [&] { for ( auto &kv : refresh ) m1.update( kv ); }, "FlatOrderedMap 1k refresh by update()" );
+    timeit( [&] { m2.insert_bulk( refresh.begin(), refresh.end(), true ); }, "FlatOrderedMap 1k refresh by insert_bulk()" );
+    REQUIRE( m1 == m2 );
+    timeit( [&] { for ( auto &kv : refresh ) m1.erase( kv.first ); }, "FlatOrderedMap 1k erase()" );
+    timeit( [&] { m2.bulk_erase( []( auto &kv ) { return kv.second == 2; } ); }, "FlatOrderedMap 1k bulk_erase()" );
+    REQUIRE( m1 == m2 );
+}
+
+ADD_TEST_CASE( FlatOrderedMap_relocation_bench )
+{
+    constexpr int NKEYS = 20000;
+    auto bench = [&]( auto &m, const char *name ) {
+        using Value = typename std::decay_t<decltype( m )>::mapped_type;
+        std::mt19937 rng( 1 );
+        std::vector<int> keys( NKEYS );
+        for ( auto &k : keys )
+            k = int( rng() );
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( auto k : keys )
+            m.update( std::make_pair( k, Value( k ) ) );
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " random insert latency(ns):" << double( ( tsStop - tsStart ).count() ) / NKEYS << std::endl;
+        const auto n = m.size();
+        tsStart = std::chrono::steady_clock::now();
+        for ( auto k : keys )
+            m.erase( k );
+        tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " random erase latency(ns):" << double( ( tsStop - tsStart ).count() ) / NKEYS << std::endl;
+        return n;
+    };
+    ftl::FlatOrderedMap<int, Payload<false>> m1;
+    ftl::FlatOrderedMap<int, Payload<true>> m2;
+    auto n = bench( m1, "FlatOrderedMap<int, Vector>, move" );
+    REQUIRE_EQ( n, bench( m2, "FlatOrderedMap<int, Vector>, memmove" ) );
+    REQUIRE( m1.empty() && m2.empty() );
 }
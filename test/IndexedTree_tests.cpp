@@ -0,0 +1,144 @@
+#include <ftl/unittest.h>
+#include <ftl/indexed_tree.h>
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <random>
+#include <vector>
+
+using namespace ftl;
+
+ADD_TEST_CASE( IndexedTree_tests )
+{
+    std::mt19937 rng( 5 );
+
+    SECTION( "indexed_tree" )
+    {
+        std::vector<long> a( 1000 );
+        for ( auto &x : a )
+            x = long( rng() % 100 );
+        indexed_tree<long> t( a.begin(), a.end() );
+        REQUIRE( t.size() == a.size() );
+        for ( int i = 0; i < 500; ++i )
+        {
+            size_t pos = rng() % a.size();
+            a[pos] += 3;
+            t.add( pos, 3 );
+        }
+        std::vector<size_t> idx( a.size() );
+        std::iota( idx.begin(), idx.end(), 0 );
+        std::shuffle( idx.begin(), idx.end(), rng );
+        std::vector<long> sums;
+        t.getResults( idx.begin(), idx.end(), std::back_inserter( sums ) );
+        for ( size_t i = 0; i < idx.size(); ++i )
+        {
+            REQUIRE_EQ( std::accumulate( a.begin(), a.begin() + idx[i] + 1, 0L ), sums[i] );
+            REQUIRE_EQ( sums[i], t.getResult( idx[i] ) );
+        }
+
+        // max is associative with identity 0 for non-negative values.
+        auto maxOf = []( long x, long y ) { return std::max( x, y ); };
+        indexed_tree<long, decltype( maxOf )> tmax( 0, maxOf );
+        tmax.construct( a.begin(), a.size() );
+        REQUIRE_EQ( *std::max_element( a.begin(), a.begin() + 100 ), tmax.getResult( 99 ) );
+
+        indexed_tree<long> empty( 3 );
+        REQUIRE( empty.getResult( 2 ) == 0 );
+    }
+
+    SECTION( "range_indexed_tree" )
+    {
+        std::vector<long> a( 300 );
+        for ( auto &x : a )
+            x = long( rng() % 100 ) - 50;
+        range_indexed_tree<long> t( a.begin(), a.end() );
+        for ( int i = 0; i < 1000; ++i )
+        {
+            size_t l = rng() % a.size(), r = rng() % a.size();
+            if ( l > r )
+                std::swap( l, r );
+            if ( i % 2 )
+            {
+                long v = long( rng() % 20 ) - 10;
+                t.range_add( l, r, v );
+                for ( size_t j = l; j <= r; ++j )
+                    a[j] += v;
+            }
+            else
+                REQUIRE_EQ( std::accumulate( a.begin() + l, a.begin() + r + 1, 0L ), t.range_sum( l, r ) );
+        }
+        REQUIRE( t[a.size() - 1] == a.back() && t.prefix_sum( 0 ) == a[0] );
+    }
+
+    SECTION( "indexed_tree_2d" )
+    {
+        const size_t R = 37, C = 53;
+        std::vector<long> grid( R * C );
+        for ( auto &x : grid )
+            x = long( rng() % 1000 );
+        indexed_tree_2d<long> t;
+        t.assign( R, C, grid.begin() );
+        REQUIRE( t.rows() == R && t.cols() == C );
+        for ( int i = 0; i < 500; ++i )
+        {
+            size_t r0 = rng() % R, r1 = rng() % R, c0 = rng() % C, c1 = rng() % C;
+            if ( i % 2 )
+            {
+                t.add( r0, c0, long( i ) );
+                grid[r0 * C + c0] += i;
+                continue;
+            }
+            if ( r0 > r1 )
+                std::swap( r0, r1 );
+            if ( c0 > c1 )
+                std::swap( c0, c1 );
+            long sum = 0;
+            for ( size_t r = r0; r <= r1; ++r )
+                for ( size_t c = c0; c <= c1; ++c )
+                    sum += grid[r * C + c];
+            REQUIRE_EQ( sum, t.range_sum( r0, c0, r1, c1 ) );
+        }
+        REQUIRE_EQ( std::accumulate( grid.begin(), grid.end(), 0L ), t.prefix_sum( R - 1, C - 1 ) );
+    }
+}
+
+ADD_TEST_CASE( IndexedTree_bench )
+{
+    constexpr size_t N = 1 << 22, NQ = 1 << 22;
+    std::mt19937 rng( 3 );
+    std::vector<long> a( N ), idx( NQ ), out( NQ );
+    for ( auto &x : a )
+        x = long( rng() % 1000 );
+    for ( auto &i : idx )
+        i = long( rng() % N );
+
+    indexed_tree<long> t1( N ), t2;
+    auto tsStart = std::chrono::steady_clock::now();
+    for ( size_t i = 0; i < N; ++i )
+        t1.add( i, a[i] );
+    auto tsStop = std::chrono::steady_clock::now();
+    std::cout << "- indexed_tree add-each build latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+    tsStart = std::chrono::steady_clock::now();
+    t2.construct( a.begin(), a.end() );
+    tsStop = std::chrono::steady_clock::now();
+    std::cout << "- indexed_tree linear build latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+    REQUIRE( t1.getBiTree() == t2.getBiTree() );
+
+    long sum = 0;
+    tsStart = std::chrono::steady_clock::now();
+    for ( auto i : idx )
+        sum += t2.getResult( size_t( i ) );
+    tsStop = std::chrono::steady_clock::now();
+    std::cout << "- indexed_tree getResult latency(ns):" << double( ( tsStop - tsStart ).count() ) / NQ << std::endl;
+    t2.getResults( idx.begin(), idx.end(), out.begin() );
+    REQUIRE_EQ( sum, std::accumulate( out.begin(), out.end(), 0L ) );
+
+    constexpr size_t R = 512, C = 2048;
+    std::vector<long> grid( R * C, 1 );
+    indexed_tree_2d<long> t2d;
+    tsStart = std::chrono::steady_clock::now();
+    t2d.assign( R, C, grid.begin() );
+    tsStop = std::chrono::steady_clock::now();
+    std::cout << "- indexed_tree_2d build latency(ns):" << double( ( tsStop - tsStart ).count() ) / ( R * C ) << std::endl;
+    REQUIRE_EQ( long( R * C ), t2d.prefix_sum( R - 1, C - 1 ) );
+}
@@ -0,0 +1,144 @@
+#include <ftl/unittest.h>
+#include <ftl/interval_tree.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace ftl;
+
+namespace
+{
+using Interval = std::pair<std::pair<int, int>, int>;
+
+// ids of intervals in v overlapping [lo, hi], sorted.
+std::vector<int> brute_overlap( const std::vector<Interval> &v, int lo, int hi )
+{
+    std::vector<int> ids;
+    for ( auto &iv : v )
+        if ( iv.first.second >= lo && iv.first.first <= hi )
+            ids.push_back( iv.second );
+    std::sort( ids.begin(), ids.end() );
+    return ids;
+}
+
+template<class Tree>
+std::vector<int> tree_overlap( const Tree &tree, int lo, int hi )
+{
+    std::vector<int> ids;
+    auto n = tree.for_each_overlap( lo, hi, [&]( auto &kv ) { ids.push_back( kv.second ); } );
+    std::sort( ids.begin(), ids.end() );
+    return n == ids.size() ? ids : std::vector<int>{-1};
+}
+
+std::vector<Interval> random_intervals( std::mt19937 &rng, int n, int range, int maxLen )
+{
+    std::vector<Interval> v;
+    for ( int i = 0; i < n; ++i )
+    {
+        int lo = int( rng() % range );
+        v.push_back( {{lo, lo + int( rng() % maxLen )}, i} );
+    }
+    return v;
+}
+} // namespace
+
+ADD_TEST_CASE( IntervalTree_tests )
+{
+    SECTION( "basic" )
+    {
+        interval_tree<int, std::string> t = {{{10, 20}, "a"}, {{15, 15}, "b"}, {{30, 40}, "c"}, {{1, 5}, "d"}};
+        REQUIRE( t.size() == 4 && t.verify() );
+        REQUIRE( t.begin()->second == "d" && std::prev( t.end() )->second == "c" );
+
+        std::string s;
+        REQUIRE( t.for_each_stab( 15, [&]( auto &kv ) { s += kv.second; } ) == 2 );
+        REQUIRE( s == "ab" );
+        REQUIRE( t.for_each_overlap( 21, 29, []( auto & ) {} ) == 0 );
+        REQUIRE( t.find_overlap( 21, 29 ) == t.end() );
+        REQUIRE( t.find_overlap( 18, 35 ) != t.end() );
+
+        t.insert( 15, 15, "e" );
+        REQUIRE( t.erase( {15, 15} ) == 2 );
+        REQUIRE( t.find( {15, 15} ) == t.end() && t.size() == 3 );
+        auto it = t.erase( t.find( {10, 20} ) );
+        REQUIRE( it->second == "c" && t.verify() );
+        t.clear();
+        REQUIRE( t.empty() && t.begin() == t.end() );
+    }
+
+    SECTION( "random" )
+    {
+        std::mt19937 rng( 7 );
+        auto v = random_intervals( rng, 3000, 100000, 500 );
+        interval_tree<int, int> t;
+        for ( auto &iv : v )
+            t.insert( iv );
+        REQUIRE( t.verify() && t.height() <= 17 ); // AVL height < 1.44 log2( n ).
+
+        // erase half, sorted input keeps balance.
+        std::vector<Interval> kept;
+        for ( auto it = t.begin(); it != t.end(); )
+        {
+            if ( it->second % 2 )
+                it = t.erase( it );
+            else
+                kept.push_back( *it++ );
+        }
+        REQUIRE( t.verify() && t.size() == kept.size() );
+        for ( int i = 0; i < 300; ++i )
+        {
+            int lo = int( rng() % 100500 ), hi = lo + int( rng() % 2000 ) * ( i % 2 );
+            REQUIRE( tree_overlap( t, lo, hi ) == brute_overlap( kept, lo, hi ) );
+        }
+
+        interval_tree<int, int> bulk( v.begin(), v.end() ), copy = bulk;
+        REQUIRE( bulk.verify() && copy.verify() && bulk.height() == 12 );
+        auto moved = std::move( copy );
+        REQUIRE( copy.empty() && moved.size() == v.size() );
+        static_interval_tree<int, int> st( v.begin(), v.end() );
+        REQUIRE( st.depth() <= 13 );
+        for ( int i = 0; i < 300; ++i )
+        {
+            int lo = int( rng() % 100500 ), hi = lo + int( rng() % 2000 ) * ( i % 2 );
+            auto ref = brute_overlap( v, lo, hi );
+            REQUIRE( tree_overlap( moved, lo, hi ) == ref );
+            REQUIRE( tree_overlap( st, lo, hi ) == ref );
+        }
+    }
+}
+
+ADD_TEST_CASE( IntervalTree_bench )
+{
+    constexpr int N = 200000, NQ = 200000;
+    std::mt19937 rng( 11 );
+    auto v = random_intervals( rng, N, 10000000, 2000 ); // about 40 intervals contain a point.
+    std::vector<int> points;
+    for ( int i = 0; i < NQ; ++i )
+        points.push_back( int( rng() % 10000000 ) );
+
+    auto tsStart = std::chrono::steady_clock::now();
+    interval_tree<int, int> t;
+    for ( auto &iv : v )
+        t.insert( iv );
+    auto tsStop = std::chrono::steady_clock::now();
+    std::cout << "- interval_tree insert latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+
+    tsStart = std::chrono::steady_clock::now();
+    static_interval_tree<int, int> st( v.begin(), v.end() );
+    tsStop = std::chrono::steady_clock::now();
+    std::cout << "- static_interval_tree build latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+
+    auto bench = [&]( auto &tree, const char *name ) {
+        size_t sum = 0;
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( auto x : points )
+            tree.for_each_stab( x, [&]( auto &kv ) { sum += kv.second; } );
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " stab latency(ns):" << double( ( tsStop - tsStart ).count() ) / NQ << std::endl;
+        return sum;
+    };
+    auto sum = bench( t, "interval_tree" );
+    REQUIRE_EQ( sum, bench( st, "static_interval_tree" ) );
+}
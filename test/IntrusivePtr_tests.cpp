@@ -0,0 +1,164 @@
+#include <ftl/unittest.h>
+#include <ftl/intrusive_ptr.h>
+#include <ftl/chan.h>
+#include <ftl/mem_pool.h>
+#include <chrono>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+using namespace ftl;
+
+namespace
+{
+int g_nLive = 0;
+
+template<bool Atomic>
+struct Node : intrusive_ref_counter<Node<Atomic>, Atomic>
+{
+    int value;
+    Node( int v = 0 ) : value( v )
+    {
+        ++g_nLive;
+    }
+    ~Node()
+    {
+        --g_nLive;
+    }
+};
+
+struct Base : intrusive_ref_counter<Base>
+{
+    virtual ~Base() = default;
+};
+struct Derived : Base
+{
+    int value = 7;
+};
+} // namespace
+
+ADD_TEST_CASE( intrusive_ptr_tests )
+{
+    static_assert( sizeof( intrusive_ptr<Node<true>> ) == sizeof( void * ) );
+
+    SECTION( "ref_count" )
+    {
+        {
+            auto p1 = make_intrusive<Node<false>>( 1 );
+            REQUIRE_EQ( 1u, p1->use_count() );
+            auto p2 = p1;
+            REQUIRE_EQ( 2u, p1->use_count() );
+            REQUIRE( p1 == p2 );
+            auto p3 = std::move( p2 );
+            REQUIRE( !p2 );
+            REQUIRE_EQ( 2u, p1->use_count() );
+            p3.reset();
+            REQUIRE_EQ( 1u, p1->use_count() );
+
+            auto pRaw = p1.detach();
+            REQUIRE_EQ( 1, g_nLive );
+            intrusive_ptr<Node<false>> p4( pRaw, false ); // adopt
+            REQUIRE_EQ( 1u, p4->use_count() );
+
+            std::unordered_set<intrusive_ptr<Node<false>>> set{p4};
+            REQUIRE( set.count( p4 ) );
+        }
+        REQUIRE_EQ( 0, g_nLive );
+
+        intrusive_ptr<Base> pBase = make_intrusive<Derived>();
+        REQUIRE_EQ( 7, static_cast<Derived &>( *pBase ).value );
+    }
+
+    SECTION( "object_pool" )
+    {
+        ObjectPool<Node<true>> pool( 4 );
+        {
+            auto p1 = pool.create_intrusive( 1 );
+            auto p2 = pool.create_intrusive( 2 );
+            REQUIRE_EQ( 2u, pool.allocated_size() );
+            auto p3 = p1;
+            p1.reset();
+            REQUIRE_EQ( 2u, pool.allocated_size() );
+            p3.reset();
+            REQUIRE_EQ( 1u, pool.allocated_size() );
+            REQUIRE_EQ( 2, p2->value );
+        }
+        REQUIRE_EQ( 0u, pool.allocated_size() );
+        REQUIRE_EQ( 0, g_nLive );
+    }
+
+    SECTION( "mem_pool" )
+    {
+        MemPool<false> pool( AllocRequest{sizeof( Node<false> ), 4} );
+        {
+            auto p = pool.create_intrusive<Node<false>>( 3 );
+            REQUIRE_EQ( 3, p->value );
+            REQUIRE_EQ( pool.capacity() - 1, pool.free_size() );
+        }
+        REQUIRE_EQ( pool.capacity(), pool.free_size() );
+        REQUIRE_EQ( 0, g_nLive );
+    }
+
+    SECTION( "shared_by_threads" )
+    {
+        constexpr int N = 10000, NTHREADS = 4;
+        ObjectPool<Node<true>> pool( 16 );
+        std::vector<intrusive_ptr<Node<true>>> objs;
+        for ( int i = 0; i < N; ++i )
+            objs.push_back( pool.create_intrusive( i ) );
+        std::vector<std::thread> threads;
+        for ( int k = 0; k < NTHREADS; ++k )
+            threads.emplace_back( [objs] {
+                auto copies = objs;
+                for ( auto &p : copies )
+                    p.reset();
+            } );
+        objs.clear();
+        for ( auto &th : threads )
+            th.join();
+        REQUIRE_EQ( 0u, pool.allocated_size() );
+        REQUIRE_EQ( 0, g_nLive );
+    }
+
+    SECTION( "pooled_chan" )
+    {
+        MPSCPooledChan<Node<false>> chan( 16, 4 );
+        for ( int i = 0; i < 10; ++i )
+            REQUIRE( chan.send( chan.create_intrusive( i ) ) );
+        for ( int i = 0; i < 10; ++i )
+        {
+            auto p = chan.recv_intrusive();
+            REQUIRE( p );
+            REQUIRE_EQ( i, p->value );
+        }
+        REQUIRE( !chan.recv_intrusive() );
+        REQUIRE_EQ( 0, g_nLive );
+        const auto nAllocated = chan.pool_allocated_size();
+        for ( int i = 0; i < 100; ++i ) // objects are reused.
+            chan.send( chan.create_intrusive( i ) ), chan.recv_intrusive();
+        REQUIRE_EQ( nAllocated, chan.pool_allocated_size() );
+    }
+}
+
+ADD_TEST_CASE( intrusive_ptr_bench )
+{
+    constexpr int N = 1000000, NOBJS = 64;
+    auto bench = [&]( auto &&create, const char *name ) {
+        std::vector<decltype( create( 0 ) )> objs( NOBJS );
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( int i = 0; i < N; ++i )
+        {
+            auto &p = objs[i % NOBJS];
+            p = create( i );
+            auto pCopy = p;
+        }
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " create+copy+release latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+    };
+
+    ObjectPool<Node<true>> pool( NOBJS + 1 );
+    bench( [&]( int i ) { return pool.create_shared( i ); }, "ObjectPool::create_shared" );
+    bench( [&]( int i ) { return pool.create_intrusive( i ); }, "ObjectPool::create_intrusive" );
+    ObjectPool<Node<false>, alignof( Node<false> ), false> stPool( NOBJS + 1 );
+    bench( [&]( int i ) { return stPool.create_intrusive( i ); }, "single-threaded ObjectPool::create_intrusive non-atomic" );
+}
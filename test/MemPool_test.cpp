@@ -1,8 +1,30 @@
 #include <ftl/unittest.h>
 #include <ftl/mem_pool.h>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <thread>
 
 using namespace ftl;
 
+namespace
+{
+struct CountedCache
+{
+    static inline std::atomic<int> nAlive{0};
+    std::atomic<bool> adopted{true};
+
+    CountedCache()
+    {
+        ++nAlive;
+    }
+    ~CountedCache()
+    {
+        --nAlive;
+    }
+};
+} // namespace
+
 ADD_TEST_CASE( MemPool_tests )
 {
     SECTION( "basic" )
@@ -38,3 +60,560 @@ ADD_TEST_CASE( MemPool_tests )
         pool.clear();
     }
 }
+
+ADD_TEST_CASE( ThreadCachedMemPool_tests )
+{
+    SECTION( "basic" )
+    {
+        ThreadCachedMemPool<> pool( AllocRequest{100, 500} );
+        REQUIRE_EQ( pool.capacity(), 500 );
+        REQUIRE_EQ( pool.free_size(), 500 );
+        std::vector<void *> slots;
+        for ( int i = 0; i < 100; ++i )
+        {
+            slots.push_back( pool.malloc() );
+            REQUIRE( slots.back() );
+        }
+        REQUIRE_EQ( pool.free_size(), 400 );
+        for ( auto p : slots )
+            pool.free( p );
+        REQUIRE_EQ( pool.free_size(), 500 );
+        pool.clear();
+        REQUIRE_EQ( pool.free_size(), 500 );
+    }
+
+    SECTION( "cross_thread_free" )
+    {
+        ThreadCachedMemPool<> pool( AllocRequest{64, 64} );
+        constexpr std::size_t N = 10000;
+        std::vector<void *> slots( N );
+        std::thread( [&] {
+            for ( auto &p : slots )
+                p = pool.malloc();
+        } ).join();
+        REQUIRE_EQ( pool.capacity() - N, pool.free_size() );
+        std::thread( [&] {
+            for ( auto p : slots )
+                pool.free( p );
+        } ).join();
+        REQUIRE_EQ( pool.capacity(), pool.free_size() );
+        // the depot and caches of exited threads are reused, no growth.
+        auto cap = pool.capacity();
+        std::thread( [&] {
+            for ( auto &p : slots )
+                p = pool.malloc();
+            for ( auto p : slots )
+                pool.free( p );
+        } ).join();
+        REQUIRE_EQ( cap, pool.capacity() );
+    }
+
+    SECTION( "owner_churn" )
+    {
+        // a long-lived thread using many short-lived owners drops the caches of destroyed owners.
+        bool sameCache = true;
+        int nAlive = 0;
+        std::thread( [&] {
+            for ( int i = 0; i < 1000; ++i )
+            {
+                ThreadCacheRegistry<CountedCache> registry;
+                sameCache &= &registry.local() == &registry.local();
+            }
+            ThreadCacheRegistry<CountedCache> registry;
+            registry.local();
+            nAlive = CountedCache::nAlive.load();
+        } ).join();
+        REQUIRE( sameCache && nAlive == 1 );
+        REQUIRE_EQ( 0, CountedCache::nAlive.load() );
+    }
+}
+
+ADD_TEST_CASE( MemPool_bench )
+{
+    constexpr std::size_t NTHREADS = 16, N = 200000, BURST = 16;
+    auto bench = [&]( auto &pool, const char *name ) {
+        std::vector<std::thread> threads;
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( std::size_t k = 0; k < NTHREADS; ++k )
+            threads.emplace_back( [&] {
+                void *slots[BURST];
+                for ( std::size_t i = 0; i < N; i += BURST )
+                {
+                    for ( auto &p : slots )
+                        p = pool.malloc();
+                    for ( auto p : slots )
+                        pool.free( p );
+                }
+            } );
+        for ( auto &th : threads )
+            th.join();
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " threads:" << NTHREADS << ", malloc+free latency(ns):" << ( tsStop - tsStart ).count() / ( NTHREADS * N )
+                  << std::endl;
+        REQUIRE_EQ( pool.capacity(), pool.free_size() );
+    };
+    MemPool<true> pool( AllocRequest{64, NTHREADS * BURST * 4} );
+    bench( pool, "MemPool<true>" );
+    ThreadCachedMemPool<> cachedPool( AllocRequest{64, NTHREADS * BURST * 4} );
+    bench( cachedPool, "ThreadCachedMemPool" );
+}
+
+namespace
+{
+struct ListNode
+{
+    std::atomic<ListNode *> pNext{nullptr};
+};
+template<class Head>
+ListNode *pop_node( Head &head )
+{
+    return PopSinglyListNode<ListNode, &ListNode::pNext>( &head );
+}
+template<class Head>
+void push_node( Head &head, ListNode *p )
+{
+    PushSinglyListNode<ListNode, &ListNode::pNext>( &head, p );
+}
+} // namespace
+
+ADD_TEST_CASE( FreeList_ABA_tests )
+{
+    // Replay the interleaving: thread 1 loads head A and A->next B, then gets preempted. Thread 2 pops A, pops B, pushes A back.
+    // Thread 1 resumes and CAS(head: A -> B) while B is in use.
+    ListNode a, b, c;
+    SECTION( "plain_head_reproduces_aba" )
+    {
+        std::atomic<ListNode *> head{nullptr};
+        for ( auto p : {&c, &b, &a} )
+            push_node( head, p );
+        auto pStaleHead = head.load();
+        auto pStaleNext = pStaleHead->pNext.load();
+        REQUIRE_EQ( &a, pop_node( head ) );
+        REQUIRE_EQ( &b, pop_node( head ) ); // b is in use now
+        push_node( head, &a );
+        REQUIRE( head.compare_exchange_strong( pStaleHead, pStaleNext ) ); // ABA: CAS succeeds
+        REQUIRE_EQ( &b, head.load() ); // b is handed out twice, c is lost.
+    }
+    SECTION( "tagged_head_detects_aba" )
+    {
+        AtomicTaggedPtr<ListNode> head;
+        for ( auto p : {&c, &b, &a} )
+            push_node( head, p );
+        auto vStaleHead = head.load();
+        auto pStaleNext = vStaleHead.ptr()->pNext.load();
+        REQUIRE_EQ( &a, pop_node( head ) );
+        REQUIRE_EQ( &b, pop_node( head ) );
+        push_node( head, &a );
+        REQUIRE( !head.compare_exchange_weak( vStaleHead, pStaleNext ) ); // tag changed, CAS fails
+        REQUIRE_EQ( &a, head.load().ptr() );
+        REQUIRE_EQ( &a, pop_node( head ) );
+        REQUIRE_EQ( &c, pop_node( head ) );
+        REQUIRE( !pop_node( head ) );
+    }
+    SECTION( "mempool_stress" )
+    {
+        // each thread stamps its slots and checks the stamp before free. A slot handed out twice is detected.
+        constexpr std::size_t NTHREADS = 8, N = 200000, BURST = 4;
+        MemPool<true> pool( AllocRequest{64, NTHREADS * BURST / 2} ); // small pool: slots are recycled quickly.
+        std::atomic<std::size_t> nCorrupted{0};
+        std::vector<std::thread> threads;
+        for ( std::size_t k = 0; k < NTHREADS; ++k )
+            threads.emplace_back( [&, k] {
+                void *slots[BURST];
+                for ( std::size_t i = 0; i < N; ++i )
+                {
+                    for ( auto &p : slots )
+                    {
+                        p = pool.malloc();
+                        static_cast<std::atomic<std::size_t> *>( p )[1] = k;
+                    }
+                    for ( auto p : slots )
+                    {
+                        if ( static_cast<std::atomic<std::size_t> *>( p )[1] != k )
+                            ++nCorrupted;
+                        pool.free( p );
+                    }
+                }
+            } );
+        for ( auto &th : threads )
+            th.join();
+        REQUIRE_EQ( 0u, nCorrupted.load() );
+        REQUIRE_EQ( pool.capacity(), pool.free_size() );
+    }
+}
+
+ADD_TEST_CASE( FreeList_bench )
+{
+    constexpr std::size_t NNODES = 64, N = 2000000;
+    std::vector<ListNode> nodes( NNODES );
+    auto bench = [&]( auto &head, const char *name ) {
+        for ( auto &node : nodes )
+            push_node( head, &node );
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( std::size_t i = 0; i < N; ++i )
+            PushSinglyListNode<ListNode, &ListNode::pNext>( &head, pop_node( head ) );
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " pop+push latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+    };
+    std::atomic<ListNode *> plainHead{nullptr};
+    bench( plainHead, "plain CAS head" );
+    AtomicTaggedPtr<ListNode> taggedHead;
+    bench( taggedHead, "tagged CAS head" );
+}
+
+ADD_TEST_CASE( HugePage_tests )
+{
+    SECTION( "fallback" )
+    {
+        // hugetlbfs pages are usually not reserved, allocation falls back to smaller pages but never fails.
+        for ( auto pageType : {PageType::Normal, PageType::TransparentHuge, PageType::Huge2M, PageType::Huge1G} )
+        {
+            PageType got;
+            std::size_t len = 0;
+            auto p = static_cast<Byte *>( MmapAlignedAlloc::aligned_alloc( 64, 3 << 20, 4096, true, pageType, &got, &len ) );
+            REQUIRE( p );
+            REQUIRE( got <= pageType );
+            REQUIRE( std::size_t( p ) % page_size( got ) == 0 );
+            REQUIRE( len >= ( 3 << 20 ) && ( got == PageType::Huge1G || len <= ( 4 << 20 ) ) ); // a fallback doesn't map 1GB.
+            p[len - 1] = 1;
+            REQUIRE( MmapAlignedAlloc::free( p, len, got ) );
+        }
+    }
+
+    SECTION( "slab_granularity" )
+    {
+        AllocRequest ar{100, 10};
+        ar.pageType = PageType::Huge2M;
+        MemPool<false> pool( ar );
+        REQUIRE( pool.capacity() >= ( 2 << 20 ) / 112 - 1 ); // slab is a whole huge page.
+        auto p = pool.malloc();
+        REQUIRE( p );
+        pool.free( p );
+    }
+}
+
+ADD_TEST_CASE( HugePage_bench )
+{
+    // 4GB in production with reserved huge pages; scaled down to keep the test suite fast.
+    constexpr std::size_t POOL_BYTES = std::size_t( 512 ) << 20, SLAB_BYTES = std::size_t( 256 ) << 20, SLOT_SIZE = 64, N = 10000000;
+    struct Slot
+    {
+        Slot *pNext;
+    };
+
+    auto bench = [&]( PageType pageType, const char *name ) {
+        AllocRequest ar{SLOT_SIZE, SLAB_BYTES / SLOT_SIZE};
+        ar.pageType = pageType;
+        MemPool<false> pool( ar );
+        std::vector<Slot *> slots;
+        for ( std::size_t k = 0; k < POOL_BYTES / SLOT_SIZE; ++k )
+            slots.push_back( static_cast<Slot *>( pool.malloc() ) );
+        std::shuffle( slots.begin(), slots.end(), std::mt19937( 1 ) );
+        for ( std::size_t k = 0; k < slots.size(); ++k )
+            slots[k]->pNext = slots[k + 1 == slots.size() ? 0 : k + 1];
+
+        // dependent random reads, each is likely a TLB miss with 4K pages.
+        auto pSlot = slots[0];
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( std::size_t i = 0; i < N; ++i )
+            pSlot = pSlot->pNext;
+        auto tsStop = std::chrono::steady_clock::now();
+        REQUIRE( pSlot );
+        std::cout << "- " << name << " pool(MB):" << ( POOL_BYTES >> 20 )
+                  << ", random access latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+    };
+    bench( PageType::Normal, "4K pages" );
+    bench( PageType::TransparentHuge, "transparent huge pages" );
+    bench( PageType::Huge2M, "2MB huge pages" );
+}
+
+ADD_TEST_CASE( MemPool_trim_tests )
+{
+    auto malloc_n = []( auto &pool, std::size_t n ) {
+        std::vector<void *> slots;
+        for ( std::size_t i = 0; i < n; ++i )
+            slots.push_back( pool.malloc() );
+        return slots;
+    };
+
+    SECTION( "release_empty_slabs" )
+    {
+        AllocRequest ar{64, 100};
+        ar.keepFreeSlots = 150;
+        MemPool<false> pool( ar );
+        auto slots = malloc_n( pool, 1000 );
+        REQUIRE_EQ( 1000, pool.capacity() );
+        REQUIRE_EQ( 0, pool.trim() );
+
+        for ( std::size_t i = 1; i < slots.size(); ++i )
+            pool.free( slots[i] );
+        REQUIRE_EQ( 8, pool.trim() ); // the slab of slots[0] is in use, another slab is kept for low-water mark.
+        REQUIRE_EQ( 200, pool.capacity() );
+        REQUIRE_EQ( 199, pool.free_size() );
+        pool.free( slots[0] );
+
+        slots = malloc_n( pool, 1000 ); // grow again.
+        for ( auto p : slots )
+            REQUIRE( p );
+        for ( auto p : slots )
+            pool.free( p );
+        REQUIRE_EQ( 8, pool.trim() );
+    }
+
+    SECTION( "atomic_pool_drops_pages" )
+    {
+        MemPool<true> pool( AllocRequest{4096, 64} );
+        auto slots = malloc_n( pool, 64 * 4 );
+        for ( auto p : slots )
+            static_cast<Byte *>( p )[0] = 1;
+        for ( auto p : slots )
+            pool.free( p );
+        REQUIRE_EQ( 4, pool.trim() );
+        REQUIRE_EQ( 0, pool.capacity() );
+        unsigned char resident = 1;
+        REQUIRE_EQ( 0, mincore( slots[1], 4096, &resident ) );
+        REQUIRE_EQ( 0, resident & 1 );
+
+        // released slabs are reused.
+        slots = malloc_n( pool, 64 * 4 );
+        REQUIRE_EQ( 64 * 4, pool.capacity() );
+        for ( auto p : slots )
+            pool.free( p );
+    }
+
+    SECTION( "background_trim" )
+    {
+        constexpr int N = 100000, NTHREADS = 4;
+        MemPool<true> pool( AllocRequest{64, 16} );
+        {
+            PoolMaintainer maintainer( pool, std::chrono::milliseconds( 1 ), std::chrono::milliseconds( 1 ) );
+            std::vector<std::thread> threads;
+            for ( int k = 0; k < NTHREADS; ++k )
+                threads.emplace_back( [&] {
+                    std::vector<void *> slots;
+                    for ( int i = 0; i < N; ++i )
+                    {
+                        if ( slots.size() < 100 && ( i / 1000 ) % 2 == 0 ) // bursts
+                        {
+                            auto p = static_cast<int *>( pool.malloc() );
+                            REQUIRE( p );
+                            *p = i;
+                            slots.push_back( p );
+                        }
+                        else if ( !slots.empty() )
+                        {
+                            pool.free( slots.back() );
+                            slots.pop_back();
+                        }
+                    }
+                    for ( auto p : slots )
+                        pool.free( p );
+                } );
+            for ( auto &th : threads )
+                th.join();
+        }
+        REQUIRE_EQ( pool.capacity(), pool.free_size() );
+        pool.trim();
+        REQUIRE_EQ( 0, pool.capacity() );
+    }
+
+    SECTION( "thread_cached_pool" )
+    {
+        ThreadCachedMemPool<> pool( AllocRequest{64, 64} );
+        std::thread( [&] {
+            auto slots = malloc_n( pool, 64 * 10 );
+            for ( auto p : slots )
+                pool.free( p );
+        } ).join();
+        REQUIRE( pool.trim() > 0 );
+        REQUIRE( pool.capacity() < 64 * 10 );
+    }
+}
+
+ADD_TEST_CASE( MemPool_growth_tests )
+{
+    SECTION( "doubling_capped" )
+    {
+        AllocRequest ar{64, 16};
+        ar.maxSlotsPerSlab = 256;
+        MemPool<false, false> pool( ar );
+        std::vector<void *> slots;
+        std::vector<std::size_t> capacities{pool.capacity()};
+        while ( pool.capacity() < 2000 )
+        {
+            slots.push_back( pool.malloc() );
+            if ( capacities.back() != pool.capacity() )
+                capacities.push_back( pool.capacity() );
+        }
+        for ( std::size_t i = 1; i < capacities.size(); ++i )
+        {
+            const auto nSlabSlots = capacities[i] - capacities[i - 1];
+            REQUIRE( nSlabSlots <= 256 );
+            if ( i > 1 )
+                REQUIRE( nSlabSlots >= std::min<std::size_t>( 256, 2 * ( capacities[i - 1] - capacities[i - 2] ) ) );
+        }
+        for ( auto p : slots )
+            pool.free( p );
+    }
+
+    SECTION( "reserve_while_growing" )
+    {
+        struct TestPool : MemPool<true>
+        {
+            using MemPool<true>::MemPool;
+            using MemPool<true>::m_slabLock;
+        };
+        AllocRequest ar{64, 64};
+        ar.reserveSlots = 8;
+        TestPool pool( ar );
+        REQUIRE_EQ( 64, pool.capacity() );
+        std::vector<void *> slots;
+        for ( int i = 0; i < 64 - 8; ++i )
+            slots.push_back( pool.malloc() );
+        {
+            std::lock_guard<std::mutex> guard( pool.m_slabLock ); // another thread is growing.
+            for ( int i = 0; i < 8; ++i )
+                slots.push_back( pool.malloc() );
+            REQUIRE_EQ( 64, pool.capacity() );
+            REQUIRE_EQ( 0, pool.free_size() );
+        }
+        slots.push_back( pool.malloc() ); // grow and top up reserve.
+        REQUIRE_EQ( 128, pool.capacity() );
+        for ( auto p : slots )
+            REQUIRE( p );
+        std::sort( slots.begin(), slots.end() );
+        REQUIRE( std::adjacent_find( slots.begin(), slots.end() ) == slots.end() );
+        for ( auto p : slots )
+            pool.free( p );
+    }
+
+    SECTION( "concurrent_growth" )
+    {
+        constexpr int N = 20000, NTHREADS = 4;
+        AllocRequest ar{64, 16};
+        ar.maxSlotsPerSlab = 1024;
+        ar.reserveSlots = 4;
+        MemPool<true, false> pool( ar );
+        std::vector<std::vector<void *>> slots( NTHREADS );
+        std::vector<std::thread> threads;
+        for ( int k = 0; k < NTHREADS; ++k )
+            threads.emplace_back( [&, k] {
+                for ( int i = 0; i < N; ++i )
+                {
+                    auto p = static_cast<int *>( pool.malloc() );
+                    REQUIRE( p );
+                    *p = k;
+                    slots[k].push_back( p );
+                }
+            } );
+        for ( auto &th : threads )
+            th.join();
+        std::vector<void *> all;
+        for ( int k = 0; k < NTHREADS; ++k )
+            for ( auto p : slots[k] )
+            {
+                REQUIRE_EQ( k, *static_cast<int *>( p ) );
+                all.push_back( p );
+            }
+        std::sort( all.begin(), all.end() );
+        REQUIRE( std::adjacent_find( all.begin(), all.end() ) == all.end() );
+        REQUIRE( pool.capacity() < std::size_t( N * NTHREADS + 2 * 1024 ) );
+        for ( auto p : all )
+            pool.free( p );
+        REQUIRE_EQ( pool.capacity(), pool.free_size() );
+    }
+
+    SECTION( "pre_grow" )
+    {
+        AllocRequest ar{64, 256};
+        ar.preGrowFreeSlots = 64;
+        MemPool<true> pool( ar );
+        PoolMaintainer maintainer( pool );
+        std::vector<void *> slots;
+        for ( int i = 0; i < 256 * 10; ++i )
+        {
+            const auto capacity = pool.capacity();
+            if ( pool.free_size() == 0 )
+            {
+                // maintainer is behind, wait for it instead of growing in this thread.
+                for ( int k = 0; k < 1000 && pool.capacity() == capacity; ++k )
+                    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+                REQUIRE( pool.capacity() > capacity );
+            }
+            slots.push_back( pool.malloc() );
+        }
+        for ( int k = 0; k < 1000 && pool.free_size() < 64; ++k )
+            std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+        REQUIRE( pool.free_size() >= 64 );
+        for ( auto p : slots )
+            pool.free( p );
+    }
+}
+
+ADD_TEST_CASE( MemPool_debug_tests )
+{
+    static std::vector<std::pair<PoolError, int>> s_errors; // error and number of stack frames.
+    auto prevHandler = set_pool_error_handler(
+            []( PoolError err, const void *, void *const *, int nFrames ) { s_errors.emplace_back( err, nFrames ); } );
+    static_assert( std::is_empty_v<PoolDebugger<false>> );
+
+    using DebugPool = MemPool<false, true, MmapAlignedAlloc, true>;
+
+    SECTION( "double_free" )
+    {
+        s_errors.clear();
+        DebugPool pool( AllocRequest{24, 16} );
+        auto p = pool.malloc();
+        pool.free( p );
+        pool.free( p );
+        REQUIRE_EQ( 1u, s_errors.size() );
+        REQUIRE( s_errors[0].first == PoolError::DoubleFree );
+        REQUIRE_EQ( pool.capacity(), pool.free_size() );
+        REQUIRE( pool.malloc() != pool.malloc() ); // slot is not in free list twice.
+        REQUIRE( !pool.verify_allocated( static_cast<char *>( pool.malloc() ) + 8 ) );
+        REQUIRE( s_errors.back().first == PoolError::InvalidFree );
+        s_errors.clear();
+    }
+
+    SECTION( "overflow_and_use_after_free" )
+    {
+        s_errors.clear();
+        DebugPool pool( AllocRequest{24, 1} );
+        auto p = static_cast<char *>( pool.malloc() );
+        std::memset( p, 0, 24 );
+        REQUIRE( s_errors.empty() );
+        p[24] = 1;
+        pool.free( p );
+        REQUIRE_EQ( 1u, s_errors.size() );
+        REQUIRE( s_errors[0].first == PoolError::BufferOverflow );
+
+        p[16] = 1; // write after free.
+        REQUIRE_EQ( p, pool.malloc() );
+        REQUIRE_EQ( 2u, s_errors.size() );
+        REQUIRE( s_errors[1].first == PoolError::UseAfterFree );
+        pool.free( p );
+        s_errors.clear();
+    }
+
+    SECTION( "leak" )
+    {
+        s_errors.clear();
+        {
+            MemPool<true, true, MmapAlignedAlloc, true> pool( AllocRequest{64, 16} );
+            for ( int i = 0; i < 3; ++i )
+                pool.free( pool.malloc() );
+            pool.malloc();
+            pool.malloc();
+            REQUIRE( s_errors.empty() );
+        }
+        REQUIRE_EQ( 2u, s_errors.size() );
+        for ( auto &err : s_errors )
+        {
+            REQUIRE( err.first == PoolError::Leak );
+            REQUIRE( err.second > 0 ); // allocation stack is recorded.
+        }
+        s_errors.clear();
+    }
+
+    set_pool_error_handler( prevHandler );
+}
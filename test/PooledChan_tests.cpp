@@ -0,0 +1,96 @@
+#include <ftl/unittest.h>
+#include <ftl/chan.h>
+#include <thread>
+
+using namespace ftl;
+
+namespace
+{
+struct Order
+{
+    std::uint64_t id;
+    double price;
+    char symbol[16];
+    Order( std::uint64_t id = 0, double price = 0 ) : id( id ), price( price )
+    {
+    }
+};
+} // namespace
+
+ADD_TEST_CASE( PooledChan_tests )
+{
+    SECTION( "basic" )
+    {
+        MPSCPooledChan<Order> chan( 16, 8 );
+        auto p = chan.create( 1, 2.5 );
+        REQUIRE( p );
+        REQUIRE( chan.send( p ) );
+        REQUIRE( !chan.empty() );
+        REQUIRE_EQ( p, chan.peek() );
+        auto q = chan.recv_unique();
+        REQUIRE_EQ( p, q.get() );
+        REQUIRE_EQ( 1u, q->id );
+        q.reset(); // returned to producer cache
+        REQUIRE( chan.empty() );
+        REQUIRE_EQ( p, chan.create( 2, 3.0 ) ); // reused from producer cache
+        REQUIRE_EQ( 1u, chan.pool_allocated_size() );
+        REQUIRE( chan.send( chan.create_unique( 3, 1.0 ) ) );
+        chan.clear();
+        REQUIRE_EQ( 0u, chan.pool_allocated_size() );
+    }
+
+    SECTION( "spmc" )
+    {
+        SPMCPooledChan<Order> chan( 4, 4 );
+        REQUIRE( chan.send( chan.create( 7 ) ) );
+        auto p = chan.recv();
+        REQUIRE( p );
+        REQUIRE_EQ( 7u, p->id );
+        chan.release( p );
+        REQUIRE( !chan.recv() );
+    }
+}
+
+// steady-state allocation rate: after warming up, objects only cycle between producer caches and consumer.
+ADD_TEST_CASE( PooledChan_bench )
+{
+    constexpr std::size_t NPRODUCERS = 4, N = 200000, QSIZE = 1024;
+    MPSCPooledChan<Order> chan( QSIZE, QSIZE );
+
+    auto run = [&]( std::size_t nMsgs ) {
+        std::vector<std::thread> producers;
+        for ( std::size_t k = 0; k < NPRODUCERS; ++k )
+            producers.emplace_back( [&] {
+                for ( std::size_t i = 0; i < nMsgs; ++i )
+                {
+                    Order *p;
+                    while ( !( p = chan.create( i, 1.0 ) ) )
+                        std::this_thread::yield();
+                    while ( !chan.send( p ) )
+                        std::this_thread::yield();
+                }
+            } );
+        for ( std::size_t n = 0; n < nMsgs * NPRODUCERS; )
+        {
+            if ( auto p = chan.recv() )
+            {
+                chan.release( p );
+                ++n;
+            }
+        }
+        for ( auto &th : producers )
+            th.join();
+    };
+
+    run( N / 10 ); // warm up producer caches.
+    const auto allocatedBefore = chan.pool_allocated_size();
+    auto tsStart = std::chrono::steady_clock::now();
+    run( N );
+    auto tsStop = std::chrono::steady_clock::now();
+    const auto allocatedAfter = chan.pool_allocated_size();
+
+    std::cout << "- PooledChan " << NPRODUCERS << " producers, msgs:" << N * NPRODUCERS
+              << ", latency(ns):" << ( tsStop - tsStart ).count() / ( N * NPRODUCERS )
+              << ", steady-state pool allocations:" << ( allocatedAfter - allocatedBefore ) << std::endl;
+    REQUIRE_EQ( allocatedBefore, allocatedAfter );
+}
@@ -0,0 +1,190 @@
+#include <ftl/unittest.h>
+#include <ftl/reclaim.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace ftl::reclaim;
+
+namespace
+{
+std::atomic<int> g_nLive{0};
+
+struct Node
+{
+    int value;
+    Node *pNext = nullptr;
+    Node( int v ) : value( v )
+    {
+        ++g_nLive;
+    }
+    ~Node()
+    {
+        value = -1;
+        --g_nLive;
+    }
+};
+
+/// \brief Treiber stack whose popped nodes are retired to DomainT.
+template<class DomainT>
+struct Stack
+{
+    DomainT &domain;
+    std::atomic<Node *> head{nullptr};
+
+    void push( int v )
+    {
+        auto pNode = new Node( v );
+        pNode->pNext = head.load( std::memory_order_relaxed );
+        while ( !head.compare_exchange_weak( pNode->pNext, pNode, std::memory_order_release, std::memory_order_relaxed ) )
+            ;
+    }
+
+    bool pop( int &v )
+    {
+        typename DomainT::Guard guard( domain );
+        for ( ;; )
+        {
+            Node *pHead;
+            if constexpr ( std::is_same_v<DomainT, EpochDomain> )
+                pHead = head.load( std::memory_order_acquire );
+            else
+                pHead = guard.protect( head );
+            if ( !pHead )
+                return false;
+            if ( head.compare_exchange_strong( pHead, pHead->pNext, std::memory_order_acq_rel ) )
+            {
+                v = pHead->value;
+                domain.retire( pHead );
+                return true;
+            }
+        }
+    }
+};
+
+} // namespace
+
+ADD_TEST_CASE( Reclaim_tests )
+{
+    SECTION( "hazard_pointer" )
+    {
+        HazardDomain<> domain( 1000 );
+        std::atomic<Node *> src{new Node( 1 )};
+        {
+            HazardDomain<>::Guard guard( domain );
+            auto p = guard.protect( src );
+            src = nullptr;
+            domain.retire( p );
+            REQUIRE_EQ( 0u, domain.flush() ); // protected.
+            REQUIRE_EQ( 1, p->value );
+
+            std::thread( [&] { REQUIRE_EQ( 0u, domain.flush() ); } ).join(); // nothing retired by the other thread.
+            guard.reset();
+            REQUIRE_EQ( 1u, domain.flush() );
+        }
+        REQUIRE_EQ( 0, g_nLive.load() );
+
+        // retired objects are reclaimed when the domain is destroyed.
+        {
+            HazardDomain<> domain2;
+            std::thread( [&] { domain2.retire( new Node( 2 ) ); } ).join();
+            REQUIRE_EQ( 1u, domain2.retired_size() );
+        }
+        REQUIRE_EQ( 0, g_nLive.load() );
+    }
+
+    SECTION( "epoch" )
+    {
+        EpochDomain domain( 1000 );
+        auto p = new Node( 1 );
+        std::atomic<bool> pinned{false}, unpin{false};
+        std::thread reader( [&] {
+            EpochDomain::Guard guard( domain );
+            pinned = true;
+            while ( !unpin )
+                std::this_thread::yield();
+        } );
+        while ( !pinned )
+            std::this_thread::yield();
+        domain.retire( p );
+        for ( int i = 0; i < 5; ++i )
+            REQUIRE_EQ( 0u, domain.flush() ); // the reader blocks epoch from advancing twice.
+        REQUIRE_EQ( 1, p->value );
+        unpin = true;
+        reader.join();
+        REQUIRE_EQ( 1u, domain.flush() );
+        REQUIRE_EQ( 0, g_nLive.load() );
+
+        {
+            EpochDomain::Guard outer( domain );
+            EpochDomain::Guard inner( domain ); // nested
+            domain.retire( new Node( 2 ) );
+        }
+        domain.flush();
+        domain.flush();
+        REQUIRE_EQ( 0, g_nLive.load() );
+    }
+
+    auto stressStack = [&]( auto *pDomainTag ) {
+        using DomainT = std::remove_pointer_t<decltype( pDomainTag )>;
+        constexpr int N = 20000, NTHREADS = 4;
+        {
+            DomainT domain( 16 );
+            Stack<DomainT> stack{domain};
+            std::atomic<long> sumPopped{0};
+            std::vector<std::thread> threads;
+            for ( int k = 0; k < NTHREADS; ++k )
+                threads.emplace_back( [&, k] {
+                    long sum = 0;
+                    int v;
+                    for ( int i = 0; i < N; ++i )
+                    {
+                        stack.push( k * N + i );
+                        if ( stack.pop( v ) )
+                            sum += v; // a reclaimed node would give -1.
+                    }
+                    while ( stack.pop( v ) )
+                        sum += v;
+                    sumPopped += sum;
+                } );
+            for ( auto &th : threads )
+                th.join();
+            const long n = long( N ) * NTHREADS;
+            REQUIRE_EQ( n * ( n - 1 ) / 2, sumPopped.load() );
+            REQUIRE( domain.retired_size() < std::size_t( n ) ); // reclaimed in batches.
+        }
+        REQUIRE_EQ( 0, g_nLive.load() );
+    };
+
+    SECTION( "stack_hazard_pointer" )
+    {
+        stressStack( static_cast<HazardDomain<> *>( nullptr ) );
+    }
+
+    SECTION( "stack_epoch" )
+    {
+        stressStack( static_cast<EpochDomain *>( nullptr ) );
+    }
+}
+
+ADD_TEST_CASE( Reclaim_bench )
+{
+    constexpr int N = 1000000;
+    auto bench = [&]( auto &domain, const char *name ) {
+        using DomainT = std::remove_reference_t<decltype( domain )>;
+        Stack<DomainT> stack{domain};
+        int v;
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( int i = 0; i < N; ++i )
+        {
+            stack.push( i );
+            stack.pop( v );
+        }
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " push+pop latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+    };
+    HazardDomain<> hazardDomain;
+    bench( hazardDomain, "Treiber stack with HazardDomain" );
+    EpochDomain epochDomain;
+    bench( epochDomain, "Treiber stack with EpochDomain" );
+}
@@ -1,6 +1,9 @@
 #include <ftl/unittest.h>
 #include <ftl/shared_object_pool.h>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace
 {
@@ -86,3 +89,150 @@ ADD_TEST_CASE( test_shared_object_pool )
         }
     }
 }
+
+ADD_TEST_CASE( shared_object_pool_tests )
+{
+    using namespace ftl;
+    struct Obj
+    {
+        int id;
+        std::atomic<int> *pLive;
+        Obj( int id, std::atomic<int> &live ) : id( id ), pLive( &live )
+        {
+            ++live;
+        }
+        ~Obj()
+        {
+            --*pLive;
+        }
+    };
+
+    SECTION( "control_block_in_slot" )
+    {
+        std::atomic<int> live{0};
+        auto pool = fixed_shared_pool<Obj, 4>::create_me();
+        const auto cap = pool->size();
+        REQUIRE_EQ( 4u, cap );
+        {
+            auto p = pool->create_shared( 1, live );
+            REQUIRE_EQ( cap - 1, pool->size() ); // one slot for both control block and object.
+            std::weak_ptr<Obj> w = p;
+            auto q = p;
+            p.reset();
+            REQUIRE_EQ( 1, q->id );
+            q.reset();
+            REQUIRE_EQ( 0, live.load() );
+            REQUIRE_EQ( cap - 1, pool->size() ); // control block is held by weak_ptr.
+        }
+        REQUIRE_EQ( cap, pool->size() );
+
+        auto u = pool->create_unique( 2, live );
+        REQUIRE_EQ( 2, u->id );
+        u.reset();
+        REQUIRE_EQ( cap, pool->size() );
+
+        std::vector<std::shared_ptr<Obj>> objs;
+        for ( int i = 0; i < 5; ++i )
+            if ( auto p = pool->create_shared( i, live ) )
+                objs.push_back( std::move( p ) );
+        REQUIRE_EQ( 4u, objs.size() );
+        objs.clear();
+        REQUIRE_EQ( 0, live.load() );
+
+        // a control block padded beyond object + allocator + counters still takes a slot, not the heap.
+        auto charPool = fixed_shared_pool<char, 2>::create_me();
+        auto c1 = charPool->create_shared( 'a' ), c2 = charPool->create_shared( 'b' );
+        REQUIRE( c1 && c2 && *c2 == 'b' && charPool->size() == 0 && !charPool->create_shared( 'c' ) );
+        c1.reset();
+        c2.reset();
+        charPool->clear(); // keeps the fixed capacity.
+        REQUIRE( charPool->size() == 2 && charPool->create_shared( 'd' ) );
+
+        auto growable = shared_object_pool<Obj>::create_me( 4 );
+        for ( int i = 0; i < 1000; ++i )
+            objs.push_back( growable->create_shared( i, live ) );
+        REQUIRE_EQ( 1000, live.load() );
+        REQUIRE_EQ( 999, objs.back()->id );
+        objs.clear();
+        REQUIRE_EQ( 0, live.load() );
+        growable->clear();
+        REQUIRE( growable->create_shared( 1, live ) );
+    }
+
+    SECTION( "pool_outlives_objects" )
+    {
+        std::atomic<int> live{0};
+        std::shared_ptr<Obj> p;
+        {
+            auto pool = fixed_shared_pool<Obj, 2>::create_me();
+            p = pool->create_shared( 1, live );
+        }
+        REQUIRE_EQ( 1, p->id );
+        p.reset();
+        REQUIRE_EQ( 0, live.load() );
+    }
+
+    SECTION( "release_by_other_threads" )
+    {
+        constexpr int N = 100000, NTHREADS = 4;
+        std::atomic<int> live{0}, nCreated{0};
+        auto pool = fixed_shared_pool<Obj, 1024>::create_me();
+        std::mutex lock;
+        std::vector<std::shared_ptr<Obj>> handoff; // created by one thread, released by another.
+        std::vector<std::thread> threads;
+        for ( int k = 0; k < NTHREADS; ++k )
+            threads.emplace_back( [&, k] {
+                std::vector<std::shared_ptr<Obj>> objs;
+                for ( int i = 0; i < N; ++i )
+                {
+                    if ( auto p = pool->create_shared( k, live ) )
+                    {
+                        ++nCreated;
+                        objs.push_back( std::move( p ) );
+                    }
+                    if ( objs.size() >= 32 )
+                    {
+                        {
+                            std::lock_guard<std::mutex> guard( lock );
+                            std::swap( objs, handoff );
+                        }
+                        objs.clear(); // release objects of other threads concurrently.
+                    }
+                }
+            } );
+        for ( auto &th : threads )
+            th.join();
+        handoff.clear();
+        REQUIRE_EQ( 0, live.load() );
+        REQUIRE_EQ( 1024u, pool->size() );
+        REQUIRE( nCreated.load() > N );
+    }
+}
+
+ADD_TEST_CASE( shared_object_pool_bench )
+{
+    using namespace ftl;
+    constexpr int N = 1000000, NOBJS = 64;
+    struct Obj
+    {
+        int64_t values[4];
+        Obj( int64_t v ) : values{v, v, v, v}
+        {
+        }
+    };
+
+    auto bench = [&]( auto &&create, const char *name ) {
+        std::shared_ptr<Obj> objs[NOBJS];
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( int i = 0; i < N; ++i )
+            objs[i % NOBJS] = create( i );
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " create+release latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+    };
+
+    bench( []( int i ) { return std::make_shared<Obj>( i ); }, "std::make_shared" );
+    auto pool = shared_object_pool<Obj>::create_me( NOBJS );
+    bench( [&]( int i ) { return pool->create_shared( i ); }, "shared_object_pool::create_shared" );
+    auto fixedPool = fixed_shared_pool<Obj, NOBJS + 1>::create_me();
+    bench( [&]( int i ) { return fixedPool->create_shared( i ); }, "fixed_shared_pool::create_shared" );
+}
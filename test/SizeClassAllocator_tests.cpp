@@ -0,0 +1,177 @@
+#include <ftl/unittest.h>
+#include <ftl/size_class_allocator.h>
+#include <ftl/vector.h>
+#include <ftl/flat_ordered_map.h>
+#include <ftl/Jzjson.h>
+#include <chrono>
+#include <random>
+#include <thread>
+
+using namespace ftl;
+
+ADD_TEST_CASE( SizeClassAllocator_tests )
+{
+    using Alloc = SizeClassAllocator<>;
+
+    SECTION( "size_classes" )
+    {
+        REQUIRE_EQ( SizeClasses::MAX_SIZE, SizeClasses::class_size( SizeClasses::NUM_CLASSES - 1 ) );
+        for ( std::size_t idx = 0; idx < SizeClasses::NUM_CLASSES; ++idx )
+        {
+            const auto size = SizeClasses::class_size( idx );
+            REQUIRE_EQ( idx, SizeClasses::class_index( size ) );
+            REQUIRE( size % SizeClasses::class_alignment( idx ) == 0 );
+            if ( idx + 1 < SizeClasses::NUM_CLASSES )
+            {
+                REQUIRE_EQ( idx + 1, SizeClasses::class_index( size + 1 ) );
+                if ( size >= SizeClasses::SMALL_SIZE )
+                    REQUIRE( SizeClasses::class_size( idx + 1 ) - size <= size / 4 ); // fragmentation < 25%
+            }
+        }
+        REQUIRE_EQ( 0u, SizeClasses::lookup( 1, 8 ) );
+        REQUIRE_EQ( SizeClasses::NUM_CLASSES, SizeClasses::lookup( SizeClasses::MAX_SIZE + 1, 8 ) );
+        REQUIRE_EQ( SizeClasses::NUM_CLASSES, SizeClasses::lookup( 8, 8192 ) );
+        auto idx = SizeClasses::lookup( 100, 64 );
+        REQUIRE( SizeClasses::class_alignment( idx ) >= 64 );
+    }
+
+    SECTION( "malloc_free" )
+    {
+        Alloc alloc;
+        std::vector<std::pair<void *, std::size_t>> blocks;
+        for ( std::size_t size = 1; size <= 100 * 1024; size = size * 5 / 4 + 1 )
+        {
+            auto p = alloc.malloc( size );
+            REQUIRE( p );
+            REQUIRE( std::size_t( p ) % alignof( std::max_align_t ) == 0 );
+            std::memset( p, 0xab, size );
+            blocks.emplace_back( p, size );
+        }
+        REQUIRE( alloc.allocated_bytes() > 100 * 1024 );
+        REQUIRE( alloc.class_capacity( 40 ) > 0 );
+        REQUIRE_EQ( 0u, alloc.class_capacity( 3000000 ) );
+
+        auto p = alloc.malloc( 100, 256 );
+        REQUIRE( std::size_t( p ) % 256 == 0 );
+        alloc.free( p, 100, 256 );
+
+        for ( auto &block : blocks )
+            alloc.free( block.first, block.second );
+        REQUIRE_EQ( 0u, alloc.allocated_bytes() );
+
+        // slots are reused.
+        const auto cap = alloc.class_capacity( 40 );
+        for ( int i = 0; i < 1000; ++i )
+            alloc.free( alloc.malloc( 40 ), 40 );
+        REQUIRE_EQ( cap, alloc.class_capacity( 40 ) );
+    }
+
+    SECTION( "containers" )
+    {
+        Alloc alloc;
+        {
+            using IntAlloc = SizeClassAllocatorRef<int>;
+            IntAlloc intAlloc( alloc );
+            ftl::Vector<int, 0, IntAlloc> vec( intAlloc );
+            for ( int i = 0; i < 1000; ++i )
+                vec.push_back( i );
+            REQUIRE_EQ( 999, vec.back() );
+
+            using PairAlloc = SizeClassAllocatorRef<std::pair<int, int>>;
+            FlatOrderedMap<int, int, LessThanOther<int>, PairAlloc> map{LessThanOther<int>{}, PairAlloc( alloc )};
+            for ( int i = 100; i > 0; --i )
+                map.insert( {i, i * 2} );
+            REQUIRE_EQ( 100u, map.size() );
+            REQUIRE_EQ( 1, map.begin()->first );
+
+            std::pmr::vector<std::pmr::string> strs( &alloc );
+            for ( int i = 0; i < 100; ++i )
+                strs.emplace_back( "a string longer than small string buffer " + std::to_string( i ) );
+            REQUIRE_EQ( 100u, strs.size() );
+            REQUIRE( alloc.allocated_bytes() > 0 );
+        }
+        REQUIRE_EQ( 0u, alloc.allocated_bytes() );
+    }
+
+    SECTION( "dyn_node" )
+    {
+        using Node = jz::DynNode<SizeClassString<>>;
+        auto &alloc = Alloc::instance();
+        const auto nBytes = alloc.allocated_bytes();
+        {
+            std::stringstream ss( R"(
+{ action: addOrder, qty: 14, others: { "first name": "a name longer than small string buffer", scores: [2, 3] } }
+)" );
+            Node node;
+            REQUIRE( jz::jzonSerializer.read( node, ss, std::cerr ) );
+            REQUIRE_EQ( node["action"].str(), "addOrder" );
+            REQUIRE_EQ( node["others"]["scores"][1].toInt(), 3 );
+            REQUIRE( alloc.allocated_bytes() > nBytes );
+        }
+        REQUIRE_EQ( nBytes, alloc.allocated_bytes() );
+    }
+
+    SECTION( "multi_threads" )
+    {
+        constexpr int N = 100000, NTHREADS = 4;
+        Alloc alloc;
+        std::vector<std::thread> threads;
+        for ( int k = 0; k < NTHREADS; ++k )
+            threads.emplace_back( [&, k] {
+                std::mt19937 rng( k );
+                std::vector<std::pair<std::size_t *, std::size_t>> blocks;
+                for ( int i = 0; i < N; ++i )
+                {
+                    if ( blocks.size() < 64 || rng() % 2 )
+                    {
+                        std::size_t size = sizeof( std::size_t ) + rng() % 2048;
+                        auto p = static_cast<std::size_t *>( alloc.malloc( size ) );
+                        *p = size;
+                        blocks.emplace_back( p, size );
+                    }
+                    else
+                    {
+                        auto idx = rng() % blocks.size();
+                        REQUIRE_EQ( blocks[idx].second, *blocks[idx].first );
+                        alloc.free( blocks[idx].first, blocks[idx].second );
+                        blocks[idx] = blocks.back();
+                        blocks.pop_back();
+                    }
+                }
+                for ( auto &block : blocks )
+                    alloc.free( block.first, block.second );
+            } );
+        for ( auto &th : threads )
+            th.join();
+        REQUIRE_EQ( 0u, alloc.allocated_bytes() );
+    }
+}
+
+ADD_TEST_CASE( SizeClassAllocator_bench )
+{
+    constexpr int N = 1000000, NBLOCKS = 64;
+    std::size_t sizes[NBLOCKS];
+    std::mt19937 rng( 1 );
+    for ( auto &size : sizes )
+        size = 8 + rng() % 512;
+
+    auto bench = [&]( auto &&fnMalloc, auto &&fnFree, const char *name ) {
+        void *blocks[NBLOCKS] = {};
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( int i = 0; i < N; ++i )
+        {
+            auto k = i % NBLOCKS;
+            fnFree( blocks[k], sizes[k] );
+            blocks[k] = fnMalloc( sizes[k] );
+        }
+        auto tsStop = std::chrono::steady_clock::now();
+        for ( int k = 0; k < NBLOCKS; ++k )
+            fnFree( blocks[k], sizes[k] );
+        std::cout << "- " << name << " malloc+free latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+    };
+
+    bench( []( std::size_t size ) { return std::malloc( size ); }, []( void *p, std::size_t ) { std::free( p ); }, "std::malloc" );
+    SizeClassAllocator<> alloc;
+    bench( [&]( std::size_t size ) { return alloc.malloc( size ); }, [&]( void *p, std::size_t size ) { alloc.free( p, size ); },
+           "SizeClassAllocator" );
+}
@@ -0,0 +1,114 @@
+#include <ftl/unittest.h>
+#include <ftl/symbol.h>
+#include <ftl/Jzjson.h>
+#include <ftl/dynamic.h>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace ftl;
+
+ADD_TEST_CASE( Symbol_tests )
+{
+    SECTION( "intern" )
+    {
+        SymbolTable table( 4 );
+        auto a = table.intern( "price" );
+        REQUIRE( a.view() == "price" && a.size() == 5 && a.c_str()[5] == 0 );
+        REQUIRE( a == table.intern( std::string( "pri" ) + "ce" ) );
+        REQUIRE( a.string_hash() == std::hash<std::string_view>()( "price" ) );
+        REQUIRE( a != table.intern( "qty" ) && table.size() == 2 );
+
+        REQUIRE( table.find( "side" ).empty() ); // find doesn't intern.
+        REQUIRE( table.size() == 2 );
+        REQUIRE( table.find( "qty" ) == table.intern( "qty" ) );
+        REQUIRE( table.intern( "" ) == Symbol() && table.size() == 2 );
+
+        // symbols of different tables are different.
+        Symbol g( "price" );
+        REQUIRE( g == Symbol( std::string_view( "price" ) ) && g != a && g.view() == a.view() );
+    }
+
+    SECTION( "grow" )
+    {
+        SymbolTable table( 4 );
+        std::vector<Symbol> syms;
+        for ( int i = 0; i < 10000; ++i )
+            syms.push_back( table.intern( "field_" + std::to_string( i ) ) );
+        REQUIRE( table.size() == 10000 && table.capacity() >= 20000 );
+        for ( int i = 0; i < 10000; ++i )
+            REQUIRE( table.find( "field_" + std::to_string( i ) ) == syms[i] );
+    }
+
+    SECTION( "concurrent" )
+    {
+        constexpr int NTHREADS = 4, NSYMS = 5000;
+        SymbolTable table( 4 );
+        std::vector<std::vector<Symbol>> results( NTHREADS );
+        std::vector<std::thread> threads;
+        for ( int t = 0; t < NTHREADS; ++t )
+            threads.emplace_back( [&, t] {
+                for ( int i = 0; i < NSYMS; ++i ) // each thread interns the same names in a different order.
+                    results[t].push_back( table.intern( "s" + std::to_string( ( i * ( 2 * t + 1 ) ) % NSYMS ) ) );
+            } );
+        for ( auto &th : threads )
+            th.join();
+        REQUIRE( table.size() == NSYMS );
+        for ( int t = 0; t < NTHREADS; ++t )
+            for ( int i = 0; i < NSYMS; ++i )
+                REQUIRE( results[t][i] == table.find( "s" + std::to_string( ( i * ( 2 * t + 1 ) ) % NSYMS ) ) );
+    }
+
+    SECTION( "json_keys" )
+    {
+        static const Symbol ADD_ORDER( "addOrder" ), PRICE( "price" ), SIDE( "side" );
+        std::stringstream ss( R"({ addOrder { qty 12, side buy, price 23.3 } })" );
+        jz::DynNode<std::string, Symbol> node;
+        REQUIRE( jz::jzonSerializer.read( node, ss, std::cerr ) );
+        REQUIRE( node[ADD_ORDER][PRICE].toDouble() == 23.3 );
+        REQUIRE( node[ADD_ORDER][SIDE].str() == "buy" );
+        REQUIRE( node[ADD_ORDER].mapContains( "qty" ) );
+        std::stringstream os;
+        os << node;
+        REQUIRE( os.str().find( "price" ) != std::string::npos );
+
+        using DynVar = dynamic_var<Symbol, std::string>;
+        std::stringstream ss2( R"({ qty: 12, side: sell })" );
+        DynVar dyn;
+        REQUIRE( dynamic_read_json( dyn, ss2, std::cerr ) );
+        REQUIRE( dyn.as<DynVar::map_type>().at( SIDE )->as_str() == "sell" );
+    }
+}
+
+ADD_TEST_CASE( Symbol_bench )
+{
+    constexpr int N = 20000;
+    const char *json = R"({ symbol "ABCD", orderType limit, side buy, price 23.3, quantity 100, timeInForce day, account "acc-1" })";
+
+    auto bench = [&]( auto tag, const char *name, auto PRICE, auto QTY, auto ACCOUNT ) {
+        using Node = decltype( tag );
+        std::vector<Node> nodes( N );
+        auto tsStart = std::chrono::steady_clock::now();
+        for ( auto &node : nodes )
+        {
+            std::stringstream ss( json );
+            jz::jzonSerializer.read( node, ss, std::cerr );
+        }
+        auto tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " parse latency(ns):" << double( ( tsStop - tsStart ).count() ) / N << std::endl;
+
+        double sum = 0;
+        tsStart = std::chrono::steady_clock::now();
+        for ( int k = 0; k < 10; ++k )
+            for ( auto &node : nodes )
+                sum += node[PRICE].toDouble() + node[QTY].toInt() + node[ACCOUNT].str().size();
+        tsStop = std::chrono::steady_clock::now();
+        std::cout << "- " << name << " 3 field lookups latency(ns):" << double( ( tsStop - tsStart ).count() ) / ( 10 * N ) << std::endl;
+        return sum;
+    };
+    auto sum = bench( jz::DynNode<>(), "string keys", std::string( "price" ), std::string( "quantity" ), std::string( "account" ) );
+    REQUIRE_EQ( sum, bench( jz::DynNode<std::string, Symbol>(), "Symbol keys", Symbol( "price" ), Symbol( "quantity" ), Symbol( "account" ) ) );
+}
@@ -0,0 +1,92 @@
+#include <ftl/unittest.h>
+#include <ftl/sys_alloc.h>
+#include <ftl/chunk_allocator.h>
+#include <ftl/mem_pool.h>
+#include <ftl/mpsc_bounded_queue.h>
+#include <ftl/spsc_queue.h>
+#include <sys/resource.h>
+
+using namespace ftl;
+
+namespace
+{
+long minor_faults()
+{
+    rusage usage;
+    getrusage( RUSAGE_THREAD, &usage );
+    return usage.ru_minflt;
+}
+
+bool is_resident( void *p, std::size_t len )
+{
+    std::vector<unsigned char> pages( ( len + 4095 ) / 4096 );
+    if ( mincore( p, len, pages.data() ) )
+        return false;
+    return std::all_of( pages.begin(), pages.end(), []( unsigned char c ) { return c & 1; } );
+}
+
+__attribute__( ( noinline ) ) void use_stack()
+{
+    volatile char buf[32 * 1024];
+    for ( std::size_t i = 0; i < sizeof( buf ); i += 4096 )
+        buf[i] = 1;
+}
+} // namespace
+
+ADD_TEST_CASE( SysAlloc_tests )
+{
+    SECTION( "latency_critical_alloc" )
+    {
+        constexpr std::size_t LEN = 1 << 20;
+        auto p = LatencyCriticalAlignedAlloc<>::aligned_alloc( 64, LEN );
+        REQUIRE( p );
+        REQUIRE( is_resident( p, LEN ) );
+        REQUIRE( LatencyCriticalAlignedAlloc<>::free( p, LEN ) );
+
+        auto pLocal = LatencyCriticalAlignedAlloc<true>::aligned_alloc( 4096, LEN );
+        REQUIRE( pLocal );
+        REQUIRE( is_resident( pLocal, LEN ) );
+        REQUIRE( LatencyCriticalAlignedAlloc<true>::free( pLocal, LEN ) );
+    }
+
+    SECTION( "no_page_fault_in_queues" )
+    {
+        constexpr std::size_t CAP = 1 << 16;
+        SPSCRingQueue<std::size_t, LatencyCriticalAllocator<std::size_t>> spsc( CAP );
+        MPSCBoundedQueue<std::size_t, LatencyCriticalAllocator<std::size_t>> mpsc( CAP );
+        std::size_t v = 0;
+        auto nFaults = minor_faults();
+        for ( std::size_t i = 0; i + 1 < CAP; ++i )
+        {
+            REQUIRE( spsc.push( i ) );
+            REQUIRE( mpsc.push( i ) );
+        }
+        for ( std::size_t i = 0; i + 1 < CAP; ++i )
+        {
+            REQUIRE( spsc.pop( &v ) );
+            REQUIRE( mpsc.pop( &v ) );
+        }
+        REQUIRE_EQ( nFaults, minor_faults() );
+    }
+
+    SECTION( "pools" )
+    {
+        ChunkAllocator<std::size_t, DoubleAccumulatedGrowthPolicy, 128, LatencyCriticalAlignedAlloc<>> chunks( 1024 );
+        MemPool<false, true, LatencyCriticalAlignedAlloc<>> pool( AllocRequest{64, 1024} );
+        auto nFaults = minor_faults();
+        for ( int i = 0; i < 1000; ++i )
+        {
+            *chunks.allocate() = i;
+            *static_cast<std::size_t *>( pool.malloc() ) = i;
+        }
+        REQUIRE_EQ( nFaults, minor_faults() );
+    }
+
+    SECTION( "warm_up" )
+    {
+        sys_warm_up( 64 * 1024, false ); // locking all may exceed RLIMIT_MEMLOCK of test environment.
+        auto nFaults = minor_faults();
+        use_stack(); // deeper stack frames are prefaulted.
+        REQUIRE_EQ( nFaults, minor_faults() );
+    }
+}
@@ -1,4 +1,5 @@
 #include <ftl/reactors.h>
+#include <ftl/mem_pool.h>
 
 #include <ftl/unittest.h>
 #include <iostream>
@@ -124,3 +125,35 @@ ADD_TEST_CASE( Test_GroupedReactors )
     ReactorsTestFixture<GroupedReactors> test;
     test.DoWork();
 }
+
+ADD_TEST_CASE( Test_PooledReactors_intrusive_events )
+{
+    struct Event : ftl::intrusive_ref_counter<Event>
+    {
+        size_t value;
+        Event( size_t v ) : value( v )
+        {
+        }
+    };
+    using EventPtr = ftl::intrusive_ptr<Event>;
+    constexpr size_t N = 10000;
+
+    ftl::ObjectPool<Event> pool( 64 );
+    std::atomic<size_t> sum{0}, nRecv{0};
+    auto reactors = PooledReactors::New();
+    reactors->Init( 4, 1024 );
+    auto sender = reactors->RegisterHandler<EventPtr>(
+            [&]( EventPtr &&e ) {
+                sum += e->value;
+                ++nRecv;
+            },
+            1024 );
+    for ( size_t i = 0; i < N; ++i )
+        REQUIRE( sender->Send( pool.create_intrusive( i ) ) );
+    while ( nRecv < N )
+        ;
+    reactors->RemoveHandler( sender );
+    reactors->Term();
+    REQUIRE_EQ( N * ( N - 1 ) / 2, sum.load() );
+    REQUIRE_EQ( 0u, pool.allocated_size() ); // all events are returned to pool.
+}
@@ -1,8 +1,27 @@
 #include <ftl/vector.h>
 #include <ftl/ftl.h>
+#include <ftl/size_class_allocator.h>
+#include <ftl/sys_alloc.h>
 #include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
 using namespace ftl;
 
+namespace
+{
+/// heap allocated string, relocatable or not, to compare growth by memcpy with growth by move and destroy.
+template<bool Relocatable, class Alloc = std::allocator<char>>
+struct HeapString : CStr<char, 0, Alloc>
+{
+    using is_trivially_relocatable = std::bool_constant<Relocatable>;
+
+    HeapString( const char *s ) : CStr<char, 0, Alloc>( s, s + std::strlen( s ) )
+    {
+    }
+};
+} // namespace
+
 ADD_TEST_CASE( vector_tests )
 {
     SECTION( "vector" )
@@ -100,4 +119,93 @@ ADD_TEST_CASE( vector_tests )
 
         REQUIRE( v == ( Vector<int, 3>{1, 4, 5} ) );
     }
+
+    //- relocation
+    {
+        static_assert( is_trivially_relocatable_v<std::pair<int, std::unique_ptr<int>>> );
+        static_assert( is_trivially_relocatable_v<Vector<std::string>> );
+        static_assert( is_trivially_relocatable_v<Array<int, 3>> );
+        static_assert( !is_trivially_relocatable_v<Vector<int, 3>> ); // may point to its inplace buffer.
+        static_assert( !is_trivially_relocatable_v<HeapString<false>> );
+
+        Vector<HeapString<true>> v;
+        for ( int i = 0; i < 100; ++i )
+            v.emplace_back( std::to_string( i * 1000000 ).c_str() );
+        v.erase( v.begin() + 10, v.begin() + 90 );
+        REQUIRE( v.size() == 20 );
+        REQUIRE( v[9] == make_view( "9000000" ), << v[9].c_str() );
+        REQUIRE( v[10] == make_view( "90000000" ), << v[10].c_str() );
+        REQUIRE( v.back() == make_view( "99000000" ), << v.back().c_str() );
+
+        Vector<HeapString<true>> copy( v );
+        REQUIRE( copy.size() == 20 && copy[0].begin() != v[0].begin() );
+        auto pBuf = copy.begin();
+        copy = v; // reuses the buffer.
+        REQUIRE( copy.size() == 20 && copy[19] == make_view( "99000000" ) && copy.begin() == pBuf );
+    }
+
+    //- grow in place
+    {
+        Vector<int, 0, SizeClassAllocatorRef<int>> v;
+        v.push_back( 1 );
+        auto p = v.begin();
+        v.push_back( 2 ); // 4 and 8 bytes are in the same size class
+        REQUIRE( v.begin() == p && v.capacity() == 2 );
+
+        SizeClassAllocator<> alloc;
+        Vector<int, 0, SizeClassAllocatorRef<int>> local( SizeClassAllocatorRef<int>{alloc} );
+        local.push_back( 3 );
+        auto copy = local; // allocates from alloc as well.
+        REQUIRE( copy.get_allocator() == local.get_allocator() && !( copy.get_allocator() == v.get_allocator() ) && copy[0] == 3 );
+
+        Vector<HeapString<true>, 0, MallocAllocator<HeapString<true>>> heap;
+        CharCStr<8, MallocAllocator<char>> s( "1234567" );
+        for ( int i = 0; i < 100000; ++i )
+        {
+            heap.emplace_back( std::to_string( i ).c_str() );
+            s += 'a';
+        }
+        REQUIRE( heap.size() == 100000 && heap[99999] == make_view( "99999" ) );
+        REQUIRE( s.size() == 100007 && s.back() == 'a' && s.begin()[s.size()] == 0 );
+    }
+}
+
+ADD_TEST_CASE( vector_relocation_bench )
+{
+    constexpr size_t N = 200000, NREPS = 10;
+
+    // time only the growth: elements are moved in from prebuilt strings.
+    auto bench = [&]( auto &&makeVector, auto &&makeSource, const char *name ) {
+        std::chrono::steady_clock::duration elapsed{};
+        size_t nTotal = 0;
+        for ( size_t rep = 0; rep < NREPS; ++rep )
+        {
+            auto src = makeSource();
+            auto v = makeVector();
+            auto tsStart = std::chrono::steady_clock::now();
+            for ( auto &s : src )
+                v.emplace_back( std::move( s ) );
+            elapsed += std::chrono::steady_clock::now() - tsStart;
+            nTotal += v.size();
+        }
+        std::cout << "- " << name << " push_back latency(ns):" << double( elapsed.count() ) / ( N * NREPS ) << std::endl;
+        return nTotal;
+    };
+    auto source = []( auto tag ) {
+        using T = decltype( tag );
+        return [] {
+            std::vector<T> src;
+            src.reserve( N );
+            for ( size_t i = 0; i < N; ++i )
+                src.emplace_back( std::string( 24, char( 'a' + i % 26 ) ).c_str() ); // not SSO
+            return src;
+        };
+    };
+    using Reloc = HeapString<true>;
+    using NoReloc = HeapString<false>;
+
+    auto n = bench( [] { return std::vector<std::string>(); }, source( std::string() ), "std::vector<std::string>" );
+    REQUIRE( n == bench( [] { return Vector<NoReloc>(); }, source( NoReloc( "" ) ), "Vector<string>, move and destroy" ) );
+    REQUIRE( n == bench( [] { return Vector<Reloc>(); }, source( Reloc( "" ) ), "Vector<relocatable string>, memcpy" ) );
+    REQUIRE( n == bench( [] { return Vector<Reloc, 0, MallocAllocator<Reloc>>(); }, source( Reloc( "" ) ), "Vector<relocatable string>, realloc" ) );
 }